@@ -1108,6 +1108,27 @@ bdi_cap_map_copy, [
 ])
 ]) # LC_HAVE_BDI_CAP_MAP_COPY
 
+#
+# LC_HAVE_LIST_LRU_ONE
+#
+# 4.0 made list_lru memcg aware, the isolate callback of list_lru_walk()
+# takes struct list_lru_one and the items are removed by list_lru_isolate().
+#
+AC_DEFUN([LC_HAVE_LIST_LRU_ONE], [
+LB_CHECK_COMPILE([if list_lru isolate callback takes 'struct list_lru_one'],
+list_lru_one, [
+	#include <linux/list_lru.h>
+],[
+	struct list_lru_one *lru = NULL;
+	struct list_head item;
+
+	list_lru_isolate(lru, &item);
+],[
+	AC_DEFINE(HAVE_LIST_LRU_ONE, 1,
+		[list_lru isolate callback takes 'struct list_lru_one'])
+])
+]) # LC_HAVE_LIST_LRU_ONE
+
 #
 # LC_IOV_ITER_RW
 #
@@ -2256,6 +2277,28 @@ inode_timespec64, [
 EXTRA_KCFLAGS="$tmp_flags"
 ]) # LC_INODE_TIMESPEC64
 
+#
+# LC_HAVE_LIST_LRU_MEMCG_SHRINKER
+#
+# 4.19 binds a memcg aware list_lru to its shrinker, so that the shrinker
+# is only called for the memcgs having objects on the list_lru.
+#
+AC_DEFUN([LC_HAVE_LIST_LRU_MEMCG_SHRINKER], [
+LB_CHECK_COMPILE([if list_lru_init_memcg() takes 'struct shrinker'],
+list_lru_init_memcg_shrinker, [
+	#include <linux/list_lru.h>
+	#include <linux/shrinker.h>
+],[
+	struct list_lru lru;
+	struct shrinker shrinker = { .flags = SHRINKER_MEMCG_AWARE };
+
+	list_lru_init_memcg(&lru, &shrinker);
+],[
+	AC_DEFINE(HAVE_LIST_LRU_MEMCG_SHRINKER, 1,
+		[list_lru_init_memcg() takes 'struct shrinker'])
+])
+]) # LC_HAVE_LIST_LRU_MEMCG_SHRINKER
+
 #
 # LC___XA_SET_MARK
 #
@@ -2542,6 +2585,7 @@ AC_DEFUN([LC_PROG_LINUX], [
 	# 3.20
 	LC_BACKING_DEV_INFO_REMOVAL
 	LC_HAVE_BDI_CAP_MAP_COPY
+	LC_HAVE_LIST_LRU_ONE
 
 	# 4.1.0
 	LC_IOV_ITER_RW
@@ -2635,6 +2679,9 @@ AC_DEFUN([LC_PROG_LINUX], [
 	# 4.18
 	LC_INODE_TIMESPEC64
 
+	# 4.19
+	LC_HAVE_LIST_LRU_MEMCG_SHRINKER
+
 	# 4.20
 	LC___XA_SET_MARK
 	LC_UAPI_LINUX_MOUNT_H
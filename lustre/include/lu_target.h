@@ -243,6 +243,40 @@ struct tg_reply_data {
 	__u16			trd_tag;
 };
 
+/*
+ * The reply data of the sub requests of a batched RPC keeps in the upper half
+ * of lrd_data the index of the first sub request done by the transaction and
+ * the number of the sub requests it may cover, the lower half still carries
+ * the intent disposition, see tsi_opdata.
+ */
+#define TGT_SUB_INDEX_SHIFT	32
+#define TGT_SUB_COUNT_SHIFT	48
+#define TGT_SUB_MAX		0xffffU
+
+static inline __u64 tgt_sub_opdata(__u32 index, __u32 count)
+{
+	if (index + count > TGT_SUB_MAX)
+		return 0;
+
+	return ((__u64)count << TGT_SUB_COUNT_SHIFT) |
+	       ((__u64)index << TGT_SUB_INDEX_SHIFT);
+}
+
+static inline bool tgt_is_sub_reply(const struct tg_reply_data *trd)
+{
+	return (trd->trd_reply.lrd_data >> TGT_SUB_COUNT_SHIFT) != 0;
+}
+
+static inline __u32 tgt_sub_reply_index(const struct tg_reply_data *trd)
+{
+	return (trd->trd_reply.lrd_data >> TGT_SUB_INDEX_SHIFT) & TGT_SUB_MAX;
+}
+
+static inline __u32 tgt_sub_reply_count(const struct tg_reply_data *trd)
+{
+	return trd->trd_reply.lrd_data >> TGT_SUB_COUNT_SHIFT;
+}
+
 extern struct lu_context_key tgt_session_key;
 
 struct tgt_session_info {
@@ -507,6 +541,9 @@ int tgt_mk_reply_data(const struct lu_env *env, struct lu_target *tgt,
 		      __u64 transno);
 struct tg_reply_data *tgt_lookup_reply_by_xid(struct tg_export_data *ted,
 					       __u64 xid);
+struct tg_reply_data *tgt_lookup_sub_replies(struct ptlrpc_request *req,
+					     __u32 count);
+void tgt_mult_trans_set(const struct lu_env *env, bool mult_trans);
 int tgt_tunables_init(struct lu_target *lut);
 void tgt_tunables_fini(struct lu_target *lut);
 void tgt_mask_cksum_types(struct lu_target *lut, enum cksum_types *cksum_types);
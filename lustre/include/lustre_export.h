@@ -89,6 +89,8 @@ struct tg_export_data {
 	 * protected by ted_lcd_lock */
 	/** List of reply data */
 	struct list_head	ted_reply_list;
+	/** Reply data of the sub requests of batched RPCs, sorted by xid */
+	struct list_head	ted_sub_reply_list;
 	int			ted_reply_cnt;
 	/** Reply data with highest transno is retained */
 	struct tg_reply_data	*ted_reply_last;
@@ -489,6 +491,11 @@ static inline int exp_connect_dom_lvb(struct obd_export *exp)
 	return !!(exp_connect_flags2(exp) & OBD_CONNECT2_DOM_LVB);
 }
 
+static inline int exp_connect_wbc(struct obd_export *exp)
+{
+	return !!(exp_connect_flags2(exp) & OBD_CONNECT2_WBC_INTENTS);
+}
+
 enum {
 	/* archive_ids in array format */
 	KKUC_CT_DATA_ARRAY_MAGIC	= 0x092013cea,
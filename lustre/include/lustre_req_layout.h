@@ -320,6 +320,11 @@ extern struct req_format RQF_BUT_CREATE_LOCKLESS;
 extern struct req_format RQF_BUT_SETATTR_EXLOCK;
 extern struct req_format RQF_BUT_SETATTR_LOCKLESS;
 extern struct req_format RQF_BUT_EXLOCK_ONLY;
+extern struct req_format RQF_BUT_UNLINK_LOCKLESS;
+extern struct req_format RQF_BUT_RENAME_LOCKLESS;
+extern struct req_format RQF_BUT_LINK_LOCKLESS;
+extern struct req_format RQF_BUT_SETXATTR_LOCKLESS;
+extern struct req_format RQF_BUT_OPEN_LOCKLESS;
 extern struct req_format RQF_MDS_BATCH;
 
 extern struct req_msg_field RMF_GENERIC_DATA;
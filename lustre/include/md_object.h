@@ -180,6 +180,16 @@ struct md_op_spec {
 	const struct dt_index_features *sp_feat;
 };
 
+/** A create in a group of creates under the same parent directory. */
+struct md_create_item {
+	const struct lu_name	*mci_name;
+	struct md_object	*mci_child;
+	struct md_op_spec	*mci_spec;
+	struct md_attr		*mci_ma;
+	/* Result of the create, set once the item is processed. */
+	int			 mci_rc;
+};
+
 enum md_layout_opc {
 	MD_LAYOUT_NOP	= 0,
 	MD_LAYOUT_WRITE,	/* FLR: write the file */
@@ -331,6 +341,16 @@ struct md_dir_operations {
 			  struct md_op_spec *spec,
 			  struct md_attr *ma);
 
+	/**
+	 * Create the objects of \a items under \a pobj in one transaction.
+	 * Returns the number of processed items, only the last of them may
+	 * have failed, or a negative errno if the group cannot be created at
+	 * once and the items are to be created one by one.
+	 */
+	int (*mdo_create_batch)(const struct lu_env *env,
+				struct md_object *pobj,
+				struct md_create_item *items, int count);
+
 	/** This method is used for creating data object for this meta object*/
 	int (*mdo_create_data)(const struct lu_env *env, struct md_object *p,
 			       struct md_object *o,
@@ -615,6 +635,15 @@ static inline int mdo_create(const struct lu_env *env,
 	return p->mo_dir_ops->mdo_create(env, p, lchild_name, c, spc, at);
 }
 
+static inline int mdo_create_batch(const struct lu_env *env,
+				   struct md_object *p,
+				   struct md_create_item *items, int count)
+{
+	if (p->mo_dir_ops->mdo_create_batch == NULL)
+		return -EOPNOTSUPP;
+	return p->mo_dir_ops->mdo_create_batch(env, p, items, count);
+}
+
 static inline int mdo_create_data(const struct lu_env *env,
                                   struct md_object *p,
                                   struct md_object *c,
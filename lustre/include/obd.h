@@ -853,6 +853,7 @@ enum md_cli_flags {
 	CLI_MIGRATE	= BIT(4),
 	CLI_DIRTY_DATA	= BIT(5),
 	CLI_WBC_TGT	= BIT(6),
+	CLI_WBC_QOS_MKDIR = BIT(7),
 };
 
 enum md_op_code {
@@ -972,6 +973,11 @@ enum md_opcode {
 	MD_OP_SETATTR_EXLOCK	= 5,
 	MD_OP_EXLOCK_ONLY	= 6,
 	MD_OP_REMOVE_LOCKLESS	= 7,
+	MD_OP_UNLINK_LOCKLESS	= 8,
+	MD_OP_RENAME_LOCKLESS	= 9,
+	MD_OP_LINK_LOCKLESS	= 10,
+	MD_OP_SETXATTR_LOCKLESS	= 11,
+	MD_OP_OPEN_LOCKLESS	= 12,
 	MD_OP_MAX,
 };
 
@@ -985,6 +991,10 @@ struct md_op_item {
 	void				*mop_cbdata;
 	__u64				 mop_flags;
 	__u64				 mop_lock_flags;
+	/* Target name for MD_OP_RENAME_LOCKLESS. */
+	struct lu_name			 mop_tgt_name;
+	/* Handle filled by MD_OP_OPEN_LOCKLESS, registered for open replay. */
+	struct obd_client_handle	*mop_och;
 	union {
 		struct inode		*mop_dir;
 		struct dentry		*mop_dentry;
@@ -1001,12 +1011,29 @@ enum lu_batch_flags {
 	BATCH_FL_SYNC	= 0x4,
 };
 
+/*
+ * Flow control of batch RPCs. The hooks are called for each batch RPC sent
+ * from the batch, the user can adjust the batch size and the concurrency of
+ * the batch RPCs according to the feedback.
+ */
+struct lu_batch_fc {
+	/* Called before the batch RPC is sent, may wait for a free slot. */
+	void	(*bfc_send)(struct lu_batch_fc *fc, __u32 count);
+	/* Called upon the completion of the batch RPC. */
+	void	(*bfc_done)(struct lu_batch_fc *fc, __u32 count,
+			    __u32 repsize, ktime_t latency, int rc);
+	/* Optional, the current max count of sub requests in a batch RPC. */
+	__u32	(*bfc_max_count)(struct lu_batch_fc *fc);
+};
+
 struct lu_batch {
 	struct ptlrpc_request_set	*bh_rqset;
 	__s32				 bh_result;
 	__u32				 bh_flags;
 	/* Max batched SUB requests count in a batch. */
 	__u32				 bh_max_count;
+	/* Optional flow control of the batch RPCs. */
+	struct lu_batch_fc		*bh_fc;
 };
 
 struct obd_ops {
@@ -1140,6 +1167,12 @@ struct md_open_data {
 	struct ptlrpc_request		*mod_close_req;
 	atomic_t			 mod_refcount;
 	bool				 mod_is_create;
+	/*
+	 * Linkage and index of the sub open in the batch RPC @mod_open_req,
+	 * if the handle was fetched by a batched open.
+	 */
+	struct list_head		 mod_batch_item;
+	__u32				 mod_batch_index;
 };
 
 struct obd_client_handle {
@@ -1280,6 +1313,7 @@ static inline struct md_open_data *obd_mod_alloc(void)
 	if (mod == NULL)
 		return NULL;
 	atomic_set(&mod->mod_refcount, 1);
+	INIT_LIST_HEAD(&mod->mod_batch_item);
 	return mod;
 }
 
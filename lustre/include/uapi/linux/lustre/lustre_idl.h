@@ -916,7 +916,8 @@ struct ptlrpc_body_v2 {
 				OBD_CONNECT2_GETATTR_PFID |\
 				OBD_CONNECT2_LSEEK | OBD_CONNECT2_DOM_LVB |\
 				OBD_CONNECT2_REP_MBITS | \
-				OBD_CONNECT2_BATCH_RPC)
+				OBD_CONNECT2_BATCH_RPC | \
+				OBD_CONNECT2_WBC_INTENTS)
 
 #define OST_CONNECT_SUPPORTED  (OBD_CONNECT_SRVLOCK | OBD_CONNECT_GRANT | \
 				OBD_CONNECT_REQPORTAL | OBD_CONNECT_VERSION | \
@@ -1971,6 +1972,8 @@ enum mds_op_bias {
 	MDS_WBC_LOCKLESS	= 1 << 22,
 	/* subtree removal used for WBC */
 	MDS_SUBTREE_REMOVAL	= 1 << 23,
+	/* WBC create carries the final attributes of the cached file */
+	MDS_WBC_CREATE_ATTR	= 1 << 24,
 };
 
 #define MDS_CLOSE_INTENT (MDS_HSM_RELEASE | MDS_CLOSE_LAYOUT_SWAP |         \
@@ -1997,8 +2000,20 @@ struct mdt_rec_create {
 		__u64		cr_rdev;
 		__u32		cr_archive_id;
 	};
-	__u64		cr_ioepoch;
-	__u64		cr_padding_1;   /* rr_blocks */
+	union {
+		__u64		cr_ioepoch;
+		/* atime of the new file with MDS_WBC_CREATE_ATTR,
+		 * only if OBD_CONNECT2_WBC_INTENTS is negotiated
+		 */
+		__s64		cr_atime;
+	};
+	union {
+		__u64		cr_padding_1;   /* rr_blocks */
+		/* ctime of the new file with MDS_WBC_CREATE_ATTR,
+		 * only if OBD_CONNECT2_WBC_INTENTS is negotiated
+		 */
+		__s64		cr_ctime;
+	};
 	__u32		cr_mode;
 	__u32		cr_bias;
 	/* use of helpers set/get_mrc_cr_flags() is needed to access
@@ -3527,6 +3542,11 @@ enum batch_update_cmd {
 	BUT_SETATTR_EXLOCK	= 4,
 	BUT_SETATTR_LOCKLESS	= 5,
 	BUT_EXLOCK_ONLY		= 6,
+	BUT_UNLINK_LOCKLESS	= 7,
+	BUT_RENAME_LOCKLESS	= 8,
+	BUT_LINK_LOCKLESS	= 9,
+	BUT_SETXATTR_LOCKLESS	= 10,
+	BUT_OPEN_LOCKLESS	= 11,
 	BUT_LAST_OPC,
 	BUT_FIRST_OPC	= BUT_GETATTR,
 };
@@ -2887,6 +2887,8 @@ enum lu_wbc_control_flags {
 	WBC_FL_UNRSV_CHILDREN	= 0x02,
 	WBC_FL_SYNC_NONE	= 0x04,
 	WBC_FL_FLOW_CONTROL	= 0x08,
+	/* The following sub requests in the batch depend on this one. */
+	WBC_FL_BATCH_CHAIN	= 0x10,
 };
 
 struct lu_wbc_state {
@@ -2908,6 +2910,14 @@ struct lu_wbc_state {
 	enum lu_wbc_flush_mode	wbcs_flush_mode;
 	/* Reserved for local open count. */
 	__u32			wbcs_open_count;
+	/*
+	 * Usage and limits (0 for unlimited) of the quota of the root WBC
+	 * directory which the file is charged to.
+	 */
+	__u64			wbcs_quota_inodes;
+	__u64			wbcs_quota_max_inodes;
+	__u64			wbcs_quota_pages;
+	__u64			wbcs_quota_max_pages;
 	/* Reserved for the path of data on PCC after supported. */
 	char			wbcs_path[PATH_MAX];
 };
@@ -314,6 +314,16 @@ static int ll_readdir(struct file *filp, void *cookie, filldir_t filldir)
 		 */
 		GOTO(out, rc = 0);
 
+	/* Go on with a hashed readdir() iteration of MemFS before reopen. */
+	if (lfd != NULL && lfd->fd_wbc_file.wbcf_resume.wdr_pos != 0) {
+#ifdef HAVE_DIR_CONTEXT
+		rc = memfs_dir_resume_read(filp, ctx);
+#else
+		rc = memfs_dir_resume_read(filp, cookie, filldir);
+#endif
+		GOTO(out, rc);
+	}
+
 	if (unlikely(ll_dir_striped(inode))) {
 		/*
 		 * This is only needed for striped dir to fill ..,
@@ -2254,6 +2264,13 @@ static loff_t ll_dir_seek(struct file *file, loff_t offset, int origin)
 				fd->lfd_pos = offset << 32;
 			else
 				fd->lfd_pos = offset;
+			fd->fd_wbc_file.wbcf_hash_off = 0;
+			/* rewinddir() lists all entries on MDT again. */
+			if (offset == 0)
+				memfs_dir_resume_fini(
+					&fd->fd_wbc_file.wbcf_resume);
+			/* The phase of merge readdir() in MemFS. */
+			memfs_dir_pos_decode(fd);
 			file->f_pos = offset;
 			file->f_version = 0;
 		}
@@ -2274,8 +2291,12 @@ static int ll_dir_open(struct inode *inode, struct file *file)
 
 static int ll_dir_release(struct inode *inode, struct file *file)
 {
-        ENTRY;
-        RETURN(ll_file_release(inode, file));
+	struct ll_file_data *fd = file->private_data;
+
+	ENTRY;
+	if (fd != NULL)
+		memfs_dir_resume_fini(&fd->fd_wbc_file.wbcf_resume);
+	RETURN(ll_file_release(inode, file));
 }
 
 const struct file_operations ll_dir_operations = {
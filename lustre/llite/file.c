@@ -133,9 +133,9 @@ static void ll_prepare_close(struct inode *inode, struct md_op_data *op_data,
  * If \a bias is MDS_CLOSE_LAYOUT_SWAP then \a data is a pointer to the inode to
  * swap layouts with.
  */
-static int ll_close_inode_openhandle(struct inode *inode,
-				     struct obd_client_handle *och,
-				     enum mds_op_bias bias, void *data)
+int ll_close_inode_openhandle(struct inode *inode,
+			      struct obd_client_handle *och,
+			      enum mds_op_bias bias, void *data)
 {
 	struct obd_export *md_exp = ll_i2mdexp(inode);
 	const struct ll_inode_info *lli = ll_i2info(inode);
@@ -270,6 +270,7 @@ struct ll_inode_info {
 	struct rw_semaphore		lli_xattrs_list_rwsem;
 	struct mutex			lli_xattrs_enq_lock;
 	struct list_head		lli_xattrs; /* ll_xattr_entry->xe_list */
+	atomic_t			lli_xattrs_count; /* in lli_xattrs */
 
 	struct wbc_inode		lli_wbc_inode;
 };
@@ -432,6 +433,12 @@ int ll_xattr_cache_insert(struct inode *inode,
 			  const char *name,
 			  char *buffer,
 			  size_t size);
+int ll_xattr_cache_update(struct inode *inode, const char *name,
+			  const char *value, size_t size, int flags);
+typedef int (*ll_xattr_iter_cb_t)(void *cbdata, const char *name,
+				  const char *value, unsigned int size);
+int ll_xattr_cache_iterate(struct inode *inode, ll_xattr_iter_cb_t cb,
+			   void *cbdata);
 
 static inline bool obd_connect_has_secctx(struct obd_connect_data *data)
 {
@@ -1122,6 +1129,9 @@ int ll_file_open(struct inode *inode, struct file *file);
 int ll_file_release(struct inode *inode, struct file *file);
 int ll_release_openhandle(struct dentry *, struct lookup_intent *);
 int ll_md_real_close(struct inode *inode, fmode_t fmode);
+int ll_close_inode_openhandle(struct inode *inode,
+			      struct obd_client_handle *och,
+			      enum mds_op_bias bias, void *data);
 void ll_track_file_opens(struct inode *inode);
 extern void ll_rw_stats_tally(struct ll_sb_info *sbi, pid_t pid,
                               struct ll_file_data *file, loff_t pos,
@@ -1755,6 +1765,11 @@ static inline struct wbc_dentry *ll_d2wbcd(struct dentry *dentry)
 	return &ll_d2d(dentry)->lld_wbc_dentry;
 }
 
+static inline bool wbc_dentry_link_pending(struct dentry *dentry)
+{
+	return ll_d2wbcd(dentry)->wbcd_flags & WBC_DENTRY_FL_LINK;
+}
+
 static inline struct wbc_super *ll_i2wbcs(struct inode *inode)
 {
 	return &ll_i2sbi(inode)->ll_wbc_super;
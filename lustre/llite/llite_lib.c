@@ -345,7 +345,8 @@ static int client_common_fill_super(struct super_block *sb, char *md, char *dt)
 				   OBD_CONNECT2_GETATTR_PFID |
 				   OBD_CONNECT2_DOM_LVB |
 				   OBD_CONNECT2_REP_MBITS |
-				   OBD_CONNECT2_BATCH_RPC;
+				   OBD_CONNECT2_BATCH_RPC |
+				   OBD_CONNECT2_WBC_INTENTS;
 
 #ifdef HAVE_LRU_RESIZE_SUPPORT
         if (sbi->ll_flags & LL_SBI_LRU_RESIZE)
@@ -1136,6 +1137,7 @@ void ll_lli_init(struct ll_inode_info *lli)
 
 	init_rwsem(&lli->lli_xattrs_list_rwsem);
 	mutex_init(&lli->lli_xattrs_enq_lock);
+	atomic_set(&lli->lli_xattrs_count, 0);
 
 	LASSERT(lli->lli_vfs_inode.i_mode != 0);
 	if (S_ISDIR(lli->lli_vfs_inode.i_mode)) {
@@ -70,6 +70,16 @@ long wbc_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		state->wbcs_cache_mode = wbci->wbci_cache_mode;
 		state->wbcs_flush_mode = wbci->wbci_flush_mode;
 		state->wbcs_dirty_flags = wbci->wbci_dirty_flags;
+		if (wbci->wbci_quota) {
+			struct wbc_quota *quota = wbci->wbci_quota;
+
+			state->wbcs_quota_inodes =
+				percpu_counter_sum(&quota->wq_inodes);
+			state->wbcs_quota_max_inodes = quota->wq_max_inodes;
+			state->wbcs_quota_pages =
+				percpu_counter_sum(&quota->wq_pages);
+			state->wbcs_quota_max_pages = quota->wq_max_pages;
+		}
 
 		if (copy_to_user(ustate, state, sizeof(*state)))
 			GOTO(out_state, rc = -EFAULT);
@@ -241,6 +251,17 @@ static void wbc_fini_op_item(struct md_op_item *item, int ioret)
 	OBD_FREE_PTR(item);
 }
 
+/*
+ * The xattrs are on MDT after the file was flushed. Drop the local cache
+ * as it is not covered by a xattr lock, so that it is fetched from MDT
+ * under the lock in need.
+ */
+static inline void wbc_xattr_cache_fini(struct inode *inode)
+{
+	if (test_bit(LLIF_XATTR_CACHE, &ll_i2info(inode)->lli_flags))
+		ll_xattr_cache_destroy(inode);
+}
+
 static inline void wbc_prep_exlock_common(struct md_op_item *item, int it_op)
 {
 	struct ldlm_enqueue_info *einfo = &item->mop_einfo;
@@ -301,6 +322,7 @@ static int wbc_create_exlock_cb(struct req_capsule *pill,
 	wbc_super_root_add(inode);
 	wbci->wbci_dirty_flags &= ~WBC_DIRTY_FL_FLUSHING;
 	spin_unlock(&inode->i_lock);
+	wbc_xattr_cache_fini(inode);
 
 	wbci->wbci_lock_handle.cookie = it->it_lock_handle;
 out_it:
@@ -314,6 +336,21 @@ out_dput:
 	RETURN(rc);
 }
 
+static inline void wbc_create_attr_pack(struct inode *inode,
+					struct md_op_data *op_data)
+{
+	op_data->op_fsuid = from_kuid(&init_user_ns, inode->i_uid);
+	op_data->op_fsgid = from_kgid(&init_user_ns, inode->i_gid);
+	/* An older MDT sets the times of the new file to the flush time. */
+	if (!exp_connect_wbc(ll_i2mdexp(inode)))
+		return;
+
+	op_data->op_attr.ia_atime = inode->i_atime;
+	op_data->op_attr.ia_mtime = inode->i_mtime;
+	op_data->op_attr.ia_ctime = inode->i_ctime;
+	op_data->op_bias |= MDS_WBC_CREATE_ATTR;
+}
+
 static int wbc_fill_create_common(struct inode *dir,
 				  struct dentry *dchild,
 				  struct md_op_item *item)
@@ -344,12 +381,11 @@ static int wbc_fill_create_common(struct inode *dir,
 		RETURN(PTR_ERR(op_data));
 
 	/*
-	 * TODO: Set the file attributes such as timestamps, uid/gid, mode for
-	 * the file correctly (If the file attributes was modified after
-	 * created in MemFS).
+	 * Create the file with the attributes it has in MemFS now, so that
+	 * any chmod/chown/utime done after the creation in MemFS is applied
+	 * together with the creation on MDT.
 	 */
-	op_data->op_fsuid = from_kuid(&init_user_ns, inode->i_uid);
-	op_data->op_fsgid = from_kgid(&init_user_ns, inode->i_gid);
+	wbc_create_attr_pack(inode, op_data);
 	op_data->op_cap = cfs_curproc_cap_pack();
 
 	if (S_ISBLK(inode->i_mode) || S_ISCHR(inode->i_mode))
@@ -612,6 +648,119 @@ wbc_prep_exlock_only(struct inode *dir, struct dentry *dchild,
 	return item;
 }
 
+static int wbc_subdir_exlock_cb(struct req_capsule *pill,
+				struct md_op_item *item, int rc)
+{
+	struct lookup_intent *it = &item->mop_it;
+	struct dentry *dentry = item->mop_dentry;
+	struct inode *inode = dentry->d_inode;
+	struct wbc_inode *wbci = ll_i2wbci(inode);
+	__u64 bits;
+
+	ENTRY;
+
+	if (rc) {
+		CDEBUG(D_CACHE, "Failed to acquire EX lock on %pd: rc = %d\n",
+		       dentry, rc);
+		GOTO(out_dput, rc);
+	}
+
+	if (it->it_lock_mode != LCK_EX)
+		GOTO(out_dput, rc = -EPROTO);
+
+	ll_set_lock_data(ll_i2mdexp(inode), inode, it, &bits);
+	LASSERT(bits & (MDS_INODELOCK_UPDATE | MDS_INODELOCK_LOOKUP));
+
+	/*
+	 * The ancestor root may have been revoked or the directory removed
+	 * while the lock was in flight. The directory then has been handled
+	 * as a normal child of the ancestor, just drop the lock reference.
+	 */
+	spin_lock(&inode->i_lock);
+	if (wbc_inode_has_protected(wbci) && wbc_inode_was_flushed(wbci) &&
+	    !wbc_inode_root(wbci) &&
+	    !(wbci->wbci_flags & WBC_STATE_FL_FREEING)) {
+		wbci->wbci_lock_handle.cookie = it->it_lock_handle;
+		wbci->wbci_flags |= WBC_STATE_FL_ROOT;
+		wbc_super_root_add(inode);
+	}
+	spin_unlock(&inode->i_lock);
+	ll_intent_release(it);
+
+out_dput:
+	dput(dentry);
+	wbc_fini_op_item(item, rc);
+
+	RETURN(rc);
+}
+
+/**
+ * Acquire an EX lock on the assimilated subdirectory @dchild in the
+ * background, so that it becomes a nested root of the WBC tree.
+ *
+ * When the lock of an ancestor root is revoked later, only the children
+ * not protected by their own EX locks need to be flushed, and the nested
+ * roots keep caching their subtrees until a conflicting access reaches
+ * them in turn.
+ * The request is sent under the EX lock of the nearest ancestor root.
+ */
+int wbcfs_subdir_exlock_async(struct dentry *dchild)
+{
+	struct inode *inode = dchild->d_inode;
+	struct ll_sb_info *sbi = ll_i2sbi(inode);
+	struct dentry *dentry = dget(dchild);
+	struct ldlm_lock *lock = NULL;
+	struct md_op_item *item;
+	int rc;
+
+	ENTRY;
+
+	LASSERT(S_ISDIR(inode->i_mode));
+	if (!ll_i2wbcc(inode)->wbcc_partial_revoke ||
+	    !wbc_mode_lock_keep(ll_i2wbci(inode)))
+		GOTO(out_dput, rc = 0);
+
+	while (!IS_ROOT(dentry)) {
+		struct dentry *parent = dget_parent(dentry);
+		struct wbc_inode *pwbci = ll_i2wbci(parent->d_inode);
+
+		dput(dentry);
+		dentry = parent;
+		if (!wbc_inode_has_protected(pwbci))
+			GOTO(out_dput, rc = 0);
+		if (wbc_inode_root(pwbci)) {
+			lock = ldlm_handle2lock(&pwbci->wbci_lock_handle);
+			break;
+		}
+	}
+
+	if (lock == NULL)
+		GOTO(out_dput, rc = 0);
+
+	item = wbc_prep_exlock_only(dentry->d_inode, dchild, 0);
+	if (IS_ERR(item)) {
+		LDLM_LOCK_PUT(lock);
+		GOTO(out_dput, rc = PTR_ERR(item));
+	}
+
+	item->mop_opc = MD_OP_EXLOCK_ONLY;
+	item->mop_dentry = dget(dchild);
+	item->mop_cb = wbc_subdir_exlock_cb;
+	item->mop_einfo.ei_mode = LCK_EX;
+	item->mop_data.op_open_handle = lock->l_remote_handle;
+	LDLM_LOCK_PUT(lock);
+
+	rc = md_intent_lock_async(sbi->ll_md_exp, item, NULL);
+	if (rc) {
+		dput(dchild);
+		wbc_fini_op_item(item, rc);
+	}
+
+out_dput:
+	dput(dentry);
+	RETURN(rc);
+}
+
 static inline void wbc_prep_lockless_common(struct md_op_item *item, int it_op)
 {
 	item->mop_it.it_op = it_op;
@@ -653,6 +802,7 @@ static int wbc_create_lockless_cb(struct req_capsule *pill,
 	wbci->wbci_flags |= WBC_STATE_FL_SYNC;
 	wbci->wbci_dirty_flags &= ~WBC_DIRTY_FL_FLUSHING;
 	spin_unlock(&inode->i_lock);
+	wbc_xattr_cache_fini(inode);
 	if (item->mop_flags & WBC_FL_UNRSV_CHILDREN) {
 		LASSERT(item->mop_flags & WBC_FL_DECOMPLETE);
 		wbc_inode_unreserve_dput(inode, dchild);
@@ -660,17 +810,27 @@ static int wbc_create_lockless_cb(struct req_capsule *pill,
 
 	LASSERT(wbc_mode_lock_keep(wbci));
 	if (S_ISREG(inode->i_mode) && item->mop_flags & WBC_FL_SYNC_NONE &&
-	    wbc_active_data_writeback(inode)) {
+	    (wbc_active_data_writeback(inode) ||
+	     wbc_inode_hardlink_dirty(wbci))) {
 		/*
 		 * Mark the inode as dirty, and the kernel flusher thread will
 		 * delay to do the assimilation work to commit the cache pages
-		 * form MemFS to Lustre.
+		 * form MemFS to Lustre, and link the other names of the file.
 		 */
 		mark_inode_dirty(inode);
 	} else if (S_ISDIR(inode->i_mode)) {
+		if (!(item->mop_flags & WBC_FL_DECOMPLETE))
+			(void) wbcfs_subdir_exlock_async(dchild);
 		if (ll_d2wbcd(dchild)->wbcd_dirent_num > 2) {
-			/* Queue the directory for parallel flush. */
-			rc = wbc_queue_writeback_work(dchild);
+			enum writeback_sync_modes mode = WB_SYNC_ALL;
+
+			if (item->mop_flags & WBC_FL_SYNC_NONE)
+				mode = WB_SYNC_NONE;
+			/*
+			 * Queue the directory for parallel flush with the
+			 * sync mode of this flush.
+			 */
+			rc = wbc_queue_writeback_work(dchild, mode);
 			if (rc)
 				CERROR("Queue work for %pd failed: rc = %d\n",
 				       dchild, rc);
@@ -760,6 +920,278 @@ wbc_prep_setattr_lockless(struct inode *dir, struct dentry *dchild,
 	return item;
 }
 
+static int wbc_setxattr_lockless_cb(struct req_capsule *pill,
+				    struct md_op_item *item, int rc)
+{
+	struct md_op_data *op_data = &item->mop_data;
+
+	ENTRY;
+
+	if (rc)
+		CERROR("Failed to set xattr %s of "DFID" with lockless IO: "
+		       "rc = %d\n", op_data->op_name, PFID(&op_data->op_fid1),
+		       rc);
+
+	/* The name and value of the xattr are in one buffer. */
+	OBD_FREE((char *)op_data->op_name,
+		 op_data->op_namelen + 1 + op_data->op_data_size);
+	wbc_fini_op_item(item, rc);
+
+	RETURN(rc);
+}
+
+static struct md_op_item *
+wbc_prep_setxattr_lockless(struct inode *inode, const char *name,
+			   const char *value, unsigned int size)
+{
+	struct md_op_data *op_data;
+	struct md_op_item *item;
+	size_t namelen = strlen(name);
+	char *buf;
+
+	OBD_ALLOC_PTR(item);
+	if (item == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	OBD_ALLOC(buf, namelen + 1 + size);
+	if (buf == NULL) {
+		OBD_FREE_PTR(item);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	op_data = ll_prep_md_op_data(&item->mop_data, inode, NULL, NULL, 0, 0,
+				     LUSTRE_OPC_ANY, NULL);
+	if (IS_ERR(op_data)) {
+		OBD_FREE(buf, namelen + 1 + size);
+		OBD_FREE_PTR(item);
+		return (struct md_op_item *)op_data;
+	}
+
+	memcpy(buf, name, namelen + 1);
+	memcpy(buf + namelen + 1, value, size);
+	op_data->op_name = buf;
+	op_data->op_namelen = namelen;
+	op_data->op_data = buf + namelen + 1;
+	op_data->op_data_size = size;
+	op_data->op_valid = OBD_MD_FLXATTR;
+	op_data->op_mod_time = inode->i_ctime.tv_sec;
+	op_data->op_cap = cfs_curproc_cap_pack();
+
+	item->mop_opc = MD_OP_SETXATTR_LOCKLESS;
+	item->mop_cb = wbc_setxattr_lockless_cb;
+	return item;
+}
+
+struct wbc_xattr_flush_args {
+	struct wbc_context	*wxfa_ctx;
+	struct lu_batch		*wxfa_batch;
+	struct inode		*wxfa_inode;
+	/* The create item which the setxattr sub requests follow. */
+	struct md_op_item	*wxfa_create;
+	/* The item to add once the next one is known. */
+	struct md_op_item	*wxfa_pending;
+};
+
+/*
+ * Add the pending item into the batch. It is chained with @next so that
+ * they are sent in the same batch RPC.
+ */
+static int wbc_xattr_flush_add(struct wbc_xattr_flush_args *args,
+			       struct md_op_item *next)
+{
+	struct md_op_item *item = args->wxfa_pending;
+	int rc = 0;
+
+	if (item != NULL) {
+		if (next != NULL)
+			item->mop_flags |= WBC_FL_BATCH_CHAIN;
+
+		rc = md_batch_add(ll_i2mdexp(args->wxfa_inode),
+				  args->wxfa_batch, item);
+		if (rc == 0 && item == args->wxfa_create)
+			args->wxfa_create = NULL;
+		else if (rc && item != args->wxfa_create)
+			item->mop_cb(NULL, item, rc);
+	}
+
+	if (rc && next != NULL) {
+		next->mop_cb(NULL, next, rc);
+		next = NULL;
+	}
+
+	args->wxfa_pending = next;
+	return rc;
+}
+
+static int wbc_xattr_flush_one(struct wbc_xattr_flush_args *args,
+			       const char *name, const char *value,
+			       unsigned int size)
+{
+	struct wbc_context *ctx = args->wxfa_ctx;
+	struct md_op_item *item;
+
+	item = wbc_prep_setxattr_lockless(args->wxfa_inode, name, value, size);
+	if (IS_ERR(item))
+		return PTR_ERR(item);
+
+	if (ctx != NULL && ctx->ioc_anchor_used) {
+		atomic_inc(&ctx->ioc_anchor.wsi_sync_nr);
+		item->mop_cbdata = ctx;
+	}
+
+	return wbc_xattr_flush_add(args, item);
+}
+
+static int wbc_xattr_flush_cb(void *cbdata, const char *name,
+			      const char *value, unsigned int size)
+{
+	return wbc_xattr_flush_one(cbdata, name, value, size);
+}
+
+#ifdef CONFIG_LUSTRE_FS_POSIX_ACL
+static int wbc_xattr_flush_acl(struct wbc_xattr_flush_args *args)
+{
+	struct ll_inode_info *lli = ll_i2info(args->wxfa_inode);
+	struct posix_acl *acl;
+	char *value;
+	int size;
+	int rc;
+
+	spin_lock(&lli->lli_lock);
+	acl = posix_acl_dup(lli->lli_posix_acl);
+	spin_unlock(&lli->lli_lock);
+	if (acl == NULL)
+		return 0;
+
+	size = posix_acl_xattr_size(acl->a_count);
+	OBD_ALLOC(value, size);
+	if (value == NULL)
+		GOTO(out_release, rc = -ENOMEM);
+
+	rc = posix_acl_to_xattr(&init_user_ns, acl, value, size);
+	if (rc >= 0)
+		rc = wbc_xattr_flush_one(args, XATTR_NAME_ACL_ACCESS,
+					 value, rc);
+
+	OBD_FREE(value, size);
+out_release:
+	posix_acl_release(acl);
+	return rc;
+}
+#else
+static inline int wbc_xattr_flush_acl(struct wbc_xattr_flush_args *args)
+{
+	return 0;
+}
+#endif
+
+/*
+ * Pack the xattrs cached in MemFS for @inode into setxattr sub requests
+ * following @create (if any) in the batch @bh.
+ * Return an error only if @create was not added into the batch, as the
+ * failures of the setxattr sub requests are noted in their callbacks.
+ */
+static int wbc_xattr_flush(struct wbc_context *ctx, struct lu_batch *bh,
+			   struct inode *inode, struct md_op_item *create)
+{
+	struct wbc_xattr_flush_args args = {
+		.wxfa_ctx	= ctx,
+		.wxfa_batch	= bh,
+		.wxfa_inode	= inode,
+		.wxfa_create	= create,
+		.wxfa_pending	= create,
+	};
+	int rc, rc2;
+
+	ENTRY;
+
+	rc = ll_xattr_cache_iterate(inode, wbc_xattr_flush_cb, &args);
+	if (rc == 0)
+		rc = wbc_xattr_flush_acl(&args);
+	rc2 = wbc_xattr_flush_add(&args, NULL);
+	if (rc == 0)
+		rc = rc2;
+
+	if (rc)
+		CERROR("%s: failed to flush xattrs of "DFID": rc = %d\n",
+		       ll_i2sbi(inode)->ll_fsname, PFID(ll_inode2fid(inode)),
+		       rc);
+
+	if (args.wxfa_create != NULL) {
+		LASSERT(rc);
+		RETURN(rc);
+	}
+
+	RETURN(create != NULL ? 0 : rc);
+}
+
+/* Whether there are xattrs of @inode cached in MemFS to flush. */
+static bool wbc_inode_xattr_cached(struct inode *inode)
+{
+	struct ll_inode_info *lli = ll_i2info(inode);
+
+	return lli->lli_posix_acl != NULL ||
+	       atomic_read(&lli->lli_xattrs_count) > 0;
+}
+
+static int wbc_sync_xattrs(struct inode *inode)
+{
+	struct obd_export *exp = ll_i2mdexp(inode);
+	struct lu_batch *bh;
+	int rc, rc2;
+
+	ENTRY;
+
+	if (!wbc_inode_xattr_cached(inode))
+		RETURN(0);
+
+	bh = md_batch_create(exp, BATCH_FL_SYNC, 0);
+	if (IS_ERR(bh))
+		RETURN(PTR_ERR(bh));
+
+	rc = wbc_xattr_flush(NULL, bh, inode, NULL);
+	rc2 = md_batch_stop(exp, bh);
+	if (rc == 0)
+		rc = rc2;
+
+	RETURN(rc);
+}
+
+/*
+ * Flush the create @item together with the xattrs cached in MemFS for the
+ * file in one batch RPC, so that the setxattr sub requests are executed
+ * right after the create on MDT. The batch @bh of the flush context is used
+ * if any, otherwise a private synchronous batch.
+ */
+static int wbc_flush_create_xattrs(struct wbc_context *ctx,
+				   struct lu_batch *bh,
+				   struct md_op_item *item)
+{
+	struct inode *inode = item->mop_dentry->d_inode;
+	struct obd_export *exp = ll_i2mdexp(inode);
+	int rc;
+	int rc2;
+
+	ENTRY;
+
+	if (bh != NULL)
+		RETURN(wbc_xattr_flush(ctx, bh, inode, item));
+
+	bh = md_batch_create(exp, BATCH_FL_SYNC, 0);
+	if (IS_ERR(bh))
+		RETURN(PTR_ERR(bh));
+
+	rc = wbc_xattr_flush(ctx, bh, inode, item);
+	rc2 = md_batch_stop(exp, bh);
+	/* The callbacks of the added items have been called on failure. */
+	if (rc2)
+		CERROR("%s: failed to flush "DFID" with xattrs: rc = %d\n",
+		       ll_i2sbi(inode)->ll_fsname, PFID(ll_inode2fid(inode)),
+		       rc2);
+
+	RETURN(rc);
+}
+
 typedef struct md_op_item *(*md_prep_op_item_t)(struct inode *dir,
 						struct dentry *dchild,
 						unsigned int valid);
@@ -914,8 +1346,18 @@ static inline int wbc_make_inode_assimilated(struct inode *inode)
 	    wbci->wbci_flags & WBC_STATE_FL_FREEING)
 		return 0;
 
+	/*
+	 * For WBC_DOP_AT_COMMIT, the file is still protected under the root
+	 * WBC EX lock after flushed in lock keep flush mode. Thus delay to
+	 * instantiate the PCC copy until commit the cache pages (i.e. fsync,
+	 * reclaim or the lock revocation).
+	 */
+	if (wbc_cache_mode_dop(wbci) && wbc_mode_lock_keep(wbci) &&
+	    ll_i2wbcc(inode)->wbcc_dop_pol == WBC_DOP_AT_COMMIT)
+		return 0;
+
 	down_write(&wbci->wbci_rw_sem);
-	rc = wbcfs_commit_cache_pages(inode);
+	rc = wbcfs_commit_cache_pages(inode, WBC_DOP_AT_FLUSH);
 	up_write(&wbci->wbci_rw_sem);
 
 	return rc > 0 ? 0 : rc;
@@ -974,11 +1416,10 @@ static int wbc_sync_create(struct inode *inode, struct dentry *dchild)
 		datalen = op_data->op_data_size;
 	}
 
-	/* TODO: Set the timstamps for the inode correctly. */
+	wbc_create_attr_pack(inode, op_data);
 	op_data->op_bias |= MDS_WBC_LOCKLESS;
 	rc = md_create(sbi->ll_md_exp, op_data, data, datalen, mode,
-		       from_kuid(&init_user_ns, inode->i_uid),
-		       from_kgid(&init_user_ns, inode->i_gid),
+		       op_data->op_fsuid, op_data->op_fsgid,
 		       cfs_curproc_cap_pack(), rdev, cr_flags, &request);
 	if (rc)
 		GOTO(out, rc);
@@ -1005,12 +1446,17 @@ static int wbc_do_create(struct inode *inode)
 
 	ENTRY;
 
-	/* TODO: Hardlink for a non-directory file. */
-	dentry = d_find_any_alias(inode);
+	dentry = wbc_d_find_alias(inode);
 	if (!dentry)
 		RETURN(0);
 
+	spin_lock(&inode->i_lock);
+	__wbc_inode_mark_links(inode, dentry);
+	spin_unlock(&inode->i_lock);
+
 	rc = wbc_sync_create(inode, dentry);
+	if (rc == 0)
+		rc = wbc_sync_xattrs(inode);
 	/*
 	 * TODO: for WB_SYNC_NONE mode, do async create and data flush on
 	 * background.
@@ -1022,30 +1468,21 @@ static int wbc_do_create(struct inode *inode)
 	RETURN(rc);
 }
 
-/* TODO: if @valid != 0, still need to set attributes for the file. */
-static int wbc_do_rmfid(struct inode *dir, unsigned int valid)
+static int wbc_do_rmfid(struct inode *dir, struct list_head *head,
+			__u32 count)
 {
 	__u32 max = ll_i2wbcc(dir)->wbcc_max_rmfid_count;
 	struct wbc_inode *wbci = ll_i2wbci(dir);
 	struct wbc_removed_item *item, *tmp;
 	struct fid_array *fa = NULL;
 	int *rcs = NULL;
-	LIST_HEAD(head);
 	unsigned int nr;
-	__u32 total = 0;
-	__u32 count;
 	__u64 flags;
 	size_t size;
-	int rc;
+	int rc = 0;
 
 	ENTRY;
 
-	spin_lock(&wbci->wbci_removed_lock);
-	count = wbci->wbci_removed_count;
-	wbci->wbci_removed_count = 0;
-	list_splice_init(&wbci->wbci_removed_list, &head);
-	spin_unlock(&wbci->wbci_removed_lock);
-
 	flags = OBD_FL_LOCKLESS;
 	if (wbci->wbci_rmpol == WBC_RMPOL_SUBTREE)
 		flags |= OBD_FL_SUBTREE_RM;
@@ -1054,64 +1491,357 @@ static int wbc_do_rmfid(struct inode *dir, unsigned int valid)
 	size = offsetof(struct fid_array, fa_fids[nr]);
 	OBD_ALLOC(fa, size);
 	if (!fa)
-		RETURN(-ENOMEM);
+		GOTO(free_items, rc = -ENOMEM);
 	OBD_ALLOC_PTR_ARRAY(rcs, nr);
 	if (!rcs)
 		GOTO(free_fa, rc = -ENOMEM);
 
-	list_for_each_entry_safe(item, tmp, &head, wbvi_item) {
+	list_for_each_entry_safe(item, tmp, head, wbvi_item) {
 		list_del_init(&item->wbvi_item);
 		fa->fa_fids[fa->fa_nr] = item->wbvi_fid;
 		fa->fa_nr++;
-		total++;
-		OBD_FREE_PTR(item);
+		wbc_removed_item_free(item);
 		if (fa->fa_nr == max) {
 			rc = md_rmfid(ll_i2mdexp(dir), fa, rcs, flags, NULL);
 			if (rc)
 				GOTO(free_rcs, rc);
+			wbc_stats_add(ll_i2wbcs(dir), WBC_STATS_RMFID,
+				      fa->fa_nr);
 			fa->fa_nr = 0;
 		}
 	}
 
-	LASSERT(total == count);
-	if (fa->fa_nr)
+	if (fa->fa_nr) {
 		rc = md_rmfid(ll_i2mdexp(dir), fa, rcs, flags, NULL);
+		if (rc == 0)
+			wbc_stats_add(ll_i2wbcs(dir), WBC_STATS_RMFID,
+				      fa->fa_nr);
+	}
 
 free_rcs:
 	OBD_FREE_PTR_ARRAY(rcs, nr);
 free_fa:
 	OBD_FREE(fa, size);
-	RETURN(rc);
-}
-
-int wbcfs_inode_sync_metadata(long opc, struct inode *inode, unsigned int valid)
-{
-	switch (opc) {
-	case MD_OP_SETATTR_LOCKLESS:
-		RETURN(wbc_do_setattr(inode, valid));
-	case MD_OP_REMOVE_LOCKLESS:
-		RETURN(wbc_do_rmfid(inode, valid));
-	case MD_OP_NONE:
-		RETURN(0);
-	default:
-		RETURN(-EOPNOTSUPP);
+free_items:
+	list_for_each_entry_safe(item, tmp, head, wbvi_item) {
+		list_del_init(&item->wbvi_item);
+		wbc_removed_item_free(item);
 	}
+	RETURN(rc);
 }
 
-int wbcfs_setattr_data_object(struct inode *inode, struct iattr *attr)
+static int wbc_namespace_lockless_cb(struct req_capsule *pill,
+				     struct md_op_item *item, int rc)
 {
-	struct wbc_inode *wbci = ll_i2wbci(inode);
-	bool cached;
-	int rc;
+	struct md_op_data *op_data = &item->mop_data;
+	struct wbc_removed_item *rmi = item->mop_cbdata;
 
 	ENTRY;
 
-	inode_unlock(inode);
-	if (wbc_cache_mode_dop(wbci)) {
-		rc = pcc_inode_setattr(inode, attr, &cached);
-		if (cached) {
-			if (rc)
-				CERROR("%s: PCC inode "DFID" setattr failed: "
+	rmi->wbvi_rc = rc;
+	if (rc)
+		CERROR("Failed to batch namespace update (opc = %d) for "
+		       DFID"/%.*s: rc = %d\n", item->mop_opc,
+		       PFID(&op_data->op_fid1), (int)op_data->op_namelen,
+		       op_data->op_name, rc);
+
+	OBD_FREE_PTR(item);
+	RETURN(rc);
+}
+
+static struct md_op_item *
+wbc_prep_namespace_lockless(struct wbc_removed_item *rmi)
+{
+	struct md_op_item *item;
+	struct md_op_data *op_data;
+
+	OBD_ALLOC_PTR(item);
+	if (item == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	op_data = &item->mop_data;
+	switch (rmi->wbvi_opc) {
+	case MD_OP_UNLINK_LOCKLESS:
+		op_data->op_fid1 = rmi->wbvi_pfid;
+		op_data->op_fid2 = rmi->wbvi_fid;
+		break;
+	case MD_OP_RENAME_LOCKLESS:
+		op_data->op_fid1 = rmi->wbvi_pfid;
+		op_data->op_fid2 = rmi->wbvi_tgt_pfid;
+		op_data->op_fid3 = rmi->wbvi_fid;
+		item->mop_tgt_name.ln_name = wbc_removed_item_tgt_name(rmi);
+		item->mop_tgt_name.ln_namelen = rmi->wbvi_tgt_namelen;
+		break;
+	case MD_OP_LINK_LOCKLESS:
+		/* Link the source object @fid1 into the target dir @fid2. */
+		op_data->op_fid1 = rmi->wbvi_fid;
+		op_data->op_fid2 = rmi->wbvi_pfid;
+		break;
+	default:
+		OBD_FREE_PTR(item);
+		return ERR_PTR(-EINVAL);
+	}
+
+	op_data->op_name = rmi->wbvi_name;
+	op_data->op_namelen = rmi->wbvi_namelen;
+	op_data->op_mode = rmi->wbvi_mode;
+	op_data->op_fsuid = from_kuid(&init_user_ns, current_fsuid());
+	op_data->op_fsgid = from_kgid(&init_user_ns, current_fsgid());
+	op_data->op_cap = cfs_curproc_cap_pack();
+	op_data->op_suppgids[0] = -1;
+	op_data->op_suppgids[1] = -1;
+	op_data->op_mod_time = ktime_get_real_seconds();
+	op_data->op_bias = MDS_WBC_LOCKLESS;
+
+	item->mop_opc = rmi->wbvi_opc;
+	item->mop_cb = wbc_namespace_lockless_cb;
+	item->mop_cbdata = rmi;
+	return item;
+}
+
+/*
+ * The link of a pinned name is done with the batch. If its sub request was
+ * not replied with success, the name is marked pending to link it again.
+ */
+static void wbc_link_item_fini(struct wbc_removed_item *rmi)
+{
+	struct dentry *dentry = rmi->wbvi_dentry;
+	struct inode *inode = dentry->d_inode;
+
+	if (rmi->wbvi_rc) {
+		spin_lock(&inode->i_lock);
+		__wbc_dentry_link_redo(inode, dentry);
+		spin_unlock(&inode->i_lock);
+	}
+	dput(dentry);
+	rmi->wbvi_dentry = NULL;
+}
+
+/*
+ * Pack the named namespace updates into batched sub requests. The batch is
+ * synchronous, so that the updates are applied on MDT before the items
+ * (holding the names) are freed, and before the following pending removals.
+ */
+static int wbc_do_batch_namespace(struct inode *dir, struct list_head *head)
+{
+	struct obd_export *exp = ll_i2mdexp(dir);
+	struct wbc_removed_item *rmi, *tmp;
+	struct md_op_item *item;
+	struct lu_batch *bh;
+	int rc = 0;
+	int rc2;
+
+	ENTRY;
+
+	bh = md_batch_create(exp, BATCH_FL_SYNC,
+			     ll_i2wbcc(dir)->wbcc_max_batch_count);
+	if (IS_ERR(bh))
+		GOTO(free_items, rc = PTR_ERR(bh));
+
+	list_for_each_entry(rmi, head, wbvi_item) {
+		item = wbc_prep_namespace_lockless(rmi);
+		if (IS_ERR(item))
+			GOTO(stop_batch, rc = PTR_ERR(item));
+
+		rc = md_batch_add(exp, bh, item);
+		if (rc) {
+			CERROR("%s: failed to add namespace update (opc = %d) "
+			       "for "DFID": rc = %d\n",
+			       ll_i2sbi(dir)->ll_fsname, rmi->wbvi_opc,
+			       PFID(&rmi->wbvi_fid), rc);
+			OBD_FREE_PTR(item);
+			GOTO(stop_batch, rc);
+		}
+		wbc_stats_flush_opc(ll_i2wbcs(dir), rmi->wbvi_opc, 1);
+	}
+
+stop_batch:
+	rc2 = md_batch_stop(exp, bh);
+	if (rc == 0)
+		rc = rc2;
+free_items:
+	list_for_each_entry_safe(rmi, tmp, head, wbvi_item) {
+		list_del_init(&rmi->wbvi_item);
+		if (rmi->wbvi_dentry)
+			wbc_link_item_fini(rmi);
+		wbc_removed_item_free(rmi);
+	}
+	RETURN(rc);
+}
+
+/*
+ * Replay the pending namespace updates in @head on MDT in order. The list is
+ * split into runs of removals by FID and of named updates, each run is sent
+ * with rmfid() or in batch respectively. All items are freed on return.
+ */
+int wbcfs_sync_removed_items(struct inode *dir, struct list_head *head)
+{
+	struct wbc_removed_item *item, *tmp;
+	LIST_HEAD(run);
+	__u32 count;
+	bool named;
+	int rc = 0;
+	int rc2;
+
+	ENTRY;
+
+	while (!list_empty(head)) {
+		item = list_first_entry(head, struct wbc_removed_item,
+					wbvi_item);
+		named = item->wbvi_opc != MD_OP_NONE;
+		count = 0;
+		list_for_each_entry_safe_from(item, tmp, head, wbvi_item) {
+			if ((item->wbvi_opc != MD_OP_NONE) != named)
+				break;
+
+			list_move_tail(&item->wbvi_item, &run);
+			count++;
+		}
+
+		if (named)
+			rc2 = wbc_do_batch_namespace(dir, &run);
+		else
+			rc2 = wbc_do_rmfid(dir, &run, count);
+		if (rc == 0)
+			rc = rc2;
+	}
+
+	RETURN(rc);
+}
+
+/*
+ * Find a name of @inode not linked on MDT yet whose parent is on MDT under
+ * the protection of the EX lock of this client, and claim it.
+ */
+static struct dentry *wbc_hardlink_claim(struct inode *inode)
+{
+	struct dentry *alias;
+
+	spin_lock(&inode->i_lock);
+	hlist_for_each_entry(alias, &inode->i_dentry, d_alias) {
+		struct inode *dir = alias->d_parent->d_inode;
+
+		if (!wbc_dentry_link_pending(alias) || dir == NULL ||
+		    !wbc_inode_was_flushed(ll_i2wbci(dir)))
+			continue;
+
+		__wbc_dentry_link_done(inode, alias);
+		dget(alias);
+		spin_unlock(&inode->i_lock);
+		return alias;
+	}
+	spin_unlock(&inode->i_lock);
+
+	return NULL;
+}
+
+/*
+ * Link the names of @inode added in MemFS into their parents on MDT, after
+ * @inode itself was created on MDT. The links are sent in one batch. The
+ * names under the parents not yet flushed are linked when flushing those
+ * parents, thus the parents are not flushed separately here.
+ */
+int wbcfs_flush_hardlinks(struct inode *inode)
+{
+	struct wbc_inode *wbci = ll_i2wbci(inode);
+	struct wbc_removed_item *item;
+	struct dentry *dentry;
+	LIST_HEAD(head);
+	int rc = 0;
+
+	ENTRY;
+
+	if (S_ISDIR(inode->i_mode) || !wbc_inode_hardlink_dirty(wbci) ||
+	    !wbc_inode_written_out(wbci))
+		RETURN(0);
+
+	while ((dentry = wbc_hardlink_claim(inode)) != NULL) {
+		struct inode *dir = dentry->d_parent->d_inode;
+
+		item = wbc_removed_item_alloc(MD_OP_LINK_LOCKLESS, inode,
+					      &dentry->d_name, NULL);
+		if (item == NULL) {
+			spin_lock(&inode->i_lock);
+			__wbc_dentry_link_redo(inode, dentry);
+			spin_unlock(&inode->i_lock);
+			dput(dentry);
+			rc = -ENOMEM;
+			break;
+		}
+
+		item->wbvi_pfid = *ll_inode2fid(dir);
+		/* The claimed reference is dropped once linked on MDT. */
+		item->wbvi_dentry = dentry;
+		list_add_tail(&item->wbvi_item, &head);
+	}
+
+	if (!list_empty(&head)) {
+		int rc2 = wbcfs_sync_removed_items(inode, &head);
+
+		if (rc == 0)
+			rc = rc2;
+	}
+
+	RETURN(rc);
+}
+
+/*
+ * Replay the pending namespace updates under @dir on MDT, then set the
+ * pending attributes @valid of @dir cleared along with the remove dirty flag.
+ * The attributes go last, so the times of @dir set in MemFS are not
+ * overwritten by the updates, which were allowed by the permission of @dir
+ * before the attribute changes.
+ */
+static int wbc_do_remove(struct inode *dir, unsigned int valid)
+{
+	struct wbc_inode *wbci = ll_i2wbci(dir);
+	LIST_HEAD(head);
+	int rc;
+
+	spin_lock(&wbci->wbci_removed_lock);
+	wbci->wbci_removed_count = 0;
+	list_splice_init(&wbci->wbci_removed_list, &head);
+	spin_unlock(&wbci->wbci_removed_lock);
+
+	rc = wbcfs_sync_removed_items(dir, &head);
+	if (valid != 0) {
+		int rc2 = wbc_do_setattr(dir, valid);
+
+		if (rc == 0)
+			rc = rc2;
+	}
+
+	return rc;
+}
+
+int wbcfs_inode_sync_metadata(long opc, struct inode *inode, unsigned int valid)
+{
+	switch (opc) {
+	case MD_OP_SETATTR_LOCKLESS:
+		RETURN(wbc_do_setattr(inode, valid));
+	case MD_OP_REMOVE_LOCKLESS:
+		RETURN(wbc_do_remove(inode, valid));
+	case MD_OP_NONE:
+		RETURN(0);
+	default:
+		RETURN(-EOPNOTSUPP);
+	}
+}
+
+int wbcfs_setattr_data_object(struct inode *inode, struct iattr *attr)
+{
+	struct wbc_inode *wbci = ll_i2wbci(inode);
+	bool cached;
+	int rc;
+
+	ENTRY;
+
+	inode_unlock(inode);
+	if (wbc_cache_mode_dop(wbci)) {
+		rc = pcc_inode_setattr(inode, attr, &cached);
+		if (cached) {
+			if (rc)
+				CERROR("%s: PCC inode "DFID" setattr failed: "
 				       "rc = %d\n", ll_i2sbi(inode)->ll_fsname,
 				       PFID(ll_inode2fid(inode)), rc);
 			GOTO(out, rc);
@@ -1158,7 +1888,13 @@ static int wbc_reopen_pcc_file(struct inode *inode)
 	RETURN(rc);
 }
 
-static int wbc_commit_data_pcc(struct inode *inode)
+/*
+ * Move the cache pages in MemFS into the PCC copy. @reason tells which of the
+ * events listed by enum wbc_dop_policy triggers the move, which may differ
+ * from the configured policy (e.g. fsync(2) or reclaim under WBC_DOP_AT_WRITE).
+ */
+static int wbc_commit_data_pcc(struct inode *inode,
+			       enum wbc_dop_policy reason)
 {
 	struct wbc_inode *wbci = ll_i2wbci(inode);
 	struct address_space *mapping = inode->i_mapping;
@@ -1178,6 +1914,8 @@ static int wbc_commit_data_pcc(struct inode *inode)
 	if (rc < 0)
 		RETURN(rc);
 
+	__add_wbc_stat(ll_i2mwb(inode), wbc_dop_pol2stat(reason), nr_pages);
+
 	rc = wbc_reopen_pcc_file(inode);
 	/* XXX failure handling. */
 	wbc_inode_data_lru_del(inode);
@@ -1381,13 +2119,13 @@ out:
 	RETURN(rc);
 }
 
-int wbcfs_commit_cache_pages(struct inode *inode)
+int wbcfs_commit_cache_pages(struct inode *inode, enum wbc_dop_policy reason)
 {
 	switch (ll_i2wbci(inode)->wbci_cache_mode) {
 	case WBC_MODE_MEMFS:
 		return wbc_commit_data_lustre(inode);
 	case WBC_MODE_DATA_PCC:
-		return wbc_commit_data_pcc(inode);
+		return wbc_commit_data_pcc(inode, reason);
 	default:
 		return -EOPNOTSUPP;
 	}
@@ -1404,7 +2142,8 @@ void wbc_free_inode_pages_final(struct inode *inode,
 		}
 
 		if (inode->i_nlink) {
-			(void) wbcfs_commit_cache_pages(inode);
+			(void) wbcfs_commit_cache_pages(inode,
+							WBC_DOP_AT_COMMIT);
 			cl_sync_file_range(inode, 0, OBD_OBJECT_EOF,
 					   CL_FSYNC_LOCAL, 1);
 		} else {
@@ -1432,11 +2171,12 @@ int wbcfs_writeback_dir_child(struct inode *dir, struct dentry *child,
 		if (wbcx->for_pflush)
 			RETURN(0);
 
-		if (wbc_active_data_writeback(inode))
+		rc = wbcfs_flush_hardlinks(inode);
+		if (rc == 0 && wbc_active_data_writeback(inode))
 			rc = wbc_make_inode_assimilated(inode);
 		RETURN(rc);
 	} else if (opc == MD_OP_REMOVE_LOCKLESS) {
-		rc = wbc_do_rmfid(inode, valid);
+		rc = wbc_do_remove(inode, valid);
 		spin_lock(&inode->i_lock);
 		LASSERT(wbci->wbci_flags & WBC_STATE_FL_WRITEBACK &&
 			wbci->wbci_dirty_flags & WBC_DIRTY_FL_FLUSHING);
@@ -1456,6 +2196,10 @@ int wbcfs_writeback_dir_child(struct inode *dir, struct dentry *child,
 	}
 
 	LASSERT(opc == MD_OP_CREATE_LOCKLESS);
+	spin_lock(&inode->i_lock);
+	__wbc_inode_mark_links(inode, child);
+	spin_unlock(&inode->i_lock);
+
 	item = wbc_prep_op_item(opc, dir, child, NULL, wbcx, valid);
 	if (IS_ERR(item))
 		RETURN(PTR_ERR(item));
@@ -1463,7 +2207,14 @@ int wbcfs_writeback_dir_child(struct inode *dir, struct dentry *child,
 	ctx = &sbi->ll_wbc_super.wbcs_context;
 	atomic_inc(&ctx->ioc_anchor.wsi_sync_nr);
 	item->mop_cbdata = ctx;
-	if (wbcx->has_ioctx) {
+	if (wbc_inode_xattr_cached(child->d_inode)) {
+		struct lu_batch *bh = NULL;
+
+		if (wbcx->has_ioctx &&
+		    wbcx->context.ioc_pol == WBC_FLUSH_POL_BATCH)
+			bh = wbcx->context.ioc_batch;
+		rc = wbc_flush_create_xattrs(ctx, bh, item);
+	} else if (wbcx->has_ioctx) {
 		struct wbc_context *ctx = &wbcx->context;
 
 		switch (ctx->ioc_pol) {
@@ -1500,7 +2251,7 @@ static int wbc_inode_flush_lockless_async(struct inode *inode,
 
 	ENTRY;
 
-	dentry = d_find_any_alias(inode);
+	dentry = wbc_d_find_alias(inode);
 	if (!dentry)
 		RETURN(0);
 
@@ -1523,7 +2274,9 @@ static int wbc_inode_flush_lockless_sync(struct inode *inode,
 	opc = wbc_flush_opcode_get(inode, NULL, wbcx, &valid);
 	switch (opc) {
 	case MD_OP_NONE:
-		rc = wbc_make_inode_assimilated(inode);
+		rc = wbcfs_flush_hardlinks(inode);
+		if (rc == 0)
+			rc = wbc_make_inode_assimilated(inode);
 		break;
 	case MD_OP_CREATE_LOCKLESS:
 		rc = wbc_do_create(inode);
@@ -1534,8 +2287,21 @@ static int wbc_inode_flush_lockless_sync(struct inode *inode,
 		if (rc == 0)
 			wbci->wbci_flags |= WBC_STATE_FL_SYNC;
 		spin_unlock(&inode->i_lock);
+		if (rc == 0) {
+			wbc_xattr_cache_fini(inode);
+			rc = wbcfs_flush_hardlinks(inode);
+		}
 		if (!wbcx->for_fsync)
 			wbc_inode_writeback_complete(inode);
+		if (rc == 0 && S_ISDIR(inode->i_mode) &&
+		    !wbcx->for_decomplete) {
+			struct dentry *dentry = d_find_any_alias(inode);
+
+			if (dentry) {
+				(void) wbcfs_subdir_exlock_async(dentry);
+				dput(dentry);
+			}
+		}
 		break;
 	case MD_OP_SETATTR_LOCKLESS: {
 		rc = wbc_do_setattr(inode, valid);
@@ -1548,7 +2314,7 @@ static int wbc_inode_flush_lockless_sync(struct inode *inode,
 		break;
 	}
 	case MD_OP_REMOVE_LOCKLESS: {
-		rc = wbc_do_rmfid(inode, valid);
+		rc = wbc_do_remove(inode, valid);
 		spin_lock(&inode->i_lock);
 		LASSERT(wbci->wbci_flags & WBC_STATE_FL_WRITEBACK &&
 			wbci->wbci_dirty_flags & WBC_DIRTY_FL_FLUSHING);
@@ -1598,8 +2364,7 @@ int wbcfs_context_init(struct super_block *sb, struct wbc_context *ctx,
 			RETURN(-ENOMEM);
 		break;
 	case WBC_FLUSH_POL_BATCH:
-		ctx->ioc_batch = md_batch_create(ll_s2sbi(sb)->ll_md_exp, 0,
-						 conf->wbcc_max_batch_count);
+		ctx->ioc_batch = wbc_flush_batch_create(sb);
 		if (IS_ERR(ctx->ioc_batch))
 			RETURN(PTR_ERR(ctx->ioc_batch));
 		/* fall through */
@@ -1715,6 +2480,13 @@ static int wbc_flush_dir_child(struct wbc_context *ctx, struct inode *dir,
 	struct ll_sb_info *sbi = ll_i2sbi(dir);
 	int rc;
 
+	if ((item->mop_opc == MD_OP_CREATE_LOCKLESS ||
+	     item->mop_opc == MD_OP_CREATE_EXLOCK) &&
+	    wbc_inode_xattr_cached(item->mop_dentry->d_inode))
+		return wbc_flush_create_xattrs(ctx,
+				ctx->ioc_pol == WBC_FLUSH_POL_BATCH ?
+				ctx->ioc_batch : NULL, item);
+
 	switch (ctx->ioc_pol) {
 	case WBC_FLUSH_POL_PTLRPCD:
 		LASSERT(ctx->ioc_rqset == NULL);
@@ -1758,6 +2530,13 @@ int wbcfs_flush_dir_child(struct wbc_context *ctx, struct inode *dir,
 	if (opc == MD_OP_NONE)
 		RETURN(0);
 
+	/*
+	 * The hard link is linked into @dir in batch by the caller after the
+	 * creation of the file with its other name commits.
+	 */
+	if (opc == MD_OP_LINK_LOCKLESS)
+		RETURN(1);
+
 	item = wbc_prep_op_item(opc, dir, dchild, lock, wbcx, valid);
 	if (IS_ERR(item)) {
 		CERROR("prepare op item failed: rc = %ld\n", PTR_ERR(item));
@@ -1849,86 +2628,625 @@ void wbcfs_file_release_local(struct inode *inode, struct file *file)
 	file->private_data = NULL;
 }
 
-int wbcfs_dcache_dir_open(struct inode *inode, struct file *file)
+/*
+ * MDS open handle fetched in batch for the files opened locally under a WBC
+ * root, whose EX lock is being revoked.
+ */
+struct wbc_reopen_item {
+	struct md_op_item		 wri_item;
+	struct list_head		 wri_list;
+	struct obd_client_handle	*wri_och;
+	struct inode			*wri_inode;
+};
+
+/* Open handles of an inode shared by the opened files, see ll_file_open(). */
+enum wbc_reopen_slot {
+	WBC_REOPEN_WRITE	= 0,
+	WBC_REOPEN_EXEC		= 1,
+	WBC_REOPEN_READ		= 2,
+	WBC_REOPEN_MAX,
+};
+
+static enum wbc_reopen_slot wbc_reopen_slot(__u64 flags)
 {
-	struct ll_file_data *fd = file->private_data;
-	int rc;
+	if (flags & FMODE_WRITE)
+		return WBC_REOPEN_WRITE;
+	if (flags & FMODE_EXEC)
+		return WBC_REOPEN_EXEC;
+	return WBC_REOPEN_READ;
+}
 
-	rc = dcache_dir_open(inode, file);
-	fd->fd_wbc_file.wbcf_private_data = file->private_data;
-	file->private_data = fd;
-	return rc;
+static struct obd_client_handle **
+wbc_reopen_och_p(struct ll_inode_info *lli, enum wbc_reopen_slot slot)
+{
+	switch (slot) {
+	case WBC_REOPEN_WRITE:
+		return &lli->lli_mds_write_och;
+	case WBC_REOPEN_EXEC:
+		return &lli->lli_mds_exec_och;
+	default:
+		return &lli->lli_mds_read_och;
+	}
 }
 
-int wbcfs_dcache_dir_close(struct inode *inode, struct file *file)
+/*
+ * Convert the open flags of a local file in the same way as ll_file_open().
+ * The file exists on MDT and its data was flushed already, thus the creation
+ * and truncation flags must not be replayed.
+ */
+static __u64 wbc_reopen_flags(struct file *file)
 {
-	struct ll_file_data *fd = file->private_data;
+	__u64 flags = file->f_flags;
 
-	dput(fd->fd_wbc_file.wbcf_private_data);
-	return 0;
+	if ((flags + 1) & O_ACCMODE)
+		flags++;
+	if (file->f_flags & O_TRUNC)
+		flags |= FMODE_WRITE;
+	if (flags & (FMODE_WRITE | FMODE_READ))
+		flags |= MDS_OPEN_OWNEROVERRIDE;
+
+	return flags & ~(O_CREAT | O_EXCL | O_TRUNC);
 }
 
-void wbc_inode_lock_callback(struct inode *inode, struct ldlm_lock *lock,
-			     bool *cached)
+static int wbc_open_lockless_cb(struct req_capsule *pill,
+				struct md_op_item *item, int rc)
 {
-	struct wbc_inode *wbci = ll_i2wbci(inode);
-	struct writeback_control_ext wbcx = {
-		.sync_mode = WB_SYNC_ALL,
-		.nr_to_write = 0, /* metadata-only */
-		.for_callback = 1,
-	};
+	struct wbc_reopen_item *wri;
+	struct obd_client_handle *och;
+	struct mdt_body *body;
 
 	ENTRY;
 
-	*cached = wbc_inode_has_protected(wbci);
-	if (!*cached)
-		RETURN_EXIT;
+	wri = container_of(item, struct wbc_reopen_item, wri_item);
+	och = wri->wri_och;
+	if (rc)
+		GOTO(out, rc);
 
-	down_write(&wbci->wbci_rw_sem);
-	*cached = wbc_inode_has_protected(wbci);
-	if (!*cached) {
-		up_write(&wbci->wbci_rw_sem);
-		RETURN_EXIT;
+	body = req_capsule_server_get(pill, &RMF_MDT_BODY);
+	if (body == NULL)
+		GOTO(out, rc = -EPROTO);
+	if (body->mbo_valid & OBD_MD_MDS)
+		GOTO(out, rc = -EREMOTE);
+
+	och->och_open_handle = body->mbo_open_handle;
+	och->och_fid = body->mbo_fid1;
+	och->och_flags = item->mop_it.it_flags;
+	och->och_magic = OBD_CLIENT_HANDLE_MAGIC;
+out:
+	if (rc)
+		CDEBUG(D_CACHE, "Failed to reopen "DFID" in batch: rc = %d\n",
+		       PFID(ll_inode2fid(wri->wri_inode)), rc);
+	RETURN(rc);
+}
+
+static void wbc_reopen_item_free(struct wbc_reopen_item *wri)
+{
+	if (wri->wri_och)
+		OBD_FREE_PTR(wri->wri_och);
+	ll_unlock_md_op_lsm(&wri->wri_item.mop_data);
+	OBD_FREE_PTR(wri);
+}
+
+static struct wbc_reopen_item *
+wbc_reopen_item_alloc(struct inode *inode, __u64 flags)
+{
+	struct wbc_reopen_item *wri;
+	struct md_op_item *item;
+	struct md_op_data *op_data;
+
+	OBD_ALLOC_PTR(wri);
+	if (wri == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	OBD_ALLOC_PTR(wri->wri_och);
+	if (wri->wri_och == NULL) {
+		OBD_FREE_PTR(wri);
+		return ERR_PTR(-ENOMEM);
 	}
 
-	(void) wbc_make_inode_deroot(inode, lock, &wbcx);
-	up_write(&wbci->wbci_rw_sem);
-	RETURN_EXIT;
+	item = &wri->wri_item;
+	op_data = ll_prep_md_op_data(&item->mop_data, inode, inode, NULL, 0,
+				     0, LUSTRE_OPC_ANY, NULL);
+	if (IS_ERR(op_data)) {
+		OBD_FREE_PTR(wri->wri_och);
+		OBD_FREE_PTR(wri);
+		return (struct wbc_reopen_item *)op_data;
+	}
+
+	item->mop_it.it_op = IT_OPEN;
+	item->mop_it.it_flags = flags;
+	item->mop_it.it_create_mode = inode->i_mode;
+	item->mop_opc = MD_OP_OPEN_LOCKLESS;
+	item->mop_cb = wbc_open_lockless_cb;
+	item->mop_och = wri->wri_och;
+	wri->wri_inode = inode;
+	INIT_LIST_HEAD(&wri->wri_list);
+	return wri;
 }
 
 /*
- * TODO: Set cache policy for the root WBC directory according to
- * the predefined customized caching rules.
+ * Collect one reopen item for each open mode of the local files of @inode
+ * which does not have an MDS open handle yet.
  */
-void wbc_intent_inode_init(struct inode *dir, struct inode *inode,
-			   struct lookup_intent *it)
+static int wbc_reopen_prep_inode(struct inode *inode, struct list_head *head)
 {
-	struct wbc_inode *dwbci = ll_i2wbci(dir);
-	struct wbc_inode *wbci = ll_i2wbci(inode);
-
-	ENTRY;
+	struct ll_inode_info *lli = ll_i2info(inode);
+	__u64 flags[WBC_REOPEN_MAX] = { 0 };
+	bool used[WBC_REOPEN_MAX] = { false };
+	struct dentry *dentry;
+	int i;
 
-	LASSERT(it->it_op == IT_CREAT || it->it_op == IT_LOOKUP);
 	spin_lock(&inode->i_lock);
-	if (it->it_lock_mode == LCK_EX) {
-		struct wbc_super *super = ll_i2wbcs(dir);
-
-		LASSERT(!wbc_inode_has_protected(dwbci));
-		wbci->wbci_cache_mode = super->wbcs_conf.wbcc_cache_mode;
-		wbci->wbci_flush_mode = super->wbcs_conf.wbcc_flush_mode;
+	hlist_for_each_entry(dentry, &inode->i_dentry, d_alias) {
+		struct wbc_dentry *wbcd = ll_d2wbcd(dentry);
+		struct ll_file_data *fd;
+
+		spin_lock(&wbcd->wbcd_open_lock);
+		list_for_each_entry(fd, &wbcd->wbcd_open_files,
+				    fd_wbc_file.wbcf_open_item) {
+			__u64 fl = wbc_reopen_flags(fd->fd_file);
+
+			i = wbc_reopen_slot(fl);
+			if (!used[i]) {
+				used[i] = true;
+				flags[i] = fl;
+			}
+		}
+		spin_unlock(&wbcd->wbcd_open_lock);
+	}
+	spin_unlock(&inode->i_lock);
+
+	for (i = 0; i < WBC_REOPEN_MAX; i++) {
+		struct wbc_reopen_item *wri;
+		bool present;
+
+		if (!used[i])
+			continue;
+
+		mutex_lock(&lli->lli_och_mutex);
+		present = *wbc_reopen_och_p(lli, i) != NULL;
+		mutex_unlock(&lli->lli_och_mutex);
+		if (present)
+			continue;
+
+		wri = wbc_reopen_item_alloc(inode, flags[i]);
+		if (IS_ERR(wri))
+			return PTR_ERR(wri);
+
+		list_add_tail(&wri->wri_list, head);
+	}
+
+	return 0;
+}
+
+/* Install the fetched open handle, or close it if it is not needed. */
+static void wbc_reopen_item_fini(struct wbc_reopen_item *wri)
+{
+	struct inode *inode = wri->wri_inode;
+	struct ll_inode_info *lli = ll_i2info(inode);
+	struct obd_client_handle *och = wri->wri_och;
+	struct obd_client_handle **och_p;
+
+	if (och->och_magic != OBD_CLIENT_HANDLE_MAGIC)
+		return;
+
+	och_p = wbc_reopen_och_p(lli, wbc_reopen_slot(och->och_flags));
+	mutex_lock(&lli->lli_och_mutex);
+	if (*och_p == NULL) {
+		*och_p = och;
+		och = NULL;
+	}
+	mutex_unlock(&lli->lli_och_mutex);
+
+	/* The handle is freed by ll_close_inode_openhandle(). */
+	wri->wri_och = NULL;
+	if (och != NULL)
+		ll_close_inode_openhandle(inode, och, 0, NULL);
+}
+
+/*
+ * Fetch the MDS open handles for all local files of @inodes in batch RPCs,
+ * and install them into the inodes, thus the per file reopen on revocation
+ * of the root EX lock shares the handle and does not issue an open RPC.
+ * @inodes are usually gathered across the subtrees being flushed by
+ * wbcfs_reopen_collect().
+ *
+ * The batch RPC is kept for open replay while any of the fetched handles is
+ * open, see batch_set_open_replay_data(). On any failure, the files are
+ * reopened one by one as before.
+ */
+int wbcfs_reopen_prefetch(struct inode **inodes, unsigned int count)
+{
+	struct wbc_reopen_item *wri, *tmp;
+	struct inode *first = NULL;
+	struct obd_export *exp;
+	struct lu_batch *bh;
+	LIST_HEAD(head);
+	unsigned int i;
+	int rc = 0;
+	int rc2;
+
+	ENTRY;
+
+	for (i = 0; i < count; i++) {
+		if (inodes[i] == NULL)
+			continue;
+
+		/*
+		 * A hard linked file may be collected by several names, open
+		 * it once as the resent sub opens are matched by the file.
+		 */
+		if (inodes[i]->i_nlink > 1) {
+			bool dup = false;
+			unsigned int j;
+
+			for (j = 0; j < i && !dup; j++)
+				dup = inodes[j] == inodes[i];
+			if (dup)
+				continue;
+		}
+
+		if (first == NULL)
+			first = inodes[i];
+		rc = wbc_reopen_prep_inode(inodes[i], &head);
+		if (rc)
+			GOTO(out_free, rc);
+	}
+
+	if (list_empty(&head))
+		RETURN(0);
+
+	exp = ll_i2mdexp(first);
+	bh = md_batch_create(exp, BATCH_FL_SYNC,
+			     ll_i2wbcc(first)->wbcc_max_batch_count);
+	if (IS_ERR(bh))
+		GOTO(out_free, rc = PTR_ERR(bh));
+
+	list_for_each_entry(wri, &head, wri_list) {
+		rc = md_batch_add(exp, bh, &wri->wri_item);
+		if (rc)
+			break;
+	}
+
+	rc2 = md_batch_stop(exp, bh);
+	if (rc == 0)
+		rc = rc2;
+
+	list_for_each_entry(wri, &head, wri_list)
+		wbc_reopen_item_fini(wri);
+out_free:
+	list_for_each_entry_safe(wri, tmp, &head, wri_list) {
+		list_del(&wri->wri_list);
+		wbc_reopen_item_free(wri);
+	}
+
+	RETURN(rc);
+}
+
+/* Close the prefetched open handles which are not used by any file. */
+void wbcfs_reopen_release(struct inode *inode)
+{
+	struct ll_inode_info *lli = ll_i2info(inode);
+
+	if (lli->lli_mds_write_och && lli->lli_open_fd_write_count == 0)
+		ll_md_real_close(inode, FMODE_WRITE);
+	if (lli->lli_mds_exec_och && lli->lli_open_fd_exec_count == 0)
+		ll_md_real_close(inode, FMODE_EXEC);
+	if (lli->lli_mds_read_och && lli->lli_open_fd_read_count == 0)
+		ll_md_real_close(inode, FMODE_READ);
+}
+
+#define WBC_REOPEN_SET_INIT	32
+
+/* Add @inode into @set, the reference of @inode is taken over by @set. */
+static int wbc_reopen_set_add(struct wbc_reopen_set *set, struct inode *inode)
+{
+	if (set->wrs_count == set->wrs_size) {
+		unsigned int size = set->wrs_size ? set->wrs_size * 2 :
+						    WBC_REOPEN_SET_INIT;
+		struct inode **inodes;
+
+		OBD_ALLOC_PTR_ARRAY_LARGE(inodes, size);
+		if (inodes == NULL)
+			return -ENOMEM;
+
+		if (set->wrs_inodes) {
+			memcpy(inodes, set->wrs_inodes,
+			       set->wrs_count * sizeof(*inodes));
+			OBD_FREE_PTR_ARRAY_LARGE(set->wrs_inodes,
+						 set->wrs_size);
+		}
+		set->wrs_inodes = inodes;
+		set->wrs_size = size;
+	}
+
+	set->wrs_inodes[set->wrs_count++] = inode;
+	return 0;
+}
+
+/*
+ * Only the files already existing on MDT can be opened by FID. A directory
+ * is collected to walk into it, a regular file if it has local open files.
+ * Called with the parent d_lock held.
+ */
+static bool wbc_reopen_candidate(struct dentry *dchild, bool descend)
+{
+	struct wbc_dentry *wbcd;
+	struct inode *inode;
+	bool opened;
+
+	if (!simple_positive(dchild))
+		return false;
+
+	inode = dchild->d_inode;
+	if (!wbc_inode_was_flushed(ll_i2wbci(inode)))
+		return false;
+
+	if (S_ISDIR(inode->i_mode))
+		return descend;
+
+	if (!S_ISREG(inode->i_mode))
+		return false;
+
+	wbcd = ll_d2wbcd(dchild);
+	spin_lock(&wbcd->wbcd_open_lock);
+	opened = !list_empty(&wbcd->wbcd_open_files);
+	spin_unlock(&wbcd->wbcd_open_lock);
+
+	return opened;
+}
+
+static int wbc_reopen_collect_dir(struct inode *dir, bool descend,
+				  struct wbc_reopen_set *set)
+{
+	struct dentry *parent;
+	struct dentry *last = NULL;
+	struct list_head *p;
+	int rc = 0;
+
+	parent = d_find_alias(dir);
+	if (parent == NULL)
+		return 0;
+
+	spin_lock(&parent->d_lock);
+	p = &parent->d_subdirs;
+	while ((p = p->next) != &parent->d_subdirs) {
+		struct dentry *dchild = list_entry(p, struct dentry, d_child);
+		struct inode *inode;
+
+		if (!wbc_reopen_candidate(dchild, descend))
+			continue;
+
+		spin_lock_nested(&dchild->d_lock, DENTRY_D_LOCK_NESTED);
+		dget_dlock(dchild);
+		spin_unlock(&dchild->d_lock);
+		spin_unlock(&parent->d_lock);
+
+		dput(last);
+		last = dchild;
+		inode = igrab(dchild->d_inode);
+		if (inode != NULL) {
+			rc = wbc_reopen_set_add(set, inode);
+			if (rc) {
+				iput(inode);
+				GOTO(out_dput, rc);
+			}
+		}
+
+		spin_lock(&parent->d_lock);
+		p = &dchild->d_child;
+	}
+	spin_unlock(&parent->d_lock);
+
+out_dput:
+	dput(last);
+	dput(parent);
+	return rc;
+}
+
+/*
+ * Collect @root and the inodes in the subtree of @root down to @depth levels
+ * (-1 for the whole subtree) whose local files will be reopened when the
+ * subtree is flushed, thus their open handles can be fetched in one batch
+ * by wbcfs_reopen_prefetch() before the flush.
+ */
+int wbcfs_reopen_collect(struct inode *root, int depth,
+			 struct wbc_reopen_set *set)
+{
+	unsigned int next = set->wrs_count;
+	unsigned int level_end;
+	struct inode *inode;
+	int rc;
+
+	inode = igrab(root);
+	if (inode == NULL)
+		return 0;
+
+	rc = wbc_reopen_set_add(set, inode);
+	if (rc) {
+		iput(inode);
+		return rc;
+	}
+
+	/* Walk the subtree level by level, @set is used as the queue. */
+	level_end = set->wrs_count;
+	for (; next < set->wrs_count && depth != 0; next++) {
+		inode = set->wrs_inodes[next];
+		if (S_ISDIR(inode->i_mode)) {
+			rc = wbc_reopen_collect_dir(inode, depth != 1, set);
+			if (rc)
+				return rc;
+		}
+
+		if (next + 1 == level_end) {
+			level_end = set->wrs_count;
+			if (depth > 0)
+				depth--;
+		}
+	}
+
+	return 0;
+}
+
+/* Close the unused prefetched handles and put the inodes of @set. */
+void wbcfs_reopen_set_fini(struct wbc_reopen_set *set)
+{
+	unsigned int i;
+
+	for (i = 0; i < set->wrs_count; i++) {
+		wbcfs_reopen_release(set->wrs_inodes[i]);
+		iput(set->wrs_inodes[i]);
+	}
+
+	if (set->wrs_inodes)
+		OBD_FREE_PTR_ARRAY_LARGE(set->wrs_inodes, set->wrs_size);
+	set->wrs_inodes = NULL;
+	set->wrs_count = 0;
+	set->wrs_size = 0;
+}
+
+int wbcfs_dcache_dir_open(struct inode *inode, struct file *file)
+{
+	struct ll_file_data *fd = file->private_data;
+	int rc;
+
+	/* The hashed index is built at the first readdir() call. */
+	if (wbc_readdir_pol_hashed(fd->fd_wbc_file.wbcf_readdir_pol)) {
+		fd->fd_wbc_file.wbcf_private_data = NULL;
+		return 0;
+	}
+
+	rc = dcache_dir_open(inode, file);
+	fd->fd_wbc_file.wbcf_private_data = file->private_data;
+	file->private_data = fd;
+	return rc;
+}
+
+int wbcfs_dcache_dir_close(struct inode *inode, struct file *file)
+{
+	struct ll_file_data *fd = file->private_data;
+
+	if (wbc_readdir_pol_hashed(fd->fd_wbc_file.wbcf_readdir_pol))
+		wbc_hindex_free(fd->fd_wbc_file.wbcf_private_data);
+	else
+		dput(fd->fd_wbc_file.wbcf_private_data);
+	fd->fd_wbc_file.wbcf_private_data = NULL;
+	return 0;
+}
+
+void wbc_inode_lock_callback(struct inode *inode, struct ldlm_lock *lock,
+			     bool *cached)
+{
+	struct wbc_inode *wbci = ll_i2wbci(inode);
+	struct memfs_writeback *mwb = ll_i2mwb(inode);
+	struct writeback_control_ext wbcx = {
+		.sync_mode = WB_SYNC_ALL,
+		.nr_to_write = 0, /* metadata-only */
+		.for_callback = 1,
+	};
+	struct wbc_super *super = ll_i2wbcs(inode);
+	struct wbc_reopen_set set = { 0 };
+	ktime_t start = ktime_get();
+	s64 written;
+	s64 elapsed;
+
+	ENTRY;
+
+	*cached = wbc_inode_has_protected(wbci);
+	if (!*cached)
+		RETURN_EXIT;
+
+	/*
+	 * The children of the root are flushed on revocation, fetch the open
+	 * handles of their local files in one batch RPC before the flush.
+	 */
+	if (wbcfs_reopen_collect(inode, 1, &set) == 0)
+		(void) wbcfs_reopen_prefetch(set.wrs_inodes, set.wrs_count);
+
+	down_write(&wbci->wbci_rw_sem);
+	*cached = wbc_inode_has_protected(wbci);
+	if (!*cached) {
+		up_write(&wbci->wbci_rw_sem);
+		wbcfs_reopen_set_fini(&set);
+		RETURN_EXIT;
+	}
+
+	written = wbc_stat_sum(mwb, WB_INODE_WRITTEN);
+	(void) wbc_make_inode_deroot(inode, lock, &wbcx);
+	up_write(&wbci->wbci_rw_sem);
+	wbcfs_reopen_set_fini(&set);
+	elapsed = ktime_us_delta(ktime_get(), start);
+	wbc_rc_sample(super, wbc_stat_sum(mwb, WB_INODE_WRITTEN) - written,
+		      elapsed, true);
+	wbc_stats_add(super, WBC_STATS_REVOKE, elapsed);
+	lprocfs_oh_tally_log2(&super->wbcs_stats.ws_revoke_latency,
+			      elapsed / USEC_PER_MSEC);
+	RETURN_EXIT;
+}
+
+/*
+ * Set @inode as a root WBC directory protected by the EX lock @handle, with
+ * the state of Protected(P) | Sync(S) | Root(R). @spec is the cache
+ * specification of the matched rule, if any, with the global configuration
+ * as fallback. Called with @inode->i_lock held.
+ */
+static void wbc_inode_root_init(struct inode *inode,
+				struct wbc_cache_spec *spec, __u64 handle)
+{
+	struct wbc_conf *conf = &ll_i2wbcs(inode)->wbcs_conf;
+	struct wbc_inode *wbci = ll_i2wbci(inode);
+
+	wbci->wbci_cache_mode = conf->wbcc_cache_mode;
+	wbci->wbci_flush_mode = conf->wbcc_flush_mode;
+	if (spec && spec->wcs_cache_mode != WBC_MODE_NONE)
+		wbci->wbci_cache_mode = spec->wcs_cache_mode;
+	if (spec && spec->wcs_flush_mode != WBC_FLUSH_NONE)
+		wbci->wbci_flush_mode = spec->wcs_flush_mode;
+	if (spec && spec->wcs_rmpol != WBC_RMPOL_NONE &&
+	    S_ISDIR(inode->i_mode))
+		wbci->wbci_rmpol = spec->wcs_rmpol;
+	wbci->wbci_flags = WBC_STATE_FL_ROOT | WBC_STATE_FL_PROTECTED |
+			   WBC_STATE_FL_SYNC;
+	wbc_super_root_add(inode);
+	wbci->wbci_lock_handle.cookie = handle;
+}
+
+/*
+ * Initialize the WBC state of the newly created @inode under @dir.
+ * For a root WBC directory, @spec is the cache specification of the matched
+ * rule, if any, with the global configuration as fallback.
+ */
+void wbc_intent_inode_init(struct inode *dir, struct inode *inode,
+			   struct lookup_intent *it,
+			   struct wbc_cache_spec *spec)
+{
+	struct wbc_inode *dwbci = ll_i2wbci(dir);
+	struct wbc_inode *wbci = ll_i2wbci(inode);
+
+	ENTRY;
+
+	LASSERT(it->it_op == IT_CREAT || it->it_op == IT_LOOKUP);
+	if (it->it_lock_mode == LCK_EX)
+		wbc_quota_root_init(inode, spec);
+	else
+		wbci->wbci_quota = wbc_quota_get(dwbci->wbci_quota);
+
+	spin_lock(&inode->i_lock);
+	if (it->it_lock_mode == LCK_EX) {
+		LASSERT(!wbc_inode_has_protected(dwbci));
 		/*
 		 * Set this newly created WBC directory with the state of
 		 * Protected(P) | Sync(S) | Root(R) | Complete(C).
 		 */
-		wbci->wbci_flags = WBC_STATE_FL_ROOT | WBC_STATE_FL_PROTECTED |
-				   WBC_STATE_FL_SYNC | WBC_STATE_FL_COMPLETE;
-		wbc_super_root_add(inode);
-		wbci->wbci_lock_handle.cookie = it->it_lock_handle;
+		wbc_inode_root_init(inode, spec, it->it_lock_handle);
+		wbci->wbci_flags |= WBC_STATE_FL_COMPLETE;
 	} else {
 		LASSERT(it->it_lock_mode == 0 &&
 			wbc_inode_has_protected(dwbci));
 		wbci->wbci_cache_mode = dwbci->wbci_cache_mode;
 		wbci->wbci_flush_mode = dwbci->wbci_flush_mode;
+		if (S_ISDIR(inode->i_mode))
+			wbci->wbci_rmpol = dwbci->wbci_rmpol;
 		wbci->wbci_flags = WBC_STATE_FL_PROTECTED | WBC_STATE_FL_SYNC;
 	}
 
@@ -1938,22 +3256,21 @@ void wbc_intent_inode_init(struct inode *dir, struct inode *inode,
 }
 
 /*
- * TODO: Customizable rule based auto WBC.
- * Define various auto caching rule for WBC on a client similar to TBF or PCC.
- * When a newly creating directory meets the rule condition, it can try to
- * obtain EX WBC lock from MDS and keep exclusive access on the directory
- * under the protection of the EX lock on the client.
- * The rule can be combination of uid/gid/projid/fname or jobid.
- * Moerover, it would better to return the customized WBC cache specification
- * here to set the cache mode and flush mode for the newly created directory.
+ * Check whether the directory @dentry being created under @dir can obtain
+ * the EX WBC lock from MDS and be cached exclusively on the client.
+ * Under a directory not cached yet, the directory becomes a root WBC
+ * directory only if it meets the auto caching rules (see wbc_rule.c), and
+ * @spec returns the cache specification of the matched rule.
  */
 bool wbc_may_exclusive_cache(struct inode *dir, struct dentry *dentry,
-			     umode_t mode, __u64 *extra_lock_flags)
+			     umode_t mode, __u64 *extra_lock_flags,
+			     struct wbc_cache_spec *spec)
 {
-	struct wbc_conf *conf = &ll_i2wbcs(dir)->wbcs_conf;
+	struct wbc_super *super = ll_i2wbcs(dir);
 	struct wbc_inode *wbci = ll_i2wbci(dir);
 
-	if (conf->wbcc_cache_mode == WBC_MODE_NONE) {
+	memset(spec, 0, sizeof(*spec));
+	if (super->wbcs_conf.wbcc_cache_mode == WBC_MODE_NONE) {
 		*extra_lock_flags = 0;
 		return false;
 	}
@@ -1963,6 +3280,10 @@ bool wbc_may_exclusive_cache(struct inode *dir, struct dentry *dentry,
 		*extra_lock_flags = LDLM_FL_INTENT_PARENT_LOCKED;
 	} else {
 		LASSERT(wbc_inode_none(wbci));
+		if (!wbc_rule_match(super, dir, dentry, spec)) {
+			*extra_lock_flags = 0;
+			return false;
+		}
 		*extra_lock_flags = LDLM_FL_INTENT_EXLOCK_UPDATE;
 	}
 
@@ -1979,9 +3300,12 @@ int ll_new_inode_init(struct inode *dir, struct dentry *dchild,
 		struct wbc_inode *wbci = ll_i2wbci(inode);
 
 		LASSERT(!wbc_inode_complete(dwbci));
+		wbci->wbci_quota = wbc_quota_get(dwbci->wbci_quota);
 		spin_lock(&inode->i_lock);
 		wbci->wbci_cache_mode = dwbci->wbci_cache_mode;
 		wbci->wbci_flush_mode = dwbci->wbci_flush_mode;
+		if (S_ISDIR(inode->i_mode))
+			wbci->wbci_rmpol = dwbci->wbci_rmpol;
 		wbci->wbci_flags = WBC_STATE_FL_PROTECTED | WBC_STATE_FL_SYNC;
 		spin_unlock(&inode->i_lock);
 		wbc_inode_operations_set(inode, inode->i_mode, inode->i_rdev);
@@ -2006,13 +3330,594 @@ void ll_intent_inode_init(struct inode *dir, struct inode *inode,
 			  struct lookup_intent *it)
 {
 	if (wbc_inode_has_protected(ll_i2wbci(dir)))
-		wbc_intent_inode_init(dir, inode, it);
+		wbc_intent_inode_init(dir, inode, it, NULL);
+}
+
+/* Seconds to wait before prefetching a directory found too large again. */
+#define WBC_PREFETCH_RETRY_INTERVAL	300
+
+/* An entry of the directory being prefetched into MemFS. */
+struct wbc_prefetch_entry {
+	struct list_head	 wpe_list;
+	struct lu_fid		 wpe_fid;
+	/* Inode fetched from MDT, referenced until it is instantiated. */
+	struct inode		*wpe_inode;
+	int			 wpe_rc;
+	__u16			 wpe_namelen;
+	char			 wpe_name[0];
+};
+
+#define WBC_PREFETCH_ENTRY_SIZE(len)	\
+	offsetof(struct wbc_prefetch_entry, wpe_name[(len) + 1])
+
+struct wbc_prefetch_lock {
+	struct wbc_sync_io	wpl_anchor;
+	struct lustre_handle	wpl_lockh;
+};
+
+static int wbc_prefetch_exlock_cb(struct req_capsule *pill,
+				  struct md_op_item *item, int rc)
+{
+	struct wbc_prefetch_lock *wpl = item->mop_cbdata;
+	struct lookup_intent *it = &item->mop_it;
+
+	ENTRY;
+
+	if (rc == 0 && it->it_lock_mode != LCK_EX)
+		rc = -EPROTO;
+
+	/* Keep the reference of the EX lock for the prefetch. */
+	if (rc == 0) {
+		wpl->wpl_lockh.cookie = it->it_lock_handle;
+		it->it_lock_mode = 0;
+	}
+
+	ll_intent_release(it);
+	ll_unlock_md_op_lsm(&item->mop_data);
+	OBD_FREE_PTR(item);
+	wbc_sync_io_note(&wpl->wpl_anchor, rc);
+
+	RETURN(rc);
+}
+
+/*
+ * Acquire the EX lock on the existing directory @dir, which is not under
+ * the protection of any root WBC directory, and return it referenced in
+ * @lockh.
+ */
+static int wbc_prefetch_exlock(struct inode *dir, struct lustre_handle *lockh)
+{
+	struct wbc_prefetch_lock wpl;
+	struct md_op_data *op_data;
+	struct md_op_item *item;
+	int rc;
+
+	ENTRY;
+
+	OBD_ALLOC_PTR(item);
+	if (item == NULL)
+		RETURN(-ENOMEM);
+
+	op_data = ll_prep_md_op_data(&item->mop_data, dir, NULL, NULL, 0, 0,
+				     LUSTRE_OPC_ANY, NULL);
+	if (IS_ERR(op_data)) {
+		OBD_FREE_PTR(item);
+		RETURN(PTR_ERR(op_data));
+	}
+
+	wbc_prep_exlock_common(item, IT_WBC_EXLOCK);
+	/* No EX lock of the parent to send along. */
+	item->mop_lock_flags = LDLM_FL_INTENT_EXLOCK_UPDATE;
+	item->mop_opc = MD_OP_EXLOCK_ONLY;
+	item->mop_cb = wbc_prefetch_exlock_cb;
+	item->mop_cbdata = &wpl;
+	item->mop_einfo.ei_mode = LCK_EX;
+
+	wpl.wpl_lockh.cookie = 0;
+	wbc_sync_io_init(&wpl.wpl_anchor, 1);
+	rc = md_intent_lock_async(ll_i2mdexp(dir), item, NULL);
+	if (rc) {
+		ll_unlock_md_op_lsm(&item->mop_data);
+		OBD_FREE_PTR(item);
+		RETURN(rc);
+	}
+
+	rc = wbc_sync_io_wait(&wpl.wpl_anchor, 0);
+	if (rc == 0)
+		*lockh = wpl.wpl_lockh;
+
+	RETURN(rc);
+}
+
+static void wbc_prefetch_entries_free(struct list_head *head)
+{
+	struct wbc_prefetch_entry *wpe, *tmp;
+
+	list_for_each_entry_safe(wpe, tmp, head, wpe_list) {
+		list_del(&wpe->wpe_list);
+		if (wpe->wpe_inode != NULL)
+			iput(wpe->wpe_inode);
+		OBD_FREE(wpe, WBC_PREFETCH_ENTRY_SIZE(wpe->wpe_namelen));
+	}
+}
+
+/*
+ * Read the entries of @dir from MDT under the EX lock into @head.
+ * Return the number of the entries, or -E2BIG if there are more than @max.
+ * If @head is NULL, the entries are only counted with the pages read under
+ * the normal lock of @dir, to check the size before taking the EX lock.
+ */
+static int wbc_prefetch_readdir(struct inode *dir, struct list_head *head,
+				unsigned int max)
+{
+	struct md_op_data *op_data;
+	unsigned int count = 0;
+	struct page *page;
+	__u64 next = 0;
+	int rc = 0;
+
+	ENTRY;
+
+	op_data = ll_prep_md_op_data(NULL, dir, dir, NULL, 0, 0,
+				     LUSTRE_OPC_ANY, dir);
+	if (IS_ERR(op_data))
+		RETURN(PTR_ERR(op_data));
+
+	if (head != NULL)
+		op_data->op_bias |= MDS_WBC_LOCKLESS;
+	while (rc == 0) {
+		struct lu_dirpage *dp;
+		struct lu_dirent *ent;
+
+		page = ll_get_dir_page(dir, op_data, next);
+		if (IS_ERR(page)) {
+			rc = PTR_ERR(page);
+			break;
+		}
+
+		dp = page_address(page);
+		for (ent = lu_dirent_start(dp); ent != NULL && rc == 0;
+		     ent = lu_dirent_next(ent)) {
+			int namelen = le16_to_cpu(ent->lde_namelen);
+			struct wbc_prefetch_entry *wpe;
+
+			/* Skip the dummy record, "." and "..". */
+			if (namelen == 0 ||
+			    (namelen == 1 && ent->lde_name[0] == '.') ||
+			    (namelen == 2 && ent->lde_name[0] == '.' &&
+			     ent->lde_name[1] == '.'))
+				continue;
+
+			if (++count > max) {
+				rc = -E2BIG;
+				break;
+			}
+
+			if (head == NULL)
+				continue;
+
+			OBD_ALLOC(wpe, WBC_PREFETCH_ENTRY_SIZE(namelen));
+			if (wpe == NULL) {
+				rc = -ENOMEM;
+				break;
+			}
+
+			fid_le_to_cpu(&wpe->wpe_fid, &ent->lde_fid);
+			memcpy(wpe->wpe_name, ent->lde_name, namelen);
+			wpe->wpe_namelen = namelen;
+			list_add_tail(&wpe->wpe_list, head);
+		}
+
+		next = le64_to_cpu(dp->ldp_hash_end);
+		ll_release_page(dir, page, rc == 0 &&
+				next != MDS_DIR_END_OFF &&
+				le32_to_cpu(dp->ldp_flags) & LDF_COLLIDE);
+		if (next == MDS_DIR_END_OFF)
+			break;
+	}
+
+	ll_finish_md_op_data(op_data);
+	/* The entries are cached in MemFS, drop the stale pages. */
+	if (head != NULL)
+		truncate_inode_pages(dir->i_mapping, 0);
+	RETURN(rc < 0 ? rc : count);
+}
+
+/*
+ * Callback for the batched getattr of an entry of the directory being
+ * prefetched, called in ptlrpcd context.
+ */
+static int wbc_prefetch_getattr_cb(struct req_capsule *pill,
+				   struct md_op_item *item, int rc)
+{
+	struct wbc_prefetch_entry *wpe = item->mop_cbdata;
+	struct lookup_intent *it = &item->mop_it;
+	struct inode *dir = item->mop_dir;
+	struct inode *child = NULL;
+	struct mdt_body *body;
+
+	ENTRY;
+
+	if (rc == 0 && it_disposition(it, DISP_LOOKUP_NEG))
+		rc = -ENOENT;
+	if (rc)
+		GOTO(out, rc);
+
+	body = req_capsule_server_get(pill, &RMF_MDT_BODY);
+	if (body == NULL)
+		GOTO(out, rc = -EFAULT);
+
+	if (!lu_fid_eq(&wpe->wpe_fid, &body->mbo_fid1))
+		GOTO(out, rc = -EAGAIN);
+
+	rc = ll_prep_inode(&child, pill, dir->i_sb, it);
+	if (rc == 0)
+		wpe->wpe_inode = child;
+out:
+	wpe->wpe_rc = rc;
+	ll_intent_release(it);
+	ll_unlock_md_op_lsm(&item->mop_data);
+	OBD_FREE_PTR(item);
+
+	RETURN(rc);
+}
+
+static struct md_op_item *
+wbc_prep_prefetch_getattr(struct inode *dir, struct wbc_prefetch_entry *wpe)
+{
+	struct ldlm_enqueue_info *einfo;
+	struct md_op_data *op_data;
+	struct md_op_item *item;
+
+	OBD_ALLOC_PTR(item);
+	if (item == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	op_data = ll_prep_md_op_data(&item->mop_data, dir, NULL,
+				     wpe->wpe_name, wpe->wpe_namelen, 0,
+				     LUSTRE_OPC_ANY, NULL);
+	if (IS_ERR(op_data)) {
+		OBD_FREE_PTR(item);
+		return (struct md_op_item *)op_data;
+	}
+
+	op_data->op_fid2 = wpe->wpe_fid;
+	item->mop_opc = MD_OP_GETATTR;
+	item->mop_it.it_op = IT_GETATTR;
+	item->mop_dir = dir;
+	item->mop_cb = wbc_prefetch_getattr_cb;
+	item->mop_cbdata = wpe;
+	/* The children are protected by the EX lock of @dir. */
+	item->mop_lock_flags = LDLM_FL_INTENT_PARENT_LOCKED;
+
+	einfo = &item->mop_einfo;
+	einfo->ei_type = LDLM_IBITS;
+	einfo->ei_mode = it_to_lock_mode(&item->mop_it);
+	einfo->ei_cb_bl = ll_md_blocking_ast;
+	einfo->ei_cb_cp = ldlm_completion_ast;
+	einfo->ei_cb_gl = NULL;
+	einfo->ei_cbdata = NULL;
+
+	return item;
+}
+
+/* Fetch the attributes of the entries in @head from MDT in batch RPCs. */
+static int wbc_prefetch_getattr(struct inode *dir, struct list_head *head)
+{
+	struct obd_export *exp = ll_i2mdexp(dir);
+	struct wbc_prefetch_entry *wpe;
+	struct lu_batch *bh;
+	int rc = 0;
+	int rc2;
+
+	ENTRY;
+
+	bh = md_batch_create(exp, BATCH_FL_RDONLY | BATCH_FL_SYNC,
+			     ll_i2wbcc(dir)->wbcc_max_batch_count);
+	if (IS_ERR(bh))
+		RETURN(PTR_ERR(bh));
+
+	list_for_each_entry(wpe, head, wpe_list) {
+		struct md_op_item *item;
+
+		item = wbc_prep_prefetch_getattr(dir, wpe);
+		if (IS_ERR(item))
+			GOTO(out_stop, rc = PTR_ERR(item));
+
+		rc = md_batch_add(exp, bh, item);
+		if (rc) {
+			ll_unlock_md_op_lsm(&item->mop_data);
+			OBD_FREE_PTR(item);
+			wpe->wpe_rc = rc;
+			/* A remote child is left to be looked up on MDT. */
+			if (rc != -EREMOTE)
+				GOTO(out_stop, rc);
+			rc = 0;
+		}
+	}
+
+out_stop:
+	rc2 = md_batch_stop(exp, bh);
+	if (rc == 0)
+		rc = rc2;
+
+	RETURN(rc);
+}
+
+/*
+ * Instantiate the entry @wpe fetched from MDT under the directory @parent
+ * prefetched into MemFS.
+ */
+static int wbc_prefetch_instantiate(struct inode *dir, struct dentry *parent,
+				    struct wbc_prefetch_entry *wpe)
+{
+	struct inode *inode = wpe->wpe_inode;
+	struct qstr name = QSTR_INIT(wpe->wpe_name, wpe->wpe_namelen);
+	struct wbc_inode *wbci;
+	struct dentry *dchild;
+	int rc;
+
+	if (inode == NULL)
+		return wpe->wpe_rc ? wpe->wpe_rc : -ENOENT;
+
+	wpe->wpe_inode = NULL;
+	wbci = ll_i2wbci(inode);
+	/*
+	 * An inode in use with another name or still in a WBC tree, and the
+	 * symlink without the cached target are looked up on MDT as usual.
+	 */
+	if (atomic_read(&inode->i_count) > 1 || !wbc_inode_none(wbci) ||
+	    S_ISLNK(inode->i_mode))
+		GOTO(out_iput, rc = -EBUSY);
+
+	dchild = d_hash_and_lookup(parent, &name);
+	if (dchild != NULL) {
+		if (!IS_ERR(dchild))
+			dput(dchild);
+		GOTO(out_iput, rc = -EEXIST);
+	}
+
+	dchild = d_alloc_name(parent, wpe->wpe_name);
+	if (dchild == NULL)
+		GOTO(out_iput, rc = -ENOMEM);
+
+	/* Drop the quota of the WBC tree the inode was derooted from. */
+	wbc_quota_put(ll_i2wbcs(inode), wbci->wbci_quota);
+	wbci->wbci_quota = NULL;
+	rc = ll_new_inode_init(dir, dchild, inode);
+	if (rc) {
+		dput(dchild);
+		GOTO(out_iput, rc);
+	}
+
+	/* The inode reference is held by @dchild now. */
+	rc = memfs_prefetch_add(dir, dchild);
+	dput(dchild);
+	return rc;
+
+out_iput:
+	iput(inode);
+	return rc;
+}
+
+static bool wbc_dentry_has_positive_child(struct dentry *dentry)
+{
+	struct dentry *dchild;
+	bool found = false;
+
+	spin_lock(&dentry->d_lock);
+	list_for_each_entry(dchild, &dentry->d_subdirs, d_child) {
+		if (dchild->d_inode != NULL && !d_unhashed(dchild)) {
+			found = true;
+			break;
+		}
+	}
+	spin_unlock(&dentry->d_lock);
+
+	return found;
+}
+
+/**
+ * Prefetch the existing directory @dentry looked up under @parent into
+ * MemFS, so that it becomes a complete root WBC directory as if it had
+ * been created on this client, and the following accesses to its entries
+ * are served from MemFS without any RPC.
+ *
+ * Only a plain directory with at most wbcc_prefetch_max_entries entries,
+ * which meets the auto caching rules, is prefetched. The client acquires
+ * the EX lock on the directory, reads its entries and fetches the
+ * attributes of all children in batch RPCs, then instantiates the children
+ * in the dcache as the files created in MemFS. If any child can not be
+ * cached, e.g. it is on another MDT or the cache limits are reached, the
+ * directory is left as an incomplete root, where the missing entries are
+ * looked up on MDT as usual.
+ * Only one level is prefetched, the subdirectories are not complete.
+ * The entries are counted under the normal lock before taking the EX lock,
+ * and a directory found too large is not tried again for a while, so that
+ * the lookups under a large flat directory do not revoke it over and over.
+ */
+void ll_dir_prefetch(struct inode *parent, struct dentry *dentry)
+{
+	struct lookup_intent it = { .it_op = IT_WBC_EXLOCK };
+	struct inode *dir = dentry->d_inode;
+	struct lustre_handle lockh = { 0 };
+	struct wbc_prefetch_entry *wpe;
+	struct wbc_cache_spec spec;
+	struct wbc_super *super;
+	struct wbc_inode *wbci;
+	unsigned int cached = 0;
+	unsigned int count;
+	unsigned int max;
+	LIST_HEAD(head);
+	int rc;
+
+	ENTRY;
+
+	if (dir == NULL || !S_ISDIR(dir->i_mode))
+		RETURN_EXIT;
+
+	super = ll_i2wbcs(dir);
+	max = READ_ONCE(super->wbcs_conf.wbcc_prefetch_max_entries);
+	if (super->wbcs_conf.wbcc_cache_mode == WBC_MODE_NONE || max == 0)
+		RETURN_EXIT;
+
+	wbci = ll_i2wbci(dir);
+	if (wbc_inode_has_protected(ll_i2wbci(parent)) ||
+	    !wbc_inode_none(wbci) || ll_dir_striped(dir) ||
+	    dir->i_nlink < 2 || dir->i_nlink - 2 > max)
+		RETURN_EXIT;
+
+	if (ktime_get_seconds() < READ_ONCE(wbci->wbci_prefetch_retry))
+		RETURN_EXIT;
+
+	if (!wbc_rule_match(super, parent, dentry, &spec))
+		RETURN_EXIT;
+
+	inode_lock(dir);
+	if (!wbc_inode_none(wbci))
+		GOTO(out_unlock, rc = 0);
+
+	/* The children in the dcache are not in the WBC state. */
+	shrink_dcache_parent(dentry);
+	if (wbc_dentry_has_positive_child(dentry))
+		GOTO(out_unlock, rc = -EBUSY);
+
+	rc = wbc_prefetch_readdir(dir, NULL, max);
+	if (rc < 0)
+		GOTO(out_unlock, rc);
+
+	rc = wbc_prefetch_exlock(dir, &lockh);
+	if (rc)
+		GOTO(out_unlock, rc);
+
+	rc = wbc_prefetch_readdir(dir, &head, max);
+	if (rc < 0)
+		GOTO(out_unlock, rc);
+
+	count = rc;
+	rc = wbc_prefetch_getattr(dir, &head);
+	if (rc)
+		GOTO(out_unlock, rc);
+
+	wbc_quota_put(super, wbci->wbci_quota);
+	wbci->wbci_quota = NULL;
+	wbc_quota_root_init(dir, &spec);
+	spin_lock(&dir->i_lock);
+	wbc_inode_root_init(dir, &spec, lockh.cookie);
+	spin_unlock(&dir->i_lock);
+
+	it.it_lock_mode = LCK_EX;
+	it.it_lock_handle = lockh.cookie;
+	ll_set_lock_data(ll_i2mdexp(dir), dir, &it, NULL);
+	wbc_inode_operations_set(dir, dir->i_mode, dir->i_rdev);
+	memfs_prefetch_init(dir, dentry);
+
+	list_for_each_entry(wpe, &head, wpe_list) {
+		rc = wbc_prefetch_instantiate(dir, dentry, wpe);
+		if (rc == 0)
+			cached++;
+		else if (rc == -ENOSPC)
+			break;
+	}
+
+	rc = 0;
+	if (cached == count) {
+		spin_lock(&dir->i_lock);
+		wbci->wbci_flags |= WBC_STATE_FL_COMPLETE;
+		spin_unlock(&dir->i_lock);
+		wbc_stats_add(super, WBC_STATS_PREFETCH, 1);
+	}
+
+	CDEBUG(D_CACHE, "Prefetched %pd with %u/%u entries into MemFS\n",
+	       dentry, cached, count);
+out_unlock:
+	if (rc == -E2BIG)
+		WRITE_ONCE(wbci->wbci_prefetch_retry,
+			   ktime_get_seconds() + WBC_PREFETCH_RETRY_INTERVAL);
+	inode_unlock(dir);
+	/*
+	 * Drop the lock reference after @dir is unlocked, as the revocation
+	 * of the root may already be pending on it.
+	 */
+	if (lockh.cookie != 0) {
+		if (rc)
+			ldlm_lock_decref_and_cancel(&lockh, LCK_EX);
+		else
+			ldlm_lock_decref(&lockh, LCK_EX);
+	}
+
+	wbc_prefetch_entries_free(&head);
+	wbc_cache_spec_fini(super, &spec);
+	RETURN_EXIT;
+}
+
+static void wbc_fc_seq_show(struct seq_file *m, struct wbc_flow_ctrl *fc)
+{
+	__u32 count, rpcs, inflight, repsize;
+	__u64 latency, rate, nr_inc, nr_dec;
+
+	spin_lock(&fc->wfc_lock);
+	count = fc->wfc_batch_count;
+	rpcs = fc->wfc_max_rpcs;
+	inflight = fc->wfc_inflight;
+	repsize = fc->wfc_repsize;
+	latency = fc->wfc_latency;
+	rate = fc->wfc_rate;
+	nr_inc = fc->wfc_nr_increase;
+	nr_dec = fc->wfc_nr_decrease;
+	spin_unlock(&fc->wfc_lock);
+
+	seq_printf(m, "%-25s %u\n", "fc_batch_count", count);
+	seq_printf(m, "%-25s %u\n", "fc_max_rpcs", rpcs);
+	seq_printf(m, "%-25s %u\n", "fc_inflight", inflight);
+	seq_printf(m, "%-25s %llu\n", "fc_latency_us", latency);
+	seq_printf(m, "%-25s %u\n", "fc_repsize", repsize);
+	seq_printf(m, "%-25s %llu\n", "fc_ops_per_sec", rate);
+	seq_printf(m, "%-25s %llu\n", "fc_increases", nr_inc);
+	seq_printf(m, "%-25s %llu\n", "fc_decreases", nr_dec);
+}
+
+static void wbc_rc_seq_show(struct seq_file *m, struct super_block *sb)
+{
+	struct wbc_revoke_ctrl *rc = &ll_s2wbcs(sb)->wbcs_rc;
+	__u64 rate, last, max, total, count;
+	unsigned long budget;
+	s64 dirty;
+
+	spin_lock(&rc->wrc_lock);
+	rate = rc->wrc_rate;
+	budget = rc->wrc_dirty_budget;
+	last = rc->wrc_revoke_last;
+	max = rc->wrc_revoke_max;
+	total = rc->wrc_revoke_total;
+	count = rc->wrc_revoke_count;
+	spin_unlock(&rc->wrc_lock);
+
+	dirty = wbc_stat_sum(ll_s2mwb(sb), WB_INODE_DIRTY);
+	seq_printf(m, "%-25s %llu\n", "flush_inodes_per_sec", rate);
+	seq_printf(m, "%-25s %lu\n", "dirty_budget", budget);
+	seq_printf(m, "%-25s %llu\n", "revoke_predicted_ms",
+		   div64_u64(dirty * MSEC_PER_SEC, rate ?: WBC_RC_INIT_RATE));
+	seq_printf(m, "%-25s %llu\n", "revoke_count", count);
+	seq_printf(m, "%-25s %llu\n", "revoke_last_ms",
+		   div_u64(last, USEC_PER_MSEC));
+	seq_printf(m, "%-25s %llu\n", "revoke_max_ms",
+		   div_u64(max, USEC_PER_MSEC));
+	seq_printf(m, "%-25s %llu\n", "revoke_avg_ms",
+		   count ? div64_u64(total, count * USEC_PER_MSEC) : 0);
 }
 
 static int wbc_conf_seq_show(struct seq_file *m, void *v)
 {
 	struct super_block *sb = m->private;
 	struct wbc_conf *conf = ll_s2wbcc(sb);
+	s64 free_inodes = 0;
+
+	/* No inode is reserved if the number of inodes is unlimited. */
+	if (conf->wbcc_max_inodes)
+		free_inodes = max_t(s64, conf->wbcc_max_inodes -
+				    percpu_counter_sum(&conf->wbcc_used_inodes),
+				    0);
 
 	seq_printf(m, "cache_mode: %s\n",
 		   wbc_cachemode2string(conf->wbcc_cache_mode));
@@ -2027,7 +3932,7 @@ static int wbc_conf_seq_show(struct seq_file *m, void *v)
 	seq_printf(m, "remove_pol: %s\n", wbc_rmpol2string(conf->wbcc_rmpol));
 	seq_printf(m, "hiwm_ratio: %d\n", conf->wbcc_hiwm_ratio);
 	seq_printf(m, "inodes_max: %lu\n", conf->wbcc_max_inodes);
-	seq_printf(m, "inodes_free: %lu\n", conf->wbcc_free_inodes);
+	seq_printf(m, "inodes_free: %lld\n", free_inodes);
 	seq_printf(m, "inodes_hiwm: %u\n", conf->wbcc_hiwm_inodes_count);
 	seq_printf(m, "pages_max: %lu\n", conf->wbcc_max_pages);
 	seq_printf(m, "pages_free: %lu\n",
@@ -2042,6 +3947,20 @@ static int wbc_conf_seq_show(struct seq_file *m, void *v)
 		   conf->wbcc_max_nrpages_per_file);
 	seq_printf(m, "active_data_writeback: %d\n",
 		   conf->wbcc_active_data_writeback);
+	seq_printf(m, "mkdir_qos: %d\n", conf->wbcc_mkdir_qos);
+	seq_printf(m, "flushers: %u\n", conf->wbcc_flushers);
+	seq_printf(m, "dop_pol: %s\n", wbc_dop_pol2string(conf->wbcc_dop_pol));
+	seq_printf(m, "dop_write_thresh: %lu\n", conf->wbcc_dop_write_thresh);
+	seq_printf(m, "adaptive_batch: %d\n", conf->wbcc_adaptive_batch);
+	seq_printf(m, "batch_latency: %u\n", conf->wbcc_batch_latency);
+	seq_printf(m, "shrinker: %d\n", conf->wbcc_shrinker);
+	seq_printf(m, "partial_revoke: %d\n", conf->wbcc_partial_revoke);
+	seq_printf(m, "revoke_latency: %u\n", conf->wbcc_revoke_latency);
+	seq_printf(m, "root_max_inodes: %lu\n", conf->wbcc_root_max_inodes);
+	seq_printf(m, "root_max_pages: %lu\n", conf->wbcc_root_max_pages);
+	seq_printf(m, "prefetch_max_entries: %u\n",
+		   conf->wbcc_prefetch_max_entries);
+	wbc_journal_seq_show(m, ll_s2wbcs(sb));
 	return 0;
 }
 
@@ -2193,6 +4112,153 @@ static ssize_t wbc_rmpol_seq_write(struct file *file,
 }
 LDEBUGFS_SEQ_FOPS(wbc_rmpol);
 
+static int wbc_rule_seq_show(struct seq_file *m, void *v)
+{
+	struct super_block *sb = m->private;
+
+	wbc_rules_seq_show(m, ll_s2wbcs(sb));
+	return 0;
+}
+
+static ssize_t wbc_rule_seq_write(struct file *file, const char __user *buffer,
+				  size_t count, loff_t *off)
+{
+	struct seq_file *m = file->private_data;
+	struct super_block *sb = m->private;
+	char *kernbuf;
+	int rc;
+
+	if (count >= LPROCFS_WR_WBC_MAX_CMD)
+		return -EINVAL;
+
+	OBD_ALLOC(kernbuf, count + 1);
+	if (kernbuf == NULL)
+		return -ENOMEM;
+
+	if (copy_from_user(kernbuf, buffer, count))
+		GOTO(out_free_kernbuff, rc = -EFAULT);
+
+	rc = wbc_rule_cmd_handle(ll_s2wbcs(sb), kernbuf);
+out_free_kernbuff:
+	OBD_FREE(kernbuf, count + 1);
+	return rc ? rc : count;
+}
+LDEBUGFS_SEQ_FOPS(wbc_rule);
+
+static int wbc_quota_seq_show(struct seq_file *m, void *v)
+{
+	struct super_block *sb = m->private;
+
+	wbc_quotas_seq_show(m, ll_s2wbcs(sb));
+	return 0;
+}
+LDEBUGFS_SEQ_FOPS_RO(wbc_quota);
+
+static void wbc_hist_seq_show(struct seq_file *m, struct obd_histogram *oh,
+			      const char *name, const char *units)
+{
+	unsigned long tot;
+	unsigned long cum = 0;
+	int i;
+
+	seq_printf(m, "\n%-22s %10s   %% cum %%\n", name, units);
+	tot = lprocfs_oh_sum(oh);
+	if (tot == 0)
+		return;
+
+	for (i = 0; i < OBD_HIST_MAX; i++) {
+		unsigned long cnt = oh->oh_buckets[i];
+
+		cum += cnt;
+		seq_printf(m, "%u:\t\t%10lu %3u %3u\n",
+			   1U << i, cnt, pct(cnt, tot), pct(cum, tot));
+		if (cum == tot)
+			break;
+	}
+}
+
+static void wbc_stat_seq_show(struct seq_file *m, struct memfs_writeback *mwb,
+			      const char *name, enum wbc_stat_item item)
+{
+	seq_printf(m, "%-25s %lu\n", name,
+		   (unsigned long)wbc_stat_sum(mwb, item));
+}
+
+/* Runtime counters of the cache, the conf file shows only the settings. */
+static void wbc_counters_seq_show(struct seq_file *m, struct super_block *sb)
+{
+	struct memfs_writeback *mwb = ll_s2mwb(sb);
+
+	wbc_stat_seq_show(m, mwb, "flush_tasks", WB_FLUSH_TASKS);
+	wbc_stat_seq_show(m, mwb, "flush_steals", WB_FLUSH_STEALS);
+	wbc_stat_seq_show(m, mwb, "dop_pages_resident", WB_DOP_PAGES_RESIDENT);
+	wbc_stat_seq_show(m, mwb, "dop_pages_at_flush", WB_DOP_PAGES_AT_FLUSH);
+	wbc_stat_seq_show(m, mwb, "dop_pages_at_write", WB_DOP_PAGES_AT_WRITE);
+	wbc_stat_seq_show(m, mwb, "dop_pages_at_commit",
+			  WB_DOP_PAGES_AT_COMMIT);
+	seq_printf(m, "%-25s %lu\n", "lru_inodes",
+		   list_lru_count(&ll_s2wbcs(sb)->wbcs_rsvd_inode_lru));
+	seq_printf(m, "%-25s %lu\n", "lru_files",
+		   list_lru_count(&ll_s2wbcs(sb)->wbcs_data_inode_lru));
+	wbc_stat_seq_show(m, mwb, "shrink_inodes", WB_SHRINK_INODES);
+	wbc_stat_seq_show(m, mwb, "shrink_pages", WB_SHRINK_PAGES);
+	wbc_fc_seq_show(m, &ll_s2wbcs(sb)->wbcs_fc);
+	wbc_rc_seq_show(m, sb);
+}
+
+static int wbc_stats_seq_show(struct seq_file *m, void *v)
+{
+	struct super_block *sb = m->private;
+	struct wbc_super *super = ll_s2wbcs(sb);
+	struct wbc_stats *ws = &super->wbcs_stats;
+	struct lprocfs_counter_header *hdr;
+	struct lprocfs_counter ctr;
+	struct timespec64 now;
+	int i;
+
+	ktime_get_real_ts64(&now);
+	seq_printf(m, "%-25s %llu.%09lu secs.nsecs\n",
+		   "snapshot_time", (s64)now.tv_sec, now.tv_nsec);
+
+	for (i = 0; i < WBC_STATS_NR; i++) {
+		hdr = &ws->ws_stats->ls_cnt_header[i];
+		lprocfs_stats_collect(ws->ws_stats, i, &ctr);
+		if (ctr.lc_count == 0)
+			continue;
+
+		seq_printf(m, "%-25s %lld samples [%s]", hdr->lc_name,
+			   ctr.lc_count, hdr->lc_units);
+		if (hdr->lc_config & LPROCFS_CNTR_AVGMINMAX) {
+			seq_printf(m, " %lld %lld %lld",
+				   ctr.lc_min, ctr.lc_max, ctr.lc_sum);
+			if (hdr->lc_config & LPROCFS_CNTR_STDDEV)
+				seq_printf(m, " %llu", ctr.lc_sumsquare);
+		}
+		seq_putc(m, '\n');
+	}
+
+	wbc_counters_seq_show(m, sb);
+	wbc_hist_seq_show(m, &ws->ws_batch_fill, "sub reqs per rpc", "rpcs");
+	wbc_hist_seq_show(m, &ws->ws_batch_latency, "rpc latency (usec)",
+			  "rpcs");
+	wbc_hist_seq_show(m, &ws->ws_revoke_latency, "revoke latency (msec)",
+			  "revokes");
+	wbc_roots_seq_show(m, super);
+	return 0;
+}
+
+static ssize_t wbc_stats_seq_write(struct file *file,
+				   const char __user *buffer,
+				   size_t count, loff_t *off)
+{
+	struct seq_file *m = file->private_data;
+	struct super_block *sb = m->private;
+
+	wbc_stats_clear(ll_s2wbcs(sb));
+	return count;
+}
+LDEBUGFS_SEQ_FOPS(wbc_stats);
+
 struct ldebugfs_vars ldebugfs_llite_wbc_vars[] = {
 	{ .name =	"conf",
 	  .fops =	&wbc_conf_fops		},
@@ -2202,6 +4268,10 @@ struct ldebugfs_vars ldebugfs_llite_wbc_vars[] = {
 	  .fops =	&wbc_max_rpcs_fops,	},
 	{ .name =	"rmpol",
 	  .fops =	&wbc_rmpol_fops,	},
+	{ .name =	"rule",
+	  .fops =	&wbc_rule_fops,		},
+	{ .name =	"quota",
+	  .fops =	&wbc_quota_fops,	},
 	{ NULL }
 };
 
@@ -2214,6 +4284,8 @@ void wbc_tunables_init(struct super_block *sb)
 	wbcs->wbcs_debugfs_dir = debugfs_create_dir("wbc",
 						    sbi->ll_debugfs_entry);
 	ldebugfs_add_vars(wbcs->wbcs_debugfs_dir, ldebugfs_llite_wbc_vars, sb);
+	debugfs_create_file("wbc_stats", 0644, sbi->ll_debugfs_entry, sb,
+			    &wbc_stats_fops);
 }
 
 void wbc_tunables_fini(struct super_block *sb)
@@ -54,7 +54,7 @@ static int wbc_cache_enter(struct inode *dir, struct dentry *dchild)
 	if (!wbc_inode_has_protected(wbci) || !wbc_inode_complete(wbci))
 		RETURN(0);
 
-	rc = wbc_reserve_inode(ll_i2wbcs(dir));
+	rc = wbc_reserve_inode(ll_i2wbcs(dir), wbci->wbci_quota);
 	if (rc == 0)
 		RETURN(1);
 	if (rc != -ENOSPC)
@@ -90,6 +90,361 @@ wbc_dirent_account_dec(struct inode *dir, struct dentry *dchild)
 	ll_d2wbcd(dchild->d_parent)->wbcd_dirent_num--;
 }
 
+#ifndef HAVE_DIR_CONTEXT
+/* linux/fs/libfs.c: simple_positive() */
+static inline int simple_positive(struct dentry *dentry)
+{
+	return dentry->d_inode && !d_unhashed(dentry);
+}
+#endif
+
+/*
+ * Hashed index for readdir() in hash order.
+ *
+ * The hash of a file name is masked into 62 bits with WBC_DIRENT_HASH_LOCAL
+ * set, so it is below the end cookie of MDT readdir and does not collide with
+ * the positions of the MDT phase of merge readdir(). It is stored into
+ * @lfd_pos of the file handle as ll_iterate() does. The positions 0 and 1 are
+ * reserved for "." and "..". The hash of the backend dir on MDT is seeded per
+ * target and is not known by clients, so the cookies in MemFS can not be the
+ * ones on MDT. Once the directory is reopened on MDT in the middle of a
+ * readdir() iteration, the iteration goes on in the local order, see
+ * memfs_dir_resume_read().
+ *
+ * The entries with the same hash are sorted by name. The number of entries
+ * returned with the hash at the current position is kept in @wbcf_hash_off,
+ * thus a readdir() call stopping in the middle of a hash collision goes on
+ * without returning an entry twice.
+ */
+#define WBC_DIRENT_HASH_LOCAL	(1ULL << 62)
+
+static inline __u64 wbc_dirent_hash(const struct qstr *name)
+{
+	return (lustre_hash_fnv_1a_64(name->name, name->len) >> 2) |
+	       WBC_DIRENT_HASH_LOCAL;
+}
+
+static inline loff_t wbc_dirent_hash2pos(struct ll_sb_info *sbi, __u64 hash)
+{
+	bool api32 = ll_need_32bit_api(sbi);
+
+	if (hash == MDS_DIR_END_OFF)
+		return api32 ? LL_DIR_END_OFF_32BIT : LL_DIR_END_OFF;
+
+	if (api32 && sbi->ll_flags & LL_SBI_64BIT_HASH)
+		return hash >> 32;
+
+	return hash;
+}
+
+static struct wbc_hindex *wbc_hindex_alloc(bool pinned)
+{
+	struct wbc_hindex *hidx;
+
+	OBD_ALLOC_PTR(hidx);
+	if (hidx == NULL)
+		return NULL;
+
+	hidx->whi_root = RB_ROOT;
+	mutex_init(&hidx->whi_lock);
+	hidx->whi_pinned = pinned;
+	return hidx;
+}
+
+static void wbc_hindex_clear(struct wbc_hindex *hidx)
+{
+	struct rb_node *n;
+
+	while ((n = rb_first(&hidx->whi_root)) != NULL) {
+		struct wbc_hnode *node;
+
+		node = rb_entry(n, struct wbc_hnode, whn_node);
+		rb_erase(n, &hidx->whi_root);
+		if (hidx->whi_pinned)
+			dput(node->whn_dentry);
+		OBD_FREE_PTR(node);
+	}
+
+	hidx->whi_count = 0;
+	hidx->whi_valid = 0;
+}
+
+void wbc_hindex_free(struct wbc_hindex *hidx)
+{
+	if (hidx == NULL)
+		return;
+
+	wbc_hindex_clear(hidx);
+	OBD_FREE_PTR(hidx);
+}
+
+/* Order the index nodes by hash, and by name for the same hash. */
+static int wbc_hnode_cmp(struct wbc_hnode *n1, struct wbc_hnode *n2)
+{
+	const struct qstr *q1 = &n1->whn_dentry->d_name;
+	const struct qstr *q2 = &n2->whn_dentry->d_name;
+	int rc;
+
+	if (n1->whn_hash != n2->whn_hash)
+		return n1->whn_hash < n2->whn_hash ? -1 : 1;
+
+	rc = memcmp(q1->name, q2->name, min(q1->len, q2->len));
+	if (rc == 0)
+		rc = (int)q1->len - (int)q2->len;
+	return rc;
+}
+
+static void wbc_hindex_insert(struct wbc_hindex *hidx, struct wbc_hnode *node)
+{
+	struct rb_node **p = &hidx->whi_root.rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*p) {
+		struct wbc_hnode *tmp;
+
+		parent = *p;
+		tmp = rb_entry(parent, struct wbc_hnode, whn_node);
+		if (wbc_hnode_cmp(node, tmp) < 0)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+
+	rb_link_node(&node->whn_node, parent, p);
+	rb_insert_color(&node->whn_node, &hidx->whi_root);
+	hidx->whi_count++;
+}
+
+/* Find the first entry whose hash is not less than @hash. */
+static struct wbc_hnode *wbc_hindex_seek(struct wbc_hindex *hidx, __u64 hash)
+{
+	struct rb_node *n = hidx->whi_root.rb_node;
+	struct wbc_hnode *found = NULL;
+
+	while (n) {
+		struct wbc_hnode *tmp = rb_entry(n, struct wbc_hnode, whn_node);
+
+		if (tmp->whn_hash >= hash) {
+			found = tmp;
+			n = n->rb_left;
+		} else {
+			n = n->rb_right;
+		}
+	}
+
+	return found;
+}
+
+static inline struct wbc_hnode *wbc_hindex_next(struct wbc_hnode *node)
+{
+	struct rb_node *n = rb_next(&node->whn_node);
+
+	return n ? rb_entry(n, struct wbc_hnode, whn_node) : NULL;
+}
+
+/*
+ * Find the entry at the position @pos, where the first @off entries with the
+ * hash @pos were returned already.
+ */
+static struct wbc_hnode *wbc_hindex_seek_pos(struct wbc_hindex *hidx,
+					     __u64 pos, __u32 off)
+{
+	struct wbc_hnode *node = wbc_hindex_seek(hidx, pos);
+
+	while (node != NULL && node->whn_hash == pos && off-- > 0)
+		node = wbc_hindex_next(node);
+
+	return node;
+}
+
+static int wbc_hindex_add(struct wbc_hindex *hidx, struct dentry *dchild)
+{
+	struct wbc_hnode *node;
+
+	OBD_ALLOC_PTR(node);
+	if (node == NULL)
+		return -ENOMEM;
+
+	node->whn_hash = wbc_dirent_hash(&dchild->d_name);
+	node->whn_dentry = hidx->whi_pinned ? dget(dchild) : dchild;
+	wbc_hindex_insert(hidx, node);
+	return 0;
+}
+
+static void wbc_hindex_del(struct wbc_hindex *hidx, struct dentry *dchild)
+{
+	__u64 hash = wbc_dirent_hash(&dchild->d_name);
+	struct wbc_hnode *node;
+
+	for (node = wbc_hindex_seek(hidx, hash);
+	     node != NULL && node->whn_hash == hash;
+	     node = wbc_hindex_next(node)) {
+		if (node->whn_dentry == dchild) {
+			rb_erase(&node->whn_node, &hidx->whi_root);
+			hidx->whi_count--;
+			if (hidx->whi_pinned)
+				dput(dchild);
+			OBD_FREE_PTR(node);
+			return;
+		}
+	}
+}
+
+/*
+ * Build the hashed index by scanning the children dentries of @parent.
+ * The caller must hold the inode lock of the directory at least shared, so
+ * no child can be added into or removed from the directory meanwhile.
+ */
+static int wbc_hindex_build(struct wbc_hindex *hidx, struct dentry *parent)
+{
+	struct dentry *last = NULL;
+	struct list_head *p;
+	int rc = 0;
+
+	ENTRY;
+
+	wbc_hindex_clear(hidx);
+	spin_lock(&parent->d_lock);
+	p = &parent->d_subdirs;
+	while ((p = p->next) != &parent->d_subdirs) {
+		struct dentry *dchild = list_entry(p, struct dentry, d_child);
+
+		if (!simple_positive(dchild))
+			continue;
+
+		spin_lock_nested(&dchild->d_lock, DENTRY_D_LOCK_NESTED);
+		dget_dlock(dchild);
+		spin_unlock(&dchild->d_lock);
+		spin_unlock(&parent->d_lock);
+
+		dput(last);
+		last = dchild;
+		rc = wbc_hindex_add(hidx, dchild);
+		if (rc)
+			GOTO(out_dput, rc);
+
+		spin_lock(&parent->d_lock);
+		p = &dchild->d_child;
+	}
+	spin_unlock(&parent->d_lock);
+
+	hidx->whi_valid = 1;
+out_dput:
+	dput(last);
+	if (rc)
+		wbc_hindex_clear(hidx);
+
+	RETURN(rc);
+}
+
+/*
+ * Maintain the resident hashed index of the directory @dir when a child is
+ * added. If it fails to allocate the index node, just invalidate the index
+ * and it will be rebuilt at the next readdir() call.
+ */
+static void wbc_dir_hindex_add(struct inode *dir, struct dentry *dchild)
+{
+	struct wbc_hindex *hidx = ll_i2wbci(dir)->wbci_hindex;
+
+	if (hidx == NULL)
+		return;
+
+	mutex_lock(&hidx->whi_lock);
+	if (hidx->whi_valid && wbc_hindex_add(hidx, dchild))
+		wbc_hindex_clear(hidx);
+	mutex_unlock(&hidx->whi_lock);
+}
+
+static void wbc_dir_hindex_del(struct inode *dir, struct dentry *dchild)
+{
+	struct wbc_hindex *hidx = ll_i2wbci(dir)->wbci_hindex;
+
+	if (hidx == NULL)
+		return;
+
+	mutex_lock(&hidx->whi_lock);
+	if (hidx->whi_valid)
+		wbc_hindex_del(hidx, dchild);
+	mutex_unlock(&hidx->whi_lock);
+}
+
+static struct wbc_hindex *wbc_dir_hindex_get(struct inode *dir)
+{
+	struct wbc_inode *wbci = ll_i2wbci(dir);
+	struct wbc_hindex *hidx;
+
+	if (wbci->wbci_hindex)
+		return wbci->wbci_hindex;
+
+	hidx = wbc_hindex_alloc(false);
+	if (hidx == NULL)
+		return NULL;
+
+	spin_lock(&dir->i_lock);
+	if (wbci->wbci_hindex == NULL) {
+		wbci->wbci_hindex = hidx;
+		hidx = NULL;
+	}
+	spin_unlock(&dir->i_lock);
+
+	wbc_hindex_free(hidx);
+	return wbci->wbci_hindex;
+}
+
+/* Destroy the resident hashed index once the directory loses Complete(C). */
+void wbc_dir_hindex_fini(struct inode *dir)
+{
+	struct wbc_inode *wbci = ll_i2wbci(dir);
+	struct wbc_hindex *hidx;
+
+	if (!S_ISDIR(dir->i_mode))
+		return;
+
+	spin_lock(&dir->i_lock);
+	hidx = wbci->wbci_hindex;
+	wbci->wbci_hindex = NULL;
+	spin_unlock(&dir->i_lock);
+
+	wbc_hindex_free(hidx);
+}
+
+/*
+ * Get the hashed index for readdir() on @file and build it if needed.
+ * The index is returned with @whi_lock held on success.
+ */
+static struct wbc_hindex *memfs_readdir_hindex_get(struct file *file)
+{
+	struct ll_file_data *fd = file->private_data;
+	struct dentry *dentry = file->f_path.dentry;
+	struct wbc_hindex *hidx;
+	int rc;
+
+	if (fd->fd_wbc_file.wbcf_readdir_pol == WBC_READDIR_HTREE_RESIDENT) {
+		hidx = wbc_dir_hindex_get(dentry->d_inode);
+	} else {
+		hidx = fd->fd_wbc_file.wbcf_private_data;
+		if (hidx == NULL) {
+			hidx = wbc_hindex_alloc(true);
+			fd->fd_wbc_file.wbcf_private_data = hidx;
+		}
+	}
+
+	if (hidx == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	mutex_lock(&hidx->whi_lock);
+	/* Rebuild the runtime index upon rewinddir() to see new entries. */
+	if (!hidx->whi_valid || (hidx->whi_pinned && fd->lfd_pos == 0)) {
+		rc = wbc_hindex_build(hidx, dentry);
+		if (rc) {
+			mutex_unlock(&hidx->whi_lock);
+			return ERR_PTR(rc);
+		}
+	}
+
+	return hidx;
+}
+
 /*
  * These are the methods to create virtual entries for MD WBC.
  * Borrowing heavily from ramfs code.
@@ -146,6 +501,10 @@ static struct inode *wbc_get_inode(struct inode *dir, int mode, dev_t dev,
 	wbci = &lli->lli_wbc_inode;
 	wbci->wbci_cache_mode = dwbci->wbci_cache_mode;
 	wbci->wbci_flush_mode = dwbci->wbci_flush_mode;
+	if (S_ISDIR(mode))
+		wbci->wbci_rmpol = dwbci->wbci_rmpol;
+	/* Charged to the quota of the root, see wbc_cache_enter(). */
+	wbci->wbci_quota = wbc_quota_get(dwbci->wbci_quota);
 	wbci->wbci_flags = WBC_STATE_FL_PROTECTED | WBC_STATE_FL_COMPLETE |
 			   WBC_STATE_FL_INODE_RESERVED;
 	wbci->wbci_dirty_flags = WBC_DIRTY_FL_CREAT;
@@ -168,6 +527,87 @@ static struct inode *wbc_get_inode(struct inode *dir, int mode, dev_t dev,
 	RETURN(inode);
 }
 
+#ifdef CONFIG_LUSTRE_FS_POSIX_ACL
+/*
+ * Mirror the ACL inheritance done by MDT on create: a new file under @dir
+ * with a default ACL gets the access ACL derived from it and its mode masked
+ * accordingly, and a new directory inherits the default ACL itself. Without
+ * a default ACL the umask applies, which is left to MDT otherwise.
+ */
+static int memfs_acl_init(struct inode *dir, struct inode *inode)
+{
+	struct ll_inode_info *lli = ll_i2info(inode);
+	struct posix_acl *acl;
+	umode_t mode = inode->i_mode;
+	void *value;
+	int size;
+	int rc;
+
+	ENTRY;
+
+	if (!IS_POSIXACL(dir) || S_ISLNK(mode))
+		RETURN(0);
+
+	size = ll_xattr_list(dir, XATTR_NAME_ACL_DEFAULT, XATTR_ACL_DEFAULT_T,
+			     NULL, 0, OBD_MD_FLXATTR);
+	if (size == 0 || size == -ENODATA) {
+		inode->i_mode &= ~current_umask();
+		RETURN(0);
+	}
+	if (size < 0)
+		RETURN(size);
+
+	OBD_ALLOC_LARGE(value, size);
+	if (value == NULL)
+		RETURN(-ENOMEM);
+
+	rc = ll_xattr_list(dir, XATTR_NAME_ACL_DEFAULT, XATTR_ACL_DEFAULT_T,
+			   value, size, OBD_MD_FLXATTR);
+	if (rc < 0)
+		GOTO(out_free, rc);
+
+	acl = posix_acl_from_xattr(&init_user_ns, value, rc);
+	if (IS_ERR_OR_NULL(acl)) {
+		inode->i_mode &= ~current_umask();
+		GOTO(out_free, rc = PTR_ERR_OR_ZERO(acl));
+	}
+
+	if (S_ISDIR(mode)) {
+		down_write(&lli->lli_xattrs_list_rwsem);
+		rc = ll_xattr_cache_update(inode, XATTR_NAME_ACL_DEFAULT,
+					   value, rc, 0);
+		up_write(&lli->lli_xattrs_list_rwsem);
+		if (rc) {
+			posix_acl_release(acl);
+			GOTO(out_free, rc);
+		}
+	}
+
+	rc = __posix_acl_create(&acl, GFP_NOFS, &mode);
+	if (rc < 0)
+		GOTO(out_free, rc);
+
+	inode->i_mode = mode;
+	/* The ACL can not be fully represented by the mode bits. */
+	if (rc > 0) {
+		spin_lock(&lli->lli_lock);
+		lli->lli_posix_acl = acl;
+		spin_unlock(&lli->lli_lock);
+		acl = NULL;
+	}
+	posix_acl_release(acl);
+	rc = 0;
+out_free:
+	OBD_FREE_LARGE(value, size);
+	RETURN(rc);
+}
+#else
+static inline int memfs_acl_init(struct inode *dir, struct inode *inode)
+{
+	return 0;
+}
+#endif
+
 static int wbc_new_node(struct inode *dir, struct dentry *dchild,
 			const char *tgt, umode_t mode, int rdev, __u32 opc)
 {
@@ -190,10 +630,16 @@ static int wbc_new_node(struct inode *dir, struct dentry *dchild,
 		RETURN(PTR_ERR(op_data));
 
 	op_data->op_cli_flags |= CLI_WBC_TGT;
+	if (opc == LUSTRE_OPC_MKDIR && ll_i2wbcc(dir)->wbcc_mkdir_qos)
+		op_data->op_cli_flags |= CLI_WBC_QOS_MKDIR;
 	inode = wbc_get_inode(dir, mode, old_decode_dev(rdev), op_data);
 	if (IS_ERR(inode))
 		GOTO(out_exit, rc = PTR_ERR(inode));
 
+	rc = memfs_acl_init(dir, inode);
+	if (rc)
+		GOTO(out_iput, rc);
+
 	rc = wbcfs_d_init(dchild);
 	if (rc)
 		GOTO(out_iput, rc);
@@ -202,6 +648,7 @@ static int wbc_new_node(struct inode *dir, struct dentry *dchild,
 	wbc_reserved_inode_lru_add(inode);
 	d_instantiate(dchild, inode);
 	dget(dchild); /* Extra count - pin the dentry in core. */
+	wbc_dir_hindex_add(dir, dchild);
 	/* Mark @dir as dirty to update the mtime/ctime for @dir on MDT? */
 	dir->i_mtime = dir->i_ctime = current_time(dir);
 
@@ -238,10 +685,12 @@ static int wbc_new_node(struct inode *dir, struct dentry *dchild,
 		break;
 	}
 
-	wbc_account_inode_dirtied(ll_i2mwb(inode));
+	wbc_account_inode_dirtied(inode);
+	wbc_journal_log_create(dir, dchild);
 
 out_iput:
 	if (rc) {
+		wbc_dir_hindex_del(dir, dchild);
 		wbc_dirent_account_dec(dir, dchild);
 		wbc_reserved_inode_lru_del(inode);
 		iput(inode);
@@ -252,25 +701,85 @@ out_exit:
 	RETURN(rc);
 }
 
+/*
+ * Reset the directory @dentry fetched from MDT to an empty MemFS directory,
+ * before its children are added by memfs_prefetch_add().
+ */
+void memfs_prefetch_init(struct inode *dir, struct dentry *dentry)
+{
+	dir->i_size = DIRENT64_SIZE(1) + DIRENT64_SIZE(2);
+	ll_d2wbcd(dentry)->wbcd_dirent_num = 0;
+	wbc_dir_hindex_fini(dir);
+}
+
+/*
+ * Add the child @dchild fetched from MDT into the directory @dir prefetched
+ * into MemFS. As the files created in MemFS, it is charged to the quota of
+ * the root and pinned in the dcache until it is unreserved.
+ */
+int memfs_prefetch_add(struct inode *dir, struct dentry *dchild)
+{
+	struct inode *inode = dchild->d_inode;
+	struct wbc_inode *wbci = ll_i2wbci(inode);
+	int rc;
+
+	rc = wbc_reserve_inode(ll_i2wbcs(dir), wbci->wbci_quota);
+	if (rc)
+		return rc;
+
+	spin_lock(&inode->i_lock);
+	wbci->wbci_flags |= WBC_STATE_FL_INODE_RESERVED;
+	spin_unlock(&inode->i_lock);
+	wbc_reserved_inode_lru_add(inode);
+	wbc_dirent_account_inc(dir, dchild);
+	dget(dchild); /* Extra count - pin the dentry in core. */
+	wbc_dir_hindex_add(dir, dchild);
+	return 0;
+}
+
 bool wbc_inode_acct_page(struct inode *inode, long nr_pages)
 {
-	struct wbc_conf *conf = &ll_i2wbcs(inode)->wbcs_conf;
+	struct wbc_super *super = ll_i2wbcs(inode);
+	struct wbc_conf *conf = &super->wbcs_conf;
 	struct address_space *mapping = inode->i_mapping;
+	struct wbc_quota *quota = ll_i2wbci(inode)->wbci_quota;
+	bool dop = wbc_cache_mode_dop(ll_i2wbci(inode));
 
 	if (mapping->nrpages + nr_pages > conf->wbcc_max_nrpages_per_file)
 		return false;
 
+	/*
+	 * Fail the accounting once exceeding the threshold, thus the caller
+	 * will spill the cache pages of the file into the PCC copy.
+	 */
+	if (dop && conf->wbcc_dop_pol == WBC_DOP_AT_WRITE &&
+	    mapping->nrpages + nr_pages > conf->wbcc_dop_write_thresh)
+		return false;
+
+	if (!wbc_quota_charge_pages(super, quota, nr_pages))
+		return false;
+
 	if (conf->wbcc_max_pages) {
-		if (percpu_counter_compare(&conf->wbcc_used_pages,
-					   conf->wbcc_max_pages - nr_pages) > 0)
-			return false;
+		if (wbc_counter_compare(&conf->wbcc_used_pages,
+					conf->wbcc_max_pages - nr_pages,
+					conf->wbcc_max_pages) > 0)
+			goto out_uncharge;
 
-		percpu_counter_add(&conf->wbcc_used_pages, nr_pages);
+		wbc_counter_add(&conf->wbcc_used_pages, nr_pages,
+				conf->wbcc_max_pages);
 		if (wbc_cache_too_much_pages(conf))
-			wake_up_process(ll_i2wbcs(inode)->wbcs_reclaim_task);
+			wake_up_process(super->wbcs_reclaim_task);
 	}
 
+	if (dop)
+		__add_wbc_stat(ll_i2mwb(inode), WB_DOP_PAGES_RESIDENT,
+			       nr_pages);
+
 	return true;
+
+out_uncharge:
+	wbc_quota_uncharge_pages(quota, nr_pages);
+	return false;
 }
 
 void wbc_inode_unacct_pages(struct inode *inode, long nr_pages)
@@ -280,7 +789,12 @@ void wbc_inode_unacct_pages(struct inode *inode, long nr_pages)
 	ENTRY;
 
 	if (conf->wbcc_max_pages)
-		percpu_counter_sub(&conf->wbcc_used_pages, nr_pages);
+		wbc_counter_add(&conf->wbcc_used_pages, -nr_pages,
+				conf->wbcc_max_pages);
+	wbc_quota_uncharge_pages(ll_i2wbci(inode)->wbci_quota, nr_pages);
+	if (wbc_cache_mode_dop(ll_i2wbci(inode)))
+		__add_wbc_stat(ll_i2mwb(inode), WB_DOP_PAGES_RESIDENT,
+			       -nr_pages);
 	EXIT;
 }
 
@@ -290,10 +804,72 @@ static void wbc_free_removed_list(struct list_head *list)
 
 	list_for_each_entry_safe(item, tmp, list, wbvi_item) {
 		list_del_init(&item->wbvi_item);
-		OBD_FREE_PTR(item);
+		wbc_removed_item_free(item);
 	}
 }
 
+struct wbc_removed_item *
+wbc_removed_item_alloc(enum md_opcode opc, struct inode *inode,
+		       const struct qstr *name, const struct qstr *tgt_name)
+{
+	struct wbc_removed_item *item;
+	__u16 namelen = name ? name->len : 0;
+	__u16 tgt_namelen = tgt_name ? tgt_name->len : 0;
+
+	OBD_ALLOC(item, wbc_removed_item_size(namelen, tgt_namelen));
+	if (item == NULL)
+		return NULL;
+
+	INIT_LIST_HEAD(&item->wbvi_item);
+	item->wbvi_fid = *ll_inode2fid(inode);
+	item->wbvi_opc = opc;
+	item->wbvi_mode = inode->i_mode;
+	item->wbvi_namelen = namelen;
+	item->wbvi_tgt_namelen = tgt_namelen;
+	item->wbvi_rc = -ECANCELED;
+	if (namelen)
+		memcpy(item->wbvi_name, name->name, namelen);
+	if (tgt_namelen)
+		memcpy(item->wbvi_name + namelen + 1, tgt_name->name,
+		       tgt_namelen);
+
+	return item;
+}
+
+static inline void memfs_mark_remove_dirty(struct inode *dir)
+{
+	struct wbc_inode *wbci = ll_i2wbci(dir);
+
+	spin_lock(&dir->i_lock);
+	wbci->wbci_dirty_flags |= WBC_DIRTY_FL_REMOVE;
+	spin_unlock(&dir->i_lock);
+	mark_inode_dirty(dir);
+}
+
+/*
+ * Replay the named update @item of a flushed entry under @dir on MDT. It is
+ * sent at once for the sync removal policy, otherwise it is queued on @dir in
+ * order with the pending removals, and flushed in batch with the directory.
+ */
+static int wbc_add_namespace_item(struct inode *dir,
+				  struct wbc_removed_item *item)
+{
+	struct wbc_inode *dwbci = ll_i2wbci(dir);
+	LIST_HEAD(head);
+
+	if (ll_i2wbcc(dir)->wbcc_rmpol == WBC_RMPOL_SYNC) {
+		list_add_tail(&item->wbvi_item, &head);
+		return wbcfs_sync_removed_items(dir, &head);
+	}
+
+	spin_lock(&dwbci->wbci_removed_lock);
+	list_add_tail(&item->wbvi_item, &dwbci->wbci_removed_list);
+	dwbci->wbci_removed_count++;
+	spin_unlock(&dwbci->wbci_removed_lock);
+	memfs_mark_remove_dirty(dir);
+	return 0;
+}
+
 /*
  * Add a removing entry into the removed list of its parent.
  * \retval	1 if insertion succeeds.
@@ -310,17 +886,24 @@ static int wbc_add_removed_item(struct inode *dir, struct dentry *dchild,
 
 	ENTRY;
 
-	OBD_ALLOC_PTR(item);
+	/* The batched unlink removes the entry by name. */
+	if (pol == WBC_RMPOL_BATCH) {
+		item = wbc_removed_item_alloc(MD_OP_UNLINK_LOCKLESS, inode,
+					      &dchild->d_name, NULL);
+		if (item != NULL)
+			item->wbvi_pfid = *ll_inode2fid(dir);
+	} else {
+		item = wbc_removed_item_alloc(MD_OP_NONE, inode, NULL, NULL);
+	}
 	if (item == NULL)
 		RETURN(-ENOMEM);
 
-	INIT_LIST_HEAD(&item->wbvi_item);
-	item->wbvi_fid = *ll_inode2fid(inode);
 	spin_lock(&dwbci->wbci_removed_lock);
 	if (S_ISDIR(inode->i_mode)) {
 		struct wbc_inode *wbci = ll_i2wbci(inode);
 
-		if (pol == WBC_RMPOL_DELAY) {
+		/* Children must be removed before the directory itself. */
+		if (pol == WBC_RMPOL_DELAY || pol == WBC_RMPOL_BATCH) {
 			list_splice_tail_init(&wbci->wbci_removed_list,
 					      &dwbci->wbci_removed_list);
 			dwbci->wbci_removed_count += wbci->wbci_removed_count;
@@ -395,15 +978,146 @@ int memfs_mkdir(struct inode *dir, struct dentry *dchild, umode_t mode)
 	RETURN(rc);
 }
 
+/* Whether a namespace update on @inode needs to be replayed on MDT. */
+static inline bool memfs_namespace_need_sync(struct inode *inode)
+{
+	struct wbc_inode *wbci = ll_i2wbci(inode);
+
+	return wbc_mode_lock_keep(wbci) && wbc_inode_was_flushed(wbci);
+}
+
+/*
+ * The batched rename is applied within a single MDT, while the directories
+ * spread over MDTs with mkdir_qos may be remote to their parents.
+ */
+static inline bool memfs_same_mdt(struct inode *dir, struct inode *inode)
+{
+	struct ll_sb_info *sbi = ll_i2sbi(dir);
+
+	return ll_get_mdt_idx_by_fid(sbi, ll_inode2fid(dir)) ==
+	       ll_get_mdt_idx_by_fid(sbi, ll_inode2fid(inode));
+}
+
+/*
+ * The new name of a file on MDT, or being created on MDT with another name,
+ * is linked on MDT later: when flushing @dir, or in batch with the other
+ * new names of the file once both the file and @dir are on MDT.
+ */
+static void memfs_link_mark_pending(struct inode *inode, struct dentry *dentry)
+{
+	struct wbc_inode *wbci = ll_i2wbci(inode);
+	bool dirty = false;
+
+	spin_lock(&inode->i_lock);
+	if (wbc_inode_written_out(wbci) ||
+	    wbci->wbci_flags & WBC_STATE_FL_WRITEBACK) {
+		ll_d2wbcd(dentry)->wbcd_flags |= WBC_DENTRY_FL_LINK;
+		wbci->wbci_dirty_flags |= WBC_DIRTY_FL_HARDLINK;
+		dirty = true;
+	}
+	spin_unlock(&inode->i_lock);
+
+	if (dirty)
+		mark_inode_dirty(inode);
+}
+
 static int memfs_link(struct dentry *old_dentry, struct inode *dir,
 		      struct dentry *new_dentry)
 {
+	struct inode *inode = old_dentry->d_inode;
+	struct wbc_removed_item *item = NULL;
+	int rc;
+
 	ENTRY;
 
 	LASSERT(wbc_inode_has_protected(ll_i2wbci(dir)));
 
+	/*
+	 * The new name under a flushed directory is replayed in order with
+	 * the other namespace updates of the directory. A file not created on
+	 * MDT yet is created with one of its names, the others are linked.
+	 */
+	if (memfs_namespace_need_sync(inode) &&
+	    wbc_inode_was_flushed(ll_i2wbci(dir))) {
+		item = wbc_removed_item_alloc(MD_OP_LINK_LOCKLESS, inode,
+					      &new_dentry->d_name, NULL);
+		if (item == NULL)
+			RETURN(-ENOMEM);
+
+		item->wbvi_pfid = *ll_inode2fid(dir);
+	}
+
 	/* XXX Need to ensure we are in the same dir. */
-	RETURN(simple_link(old_dentry, dir, new_dentry));
+	rc = simple_link(old_dentry, dir, new_dentry);
+	if (rc) {
+		if (item)
+			wbc_removed_item_free(item);
+		RETURN(rc);
+	}
+
+	wbc_dir_hindex_add(dir, new_dentry);
+	wbc_journal_log_link(dir, new_dentry);
+	if (item)
+		rc = wbc_add_namespace_item(dir, item);
+	else
+		memfs_link_mark_pending(inode, new_dentry);
+
+	RETURN(rc);
+}
+
+/*
+ * The name @dchild of a file on MDT is to be removed. When all the other
+ * names of the file are still to be linked on MDT, the removal of this name
+ * on MDT destroys the file there, thus link a pending name on MDT first.
+ */
+static int memfs_link_pending_sync(struct dentry *dchild)
+{
+	struct inode *inode = dchild->d_inode;
+	struct wbc_inode *wbci = ll_i2wbci(inode);
+	struct dentry *pending = NULL;
+	struct dentry *alias;
+	struct dentry *parent;
+	unsigned int count = 0;
+	int rc;
+
+	ENTRY;
+
+	if (S_ISDIR(inode->i_mode))
+		RETURN(0);
+
+	spin_lock(&inode->i_lock);
+	if (!wbc_inode_hardlink_dirty(wbci) || !wbc_inode_written_out(wbci) ||
+	    wbc_dentry_link_pending(dchild)) {
+		spin_unlock(&inode->i_lock);
+		RETURN(0);
+	}
+
+	hlist_for_each_entry(alias, &inode->i_dentry, d_alias) {
+		if (!wbc_dentry_link_pending(alias))
+			continue;
+		if (pending == NULL)
+			pending = alias;
+		count++;
+	}
+	/* Otherwise some other name of the file is on MDT. */
+	if (pending && inode->i_nlink - count <= 1)
+		dget(pending);
+	else
+		pending = NULL;
+	spin_unlock(&inode->i_lock);
+
+	if (pending == NULL)
+		RETURN(0);
+
+	parent = dget_parent(pending);
+	dput(pending);
+	rc = wbc_inode_written_out(ll_i2wbci(parent->d_inode)) ? 0 :
+	     wbc_make_inode_sync(parent);
+	dput(parent);
+	if (rc == 0)
+		rc = wbcfs_flush_hardlinks(inode);
+
+	RETURN(rc);
 }
 
 static int memfs_remove_policy(struct inode *dir, struct dentry *dchild,
@@ -412,14 +1126,23 @@ static int memfs_remove_policy(struct inode *dir, struct dentry *dchild,
 	struct inode *inode = dchild->d_inode;
 	struct wbc_inode *wbci = ll_i2wbci(inode);
 	struct wbc_conf *conf = &ll_i2wbcs(dir)->wbcs_conf;
+	enum wbc_remove_policy pol = conf->wbcc_rmpol;
+	bool last;
 
 	ENTRY;
 
+	/* A hard link not yet linked on MDT is removed in MemFS only. */
+	if (wbc_dentry_link_clear(inode, dchild))
+		RETURN(0);
+
 	if (!wbc_mode_lock_keep(wbci))
 		RETURN(0);
 
+	/* The other names of a hard linked file are still flushed. */
+	last = rmdir || inode->i_nlink < 2;
 	spin_lock(&inode->i_lock);
-	wbci->wbci_flags |= WBC_STATE_FL_FREEING;
+	if (last)
+		wbci->wbci_flags |= WBC_STATE_FL_FREEING;
 	if (inode->i_state & I_SYNC)
 		__inode_wait_for_writeback(inode);
 	if (wbci->wbci_flags & WBC_STATE_FL_WRITEBACK)
@@ -429,7 +1152,18 @@ static int memfs_remove_policy(struct inode *dir, struct dentry *dchild,
 	if (!wbc_inode_was_flushed(wbci))
 		RETURN(0);
 
-	switch (conf->wbcc_rmpol) {
+	/* Remove only this name of the file on MDT, not the file by FID. */
+	if (!last && pol != WBC_RMPOL_SYNC)
+		pol = WBC_RMPOL_BATCH;
+
+	/*
+	 * The batched unlink is applied on the MDT of @dir, where the EX lock
+	 * of @dir is verified. A file on another MDT is removed at once.
+	 */
+	if (pol == WBC_RMPOL_BATCH && !memfs_same_mdt(dir, inode))
+		pol = WBC_RMPOL_SYNC;
+
+	switch (pol) {
 	case WBC_RMPOL_SYNC:
 		RETURN(rmdir ? ll_dir_inode_operations.rmdir(dir, dchild) :
 			       ll_dir_inode_operations.unlink(dir, dchild));
@@ -437,6 +1171,8 @@ static int memfs_remove_policy(struct inode *dir, struct dentry *dchild,
 		RETURN(wbc_add_removed_item(dir, dchild, WBC_RMPOL_DELAY));
 	case WBC_RMPOL_SUBTREE:
 		RETURN(wbc_add_removed_item(dir, dchild, WBC_RMPOL_SUBTREE));
+	case WBC_RMPOL_BATCH:
+		RETURN(wbc_add_removed_item(dir, dchild, WBC_RMPOL_BATCH));
 	default:
 		RETURN(0);
 	}
@@ -447,13 +1183,17 @@ static inline void memfs_remove_from_dcache(struct inode *dir,
 {
 	struct inode *inode = dchild->d_inode;
 	struct wbc_inode *wbci = ll_i2wbci(inode);
+	bool flushed = wbc_inode_was_flushed(wbci);
 
 	inode->i_ctime = dir->i_ctime = dir->i_mtime = current_time(dir);
 	drop_nlink(inode);
 	LASSERT(wbc_inode_reserved(wbci));
+	wbc_dir_hindex_del(dir, dchild);
 	wbc_inode_unreserve_dput(inode, dchild);
 	wbc_dirent_account_dec(dir, dchild);
-	wbc_unacct_inode_dirtied(ll_i2mwb(dir));
+	/* The flushed inode was unaccounted when it was created on MDT. */
+	if (!flushed)
+		wbc_unacct_inode_dirtied(inode);
 }
 
 static int memfs_rmdir(struct inode *dir, struct dentry *dchild)
@@ -470,16 +1210,14 @@ static int memfs_rmdir(struct inode *dir, struct dentry *dchild)
 			GOTO(up_rwsem, rc);
 
 
+		wbc_journal_log_unlink(dir, dchild);
 		/* copy from simple_rmdir() */
 		drop_nlink(dchild->d_inode);
 		drop_nlink(dir);
 
 		memfs_remove_from_dcache(dir, dchild);
 		if (rc == 1) {
-			spin_lock(&dir->i_lock);
-			wbci->wbci_dirty_flags |= WBC_DIRTY_FL_REMOVE;
-			spin_unlock(&dir->i_lock);
-			mark_inode_dirty(dir);
+			memfs_mark_remove_dirty(dir);
 			rc = 0;
 		}
 	} else {
@@ -504,12 +1242,17 @@ static int memfs_unlink(struct inode *dir, struct dentry *dchild)
 
 	ENTRY;
 
+	rc = memfs_link_pending_sync(dchild);
+	if (rc)
+		RETURN(rc);
+
 	down_read(&wbci->wbci_rw_sem);
 	if (wbc_inode_complete(wbci)) {
 		rc = memfs_remove_policy(dir, dchild, false);
 		if (rc < 0)
 			GOTO(up_rwsem, rc);
 
+		wbc_journal_log_unlink(dir, dchild);
 		/* copy from simple_unlink() */
 		memfs_remove_from_dcache(dir, dchild);
 		wbc_inode_data_lru_del(dchild->d_inode);
@@ -520,10 +1263,7 @@ static int memfs_unlink(struct inode *dir, struct dentry *dchild)
 		 * will be synchnorized to MDT later when flush the @dir.
 		 */
 		if (rc == 1) {
-			spin_lock(&dir->i_lock);
-			wbci->wbci_dirty_flags |= WBC_DIRTY_FL_REMOVE;
-			spin_unlock(&dir->i_lock);
-			mark_inode_dirty(dir);
+			memfs_mark_remove_dirty(dir);
 			rc = 0;
 		}
 	} else {
@@ -539,6 +1279,238 @@ up_rwsem:
 	RETURN(rc);
 }
 
+/* Replay the pending namespace updates queued on @dir on MDT at once. */
+static int memfs_sync_namespace_items(struct inode *dir)
+{
+	struct wbc_inode *wbci = ll_i2wbci(dir);
+	LIST_HEAD(head);
+
+	spin_lock(&wbci->wbci_removed_lock);
+	wbci->wbci_removed_count = 0;
+	list_splice_init(&wbci->wbci_removed_list, &head);
+	spin_unlock(&wbci->wbci_removed_lock);
+
+	if (list_empty(&head))
+		return 0;
+
+	return wbcfs_sync_removed_items(dir, &head);
+}
+
+/*
+ * The lockless rename on MDT is only safe when both directories are under
+ * the EX locks of this client on a single MDT. In lock drop flush mode, the
+ * flush of the source would deroot its parent, thus it is not used either.
+ */
+static bool memfs_rename_can_lockless(struct inode *src, struct inode *tgt,
+				      struct inode *inode,
+				      struct inode *victim)
+{
+	struct wbc_inode *swbci = ll_i2wbci(src);
+	struct wbc_inode *twbci = ll_i2wbci(tgt);
+
+	return wbc_inode_has_protected(swbci) &&
+	       wbc_inode_has_protected(twbci) &&
+	       wbc_mode_lock_keep(swbci) && wbc_mode_lock_keep(twbci) &&
+	       memfs_same_mdt(src, tgt) && memfs_same_mdt(src, inode) &&
+	       (victim == NULL || memfs_same_mdt(tgt, victim));
+}
+
+/*
+ * Flush the source entry, then rename it on MDT at once with a lockless
+ * batched sub request, and move it in MemFS. The file data stays in MemFS.
+ * Return -EAGAIN if either EX lock is revoked during the flush.
+ */
+static int memfs_rename_lockless(struct inode *src, struct dentry *src_dchild,
+				 struct inode *tgt, struct dentry *tgt_dchild)
+{
+	struct inode *inode = src_dchild->d_inode;
+	struct inode *victim = tgt_dchild->d_inode;
+	struct wbc_inode *swbci = ll_i2wbci(src);
+	struct wbc_inode *twbci = ll_i2wbci(tgt);
+	struct wbc_removed_item *item;
+	LIST_HEAD(head);
+	int rc;
+
+	ENTRY;
+
+	if (!wbc_inode_written_out(ll_i2wbci(inode))) {
+		rc = wbc_make_inode_sync(src_dchild);
+		if (rc)
+			RETURN(rc);
+	}
+
+	/* The source name may be a hard link not yet linked on MDT. */
+	if (wbc_dentry_link_pending(src_dchild)) {
+		rc = wbc_inode_written_out(swbci) ? 0 :
+		     wbc_make_inode_sync(src_dchild->d_parent);
+		if (rc == 0)
+			rc = wbcfs_flush_hardlinks(inode);
+		if (rc)
+			RETURN(rc);
+	}
+
+	if (!wbc_inode_written_out(twbci)) {
+		rc = wbc_make_inode_sync(tgt_dchild->d_parent);
+		if (rc)
+			RETURN(rc);
+	}
+
+	down_read(&swbci->wbci_rw_sem);
+	if (tgt != src)
+		down_read_nested(&twbci->wbci_rw_sem, SINGLE_DEPTH_NESTING);
+	if (!wbc_inode_has_protected(swbci) || !wbc_inode_has_protected(twbci))
+		GOTO(up_rwsem, rc = -EAGAIN);
+
+	/*
+	 * A victim on MDT is replaced by the rename there, otherwise it is
+	 * removed as unlink() does before the pending updates are replayed.
+	 */
+	if (victim && !wbc_inode_written_out(ll_i2wbci(victim))) {
+		rc = memfs_remove_policy(tgt, tgt_dchild,
+					 S_ISDIR(victim->i_mode));
+		if (rc < 0)
+			GOTO(up_rwsem, rc);
+		if (rc == 1)
+			memfs_mark_remove_dirty(tgt);
+	}
+
+	/* The pending updates may refer to the names being renamed. */
+	rc = memfs_sync_namespace_items(src);
+	if (rc == 0 && tgt != src)
+		rc = memfs_sync_namespace_items(tgt);
+	if (rc)
+		GOTO(up_rwsem, rc);
+
+	item = wbc_removed_item_alloc(MD_OP_RENAME_LOCKLESS, inode,
+				      &src_dchild->d_name,
+				      &tgt_dchild->d_name);
+	if (item == NULL)
+		GOTO(up_rwsem, rc = -ENOMEM);
+
+	item->wbvi_pfid = *ll_inode2fid(src);
+	item->wbvi_tgt_pfid = *ll_inode2fid(tgt);
+	list_add_tail(&item->wbvi_item, &head);
+	rc = wbcfs_sync_removed_items(src, &head);
+	if (rc)
+		GOTO(up_rwsem, rc);
+
+	/* A victim not pinned in MemFS is dropped as ll_rename() does. */
+	if (victim == NULL || wbc_inode_reserved(ll_i2wbci(victim))) {
+		rc = simple_rename(src, src_dchild, tgt, tgt_dchild
+#ifdef HAVE_IOPS_RENAME_WITH_FLAGS
+				   , 0
+#endif
+				  );
+		if (rc)
+			GOTO(up_rwsem, rc);
+	}
+
+	wbc_dir_hindex_del(tgt, tgt_dchild);
+	wbc_dir_hindex_del(src, src_dchild);
+	if (tgt != src && wbc_inode_complete(swbci))
+		wbc_dirent_account_dec(src, src_dchild);
+	d_move(src_dchild, tgt_dchild);
+	if (tgt != src && wbc_inode_complete(twbci))
+		wbc_dirent_account_inc(tgt, src_dchild);
+	wbc_dir_hindex_add(tgt, src_dchild);
+	rc = wbcfs_d_init(tgt_dchild);
+
+up_rwsem:
+	if (tgt != src)
+		up_read(&twbci->wbci_rw_sem);
+	up_read(&swbci->wbci_rw_sem);
+	RETURN(rc);
+}
+
+/*
+ * Rename an entry which can not be renamed in MemFS only: either directory
+ * is not Complete(C) or not cached at all, or a flushed file is renamed
+ * across directories or MDTs. The rename is applied on MDT at once rather
+ * than failing with -EXDEV, which makes mv(1) copy all the file data.
+ */
+static int memfs_rename_on_mdt(struct inode *src, struct dentry *src_dchild,
+			       struct inode *tgt, struct dentry *tgt_dchild,
+			       unsigned int flags)
+{
+	struct inode *inode = src_dchild->d_inode;
+	struct inode *victim = tgt_dchild->d_inode;
+	struct wbc_inode *swbci = ll_i2wbci(src);
+	struct wbc_inode *twbci = ll_i2wbci(tgt);
+	int rc;
+
+	ENTRY;
+
+	/* No rename flags are supported on MDT, the same as ll_rename(). */
+	if (flags)
+		RETURN(-EINVAL);
+
+	if (memfs_rename_can_lockless(src, tgt, src_dchild->d_inode,
+				      tgt_dchild->d_inode)) {
+		rc = memfs_rename_lockless(src, src_dchild, tgt, tgt_dchild);
+		if (rc != -EAGAIN)
+			RETURN(rc);
+	}
+
+	/*
+	 * Only the WBC root holds the EX lock, whose revocation by the rename
+	 * on MDT flushes the cached subtree. Below the root nothing is flushed
+	 * on behalf of the rename, so the source and its ancestors are flushed
+	 * here, and the source directory is decompleted for its pending
+	 * namespace updates to be applied before the rename on MDT.
+	 */
+	if (wbc_inode_complete(swbci)) {
+		rc = wbc_make_dir_decomplete(src, src_dchild->d_parent, 0);
+		if (rc)
+			RETURN(rc);
+	}
+
+	if (!wbc_inode_written_out(ll_i2wbci(inode))) {
+		rc = wbc_make_inode_sync(src_dchild);
+		if (rc)
+			RETURN(rc);
+	}
+
+	if (wbc_dentry_link_pending(src_dchild)) {
+		rc = wbcfs_flush_hardlinks(inode);
+		if (rc)
+			RETURN(rc);
+	}
+
+	if (wbc_inode_has_protected(twbci)) {
+		rc = wbc_make_inode_sync(victim ? tgt_dchild :
+					 tgt_dchild->d_parent);
+		if (rc)
+			RETURN(rc);
+	} else if (S_ISREG(inode->i_mode) &&
+		   !wbc_inode_none(ll_i2wbci(inode))) {
+		/* Out of the subtree no WBC EX lock protects the cached data. */
+		rc = wbc_make_data_commit(src_dchild, WBC_DOP_AT_COMMIT);
+		if (rc < 0)
+			RETURN(rc);
+	}
+
+	/* ll_rename() moves the dentry, drop the names from the indices. */
+	wbc_dir_hindex_del(tgt, tgt_dchild);
+	wbc_dir_hindex_del(src, src_dchild);
+	rc = ll_dir_inode_operations.rename(src, src_dchild, tgt, tgt_dchild
+#ifdef HAVE_IOPS_RENAME_WITH_FLAGS
+					    , 0
+#endif
+					   );
+	if (rc) {
+		wbc_dir_hindex_add(src, src_dchild);
+		if (victim)
+			wbc_dir_hindex_add(tgt, tgt_dchild);
+		RETURN(rc);
+	}
+
+	if (victim == NULL && wbc_inode_complete(twbci))
+		wbc_dirent_account_inc(tgt, src_dchild);
+	wbc_dir_hindex_add(tgt, src_dchild);
+
+	RETURN(0);
+}
+
 static int memfs_rename(struct inode *src, struct dentry *src_dchild,
 			struct inode *tgt, struct dentry *tgt_dchild
 #ifdef HAVE_IOPS_RENAME_WITH_FLAGS
@@ -546,25 +1518,86 @@ static int memfs_rename(struct inode *src, struct dentry *src_dchild,
 #endif
 			)
 {
+	struct inode *inode = src_dchild->d_inode;
+	struct inode *victim = tgt_dchild->d_inode;
+	struct wbc_removed_item *item = NULL;
+#ifndef HAVE_IOPS_RENAME_WITH_FLAGS
+	unsigned int flags = 0;
+#endif
 	int rc;
 
 	ENTRY;
 
 	LASSERT(wbc_inode_has_protected(ll_i2wbci(src)));
 
+	if (victim && d_is_dir(tgt_dchild) && !simple_empty(tgt_dchild))
+		RETURN(-ENOTEMPTY);
+
+	if (victim) {
+		rc = memfs_link_pending_sync(tgt_dchild);
+		if (rc)
+			RETURN(rc);
+	}
+
 	if (!wbc_inode_complete(ll_i2wbci(src)) ||
 	    !wbc_inode_complete(ll_i2wbci(tgt)))
-		RETURN(-EXDEV);
+		RETURN(memfs_rename_on_mdt(src, src_dchild, tgt, tgt_dchild,
+					   flags));
+
+	/* A hard link not on MDT yet is moved with its pending flag. */
+	if (memfs_namespace_need_sync(inode) &&
+	    !wbc_dentry_link_pending(src_dchild)) {
+		if (src != tgt || !memfs_same_mdt(src, inode) ||
+		    (victim && memfs_namespace_need_sync(victim) &&
+		     !memfs_same_mdt(tgt, victim)))
+			RETURN(memfs_rename_on_mdt(src, src_dchild,
+						   tgt, tgt_dchild, flags));
+
+		/* The rename on MDT will replace the victim as well. */
+		item = wbc_removed_item_alloc(MD_OP_RENAME_LOCKLESS, inode,
+					      &src_dchild->d_name,
+					      &tgt_dchild->d_name);
+		if (item == NULL)
+			RETURN(-ENOMEM);
+
+		item->wbvi_pfid = *ll_inode2fid(src);
+		item->wbvi_tgt_pfid = *ll_inode2fid(tgt);
+	} else if (victim) {
+		/*
+		 * The source is not on MDT yet, while the victim may be.
+		 * Remove the victim according to the removal policy, so that
+		 * the later flush of the source does not meet -EEXIST.
+		 */
+		rc = memfs_remove_policy(tgt, tgt_dchild,
+					 S_ISDIR(victim->i_mode));
+		if (rc < 0)
+			RETURN(rc);
+		if (rc == 1)
+			memfs_mark_remove_dirty(tgt);
+	}
 
 	rc = simple_rename(src, src_dchild, tgt, tgt_dchild
 #ifdef HAVE_IOPS_RENAME_WITH_FLAGS
 			   , flags
 #endif
 			  );
-	if (rc)
+	if (rc) {
+		if (item)
+			wbc_removed_item_free(item);
 		RETURN(rc);
+	}
 
+	wbc_journal_log_rename(src, src_dchild, tgt, tgt_dchild);
+	wbc_dir_hindex_del(tgt, tgt_dchild);
+	wbc_dir_hindex_del(src, src_dchild);
 	d_move(src_dchild, tgt_dchild);
+	wbc_dir_hindex_add(tgt, src_dchild);
+	if (item) {
+		rc = wbc_add_namespace_item(src, item);
+		if (rc)
+			RETURN(rc);
+	}
+
 	RETURN(wbcfs_d_init(tgt_dchild));
 }
 
@@ -632,7 +1665,8 @@ static int memfs_write_begin(struct file *file, struct address_space *mapping,
 		int rc2;
 
 		up_read(&wbci->wbci_rw_sem);
-		rc2 = wbc_make_data_commit(file->f_path.dentry);
+		rc2 = wbc_make_data_commit(file->f_path.dentry,
+					   WBC_DOP_AT_WRITE);
 		down_read(&wbci->wbci_rw_sem);
 		if (rc2 < 0)
 			rc = rc2;
@@ -712,7 +1746,7 @@ static int memfs_fsync(struct file *file, loff_t start,
 
 	if (S_ISREG(inode->i_mode)) {
 		down_write(&wbci->wbci_rw_sem);
-		rc = wbcfs_commit_cache_pages(inode);
+		rc = wbcfs_commit_cache_pages(inode, WBC_DOP_AT_COMMIT);
 		up_write(&wbci->wbci_rw_sem);
 	}
 
@@ -977,7 +2011,8 @@ static ssize_t memfs_file_write_iter(struct kiocb *iocb, struct iov_iter *iter)
 {
 	struct inode *inode = file_inode(iocb->ki_filp);
 	struct wbc_inode *wbci = ll_i2wbci(inode);
-	int rc;
+	ssize_t written = 0;
+	ssize_t rc;
 
 	ENTRY;
 
@@ -987,11 +2022,23 @@ repeat:
 		rc = generic_file_write_iter(iocb, iter);
 		if (rc == -ENOSPC)
 			GOTO(repeat, rc);
+		/*
+		 * The cache pages were committed in the middle of the write,
+		 * continue to write the remaining data into Lustre or PCC.
+		 */
+		if (rc > 0 && iov_iter_count(iter) > 0 &&
+		    !wbc_inode_data_caching(wbci)) {
+			written += rc;
+			GOTO(repeat, rc);
+		}
 	} else {
 		rc = ll_i2sbi(inode)->ll_fop->write_iter(iocb, iter);
 	}
 	up_read(&wbci->wbci_rw_sem);
 
+	if (written)
+		rc = rc < 0 ? written : written + rc;
+
 	RETURN(rc);
 }
 
@@ -1331,6 +2378,7 @@ static int memfs_setattr(struct dentry *dentry, struct iattr *attr)
 		wbci->wbci_dirty_flags |= WBC_DIRTY_FL_ATTR;
 		wbci->wbci_dirty_attr |= attr->ia_valid;
 		spin_unlock(&inode->i_lock);
+		wbc_journal_log_setattr(inode, attr->ia_valid);
 		if (wbc_flush_mode_aging(wbci))
 			mark_inode_dirty(inode);
 	} else {
@@ -1342,6 +2390,109 @@ up_rwsem:
 	RETURN(rc);
 }
 
+#ifdef CONFIG_LUSTRE_FS_POSIX_ACL
+/*
+ * The access ACL is kept in @lli_posix_acl as for a file fetched from MDT,
+ * and the mode of the file is updated according to the ACL.
+ */
+static int memfs_acl_access_set(struct inode *inode, const void *value,
+				size_t size)
+{
+	struct ll_inode_info *lli = ll_i2info(inode);
+	struct posix_acl *acl = NULL;
+	struct posix_acl *old;
+	umode_t mode = inode->i_mode;
+	int rc;
+
+	if (value != NULL) {
+		acl = posix_acl_from_xattr(&init_user_ns, value, size);
+		if (IS_ERR(acl))
+			return PTR_ERR(acl);
+	}
+
+	if (acl != NULL) {
+		rc = posix_acl_valid(&init_user_ns, acl);
+		if (rc)
+			GOTO(out_release, rc);
+
+		rc = posix_acl_equiv_mode(acl, &mode);
+		if (rc < 0)
+			GOTO(out_release, rc);
+
+		/* The ACL can be fully represented by the mode bits. */
+		if (rc == 0) {
+			posix_acl_release(acl);
+			acl = NULL;
+		}
+	}
+
+	spin_lock(&lli->lli_lock);
+	old = lli->lli_posix_acl;
+	lli->lli_posix_acl = acl;
+	spin_unlock(&lli->lli_lock);
+	inode->i_mode = mode;
+	forget_cached_acl(inode, ACL_TYPE_ACCESS);
+	if (old)
+		posix_acl_release(old);
+
+	return 0;
+
+out_release:
+	posix_acl_release(acl);
+	return rc;
+}
+#endif
+
+/*
+ * Set or remove (@value is NULL) the xattr @name of a file which is not
+ * yet flushed to MDT. The xattr is kept in the client xattr cache and
+ * sent to MDT right after the file creation in the same batch.
+ * Return -EAGAIN if the file was flushed meanwhile, then the caller must
+ * set the xattr on MDT instead.
+ */
+int memfs_xattr_set(struct inode *inode, const char *name,
+		    const void *value, size_t size, int flags)
+{
+	struct ll_inode_info *lli = ll_i2info(inode);
+	struct wbc_inode *wbci = ll_i2wbci(inode);
+	int rc;
+
+	ENTRY;
+
+again:
+	down_write(&lli->lli_xattrs_list_rwsem);
+	spin_lock(&inode->i_lock);
+	/*
+	 * The xattrs are packed for flush under the WRITEBACK state, wait
+	 * for the file creation on MDT finished.
+	 */
+	if (wbci->wbci_flags & WBC_STATE_FL_WRITEBACK) {
+		up_write(&lli->lli_xattrs_list_rwsem);
+		__wbc_inode_wait_for_writeback(inode);
+		spin_unlock(&inode->i_lock);
+		goto again;
+	}
+
+	if (!wbc_inode_xattr_local(wbci)) {
+		spin_unlock(&inode->i_lock);
+		up_write(&lli->lli_xattrs_list_rwsem);
+		RETURN(-EAGAIN);
+	}
+	spin_unlock(&inode->i_lock);
+
+#ifdef CONFIG_LUSTRE_FS_POSIX_ACL
+	if (strcmp(name, XATTR_NAME_ACL_ACCESS) == 0)
+		rc = memfs_acl_access_set(inode, value, size);
+	else
+#endif
+		rc = ll_xattr_cache_update(inode, name, value, size, flags);
+	if (rc == 0)
+		inode->i_ctime = current_time(inode);
+	up_write(&lli->lli_xattrs_list_rwsem);
+
+	RETURN(rc);
+}
+
 static int memfs_mknod(struct inode *dir, struct dentry *dchild,
 		       umode_t mode, dev_t rdev)
 {
@@ -1467,6 +2618,521 @@ static inline unsigned char dt_type(struct inode *inode)
 	return (inode->i_mode >> 12) & 15;
 }
 
+/*
+ * Merge readdir for a directory which is Complete(C) in MemFS and has been
+ * flushed to MDT, i.e. WBC_READDIR_HTREE_MERGE policy.
+ *
+ * The flushed entries are read from the hash ordered dir pages on MDT, while
+ * the entries not yet on MDT are read from the hashed index in MemFS. The hash
+ * cookies on MDT and the local hashes are not comparable, thus the two streams
+ * are not interleaved but returned one after the other:
+ * - First the entries on MDT in the MDT hash order, @lfd_pos is an MDT hash
+ *   cookie and @wbcf_mdt_pos is set;
+ * - Then the local only entries in the local hash order, @lfd_pos is a local
+ *   hash.
+ * The position told to user space encodes the phase: a local hash always has
+ * WBC_DIRENT_HASH_LOCAL set, while an MDT hash cookie is shifted by one bit to
+ * keep it clear, see memfs_merge_mdt_pos() and memfs_dir_pos_decode().
+ * Where each entry is read from is decided once the runtime index is built at
+ * the beginning of the iteration, so every entry is returned exactly once even
+ * if it is flushed in the middle of the iteration. A directory not flushed yet
+ * at that time is read from MemFS only.
+ * The dcache is still authoritative for a Complete(C) directory:
+ * - An entry on MDT is returned only if there is a positive dentry with the
+ *   same name and FID in MemFS, and there was no pending namespace update on
+ *   the name. Thus the entries removed or renamed locally but not yet on MDT
+ *   are suppressed;
+ * - A dentry in MemFS is returned only if the file was not flushed yet, or it
+ *   is the new name of a pending rename or link on MDT.
+ */
+struct memfs_dir_emitter {
+#ifdef HAVE_DIR_CONTEXT
+	struct dir_context	*mde_ctx;
+#else
+	void			*mde_dirent;
+	filldir_t		 mde_filldir;
+#endif
+};
+
+static inline bool memfs_dir_emit(struct memfs_dir_emitter *mde,
+				  const char *name, int namelen, loff_t pos,
+				  u64 ino, unsigned int type)
+{
+#ifdef HAVE_DIR_CONTEXT
+	mde->mde_ctx->pos = pos;
+	return dir_emit(mde->mde_ctx, name, namelen, ino, type);
+#else
+	return mde->mde_filldir(mde->mde_dirent, name, namelen, pos,
+				ino, type) >= 0;
+#endif
+}
+
+/* Return "." and ".." at the positions 0 and 1. */
+static bool memfs_dir_emit_dots(struct file *file,
+				struct memfs_dir_emitter *mde, __u64 *ppos)
+{
+	struct dentry *dentry = file->f_path.dentry;
+
+	if (*ppos == 0) {
+		if (!memfs_dir_emit(mde, ".", 1, 0, file_inode(file)->i_ino,
+				    DT_DIR))
+			return false;
+		*ppos = 1;
+	}
+
+	if (*ppos == 1) {
+		if (!memfs_dir_emit(mde, "..", 2, 1, parent_ino(dentry),
+				    DT_DIR))
+			return false;
+		*ppos = 2;
+	}
+
+	return true;
+}
+
+/*
+ * Return the entries in the hashed index @hidx from the position @ppos with
+ * the first @poff entries at the hash @ppos skipped, which were returned by
+ * the previous call. The entries which merge readdir() returns from MDT are
+ * skipped as well. The position and the offset of the first entry not
+ * returned yet are saved back.
+ */
+static void memfs_hindex_emit(struct memfs_dir_emitter *mde,
+			      struct ll_sb_info *sbi, struct wbc_hindex *hidx,
+			      __u64 *ppos, __u32 *poff)
+{
+	__u64 pos = *ppos;
+	__u32 off = *poff;
+	struct wbc_hnode *node;
+
+	for (node = wbc_hindex_seek_pos(hidx, pos, off); node != NULL;
+	     node = wbc_hindex_next(node)) {
+		struct dentry *dchild = node->whn_dentry;
+
+		if (node->whn_hash != pos) {
+			pos = node->whn_hash;
+			off = 0;
+		}
+
+		if (!node->whn_mdt && simple_positive(dchild) &&
+		    !memfs_dir_emit(mde, dchild->d_name.name,
+				    dchild->d_name.len,
+				    wbc_dirent_hash2pos(sbi, pos),
+				    d_inode(dchild)->i_ino,
+				    dt_type(d_inode(dchild))))
+			break;
+		off++;
+	}
+
+	if (node == NULL) {
+		pos = MDS_DIR_END_OFF;
+		off = 0;
+	}
+
+	*ppos = pos;
+	*poff = off;
+}
+
+/* Set the position of @file after a readdir() call. */
+static inline void memfs_dir_pos_set(struct file *file,
+				     struct memfs_dir_emitter *mde,
+				     loff_t pos)
+{
+#ifdef HAVE_DIR_CONTEXT
+	mde->mde_ctx->pos = pos;
+#else
+	file->f_pos = pos;
+#endif
+}
+
+/* Position told to user space for the MDT hash cookie @hash. */
+static inline loff_t memfs_merge_mdt_pos(struct ll_sb_info *sbi, __u64 hash)
+{
+	if (hash >= 2 && hash != MDS_DIR_END_OFF)
+		hash = max_t(__u64, hash >> 1, 2);
+
+	return wbc_dirent_hash2pos(sbi, hash);
+}
+
+/*
+ * Decode the position @lfd_pos set by seekdir() for merge readdir(), also
+ * when it goes on after reopen. A position without WBC_DIRENT_HASH_LOCAL is in
+ * the MDT phase if the iteration has one. The lowest bit of the MDT hash lost
+ * in the encoding may have an entry at the neighbouring hash returned again,
+ * as for a hash collision.
+ */
+void memfs_dir_pos_decode(struct ll_file_data *fd)
+{
+	struct wbc_file *wbcf = &fd->fd_wbc_file;
+	__u64 pos = fd->lfd_pos;
+
+	if (wbcf->wbcf_readdir_pol != WBC_READDIR_HTREE_MERGE &&
+	    !wbcf->wbcf_resume.wdr_merge)
+		return;
+
+	if (pos == MDS_DIR_END_OFF)
+		return;
+
+	wbcf->wbcf_mdt_pos = wbcf->wbcf_mdt_read &&
+			     !(pos & WBC_DIRENT_HASH_LOCAL);
+	if (wbcf->wbcf_mdt_pos && pos > 2)
+		fd->lfd_pos = pos << 1;
+}
+
+/* Whether @name under @dir will be created on MDT by a pending update. */
+static bool memfs_name_pending(struct inode *dir, const char *name,
+			       int namelen)
+{
+	struct wbc_inode *wbci = ll_i2wbci(dir);
+	struct wbc_removed_item *item;
+	bool found = false;
+
+	spin_lock(&wbci->wbci_removed_lock);
+	list_for_each_entry(item, &wbci->wbci_removed_list, wbvi_item) {
+		if (item->wbvi_opc == MD_OP_RENAME_LOCKLESS &&
+		    item->wbvi_tgt_namelen == namelen &&
+		    !memcmp(wbc_removed_item_tgt_name(item), name, namelen)) {
+			found = true;
+			break;
+		}
+
+		if (item->wbvi_opc == MD_OP_LINK_LOCKLESS &&
+		    item->wbvi_namelen == namelen &&
+		    !memcmp(item->wbvi_name, name, namelen)) {
+			found = true;
+			break;
+		}
+	}
+	spin_unlock(&wbci->wbci_removed_lock);
+
+	return found;
+}
+
+/* Mark the indexed entries which merge readdir() returns from MDT. */
+static void memfs_merge_classify(struct inode *dir, struct wbc_hindex *hidx)
+{
+	struct rb_node *n;
+
+	for (n = rb_first(&hidx->whi_root); n != NULL; n = rb_next(n)) {
+		struct wbc_hnode *node = rb_entry(n, struct wbc_hnode,
+						  whn_node);
+		struct dentry *dchild = node->whn_dentry;
+
+		node->whn_mdt = simple_positive(dchild) &&
+				wbc_inode_was_flushed(
+					ll_i2wbci(d_inode(dchild))) &&
+				!memfs_name_pending(dir, dchild->d_name.name,
+						    dchild->d_name.len);
+	}
+}
+
+/* Find the indexed entry with the name @name and the FID @fid. */
+static struct wbc_hnode *memfs_hindex_lookup(struct wbc_hindex *hidx,
+					     const char *name, int namelen,
+					     const struct lu_fid *fid)
+{
+	struct qstr qstr = QSTR_INIT(name, namelen);
+	__u64 hash = wbc_dirent_hash(&qstr);
+	struct wbc_hnode *node;
+
+	for (node = wbc_hindex_seek(hidx, hash);
+	     node != NULL && node->whn_hash == hash;
+	     node = wbc_hindex_next(node)) {
+		struct dentry *dchild = node->whn_dentry;
+
+		if (dchild->d_name.len != namelen ||
+		    memcmp(dchild->d_name.name, name, namelen))
+			continue;
+
+		if (dchild->d_inode != NULL &&
+		    lu_fid_eq(ll_inode2fid(dchild->d_inode), fid))
+			return node;
+	}
+
+	return NULL;
+}
+
+/*
+ * Read the entries on MDT from the position @ppos for merge readdir(). The
+ * index lock @whi_lock is dropped while reading a dir page from MDT, thus no
+ * index node is kept across the RPC.
+ */
+static int memfs_merge_mdt_read(struct file *file,
+				struct memfs_dir_emitter *mde,
+				struct wbc_hindex *hidx, __u64 *ppos)
+{
+	struct inode *dir = file_inode(file);
+	struct ll_sb_info *sbi = ll_i2sbi(dir);
+	bool api32 = ll_need_32bit_api(sbi);
+	struct md_op_data *op_data;
+	__u64 pos = *ppos;
+	bool done = false;
+	int rc = 0;
+
+	ENTRY;
+
+	op_data = ll_prep_md_op_data(NULL, dir, dir, NULL, 0, 0,
+				     LUSTRE_OPC_ANY, dir);
+	if (IS_ERR(op_data))
+		RETURN(PTR_ERR(op_data));
+
+	op_data->op_bias |= wbc_md_op_bias(ll_i2wbci(dir));
+	while (!done) {
+		struct lu_dirpage *dp;
+		struct lu_dirent *ent;
+		struct page *page;
+		__u64 hash = MDS_DIR_END_OFF;
+
+		mutex_unlock(&hidx->whi_lock);
+		page = ll_get_dir_page(dir, op_data, pos);
+		mutex_lock(&hidx->whi_lock);
+		if (IS_ERR(page)) {
+			rc = PTR_ERR(page);
+			break;
+		}
+
+		dp = page_address(page);
+		for (ent = lu_dirent_start(dp); ent != NULL && !done;
+		     ent = lu_dirent_next(ent)) {
+			int namelen = le16_to_cpu(ent->lde_namelen);
+			struct wbc_hnode *node;
+			struct lu_fid fid;
+
+			hash = le64_to_cpu(ent->lde_hash);
+			/* Skip until the target hash, and the dummy record. */
+			if (hash < pos || namelen == 0)
+				continue;
+
+			fid_le_to_cpu(&fid, &ent->lde_fid);
+			node = memfs_hindex_lookup(hidx, ent->lde_name,
+						   namelen, &fid);
+			if (node == NULL || !node->whn_mdt ||
+			    !simple_positive(node->whn_dentry))
+				continue;
+
+			done = !memfs_dir_emit(mde, ent->lde_name, namelen,
+					       memfs_merge_mdt_pos(sbi, hash),
+					       cl_fid_build_ino(&fid, api32),
+					       S_DT(lu_dirent_type_get(ent)));
+		}
+
+		if (done) {
+			pos = hash;
+			ll_release_page(dir, page, false);
+			break;
+		}
+
+		pos = le64_to_cpu(dp->ldp_hash_end);
+		ll_release_page(dir, page, pos != MDS_DIR_END_OFF &&
+				le32_to_cpu(dp->ldp_flags) & LDF_COLLIDE);
+		done = pos == MDS_DIR_END_OFF;
+	}
+
+	ll_finish_md_op_data(op_data);
+	*ppos = pos;
+	RETURN(rc);
+}
+
+static int memfs_merge_readdir(struct file *file,
+			       struct memfs_dir_emitter *mde,
+			       struct wbc_hindex *hidx)
+{
+	struct inode *dir = file_inode(file);
+	struct ll_sb_info *sbi = ll_i2sbi(dir);
+	struct ll_file_data *fd = file->private_data;
+	struct wbc_file *wbcf = &fd->fd_wbc_file;
+	__u64 pos = fd->lfd_pos;
+	int rc = 0;
+
+	ENTRY;
+
+	if (pos == MDS_DIR_END_OFF)
+		RETURN(0);
+
+	if (pos == 0) {
+		/* The runtime index is (re)built for a new iteration. */
+		wbcf->wbcf_mdt_read = wbc_inode_was_flushed(ll_i2wbci(dir));
+		wbcf->wbcf_mdt_pos = wbcf->wbcf_mdt_read;
+		if (wbcf->wbcf_mdt_read)
+			memfs_merge_classify(dir, hidx);
+	}
+
+	if (!memfs_dir_emit_dots(file, mde, &pos))
+		GOTO(out, rc = 0);
+
+	if (wbcf->wbcf_mdt_pos) {
+		rc = memfs_merge_mdt_read(file, mde, hidx, &pos);
+		if (rc || pos != MDS_DIR_END_OFF)
+			GOTO(out, rc);
+
+		/* Continue with the local only entries in MemFS. */
+		wbcf->wbcf_mdt_pos = 0;
+		wbcf->wbcf_hash_off = 0;
+		pos = 2;
+	}
+
+	memfs_hindex_emit(mde, sbi, hidx, &pos, &wbcf->wbcf_hash_off);
+out:
+	fd->lfd_pos = pos;
+	memfs_dir_pos_set(file, mde, wbcf->wbcf_mdt_pos ?
+					memfs_merge_mdt_pos(sbi, pos) :
+					wbc_dirent_hash2pos(sbi, pos));
+	RETURN(rc);
+}
+
+/*
+ * Save the readdir() state of @file in MemFS into @resume before the file is
+ * reopened on MDT. The runtime index is handed over as the snapshot of the
+ * entries to return for the rest of the iteration, and for merge readdir(), it
+ * tells which entries were returned from MDT as well. A pinned snapshot is
+ * built for the resident index which goes away with Complete(C).
+ */
+void memfs_dir_resume_save(struct file *file, struct wbc_dir_resume *resume)
+{
+	struct ll_file_data *fd = file->private_data;
+	struct wbc_file *wbcf = &fd->fd_wbc_file;
+	struct wbc_hindex *hidx;
+
+	resume->wdr_pos = fd->lfd_pos;
+	if (resume->wdr_pos == 0 || resume->wdr_pos == MDS_DIR_END_OFF)
+		return;
+
+	if (wbcf->wbcf_readdir_pol == WBC_READDIR_HTREE_RESIDENT) {
+		hidx = wbc_hindex_alloc(true);
+		if (hidx != NULL &&
+		    wbc_hindex_build(hidx, file->f_path.dentry)) {
+			wbc_hindex_free(hidx);
+			hidx = NULL;
+		}
+	} else {
+		hidx = wbcf->wbcf_private_data;
+		wbcf->wbcf_private_data = NULL;
+	}
+
+	/* Out of memory, restart the iteration on MDT from the beginning. */
+	if (hidx == NULL) {
+		resume->wdr_pos = 0;
+		return;
+	}
+
+	resume->wdr_index = hidx;
+	resume->wdr_hash_off = wbcf->wbcf_hash_off;
+	resume->wdr_merge = wbcf->wbcf_readdir_pol == WBC_READDIR_HTREE_MERGE;
+	resume->wdr_mdt_read = wbcf->wbcf_mdt_read;
+	resume->wdr_mdt_pos = wbcf->wbcf_mdt_pos;
+}
+
+/* Set the saved readdir() state @resume into @file reopened on MDT. */
+void memfs_dir_resume_set(struct file *file, struct wbc_dir_resume *resume)
+{
+	struct ll_file_data *fd = file->private_data;
+	struct wbc_file *wbcf = &fd->fd_wbc_file;
+
+	fd->lfd_pos = resume->wdr_pos;
+	if (resume->wdr_pos != 0 && resume->wdr_pos != MDS_DIR_END_OFF) {
+		wbcf->wbcf_hash_off = resume->wdr_hash_off;
+		wbcf->wbcf_mdt_read = resume->wdr_mdt_read;
+		wbcf->wbcf_mdt_pos = resume->wdr_mdt_pos;
+		wbcf->wbcf_resume = *resume;
+	}
+}
+
+void memfs_dir_resume_fini(struct wbc_dir_resume *resume)
+{
+	wbc_hindex_free(resume->wdr_index);
+	memset(resume, 0, sizeof(*resume));
+}
+
+/*
+ * Continue readdir() for a directory which was reopened on MDT in the middle
+ * of a hashed readdir() iteration in MemFS.
+ *
+ * The hash cookies in MemFS are not comparable with the ones on MDT, thus the
+ * iteration is not moved to MDT, which would have to read the whole directory
+ * on MDT again to find out the entries not returned yet. Instead it goes on
+ * with the snapshot of the directory taken at reopen in the same order and
+ * with the same positions as in MemFS, so the positions told before stay
+ * valid for seekdir(). For merge readdir(), the entries on MDT are still read
+ * from the dir pages on MDT. The entries added or removed after the reopen
+ * may or may not be returned, as POSIX allows. Once the end is reached, or
+ * upon rewinddir(), it is a normal MDT readdir.
+ */
+#ifdef HAVE_DIR_CONTEXT
+int memfs_dir_resume_read(struct file *file, struct dir_context *ctx)
+#else
+int memfs_dir_resume_read(struct file *file, void *cookie, filldir_t filldir)
+#endif
+{
+	struct ll_sb_info *sbi = ll_i2sbi(file_inode(file));
+	struct ll_file_data *fd = file->private_data;
+	struct wbc_file *wbcf = &fd->fd_wbc_file;
+	struct wbc_dir_resume *resume = &wbcf->wbcf_resume;
+	struct wbc_hindex *hidx = resume->wdr_index;
+	struct memfs_dir_emitter mde = {
+#ifdef HAVE_DIR_CONTEXT
+		.mde_ctx	= ctx,
+#else
+		.mde_dirent	= cookie,
+		.mde_filldir	= filldir,
+#endif
+	};
+	__u64 pos = fd->lfd_pos;
+	int rc = 0;
+
+	ENTRY;
+
+	if (!memfs_dir_emit_dots(file, &mde, &pos))
+		GOTO(out, rc = 0);
+
+	mutex_lock(&hidx->whi_lock);
+	if (wbcf->wbcf_mdt_pos) {
+		rc = memfs_merge_mdt_read(file, &mde, hidx, &pos);
+		if (rc || pos != MDS_DIR_END_OFF)
+			GOTO(out_unlock, rc);
+
+		wbcf->wbcf_mdt_pos = 0;
+		wbcf->wbcf_hash_off = 0;
+		pos = 2;
+	}
+
+	memfs_hindex_emit(&mde, sbi, hidx, &pos, &wbcf->wbcf_hash_off);
+out_unlock:
+	mutex_unlock(&hidx->whi_lock);
+	/* All the entries in the snapshot are returned now. */
+	if (pos == MDS_DIR_END_OFF)
+		memfs_dir_resume_fini(resume);
+out:
+	fd->lfd_pos = pos;
+	memfs_dir_pos_set(file, &mde, wbcf->wbcf_mdt_pos ?
+					memfs_merge_mdt_pos(sbi, pos) :
+					wbc_dirent_hash2pos(sbi, pos));
+	RETURN(rc);
+}
+
+/*
+ * Read the directory in the hashed index @hidx for the policies
+ * WBC_READDIR_HTREE_RUNTIME and WBC_READDIR_HTREE_RESIDENT.
+ */
+static int memfs_hindex_readdir(struct file *file,
+				struct memfs_dir_emitter *mde,
+				struct wbc_hindex *hidx)
+{
+	struct ll_sb_info *sbi = ll_i2sbi(file_inode(file));
+	struct ll_file_data *fd = file->private_data;
+	__u64 pos = fd->lfd_pos;
+
+	if (pos == MDS_DIR_END_OFF)
+		return 0;
+
+	if (memfs_dir_emit_dots(file, mde, &pos))
+		memfs_hindex_emit(mde, sbi, hidx, &pos,
+				  &fd->fd_wbc_file.wbcf_hash_off);
+
+	fd->lfd_pos = pos;
+	memfs_dir_pos_set(file, mde, wbc_dirent_hash2pos(sbi, pos));
+	return 0;
+}
+
 /*
  * Directory is locked and all positive dentries in it are safe, since
  * for ramfs-type trees they can't go away without unlink() or rmdir(),
@@ -1567,6 +3233,7 @@ static int memfs_readdir(struct file *filp, struct dir_context *ctx)
 	if (wbc_inode_complete(wbci)) {
 		struct ll_file_data *fd = filp->private_data;
 		struct getdents_callback64 *buf;
+		struct wbc_hindex *hidx;
 
 		switch (fd->fd_wbc_file.wbcf_readdir_pol) {
 		case WBC_READDIR_DCACHE_COMPAT:
@@ -1589,6 +3256,23 @@ static int memfs_readdir(struct file *filp, struct dir_context *ctx)
 								      ctx);
 			}
 			break;
+		case WBC_READDIR_HTREE_RUNTIME:
+		case WBC_READDIR_HTREE_RESIDENT:
+		case WBC_READDIR_HTREE_MERGE: {
+			struct memfs_dir_emitter mde = { .mde_ctx = ctx };
+
+			hidx = memfs_readdir_hindex_get(filp);
+			if (IS_ERR(hidx))
+				GOTO(up_rwsem, rc = PTR_ERR(hidx));
+
+			if (fd->fd_wbc_file.wbcf_readdir_pol ==
+			    WBC_READDIR_HTREE_MERGE)
+				rc = memfs_merge_readdir(filp, &mde, hidx);
+			else
+				rc = memfs_hindex_readdir(filp, &mde, hidx);
+			mutex_unlock(&hidx->whi_lock);
+			break;
+		}
 		default:
 			rc = -ENOTSUPP;
 			break;
@@ -1603,12 +3287,6 @@ up_rwsem:
 
 #else
 
-/* linux/fs/libfs.c: simple_positive() */
-static inline int simple_positive(struct dentry *dentry)
-{
-	return dentry->d_inode && !d_unhashed(dentry);
-}
-
 /* linux/fs/libfs.c: dcache_readdir() */
 int memfs_dcache_readdir(struct file *filp, void *dirent, filldir_t filldir)
 {
@@ -1682,6 +3360,7 @@ static int memfs_readdir(struct file *filp, void *dirent, filldir_t filldir)
 	if (wbc_inode_complete(wbci)) {
 		struct ll_file_data *fd = filp->private_data;
 		struct getdents_callback64 *buf;
+		struct wbc_hindex *hidx;
 
 		switch (fd->fd_wbc_file.wbcf_readdir_pol) {
 		case WBC_READDIR_DCACHE_COMPAT:
@@ -1704,6 +3383,26 @@ static int memfs_readdir(struct file *filp, void *dirent, filldir_t filldir)
 							       filldir);
 			}
 			break;
+		case WBC_READDIR_HTREE_RUNTIME:
+		case WBC_READDIR_HTREE_RESIDENT:
+		case WBC_READDIR_HTREE_MERGE: {
+			struct memfs_dir_emitter mde = {
+				.mde_dirent	= dirent,
+				.mde_filldir	= filldir,
+			};
+
+			hidx = memfs_readdir_hindex_get(filp);
+			if (IS_ERR(hidx))
+				GOTO(up_rwsem, rc = PTR_ERR(hidx));
+
+			if (fd->fd_wbc_file.wbcf_readdir_pol ==
+			    WBC_READDIR_HTREE_MERGE)
+				rc = memfs_merge_readdir(filp, &mde, hidx);
+			else
+				rc = memfs_hindex_readdir(filp, &mde, hidx);
+			mutex_unlock(&hidx->whi_lock);
+			break;
+		}
 		default:
 			rc = -ENOTSUPP;
 			break;
@@ -1750,10 +3449,24 @@ static void *memfs_follow_link(struct dentry *dentry, struct nameidata *nd)
 }
 #endif /* HAVE_IOP_GET_LINK */
 
+static loff_t memfs_dir_llseek(struct file *file, loff_t offset, int origin)
+{
+	struct ll_file_data *fd = file->private_data;
+
+	/*
+	 * The position is a hash cookie in the format of MDT readdir. For
+	 * merge readdir(), it tells the phase as well, see ll_dir_seek().
+	 */
+	if (wbc_readdir_pol_hashed(fd->fd_wbc_file.wbcf_readdir_pol))
+		return ll_dir_operations.llseek(file, offset, origin);
+
+	return dcache_dir_lseek(file, offset, origin);
+}
+
 static const struct file_operations memfs_dir_operations = {
 	.open		= memfs_dir_open,
 	.release	= memfs_dir_close,
-	.llseek		= dcache_dir_lseek,
+	.llseek		= memfs_dir_llseek,
 	.read		= generic_read_dir,
 #ifdef HAVE_DIR_CONTEXT
 	.iterate_shared	= memfs_readdir,
@@ -1776,11 +3489,25 @@ static const struct inode_operations memfs_dir_inode_operations = {
 	.rename		= memfs_rename,
 	.setattr	= memfs_setattr,
 	.getattr	= memfs_getattr,
+#ifdef HAVE_IOP_XATTR
+	.setxattr	= ll_setxattr,
+	.getxattr	= ll_getxattr,
+	.removexattr	= ll_removexattr,
+#endif
+	.listxattr	= ll_listxattr,
+	.get_acl	= ll_get_acl,
 };
 
 static const struct inode_operations memfs_file_inode_operations = {
 	.setattr	= memfs_setattr,
 	.getattr	= memfs_getattr,
+#ifdef HAVE_IOP_XATTR
+	.setxattr	= ll_setxattr,
+	.getxattr	= ll_getxattr,
+	.removexattr	= ll_removexattr,
+#endif
+	.listxattr	= ll_listxattr,
+	.get_acl	= ll_get_acl,
 };
 
 static const struct file_operations memfs_file_operations = {
@@ -1069,8 +1069,12 @@ static struct dentry *ll_lookup_nd(struct inode *parent, struct dentry *dentry,
 	de = ll_lookup_it(parent, dentry, itp, NULL, NULL, NULL, false,
 			  NULL, NULL);
 
-	if (itp != NULL)
+	if (itp != NULL) {
 		ll_intent_release(itp);
+		/* Prefetch a plain directory into MemFS if configured. */
+		if (!IS_ERR(de))
+			ll_dir_prefetch(parent, de != NULL ? de : dentry);
+	}
 
 	if (IS_ERR(de) && PTR_ERR(de) == -ENOENT && (flags & LOOKUP_CREATE))
 		de = NULL;
@@ -1142,6 +1146,8 @@ static int ll_atomic_open(struct inode *dir, struct dentry *dentry,
 			item.pm_gid = from_kgid(&init_user_ns, current_gid());
 			item.pm_projid = ll_i2info(dir)->lli_projid;
 			item.pm_name = &dentry->d_name;
+			item.pm_jobid = NULL;
+			item.pm_path = NULL;
 			dataset = pcc_dataset_match_get(&sbi->ll_pcc_super,
 							&item);
 			pca.pca_dataset = dataset;
@@ -1696,6 +1702,7 @@ static int ll_mkdir(struct inode *dir, struct dentry *dchild, umode_t mode)
 	struct md_op_data *op_data;
 	struct inode *inode = NULL;
 	ktime_t kstart = ktime_get();
+	struct wbc_cache_spec spec;
 	bool excl_cache = false;
 	__u64 extra_lock_flags;
 	int rc;
@@ -1714,7 +1721,7 @@ static int ll_mkdir(struct inode *dir, struct dentry *dchild, umode_t mode)
 	 * LDLM_FL_NO_LRU.
 	 */
 	excl_cache = wbc_may_exclusive_cache(dir, dchild, mode,
-					     &extra_lock_flags);
+					     &extra_lock_flags, &spec);
 
 	if (!excl_cache) {
 		mode = (mode & (S_IRWXUGO | S_ISVTX)) | S_IFDIR;
@@ -1728,7 +1735,7 @@ static int ll_mkdir(struct inode *dir, struct dentry *dchild, umode_t mode)
 				     dchild->d_name.len, mode, LUSTRE_OPC_MKDIR,
 				     NULL);
 	if (IS_ERR(op_data))
-		RETURN(PTR_ERR(op_data));
+		GOTO(out_stats, rc = PTR_ERR(op_data));
 
 	if (extra_lock_flags & LDLM_FL_INTENT_PARENT_LOCKED)
 		op_data->op_bias |= MDS_WBC_LOCKLESS;
@@ -1760,7 +1767,7 @@ static int ll_mkdir(struct inode *dir, struct dentry *dchild, umode_t mode)
 		GOTO(out_fini, rc);
 
 	if (excl_cache)
-		wbc_intent_inode_init(dir, inode, &mkdir_it);
+		wbc_intent_inode_init(dir, inode, &mkdir_it, &spec);
 
 	if (sbi->ll_flags & LL_SBI_FILE_SECCTX && !excl_cache) {
 		inode_lock(inode);
@@ -1806,6 +1813,8 @@ out_fini:
 	ll_intent_release(&mkdir_it);
 	ptlrpc_req_finished(request);
 out_stats:
+	/* Drop the quota of the matched rule if not taken by the root. */
+	wbc_cache_spec_fini(ll_i2wbcs(dir), &spec);
 	if (rc == 0)
 		ll_stats_ops_tally(sbi, LPROC_LL_MKDIR,
 				   ktime_us_delta(ktime_get(), kstart));
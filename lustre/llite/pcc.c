@@ -162,6 +162,8 @@ static void pcc_expression_free(struct pcc_expression *expr)
 		pcc_id_list_free(&expr->pe_cond);
 		break;
 	case PCC_FIELD_FNAME:
+	case PCC_FIELD_JOBID:
+	case PCC_FIELD_PATH:
 		pcc_fname_list_free(&expr->pe_cond);
 		break;
 	default:
@@ -184,7 +186,7 @@ static void pcc_conjunction_free(struct pcc_conjunction *conjunction)
 	OBD_FREE_PTR(conjunction);
 }
 
-static void pcc_rule_conds_free(struct list_head *cond_list)
+void pcc_rule_conds_free(struct list_head *cond_list)
 {
 	struct pcc_conjunction *conjunction, *n;
 
@@ -353,6 +355,18 @@ pcc_expression_parse(struct cfs_lstr *src, struct list_head *cond_list)
 					 &expr->pe_cond) < 0)
 			GOTO(out, rc = -EINVAL);
 		expr->pe_field = PCC_FIELD_FNAME;
+	} else if (pcc_check_field(&field, "jobid")) {
+		if (pcc_fname_list_parse(src->ls_str,
+					 src->ls_len,
+					 &expr->pe_cond) < 0)
+			GOTO(out, rc = -EINVAL);
+		expr->pe_field = PCC_FIELD_JOBID;
+	} else if (pcc_check_field(&field, "path")) {
+		if (pcc_fname_list_parse(src->ls_str,
+					 src->ls_len,
+					 &expr->pe_cond) < 0)
+			GOTO(out, rc = -EINVAL);
+		expr->pe_field = PCC_FIELD_PATH;
 	} else {
 		GOTO(out, rc = -EINVAL);
 	}
@@ -392,7 +406,7 @@ pcc_conjunction_parse(struct cfs_lstr *src, struct list_head *cond_list)
 	return rc;
 }
 
-static int pcc_conds_parse(char *str, int len, struct list_head *cond_list)
+int pcc_conds_parse(char *str, int len, struct list_head *cond_list)
 {
 	struct cfs_lstr src;
 	struct cfs_lstr res;
@@ -414,6 +428,22 @@ static int pcc_conds_parse(char *str, int len, struct list_head *cond_list)
 	return rc;
 }
 
+/* Return the fields referred by the conditions, in bits of enum pcc_field. */
+__u32 pcc_conds_fields(struct list_head *cond_list)
+{
+	struct pcc_conjunction *conjunction;
+	struct pcc_expression *expr;
+	__u32 fields = 0;
+
+	list_for_each_entry(conjunction, cond_list, pc_linkage) {
+		list_for_each_entry(expr, &conjunction->pc_expressions,
+				    pe_linkage)
+			fields |= BIT(expr->pe_field);
+	}
+
+	return fields;
+}
+
 static int pcc_id_parse(struct pcc_cmd *cmd, const char *id)
 {
 	int rc;
@@ -427,6 +457,10 @@ static int pcc_id_parse(struct pcc_cmd *cmd, const char *id)
 	rc = pcc_conds_parse(cmd->u.pccc_add.pccc_conds_str,
 			     strlen(cmd->u.pccc_add.pccc_conds_str),
 			     &cmd->u.pccc_add.pccc_conds);
+	/* The job ID and path are not collected for PCC. */
+	if (rc == 0 && pcc_conds_fields(&cmd->u.pccc_add.pccc_conds) &
+		       (BIT(PCC_FIELD_JOBID) | BIT(PCC_FIELD_PATH)))
+		rc = -EINVAL;
 	if (rc)
 		pcc_cmd_fini(cmd);
 
@@ -658,6 +692,14 @@ pcc_expression_match(struct pcc_expression *expr, struct pcc_matcher *matcher)
 	case PCC_FIELD_FNAME:
 		return pcc_fname_list_match(&expr->pe_cond,
 					    matcher->pm_name->name);
+	case PCC_FIELD_JOBID:
+		return matcher->pm_jobid &&
+		       pcc_fname_list_match(&expr->pe_cond,
+					    matcher->pm_jobid);
+	case PCC_FIELD_PATH:
+		return matcher->pm_path &&
+		       pcc_fname_list_match(&expr->pe_cond,
+					    matcher->pm_path);
 	default:
 		return 0;
 	}
@@ -679,8 +721,7 @@ pcc_conjunction_match(struct pcc_conjunction *conjunction,
 	return 1;
 }
 
-static int
-pcc_cond_match(struct pcc_match_rule *rule, struct pcc_matcher *matcher)
+int pcc_cond_match(struct pcc_match_rule *rule, struct pcc_matcher *matcher)
 {
 	struct pcc_conjunction *conjunction;
 	int matched;
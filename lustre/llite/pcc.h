@@ -59,6 +59,9 @@ enum pcc_field {
 	PCC_FIELD_GID,
 	PCC_FIELD_PROJID,
 	PCC_FIELD_FNAME,
+	/* Only used by the WBC rules, see wbc_rule_match(). */
+	PCC_FIELD_JOBID,
+	PCC_FIELD_PATH,
 	PCC_FIELD_MAX
 };
 
@@ -88,6 +91,9 @@ struct pcc_matcher {
 	__u32		 pm_gid;
 	__u32		 pm_projid;
 	struct qstr	*pm_name;
+	/* Job ID and path of the parent, NULL if not in the conditions. */
+	const char	*pm_jobid;
+	const char	*pm_path;
 };
 
 enum pcc_dataset_flags {
@@ -219,6 +225,10 @@ struct pcc_create_attach {
 	struct dentry *pca_dentry;
 };
 
+int pcc_conds_parse(char *str, int len, struct list_head *cond_list);
+void pcc_rule_conds_free(struct list_head *cond_list);
+__u32 pcc_conds_fields(struct list_head *cond_list);
+int pcc_cond_match(struct pcc_match_rule *rule, struct pcc_matcher *matcher);
 int pcc_super_init(struct pcc_super *super);
 void pcc_super_fini(struct pcc_super *super);
 int pcc_cmd_handle(char *buffer, unsigned long count,
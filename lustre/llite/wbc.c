@@ -34,6 +34,7 @@
 #include <lustre_compat.h>
 #include <linux/security.h>
 #include <linux/swap.h>
+#include <linux/memcontrol.h>
 #include "llite_internal.h"
 
 void wbc_super_root_add(struct inode *inode)
@@ -43,10 +44,17 @@ void wbc_super_root_add(struct inode *inode)
 
 	LASSERT(wbci->wbci_flags & WBC_STATE_FL_ROOT);
 	spin_lock(&super->wbcs_lock);
+	/*
+	 * A new root may hold any update logged since the last checkpoint
+	 * when it is a child of a root being flushed.
+	 */
+	wbci->wbci_jseq = READ_ONCE(super->wbcs_journal.wj_ckpt_seq) + 1;
 	if (wbc_flush_mode_lazy(wbci))
 		list_add(&wbci->wbci_root_list, &super->wbcs_lazy_roots);
 	else
 		list_add(&wbci->wbci_root_list, &super->wbcs_roots);
+	if (wbci->wbci_quota)
+		atomic_inc(&wbci->wbci_quota->wq_roots);
 	spin_unlock(&super->wbcs_lock);
 }
 
@@ -57,8 +65,11 @@ void wbc_super_root_del(struct inode *inode)
 
 	LASSERT(wbci->wbci_flags & WBC_STATE_FL_ROOT);
 	spin_lock(&super->wbcs_lock);
-	if (!list_empty(&wbci->wbci_root_list))
+	if (!list_empty(&wbci->wbci_root_list)) {
 		list_del_init(&wbci->wbci_root_list);
+		if (wbci->wbci_quota)
+			atomic_dec(&wbci->wbci_quota->wq_roots);
+	}
 	spin_unlock(&super->wbcs_lock);
 }
 
@@ -142,18 +153,258 @@ void wbc_inode_writeback_complete(struct inode *inode)
 	wake_up_bit(&wbci->wbci_flags, __WBC_STATE_FL_WRITEBACK);
 }
 
-int wbc_reserve_inode(struct wbc_super *super)
+struct wbc_quota *wbc_quota_alloc(struct wbc_super *super, const char *name,
+				  unsigned long max_inodes,
+				  unsigned long max_pages, bool shared)
+{
+	struct wbc_quota *quota;
+
+	OBD_ALLOC_PTR(quota);
+	if (quota == NULL)
+		return NULL;
+
+#ifdef HAVE_PERCPU_COUNTER_INIT_GFP_FLAG
+	if (percpu_counter_init(&quota->wq_inodes, 0, GFP_NOFS))
+		goto out_free;
+	if (percpu_counter_init(&quota->wq_pages, 0, GFP_NOFS))
+		goto out_inodes;
+	if (percpu_counter_init(&quota->wq_dirty, 0, GFP_NOFS))
+		goto out_pages;
+#else
+	if (percpu_counter_init(&quota->wq_inodes, 0))
+		goto out_free;
+	if (percpu_counter_init(&quota->wq_pages, 0))
+		goto out_inodes;
+	if (percpu_counter_init(&quota->wq_dirty, 0))
+		goto out_pages;
+#endif
+
+	INIT_LIST_HEAD(&quota->wq_linkage);
+	atomic_set(&quota->wq_refcount, 1);
+	quota->wq_max_inodes = max_inodes;
+	quota->wq_max_pages = max_pages;
+	atomic_set(&quota->wq_roots, 0);
+	atomic64_set(&quota->wq_denied, 0);
+	atomic64_set(&quota->wq_reclaimed_inodes, 0);
+	atomic64_set(&quota->wq_reclaimed_pages, 0);
+	quota->wq_shared = shared;
+	strlcpy(quota->wq_name, name, sizeof(quota->wq_name));
+
+	spin_lock(&super->wbcs_lock);
+	list_add_tail(&quota->wq_linkage, &super->wbcs_quotas);
+	spin_unlock(&super->wbcs_lock);
+
+	return quota;
+
+out_pages:
+	percpu_counter_destroy(&quota->wq_pages);
+out_inodes:
+	percpu_counter_destroy(&quota->wq_inodes);
+out_free:
+	OBD_FREE_PTR(quota);
+	return NULL;
+}
+
+void wbc_quota_put(struct wbc_super *super, struct wbc_quota *quota)
+{
+	if (quota == NULL ||
+	    !atomic_dec_and_lock(&quota->wq_refcount, &super->wbcs_lock))
+		return;
+
+	list_del_init(&quota->wq_linkage);
+	if (test_bit(WBC_QUOTA_FL_OVER, &quota->wq_flags))
+		atomic_dec(&super->wbcs_quotas_over);
+	spin_unlock(&super->wbcs_lock);
+
+	if (percpu_counter_sum(&quota->wq_inodes) ||
+	    percpu_counter_sum(&quota->wq_pages))
+		CWARN("WBC quota %s freed with %lld inodes %lld pages in use\n",
+		      quota->wq_name, percpu_counter_sum(&quota->wq_inodes),
+		      percpu_counter_sum(&quota->wq_pages));
+	percpu_counter_destroy(&quota->wq_dirty);
+	percpu_counter_destroy(&quota->wq_pages);
+	percpu_counter_destroy(&quota->wq_inodes);
+	OBD_FREE_PTR(quota);
+}
+
+static inline unsigned long wbc_quota_hiwm(unsigned long limit, int ratio)
+{
+	return ratio ? limit * ratio / 100 : limit;
+}
+
+static bool wbc_quota_over_hiwm(struct wbc_super *super,
+				struct wbc_quota *quota)
+{
+	int ratio = super->wbcs_conf.wbcc_hiwm_ratio;
+	unsigned long limit;
+
+	limit = READ_ONCE(quota->wq_max_inodes);
+	if (limit && wbc_counter_compare(&quota->wq_inodes,
+					 wbc_quota_hiwm(limit, ratio),
+					 limit) >= 0)
+		return true;
+
+	limit = READ_ONCE(quota->wq_max_pages);
+	if (limit && wbc_counter_compare(&quota->wq_pages,
+					 wbc_quota_hiwm(limit, ratio),
+					 limit) >= 0)
+		return true;
+
+	return false;
+}
+
+/*
+ * Hand over a quota above its high watermark to the reclaimer, which
+ * reclaims the over-quota roots before the others.
+ */
+static void wbc_quota_check(struct wbc_super *super, struct wbc_quota *quota)
+{
+	if (!wbc_quota_over_hiwm(super, quota) ||
+	    test_and_set_bit(WBC_QUOTA_FL_OVER, &quota->wq_flags))
+		return;
+
+	atomic_inc(&super->wbcs_quotas_over);
+	wake_up_process(super->wbcs_reclaim_task);
+}
+
+static int wbc_quota_charge_inode(struct wbc_super *super,
+				  struct wbc_quota *quota)
+{
+	unsigned long limit;
+
+	if (quota == NULL)
+		return 0;
+
+	/* Charge first, so that the racing charges never exceed the limit. */
+	limit = READ_ONCE(quota->wq_max_inodes);
+	wbc_counter_add(&quota->wq_inodes, 1, limit);
+	if (limit && wbc_counter_compare(&quota->wq_inodes, limit, limit) > 0) {
+		wbc_counter_add(&quota->wq_inodes, -1, limit);
+		atomic64_inc(&quota->wq_denied);
+		wbc_quota_check(super, quota);
+		return -ENOSPC;
+	}
+
+	wbc_quota_check(super, quota);
+	return 0;
+}
+
+static inline void wbc_quota_uncharge_inode(struct wbc_quota *quota)
+{
+	if (quota)
+		wbc_counter_add(&quota->wq_inodes, -1,
+				READ_ONCE(quota->wq_max_inodes));
+}
+
+bool wbc_quota_charge_pages(struct wbc_super *super, struct wbc_quota *quota,
+			    long nr_pages)
+{
+	unsigned long limit;
+
+	if (quota == NULL)
+		return true;
+
+	limit = READ_ONCE(quota->wq_max_pages);
+	wbc_counter_add(&quota->wq_pages, nr_pages, limit);
+	if (limit && wbc_counter_compare(&quota->wq_pages, limit, limit) > 0) {
+		wbc_counter_add(&quota->wq_pages, -nr_pages, limit);
+		atomic64_inc(&quota->wq_denied);
+		wbc_quota_check(super, quota);
+		return false;
+	}
+
+	wbc_quota_check(super, quota);
+	return true;
+}
+
+void wbc_quota_uncharge_pages(struct wbc_quota *quota, long nr_pages)
+{
+	if (quota)
+		wbc_counter_add(&quota->wq_pages, -nr_pages,
+				READ_ONCE(quota->wq_max_pages));
+}
+
+/*
+ * Charge the new root WBC directory @inode to the quota of the rule it
+ * matched, otherwise to a quota of its own with the default limits.
+ */
+void wbc_quota_root_init(struct inode *inode, struct wbc_cache_spec *spec)
 {
+	struct wbc_super *super = ll_i2wbcs(inode);
 	struct wbc_conf *conf = &super->wbcs_conf;
-	int rc = 0;
+	struct wbc_inode *wbci = ll_i2wbci(inode);
+	char name[WBC_QUOTA_NAME_MAX];
+
+	LASSERT(wbci->wbci_quota == NULL);
+	if (spec && spec->wcs_quota) {
+		wbci->wbci_quota = spec->wcs_quota;
+		spec->wcs_quota = NULL;
+		return;
+	}
+
+	snprintf(name, sizeof(name), DFID, PFID(ll_inode2fid(inode)));
+	wbci->wbci_quota = wbc_quota_alloc(super, name,
+					   READ_ONCE(conf->wbcc_root_max_inodes),
+					   READ_ONCE(conf->wbcc_root_max_pages),
+					   false);
+}
+
+void wbc_cache_spec_fini(struct wbc_super *super, struct wbc_cache_spec *spec)
+{
+	wbc_quota_put(super, spec->wcs_quota);
+	spec->wcs_quota = NULL;
+}
+
+void wbc_quotas_seq_show(struct seq_file *m, struct wbc_super *super)
+{
+	struct wbc_quota *quota;
+
+	spin_lock(&super->wbcs_lock);
+	list_for_each_entry(quota, &super->wbcs_quotas, wq_linkage) {
+		seq_printf(m, "%s: roots=%d shared=%d over=%d\n",
+			   quota->wq_name, atomic_read(&quota->wq_roots),
+			   quota->wq_shared,
+			   test_bit(WBC_QUOTA_FL_OVER, &quota->wq_flags));
+		seq_printf(m, "  inodes=%lld max_inodes=%lu",
+			   percpu_counter_sum(&quota->wq_inodes),
+			   quota->wq_max_inodes);
+		seq_printf(m, " pages=%lld max_pages=%lu\n",
+			   percpu_counter_sum(&quota->wq_pages),
+			   quota->wq_max_pages);
+		seq_printf(m, "  denied=%lld",
+			   (long long)atomic64_read(&quota->wq_denied));
+		seq_printf(m, " reclaimed_inodes=%lld reclaimed_pages=%lld\n",
+			   (long long)
+			   atomic64_read(&quota->wq_reclaimed_inodes),
+			   (long long)
+			   atomic64_read(&quota->wq_reclaimed_pages));
+	}
+	spin_unlock(&super->wbcs_lock);
+}
+
+int wbc_reserve_inode(struct wbc_super *super, struct wbc_quota *quota)
+{
+	struct wbc_conf *conf = &super->wbcs_conf;
+	int rc;
+
+	rc = wbc_quota_charge_inode(super, quota);
+	if (rc)
+		return rc;
 
+	/*
+	 * The per-CPU counter is only summed up when close to the limit, so
+	 * the creates on different CPUs do not bounce a shared cache line.
+	 */
+	wbc_counter_add(&conf->wbcc_used_inodes, 1, conf->wbcc_max_inodes);
 	if (conf->wbcc_max_inodes) {
-		spin_lock(&super->wbcs_lock);
-		if (!conf->wbcc_free_inodes)
+		if (wbc_counter_compare(&conf->wbcc_used_inodes,
+					conf->wbcc_max_inodes,
+					conf->wbcc_max_inodes) > 0) {
+			wbc_counter_add(&conf->wbcc_used_inodes, -1,
+					conf->wbcc_max_inodes);
+			wbc_quota_uncharge_inode(quota);
 			rc = -ENOSPC;
-		else
-			conf->wbcc_free_inodes--;
-		spin_unlock(&super->wbcs_lock);
+		}
 		if (wbc_cache_too_much_inodes(conf))
 			wake_up_process(super->wbcs_reclaim_task);
 	}
@@ -166,37 +417,45 @@ void wbc_unreserve_inode(struct inode *inode)
 	struct wbc_inode *wbci = ll_i2wbci(inode);
 
 	wbci->wbci_flags &= ~WBC_STATE_FL_INODE_RESERVED;
-	if (super->wbcs_conf.wbcc_max_inodes) {
-		spin_lock(&super->wbcs_lock);
-		if (!list_empty(&wbci->wbci_rsvd_lru))
-			list_del_init(&wbci->wbci_rsvd_lru);
-		super->wbcs_conf.wbcc_free_inodes++;
-		spin_unlock(&super->wbcs_lock);
-	}
+	list_lru_del(&super->wbcs_rsvd_inode_lru, &wbci->wbci_rsvd_lru);
+	wbc_quota_uncharge_inode(wbci->wbci_quota);
+	wbc_counter_add(&super->wbcs_conf.wbcc_used_inodes, -1,
+			super->wbcs_conf.wbcc_max_inodes);
 }
 
+/*
+ * The reserved inodes are kept in the LRU list for the reclaimer to enforce
+ * the inode limits, and for the shrinker to find them under memory pressure.
+ * Without either of them the LRU list is not walked, so the insertion is
+ * skipped. The inodes reserved meanwhile are not reclaimed when a limit is
+ * set later, until they are flushed.
+ */
 void wbc_reserved_inode_lru_add(struct inode *inode)
 {
 	struct wbc_super *super = ll_i2wbcs(inode);
+	struct wbc_conf *conf = &super->wbcs_conf;
+	struct wbc_inode *wbci = ll_i2wbci(inode);
 
-	if (super->wbcs_conf.wbcc_max_inodes) {
-		spin_lock(&super->wbcs_lock);
-		list_add_tail(&ll_i2wbci(inode)->wbci_rsvd_lru,
-			      &super->wbcs_rsvd_inode_lru);
-		spin_unlock(&super->wbcs_lock);
-	}
+	if (!READ_ONCE(conf->wbcc_max_inodes) &&
+	    !READ_ONCE(conf->wbcc_shrinker) &&
+	    (wbci->wbci_quota == NULL ||
+	     !READ_ONCE(wbci->wbci_quota->wq_max_inodes)))
+		return;
+
+	list_lru_add(&super->wbcs_rsvd_inode_lru, &wbci->wbci_rsvd_lru);
 }
 
 void wbc_reserved_inode_lru_del(struct inode *inode)
 {
 	struct wbc_super *super = ll_i2wbcs(inode);
+	struct wbc_inode *wbci = ll_i2wbci(inode);
 
-	if (super->wbcs_conf.wbcc_max_inodes) {
-		spin_lock(&super->wbcs_lock);
-		list_del_init(&ll_i2wbci(inode)->wbci_rsvd_lru);
-		super->wbcs_conf.wbcc_free_inodes++;
-		spin_unlock(&super->wbcs_lock);
-	}
+	/* Do not unreserve it again when the inode is freed. */
+	wbci->wbci_flags &= ~WBC_STATE_FL_INODE_RESERVED;
+	list_lru_del(&super->wbcs_rsvd_inode_lru, &wbci->wbci_rsvd_lru);
+	wbc_quota_uncharge_inode(wbci->wbci_quota);
+	wbc_counter_add(&super->wbcs_conf.wbcc_used_inodes, -1,
+			super->wbcs_conf.wbcc_max_inodes);
 }
 
 void wbc_free_inode(struct inode *inode)
@@ -207,6 +466,11 @@ void wbc_free_inode(struct inode *inode)
 		wbc_super_root_del(inode);
 	if (wbc_inode_reserved(wbci))
 		wbc_unreserve_inode(inode);
+	if (!list_empty(&wbci->wbci_data_lru))
+		wbc_inode_data_lru_del(inode);
+	wbc_dir_hindex_fini(inode);
+	wbc_quota_put(ll_i2wbcs(inode), wbci->wbci_quota);
+	wbci->wbci_quota = NULL;
 }
 
 void wbc_inode_unreserve_dput(struct inode *inode,
@@ -232,37 +496,147 @@ void wbc_inode_data_lru_add(struct inode *inode, struct file *file)
 	 * when the file is actual modified, i.e. at close() time with data
 	 * modified, but not at file open time.
 	 */
-	if (super->wbcs_conf.wbcc_max_pages && fd->fd_omode & FMODE_WRITE) {
-		struct wbc_inode *wbci = ll_i2wbci(inode);
-
-		spin_lock(&super->wbcs_data_lru_lock);
-		if (list_empty(&wbci->wbci_data_lru))
-			list_add_tail(&wbci->wbci_data_lru,
-				      &super->wbcs_data_inode_lru);
-		spin_unlock(&super->wbcs_data_lru_lock);
-	}
+	if (fd->fd_omode & FMODE_WRITE)
+		list_lru_add(&super->wbcs_data_inode_lru,
+			     &ll_i2wbci(inode)->wbci_data_lru);
 }
 
 void wbc_inode_data_lru_del(struct inode *inode)
 {
 	struct wbc_super *super = ll_i2wbcs(inode);
 
-	if (super->wbcs_conf.wbcc_max_pages) {
-		struct wbc_inode *wbci = ll_i2wbci(inode);
+	list_lru_del(&super->wbcs_data_inode_lru,
+		     &ll_i2wbci(inode)->wbci_data_lru);
+}
 
-		spin_lock(&super->wbcs_data_lru_lock);
-		if (!list_empty(&wbci->wbci_data_lru))
-			list_del_init(&wbci->wbci_data_lru);
-		spin_unlock(&super->wbcs_data_lru_lock);
+void wbc_account_inode_dirtied(struct inode *inode)
+{
+	struct memfs_writeback *mwb = ll_i2mwb(inode);
+	struct wbc_quota *quota = ll_i2wbci(inode)->wbci_quota;
+
+	if (quota)
+		percpu_counter_inc(&quota->wq_dirty);
+	if (wbc_cap_account_dirty(mwb)) {
+		inc_wbc_stat(mwb, WB_INODE_DIRTY);
+		wbc_check_dirty_flush(mwb);
 	}
 }
 
+void wbc_unacct_inode_dirtied(struct inode *inode)
+{
+	struct memfs_writeback *mwb = ll_i2mwb(inode);
+	struct wbc_quota *quota = ll_i2wbci(inode)->wbci_quota;
+
+	if (quota)
+		percpu_counter_dec(&quota->wq_dirty);
+	if (wbc_cap_account_dirty(mwb))
+		dec_wbc_stat(mwb, WB_INODE_DIRTY);
+}
+
 static inline void wbc_clear_dirty_for_flush(struct wbc_inode *wbci,
 					     unsigned int *valid)
 {
 	*valid = wbci->wbci_dirty_attr;
 	wbci->wbci_dirty_attr = 0;
-	wbci->wbci_dirty_flags = WBC_DIRTY_FL_FLUSHING;
+	/* The pending hard links are flushed by their parents. */
+	wbci->wbci_dirty_flags = WBC_DIRTY_FL_FLUSHING |
+				 (wbci->wbci_dirty_flags &
+				  WBC_DIRTY_FL_HARDLINK);
+}
+
+/*
+ * @dentry is the name with which @inode is created on MDT, the other names
+ * of the hard linked file are linked on MDT once the creation is done.
+ * Called with @inode->i_lock held.
+ */
+void __wbc_inode_mark_links(struct inode *inode, struct dentry *dentry)
+{
+	struct wbc_inode *wbci = ll_i2wbci(inode);
+	struct dentry *alias;
+
+	ll_d2wbcd(dentry)->wbcd_flags &= ~WBC_DENTRY_FL_LINK;
+	if (S_ISDIR(inode->i_mode) || inode->i_nlink < 2)
+		return;
+
+	hlist_for_each_entry(alias, &inode->i_dentry, d_alias) {
+		if (alias == dentry)
+			continue;
+
+		ll_d2wbcd(alias)->wbcd_flags |= WBC_DENTRY_FL_LINK;
+		wbci->wbci_dirty_flags |= WBC_DIRTY_FL_HARDLINK;
+	}
+}
+
+/*
+ * The name @dentry of @inode is linked on MDT, or removed before that.
+ * Called with @inode->i_lock held.
+ */
+void __wbc_dentry_link_done(struct inode *inode, struct dentry *dentry)
+{
+	struct dentry *alias;
+
+	ll_d2wbcd(dentry)->wbcd_flags &= ~WBC_DENTRY_FL_LINK;
+	hlist_for_each_entry(alias, &inode->i_dentry, d_alias) {
+		if (wbc_dentry_link_pending(alias))
+			return;
+	}
+
+	ll_i2wbci(inode)->wbci_dirty_flags &= ~WBC_DIRTY_FL_HARDLINK;
+}
+
+/*
+ * Linking the name @dentry of @inode on MDT failed, mark it pending again so
+ * that it is retried by the next flush, unless it was removed meanwhile.
+ * Called with @inode->i_lock held.
+ */
+void __wbc_dentry_link_redo(struct inode *inode, struct dentry *dentry)
+{
+	if (d_unhashed(dentry))
+		return;
+
+	ll_d2wbcd(dentry)->wbcd_flags |= WBC_DENTRY_FL_LINK;
+	ll_i2wbci(inode)->wbci_dirty_flags |= WBC_DIRTY_FL_HARDLINK;
+}
+
+/* Return true if the name @dentry of @inode was not linked on MDT yet. */
+bool wbc_dentry_link_clear(struct inode *inode, struct dentry *dentry)
+{
+	bool pending;
+
+	spin_lock(&inode->i_lock);
+	pending = wbc_dentry_link_pending(dentry);
+	if (pending)
+		__wbc_dentry_link_done(inode, dentry);
+	spin_unlock(&inode->i_lock);
+
+	return pending;
+}
+
+/*
+ * Find an alias to create @inode with on MDT. A hard linked file prefers a
+ * name whose parent is already on MDT, thus it does not need to flush the
+ * parents of its other names.
+ */
+struct dentry *wbc_d_find_alias(struct inode *inode)
+{
+	struct dentry *alias;
+
+	if (S_ISDIR(inode->i_mode) || inode->i_nlink < 2)
+		return d_find_any_alias(inode);
+
+	spin_lock(&inode->i_lock);
+	hlist_for_each_entry(alias, &inode->i_dentry, d_alias) {
+		struct inode *dir = alias->d_parent->d_inode;
+
+		if (dir && wbc_inode_written_out(ll_i2wbci(dir))) {
+			dget(alias);
+			spin_unlock(&inode->i_lock);
+			return alias;
+		}
+	}
+	spin_unlock(&inode->i_lock);
+
+	return d_find_any_alias(inode);
 }
 
 static inline bool wbc_flush_need_exlock(struct wbc_inode *wbci,
@@ -351,6 +725,22 @@ long wbc_flush_opcode_get(struct inode *inode, struct dentry *dchild,
 
 	decomp_keep = wbcx->for_decomplete && wbc_mode_lock_keep(wbci);
 	spin_lock(&inode->i_lock);
+	/*
+	 * A hard link of a file created on MDT, or being created, with another
+	 * name. It is linked after the creation commits, thus do not wait for
+	 * the writeback of the file here.
+	 */
+	if (dchild != NULL && wbc_dentry_link_pending(dchild) &&
+	    (wbc_inode_written_out(wbci) ||
+	     wbci->wbci_flags & WBC_STATE_FL_WRITEBACK)) {
+		if (wbci->wbci_flags & WBC_STATE_FL_FREEING)
+			opc = MD_OP_NONE;
+		else
+			opc = MD_OP_LINK_LOCKLESS;
+		spin_unlock(&inode->i_lock);
+		RETURN(opc);
+	}
+
 	if (wbc_mode_lock_keep(wbci)) {
 		if (wbci->wbci_flags & WBC_STATE_FL_FREEING) {
 			spin_unlock(&inode->i_lock);
@@ -382,7 +772,15 @@ long wbc_flush_opcode_get(struct inode *inode, struct dentry *dchild,
 	if (wbc_inode_none(wbci)) {
 		opc = MD_OP_NONE;
 	} else if (wbc_inode_was_flushed(wbci)) {
-		if (decomp_keep) {
+		if (wbcx->for_callback && wbc_inode_root(wbci)) {
+			/*
+			 * A nested root holds its own EX lock. It and its
+			 * subtree are left cached, and will be flushed only
+			 * when a conflicting access revokes that lock.
+			 */
+			LASSERT(S_ISDIR(inode->i_mode));
+			opc = MD_OP_NONE;
+		} else if (decomp_keep) {
 			LASSERT(dchild != NULL);
 			opc = MD_OP_NONE;
 			if (wbcx->unrsv_children_decomp)
@@ -402,10 +800,15 @@ long wbc_flush_opcode_get(struct inode *inode, struct dentry *dchild,
 		}
 	} else {
 		/*
-		 * TODO: Update the metadata attributes on MDT together with
-		 * the file creation.
+		 * The create carries the final attributes of the file, so
+		 * the pending attribute changes are flushed together with
+		 * the file creation and no separate setattr is needed. An
+		 * MDT without OBD_CONNECT2_WBC_INTENTS keeps the mode and
+		 * owner only.
 		 */
 		wbc_clear_dirty_for_flush(wbci, valid);
+		if (dchild != NULL)
+			__wbc_inode_mark_links(inode, dchild);
 		opc = wbc_flush_need_exlock(wbci, wbcx) ?
 		      MD_OP_CREATE_EXLOCK : MD_OP_CREATE_LOCKLESS;
 	}
@@ -415,7 +818,11 @@ long wbc_flush_opcode_get(struct inode *inode, struct dentry *dchild,
 
 	if (opc != MD_OP_NONE) {
 		wbci->wbci_flags |= WBC_STATE_FL_WRITEBACK;
-		wbc_unacct_inode_dirtied(ll_i2mwb(inode));
+		/* Only the creation was accounted as a dirty inode. */
+		if (!wbc_inode_was_flushed(wbci))
+			wbc_unacct_inode_dirtied(inode);
+		inc_wbc_stat(ll_i2mwb(inode), WB_INODE_WRITTEN);
+		wbc_stats_flush_opc(ll_i2wbcs(inode), opc, 1);
 	}
 	spin_unlock(&inode->i_lock);
 
@@ -551,7 +958,6 @@ static int wbc_inode_update_metadata(struct inode *inode,
 		wbc_clear_dirty_for_flush(wbci, &valid);
 		opc = MD_OP_SETATTR_LOCKLESS;
 	}
-	/* TODO: hardlink. */
 	spin_unlock(&inode->i_lock);
 
 	/*
@@ -562,6 +968,10 @@ static int wbc_inode_update_metadata(struct inode *inode,
 	 * WBC EX lock.
 	 */
 	rc = wbcfs_inode_sync_metadata(opc, inode, valid);
+	if (rc == 0 && opc != MD_OP_NONE)
+		wbc_stats_flush_opc(ll_i2wbcs(inode), opc, 1);
+	if (rc == 0)
+		rc = wbcfs_flush_hardlinks(inode);
 	RETURN(rc);
 }
 
@@ -574,6 +984,12 @@ static int wbc_reopen_file_handler(struct inode *inode,
 
 	ENTRY;
 
+	/*
+	 * Fetch the open handles of all files in one batch RPC, the opens
+	 * below share them then. On failure, the files are reopened by RPC.
+	 */
+	(void) wbcfs_reopen_prefetch(&inode, 1);
+
 	spin_lock(&inode->i_lock);
 	hlist_for_each_entry(dentry, &inode->i_dentry, d_alias) {
 		struct wbc_dentry *wbcd = ll_d2wbcd(dentry);
@@ -588,9 +1004,21 @@ static int wbc_reopen_file_handler(struct inode *inode,
 		 */
 		list_for_each_entry_safe(fd, tmp, &wbcd->wbcd_open_files,
 					 fd_wbc_file.wbcf_open_item) {
+			struct wbc_dir_resume resume = { 0 };
 			struct file *file = fd->fd_file;
 
 			list_del_init(&fd->fd_wbc_file.wbcf_open_item);
+			/*
+			 * For the hashed readdir() policies, the iteration
+			 * continues from MDT with the entries not returned
+			 * yet after reopen.
+			 */
+			if (S_ISDIR(inode->i_mode) &&
+			    wbc_readdir_pol_hashed(
+					fd->fd_wbc_file.wbcf_readdir_pol))
+				memfs_dir_resume_save(file, &resume);
+			wbcfs_dcache_dir_close(inode, file);
+
 			/* FIXME: Is it safe to switch file operatoins here? */
 			if (S_ISDIR(inode->i_mode))
 				file->f_op = &ll_dir_operations;
@@ -598,20 +1026,24 @@ static int wbc_reopen_file_handler(struct inode *inode,
 				file->f_op = ll_i2sbi(inode)->ll_fop;
 
 			rc = file->f_op->open(inode, file);
-			if (rc)
+			if (rc) {
+				memfs_dir_resume_fini(&resume);
 				GOTO(out_dput, rc);
+			}
 
-			wbcfs_dcache_dir_close(inode, file);
+			memfs_dir_resume_set(file, &resume);
 			dput(dentry); /* Unpin from open in MemFS. */
 		}
 out_dput:
 		dput(dentry);
 		if (rc)
-			RETURN(rc);
+			GOTO(out_release, rc);
 		spin_lock(&inode->i_lock);
 	}
 	spin_unlock(&inode->i_lock);
 
+out_release:
+	wbcfs_reopen_release(inode);
 	RETURN(rc);
 }
 
@@ -626,7 +1058,13 @@ static int wbc_flush_regular_file(struct inode *inode, struct ldlm_lock *lock,
 	if (rc)
 		RETURN(rc);
 
-	rc = wbcfs_commit_cache_pages(inode);
+	/*
+	 * In lock keep flush mode the file was flushed earlier, the lock
+	 * revocation commits the data delayed by WBC_DOP_AT_COMMIT.
+	 */
+	rc = wbcfs_commit_cache_pages(inode,
+				      wbc_mode_lock_keep(ll_i2wbci(inode)) ?
+				      WBC_DOP_AT_COMMIT : WBC_DOP_AT_FLUSH);
 	if (rc < 0)
 		RETURN(rc);
 
@@ -634,6 +1072,105 @@ static int wbc_flush_regular_file(struct inode *inode, struct ldlm_lock *lock,
 	RETURN(rc);
 }
 
+/*
+ * Link the hard links in @linklist into @dir on MDT in one batch. It is done
+ * after the creations of the files with their other names are committed.
+ * A name whose link fails is marked pending again, and the children are
+ * unreserved only once they are linked on MDT.
+ */
+static int wbc_flush_dir_links(struct inode *dir, struct list_head *linklist,
+			       struct writeback_control_ext *wbcx)
+{
+	struct wbc_removed_item *item;
+	struct wbc_dentry *wbcd, *tmp;
+	LIST_HEAD(linked);
+	LIST_HEAD(head);
+	int rc = 0;
+
+	ENTRY;
+
+	list_for_each_entry_safe(wbcd, tmp, linklist, wbcd_flush_item) {
+		struct ll_dentry_data *lld;
+		struct dentry *dchild;
+		struct inode *inode;
+		struct wbc_inode *wbci;
+
+		lld = container_of(wbcd, struct ll_dentry_data, lld_wbc_dentry);
+		dchild = lld->lld_dentry;
+		inode = dchild->d_inode;
+		wbci = ll_i2wbci(inode);
+		list_del_init(&wbcd->wbcd_flush_item);
+		if (rc)
+			goto next;
+
+		spin_lock(&inode->i_lock);
+		if (wbci->wbci_flags & WBC_STATE_FL_WRITEBACK)
+			__wbc_inode_wait_for_writeback(inode);
+		if (!wbc_dentry_link_pending(dchild) ||
+		    wbci->wbci_flags & WBC_STATE_FL_FREEING) {
+			spin_unlock(&inode->i_lock);
+			goto next;
+		}
+		if (!wbc_inode_written_out(wbci)) {
+			spin_unlock(&inode->i_lock);
+			CERROR("%s: link %pd before "DFID" created: rc = %d\n",
+			       ll_i2sbi(dir)->ll_fsname, dchild,
+			       PFID(ll_inode2fid(inode)), -EIO);
+			rc = -EIO;
+			goto next;
+		}
+		__wbc_dentry_link_done(inode, dchild);
+		spin_unlock(&inode->i_lock);
+
+		item = wbc_removed_item_alloc(MD_OP_LINK_LOCKLESS, inode,
+					      &dchild->d_name, NULL);
+		if (item == NULL) {
+			spin_lock(&inode->i_lock);
+			__wbc_dentry_link_redo(inode, dchild);
+			spin_unlock(&inode->i_lock);
+			rc = -ENOMEM;
+			goto next;
+		}
+
+		item->wbvi_pfid = *ll_inode2fid(dir);
+		item->wbvi_dentry = dget(dchild);
+		list_add_tail(&item->wbvi_item, &head);
+		/* Keep the reference until the link is done on MDT. */
+		list_add_tail(&wbcd->wbcd_flush_item, &linked);
+		continue;
+next:
+		dput(dchild);
+	}
+
+	if (!list_empty(&head)) {
+		int rc2 = wbcfs_sync_removed_items(dir, &head);
+
+		if (rc == 0)
+			rc = rc2;
+	}
+
+	list_for_each_entry_safe(wbcd, tmp, &linked, wbcd_flush_item) {
+		struct ll_dentry_data *lld;
+		struct dentry *dchild;
+		struct inode *inode;
+
+		lld = container_of(wbcd, struct ll_dentry_data, lld_wbc_dentry);
+		dchild = lld->lld_dentry;
+		inode = dchild->d_inode;
+		list_del_init(&wbcd->wbcd_flush_item);
+		if (wbcx->for_decomplete && wbcx->unrsv_children_decomp &&
+		    wbc_mode_lock_keep(ll_i2wbci(inode))) {
+			spin_lock(&inode->i_lock);
+			if (!wbc_dentry_link_pending(dchild))
+				wbc_inode_unreserve_dput(inode, dchild);
+			spin_unlock(&inode->i_lock);
+		}
+		dput(dchild);
+	}
+
+	RETURN(rc);
+}
+
 static int wbc_flush_dir_children(struct wbc_context *ctx,
 				  struct inode *dir,
 				  struct list_head *childlist,
@@ -641,6 +1178,7 @@ static int wbc_flush_dir_children(struct wbc_context *ctx,
 				  struct writeback_control_ext *wbcx)
 {
 	struct wbc_dentry *wbcd, *tmp;
+	LIST_HEAD(linklist);
 	int rc = 0;
 
 	ENTRY;
@@ -658,16 +1196,37 @@ static int wbc_flush_dir_children(struct wbc_context *ctx,
 		list_del_init(&wbcd->wbcd_flush_item);
 
 		rc = wbcfs_flush_dir_child(ctx, dir, dchild, lock, wbcx);
+		/* Keep the hard link pinned until it is linked on MDT. */
+		if (rc == 1) {
+			list_add_tail(&wbcd->wbcd_flush_item, &linklist);
+			rc = 0;
+			continue;
+		}
 		/*
 		 * Unpin the dentry.
 		 * FIXME: race between dirty inode flush and unlink/rmdir().
 		 */
 		dput(dchild);
 		if (rc)
-			RETURN(rc);
+			break;
 	}
 
-	rc = wbcfs_context_commit(dir->i_sb, ctx);
+	if (rc == 0)
+		rc = wbcfs_context_commit(dir->i_sb, ctx);
+	if (list_empty(&linklist))
+		RETURN(rc);
+
+	if (rc) {
+		list_for_each_entry_safe(wbcd, tmp, &linklist,
+					 wbcd_flush_item) {
+			list_del_init(&wbcd->wbcd_flush_item);
+			dput(container_of(wbcd, struct ll_dentry_data,
+					  lld_wbc_dentry)->lld_dentry);
+		}
+		RETURN(rc);
+	}
+
+	rc = wbc_flush_dir_links(dir, &linklist, wbcx);
 	RETURN(rc);
 }
 
@@ -798,6 +1357,7 @@ static inline void wbc_mark_inode_deroot(struct inode *inode)
 int wbc_make_inode_deroot(struct inode *inode, struct ldlm_lock *lock,
 			  struct writeback_control_ext *wbcx)
 {
+	__u64 seq = wbc_journal_seq(ll_i2wbcs(inode));
 	int rc;
 
 	LASSERT(wbc_inode_root(ll_i2wbci(inode)));
@@ -806,6 +1366,9 @@ int wbc_make_inode_deroot(struct inode *inode, struct ldlm_lock *lock,
 	spin_lock(&inode->i_lock);
 	wbc_mark_inode_deroot(inode);
 	spin_unlock(&inode->i_lock);
+	wbc_dir_hindex_fini(inode);
+	if (rc == 0)
+		wbc_journal_checkpoint(ll_i2wbcs(inode), seq);
 	return rc;
 }
 
@@ -820,6 +1383,8 @@ int wbc_make_inode_decomplete(struct inode *inode,
 		.unrsv_children_decomp = unrsv_children,
 	};
 	struct ldlm_lock *lock = NULL;
+	bool deroot = false;
+	__u64 seq;
 	int rc;
 
 	ENTRY;
@@ -838,18 +1403,26 @@ int wbc_make_inode_decomplete(struct inode *inode,
 	if (wbc_inode_none(wbci) || !wbc_inode_complete(wbci))
 		GOTO(up_rwsem, rc = 0);
 
+	seq = wbc_journal_seq(ll_i2wbcs(inode));
 	rc = wbc_inode_flush(inode, lock, &wbcx);
 	/* FIXME: error handling. */
+	wbc_stats_add(ll_i2wbcs(inode), WBC_STATS_DECOMPLETE, 1);
 
 	spin_lock(&inode->i_lock);
-	if (wbc_mode_lock_drop(wbci))
+	if (wbc_mode_lock_drop(wbci)) {
+		deroot = true;
 		wbc_mark_inode_deroot(inode);
-	else if (wbc_mode_lock_keep(wbci))
+	} else if (wbc_mode_lock_keep(wbci)) {
 		wbci->wbci_flags &= ~WBC_STATE_FL_COMPLETE;
+	}
 	spin_unlock(&inode->i_lock);
+	if (!wbc_inode_complete(wbci))
+		wbc_dir_hindex_fini(inode);
 
 up_rwsem:
 	up_write(&wbci->wbci_rw_sem);
+	if (deroot && rc == 0)
+		wbc_journal_checkpoint(ll_i2wbcs(inode), seq);
 	if (lock)
 		LDLM_LOCK_PUT(lock);
 
@@ -878,7 +1451,7 @@ int wbc_make_dir_decomplete(struct inode *dir, struct dentry *parent,
 	RETURN(rc);
 }
 
-int wbc_make_data_commit(struct dentry *dentry)
+int wbc_make_data_commit(struct dentry *dentry, enum wbc_dop_policy reason)
 {
 	struct inode *inode = dentry->d_inode;
 	struct wbc_inode *wbci = ll_i2wbci(inode);
@@ -904,7 +1477,7 @@ int wbc_make_data_commit(struct dentry *dentry)
 	}
 
 	down_write(&wbci->wbci_rw_sem);
-	rc = wbcfs_commit_cache_pages(inode);
+	rc = wbcfs_commit_cache_pages(inode, reason);
 	up_write(&wbci->wbci_rw_sem);
 
 	RETURN(rc);
@@ -944,8 +1517,8 @@ static int wbc_flush_dependency_check(struct inode *inode,
 	if (wbcx->sync_mode == WB_SYNC_ALL)
 		RETURN(0);
 
-	/* FIXME: hardlinks. */
-	dentry = d_find_any_alias(inode);
+	/* A hard linked file is created with the name wbc_do_create() uses. */
+	dentry = wbc_d_find_alias(inode);
 	if (dentry == NULL)
 		RETURN(1);
 
@@ -1003,11 +1576,14 @@ void wbc_inode_init(struct inode *inode)
 	INIT_LIST_HEAD(&wbci->wbci_rsvd_lru);
 	INIT_LIST_HEAD(&wbci->wbci_data_lru);
 	init_rwsem(&wbci->wbci_rw_sem);
+	wbci->wbci_quota = NULL;
 
 	if (S_ISDIR(inode->i_mode)) {
 		spin_lock_init(&wbci->wbci_removed_lock);
 		INIT_LIST_HEAD(&wbci->wbci_removed_list);
 		wbci->wbci_rmpol = ll_i2wbcc(inode)->wbcc_rmpol;
+		wbci->wbci_hindex = NULL;
+		wbci->wbci_prefetch_retry = 0;
 	}
 }
 
@@ -1022,6 +1598,7 @@ void wbc_dentry_init(struct dentry *dentry)
 	INIT_LIST_HEAD(&lld->lld_wbc_dentry.wbcd_fsync_item);
 	INIT_LIST_HEAD(&lld->lld_wbc_dentry.wbcd_open_files);
 	spin_lock_init(&lld->lld_wbc_dentry.wbcd_open_lock);
+	lld->lld_wbc_dentry.wbcd_flags = 0;
 }
 
 static inline struct wbc_inode *wbc_inode(struct list_head *head)
@@ -1029,6 +1606,9 @@ static inline struct wbc_inode *wbc_inode(struct list_head *head)
 	return list_entry(head, struct wbc_inode, wbci_root_list);
 }
 
+/* Maximum number of roots whose open files are reopened in one batch. */
+#define WBC_SHRINK_BATCH	16
+
 static int __wbc_super_shrink_roots(struct wbc_super *super,
 				     struct list_head *shrink_list)
 {
@@ -1038,6 +1618,8 @@ static int __wbc_super_shrink_roots(struct wbc_super *super,
 		.for_sync = 1,
 		.for_callback = 1,
 	};
+	struct wbc_inode *roots[WBC_SHRINK_BATCH];
+	struct wbc_reopen_set set = { 0 };
 	int rc = 0;
 
 	ENTRY;
@@ -1047,18 +1629,55 @@ static int __wbc_super_shrink_roots(struct wbc_super *super,
 
 	spin_lock(&super->wbcs_lock);
 	while (!list_empty(shrink_list)) {
-		struct wbc_inode *wbci = wbc_inode(shrink_list->prev);
-		struct inode *inode = ll_wbci2i(wbci);
+		unsigned int count = 0;
+		unsigned int i;
 
-		LASSERT(wbci->wbci_flags & WBC_STATE_FL_ROOT);
-		list_del_init(&wbci->wbci_root_list);
+		while (!list_empty(shrink_list) && count < WBC_SHRINK_BATCH) {
+			struct wbc_inode *wbci = wbc_inode(shrink_list->prev);
+
+			LASSERT(wbci->wbci_flags & WBC_STATE_FL_ROOT);
+			list_del_init(&wbci->wbci_root_list);
+			roots[count++] = wbci;
+		}
 		spin_unlock(&super->wbcs_lock);
-		rc = wbc_inode_flush_lockdrop(inode, &wbcx);
+
+		/*
+		 * Reopen the local files in the whole subtrees of all roots
+		 * of this round in one batch before the roots are flushed
+		 * one by one. The roots are pinned in @set.
+		 */
+		for (i = 0; i < count; i++) {
+			if (wbcfs_reopen_collect(ll_wbci2i(roots[i]), -1,
+						 &set))
+				break;
+		}
+		(void) wbcfs_reopen_prefetch(set.wrs_inodes, set.wrs_count);
+
+		for (i = 0; i < count; i++) {
+			struct inode *inode = ll_wbci2i(roots[i]);
+
+			rc = wbc_inode_flush_lockdrop(inode, &wbcx);
+			if (rc) {
+				CERROR("Failed to flush file: "DFID"\n",
+				       PFID(&ll_i2info(inode)->lli_fid));
+				break;
+			}
+		}
+
 		if (rc) {
-			CERROR("Failed to flush file: "DFID"\n",
-			       PFID(&ll_i2info(inode)->lli_fid));
-			RETURN(rc);
+			unsigned int j;
+
+			/* Put the roots not flushed back in the same order. */
+			spin_lock(&super->wbcs_lock);
+			for (j = count; j > i + 1; j--)
+				list_add_tail(&roots[j - 1]->wbci_root_list,
+					      shrink_list);
+			spin_unlock(&super->wbcs_lock);
 		}
+
+		wbcfs_reopen_set_fini(&set);
+		if (rc)
+			RETURN(rc);
 		spin_lock(&super->wbcs_lock);
 	}
 	spin_unlock(&super->wbcs_lock);
@@ -1068,6 +1687,7 @@ static int __wbc_super_shrink_roots(struct wbc_super *super,
 
 int wbc_super_shrink_roots(struct wbc_super *super)
 {
+	__u64 seq = wbc_journal_seq(super);
 	int rc;
 	int rc2;
 
@@ -1077,8 +1697,10 @@ int wbc_super_shrink_roots(struct wbc_super *super)
 	if (rc)
 		rc = rc2;
 
-	if (rc == 0)
+	if (rc == 0) {
 		wbc_kill_super(super);
+		wbc_journal_checkpoint(super, seq);
+	}
 
 	return rc;
 }
@@ -1146,136 +1768,1036 @@ int wbc_write_inode(struct inode *inode, struct writeback_control *wbc)
 	RETURN(rc);
 }
 
-static int wbc_reclaim_inodes_below(struct wbc_super *super, __u32 low)
+/* Inodes isolated from an LRU list in one walk of the reclaimer. */
+#define WBC_RECLAIM_BATCH	32
+/* Items scanned under the LRU lock in one walk of a quota reclaim. */
+#define WBC_RECLAIM_QUOTA_SCAN	(WBC_RECLAIM_BATCH * 16)
+
+struct wbc_reclaim_batch {
+	struct inode		*wrb_inodes[WBC_RECLAIM_BATCH];
+	unsigned int		 wrb_max;
+	unsigned int		 wrb_count;
+	/* Only isolate the inodes charged to this quota if set. */
+	struct wbc_quota	*wrb_quota;
+	/* Items left to scan by the walks of a quota reclaim. */
+	unsigned long		 wrb_scan;
+};
+
+#ifdef HAVE_LIST_LRU_MEMCG_SHRINKER
+# define wbc_list_lru_init(lru, shrinker) list_lru_init_memcg(lru, shrinker)
+#else
+# define wbc_list_lru_init(lru, shrinker) list_lru_init(lru)
+#endif
+
+#if defined(HAVE_LIST_LRU_MEMCG_SHRINKER) && defined(CONFIG_MEMCG)
+static inline struct mem_cgroup *wbc_memcg_get(struct mem_cgroup *memcg)
 {
-	struct wbc_conf *conf = &super->wbcs_conf;
-	int rc = 0;
+	if (memcg)
+		css_get(&memcg->css);
+	return memcg;
+}
 
-	ENTRY;
+static inline void wbc_memcg_put(struct mem_cgroup *memcg)
+{
+	if (memcg)
+		css_put(&memcg->css);
+}
+#else
+static inline struct mem_cgroup *wbc_memcg_get(struct mem_cgroup *memcg)
+{
+	return NULL;
+}
 
-	spin_lock(&super->wbcs_lock);
-	while (conf->wbcc_free_inodes < low) {
-		struct inode *inode;
-		struct wbc_inode *wbci;
-		struct ll_inode_info *lli;
-		struct dentry *dchild;
+static inline void wbc_memcg_put(struct mem_cgroup *memcg)
+{
+}
+#endif
 
-		if (list_empty(&super->wbcs_rsvd_inode_lru))
-			break;
+static inline unsigned long wbc_lru_shrink_count(struct list_lru *lru,
+						 struct shrink_control *sc)
+{
+#ifdef HAVE_LIST_LRU_ONE
+	return list_lru_shrink_count(lru, sc);
+#else
+	return list_lru_count_node(lru, sc->nid);
+#endif
+}
+
+/*
+ * Called under the lock of the LRU list. The inode is pinned and taken
+ * off the LRU list, it is reclaimed by the caller after the walk.
+ * An inode is taken off the LRU list under its i_lock, i.e. the lock of
+ * the LRU list nests inside i_lock, see wbc_mark_inode_deroot(), thus the
+ * i_lock is only tried here.
+ */
+static enum lru_status wbc_reclaim_isolate(struct wbc_inode *wbci,
+					   struct list_head *item,
+					   struct list_lru_one *lru,
+					   struct wbc_reclaim_batch *batch)
+{
+	struct ll_inode_info *lli;
+	struct inode *inode;
+
+	if (batch->wrb_count >= batch->wrb_max)
+		return LRU_SKIP;
+
+	/*
+	 * Move the inodes of other quotas to the tail, so that the next walk
+	 * of a quota reclaim resumes past them instead of scanning them again.
+	 */
+	if (batch->wrb_quota && wbci->wbci_quota != batch->wrb_quota)
+		return LRU_ROTATE;
 
-		wbci = list_entry(super->wbcs_rsvd_inode_lru.next,
-				  struct wbc_inode, wbci_rsvd_lru);
+	lli = container_of(wbci, struct ll_inode_info, lli_wbc_inode);
+	inode = ll_info2i(lli);
+	if (!spin_trylock(&inode->i_lock))
+		return LRU_SKIP;
 
-		list_del_init(&wbci->wbci_rsvd_lru);
-		lli = container_of(wbci, struct ll_inode_info, lli_wbc_inode);
-		inode = ll_info2i(lli);
-		dchild = d_find_any_alias(inode);
-		if (!dchild)
+	/* The inode being freed will be removed from the LRU by itself. */
+	if (inode->i_state & (I_FREEING | I_WILL_FREE)) {
+		spin_unlock(&inode->i_lock);
+		return LRU_SKIP;
+	}
+
+	__iget(inode);
+	spin_unlock(&inode->i_lock);
+
+#ifdef HAVE_LIST_LRU_ONE
+	list_lru_isolate(lru, item);
+#else
+	list_del_init(item);
+#endif
+	batch->wrb_inodes[batch->wrb_count++] = inode;
+	return LRU_REMOVED;
+}
+
+#ifdef HAVE_LIST_LRU_ONE
+static enum lru_status wbc_rsvd_lru_isolate(struct list_head *item,
+					    struct list_lru_one *lru,
+					    spinlock_t *lock, void *arg)
+{
+	return wbc_reclaim_isolate(container_of(item, struct wbc_inode,
+						wbci_rsvd_lru),
+				   item, lru, arg);
+}
+
+static enum lru_status wbc_data_lru_isolate(struct list_head *item,
+					    struct list_lru_one *lru,
+					    spinlock_t *lock, void *arg)
+{
+	return wbc_reclaim_isolate(container_of(item, struct wbc_inode,
+						wbci_data_lru),
+				   item, lru, arg);
+}
+#else
+static enum lru_status wbc_rsvd_lru_isolate(struct list_head *item,
+					    spinlock_t *lock, void *arg)
+{
+	return wbc_reclaim_isolate(container_of(item, struct wbc_inode,
+						wbci_rsvd_lru),
+				   item, NULL, arg);
+}
+
+static enum lru_status wbc_data_lru_isolate(struct list_head *item,
+					    spinlock_t *lock, void *arg)
+{
+	return wbc_reclaim_isolate(container_of(item, struct wbc_inode,
+						wbci_data_lru),
+				   item, NULL, arg);
+}
+#endif
+
+/*
+ * Isolate at most @batch->wrb_max inodes from @lru. The walk is limited
+ * to the LRU list of @memcg on @nid if given, otherwise to the node @nid,
+ * or to the whole LRU with NUMA_NO_NODE. For a quota reclaim, which skips
+ * the inodes of other quotas, a walk scans at most WBC_RECLAIM_QUOTA_SCAN
+ * items out of @batch->wrb_scan, thus the LRU lock is not held long.
+ */
+static void wbc_reclaim_lru_walk(struct list_lru *lru, int nid,
+				 struct mem_cgroup *memcg,
+				 list_lru_walk_cb isolate,
+				 struct wbc_reclaim_batch *batch)
+{
+	unsigned long nr = batch->wrb_max;
+
+	if (batch->wrb_quota) {
+		nr = min_t(unsigned long, batch->wrb_scan,
+			   WBC_RECLAIM_QUOTA_SCAN);
+		batch->wrb_scan -= nr;
+	}
+
+	batch->wrb_count = 0;
+#ifdef HAVE_LIST_LRU_MEMCG_SHRINKER
+	if (memcg) {
+		list_lru_walk_one(lru, nid, memcg, isolate, batch, &nr);
+		return;
+	}
+#endif
+	if (nid != NUMA_NO_NODE)
+		list_lru_walk_node(lru, nid, isolate, batch, &nr);
+	else
+		list_lru_walk(lru, isolate, batch, nr);
+}
+
+static int wbc_reclaim_inode(struct inode *inode)
+{
+	struct dentry *dchild;
+	int rc;
+
+	dchild = d_find_any_alias(inode);
+	if (!dchild)
+		return 0;
+
+	rc = wbc_make_dir_decomplete(dchild->d_parent->d_inode,
+				     dchild->d_parent, 1);
+	dput(dchild);
+	return rc;
+}
+
+/*
+ * Reclaim @nr reserved inodes from the LRU list by decompleting their
+ * parent directories, only the ones charged to @quota if given. Return
+ * the number of the inodes taken off the LRU list or a negative errno.
+ */
+static long wbc_reclaim_inodes_lru(struct wbc_super *super, int nid,
+				   struct mem_cgroup *memcg, unsigned long nr,
+				   struct wbc_quota *quota)
+{
+	struct wbc_reclaim_batch batch;
+	unsigned long reclaimed = 0;
+	int rc = 0;
+	int i;
+
+	ENTRY;
+
+	batch.wrb_quota = quota;
+	batch.wrb_scan = quota ? list_lru_count(&super->wbcs_rsvd_inode_lru) :
+				 0;
+
+	while (reclaimed < nr) {
+		batch.wrb_max = min_t(unsigned long, nr - reclaimed,
+				      WBC_RECLAIM_BATCH);
+		wbc_reclaim_lru_walk(&super->wbcs_rsvd_inode_lru, nid, memcg,
+				     wbc_rsvd_lru_isolate, &batch);
+		if (batch.wrb_count == 0) {
+			if (batch.wrb_scan == 0)
+				break;
+			cond_resched();
 			continue;
+		}
 
-		spin_unlock(&super->wbcs_lock);
+		for (i = 0; i < batch.wrb_count; i++) {
+			if (rc == 0)
+				rc = wbc_reclaim_inode(batch.wrb_inodes[i]);
+			iput(batch.wrb_inodes[i]);
+		}
 
-		rc = wbc_make_dir_decomplete(dchild->d_parent->d_inode,
-					     dchild->d_parent, 1);
-		dput(dchild);
 		if (rc) {
 			CERROR("Reclaim inodes failed: rc = %d\n", rc);
 			RETURN(rc);
 		}
 
+		reclaimed += batch.wrb_count;
 		cond_resched();
-		spin_lock(&super->wbcs_lock);
 	}
-	spin_unlock(&super->wbcs_lock);
 
-	RETURN(rc);
+	RETURN(reclaimed);
+}
+
+static int wbc_reclaim_inodes_above(struct wbc_super *super,
+				    unsigned long high)
+{
+	struct wbc_conf *conf = &super->wbcs_conf;
+	long rc = 0;
+
+	ENTRY;
+
+	/*
+	 * Reclaim one inode a time as decompleting the parent directory
+	 * unreserves all of its children.
+	 */
+	while (wbc_counter_compare(&conf->wbcc_used_inodes, high,
+				   conf->wbcc_max_inodes) > 0) {
+		rc = wbc_reclaim_inodes_lru(super, NUMA_NO_NODE, NULL, 1, NULL);
+		if (rc <= 0)
+			break;
+	}
+
+	RETURN(rc < 0 ? rc : 0);
 }
 
 static int wbc_reclaim_inodes(struct wbc_super *super)
 {
-	__u32 low = super->wbcs_conf.wbcc_max_inodes >> 1;
+	unsigned long max = super->wbcs_conf.wbcc_max_inodes;
 
-	return wbc_reclaim_inodes_below(super, low);
+	/* Reclaim until half of the inodes are free. */
+	return wbc_reclaim_inodes_above(super, max - (max >> 1));
 }
 
-static int wbc_reclaim_pages_count(struct wbc_super *super, __u32 count)
+/*
+ * Commit the cache pages of at most @nr_files files from the LRU list
+ * until @nr_pages pages are shrunk, only the files charged to @quota if
+ * given. Return the number of shrunk pages or a negative errno.
+ */
+static long wbc_reclaim_pages_lru(struct wbc_super *super, int nid,
+				  struct mem_cgroup *memcg,
+				  unsigned long nr_files,
+				  unsigned long nr_pages,
+				  struct wbc_quota *quota)
 {
-	__u32 shrank_count = 0;
+	struct wbc_reclaim_batch batch;
+	unsigned long shrank_files = 0;
+	unsigned long shrank_count = 0;
 	int rc = 0;
+	int i;
+
+	ENTRY;
+
+	batch.wrb_quota = quota;
+	batch.wrb_scan = quota ? list_lru_count(&super->wbcs_data_inode_lru) :
+				 0;
+
+	while (shrank_files < nr_files && shrank_count < nr_pages) {
+		batch.wrb_max = min_t(unsigned long, nr_files - shrank_files,
+				      WBC_RECLAIM_BATCH);
+		wbc_reclaim_lru_walk(&super->wbcs_data_inode_lru, nid, memcg,
+				     wbc_data_lru_isolate, &batch);
+		if (batch.wrb_count == 0) {
+			if (batch.wrb_scan == 0)
+				break;
+			cond_resched();
+			continue;
+		}
+
+		for (i = 0; i < batch.wrb_count; i++) {
+			struct inode *inode = batch.wrb_inodes[i];
+			struct dentry *dentry;
+
+			dentry = rc < 0 ? NULL : d_find_any_alias(inode);
+			if (dentry) {
+				rc = wbc_make_data_commit(dentry,
+							  WBC_DOP_AT_COMMIT);
+				dput(dentry);
+				if (rc > 0)
+					shrank_count += rc;
+			}
+			iput(inode);
+		}
+
+		if (rc < 0) {
+			CERROR("Reclaim pages failed: rc = %d\n", rc);
+			RETURN(rc);
+		}
+
+		shrank_files += batch.wrb_count;
+		cond_resched();
+	}
+
+	RETURN(shrank_count);
+}
+
+static int wbc_reclaim_pages(struct wbc_super *super)
+{
+	__u32 count = super->wbcs_conf.wbcc_max_pages >> 1;
+	long rc;
+
+	rc = wbc_reclaim_pages_lru(super, NUMA_NO_NODE, NULL, ULONG_MAX,
+				   count, NULL);
+	return rc < 0 ? rc : 0;
+}
+
+/* Get the next quota waiting for the reclaimer. */
+static struct wbc_quota *wbc_quota_over_next(struct wbc_super *super)
+{
+	struct wbc_quota *quota;
+
+	spin_lock(&super->wbcs_lock);
+	list_for_each_entry(quota, &super->wbcs_quotas, wq_linkage) {
+		if (test_bit(WBC_QUOTA_FL_OVER, &quota->wq_flags)) {
+			wbc_quota_get(quota);
+			spin_unlock(&super->wbcs_lock);
+			return quota;
+		}
+	}
+	spin_unlock(&super->wbcs_lock);
+
+	return NULL;
+}
+
+/*
+ * Reclaim the caches charged to an over-quota root down to the half of its
+ * limits, in the same way as the global reclaim but restricted to the inodes
+ * of the quota.
+ */
+static void wbc_quota_reclaim(struct wbc_super *super)
+{
+	struct wbc_quota *quota;
+	unsigned long limit;
+	long used;
+	long rc;
+
+	quota = wbc_quota_over_next(super);
+	if (quota == NULL)
+		return;
+
+	limit = READ_ONCE(quota->wq_max_inodes);
+	used = percpu_counter_sum(&quota->wq_inodes);
+	while (limit &&
+	       wbc_counter_compare(&quota->wq_inodes, limit / 2, limit) > 0) {
+		rc = wbc_reclaim_inodes_lru(super, NUMA_NO_NODE, NULL, 1,
+					    quota);
+		if (rc <= 0)
+			break;
+	}
+	/* Decompleting a directory unreserves all of its children. */
+	used -= percpu_counter_sum(&quota->wq_inodes);
+	if (used > 0)
+		atomic64_add(used, &quota->wq_reclaimed_inodes);
+
+	limit = READ_ONCE(quota->wq_max_pages);
+	used = percpu_counter_sum(&quota->wq_pages);
+	if (limit && used > limit / 2) {
+		rc = wbc_reclaim_pages_lru(super, NUMA_NO_NODE, NULL,
+					   ULONG_MAX, used - limit / 2, quota);
+		if (rc > 0)
+			atomic64_add(rc, &quota->wq_reclaimed_pages);
+	}
+
+	if (test_and_clear_bit(WBC_QUOTA_FL_OVER, &quota->wq_flags))
+		atomic_dec(&super->wbcs_quotas_over);
+	wbc_quota_put(super, quota);
+}
+
+static inline bool wbc_shrink_pending(struct wbc_super *super)
+{
+	return READ_ONCE(super->wbcs_shrink_nr_inodes) ||
+	       READ_ONCE(super->wbcs_shrink_nr_files);
+}
+
+/* Perform the reclaim requested by the shrinker. */
+static void wbc_shrink_reclaim(struct wbc_super *super)
+{
+	struct memfs_writeback *mwb = &super->wbcs_mwb;
+	struct mem_cgroup *memcg;
+	unsigned long nr_inodes;
+	unsigned long nr_files;
+	long rc;
+	int nid;
+
+	spin_lock(&super->wbcs_lock);
+	nid = super->wbcs_shrink_nid;
+	memcg = super->wbcs_shrink_memcg;
+	nr_inodes = super->wbcs_shrink_nr_inodes;
+	nr_files = super->wbcs_shrink_nr_files;
+	super->wbcs_shrink_memcg = NULL;
+	super->wbcs_shrink_nr_inodes = 0;
+	super->wbcs_shrink_nr_files = 0;
+	spin_unlock(&super->wbcs_lock);
+
+	if (nr_inodes) {
+		rc = wbc_reclaim_inodes_lru(super, nid, memcg, nr_inodes,
+					    NULL);
+		if (rc > 0)
+			__add_wbc_stat(mwb, WB_SHRINK_INODES, rc);
+	}
+
+	if (nr_files) {
+		rc = wbc_reclaim_pages_lru(super, nid, memcg, nr_files,
+					   ULONG_MAX, NULL);
+		if (rc > 0)
+			__add_wbc_stat(mwb, WB_SHRINK_PAGES, rc);
+	}
+
+	wbc_memcg_put(memcg);
+}
+
+#ifndef TASK_IDLE
+#define TASK_IDLE TASK_INTERRUPTIBLE
+#endif
+
+static int ll_wbc_reclaim_main(void *arg)
+{
+	struct wbc_super *super = arg;
 
 	ENTRY;
 
-	spin_lock(&super->wbcs_data_lru_lock);
-	while (shrank_count < count) {
-		struct inode *inode;
-		struct wbc_inode *wbci;
-		struct ll_inode_info *lli;
-		struct dentry *dentry;
+	while (({set_current_state(TASK_IDLE);
+		 !kthread_should_stop(); })) {
+		if (atomic_read(&super->wbcs_quotas_over) > 0) {
+			/* The over-quota roots are reclaimed first. */
+			__set_current_state(TASK_RUNNING);
+			wbc_quota_reclaim(super);
+			wbc_stats_add(super, WBC_STATS_RECLAIM, 1);
+			cond_resched();
+		} else if (wbc_cache_too_much_inodes(&super->wbcs_conf)) {
+			__set_current_state(TASK_RUNNING);
+			(void) wbc_reclaim_inodes(super);
+			wbc_stats_add(super, WBC_STATS_RECLAIM, 1);
+			cond_resched();
+		} else if (wbc_cache_too_much_pages(&super->wbcs_conf)) {
+			__set_current_state(TASK_RUNNING);
+			(void) wbc_reclaim_pages(super);
+			wbc_stats_add(super, WBC_STATS_RECLAIM, 1);
+		} else if (wbc_shrink_pending(super)) {
+			__set_current_state(TASK_RUNNING);
+			wbc_shrink_reclaim(super);
+			wbc_stats_add(super, WBC_STATS_RECLAIM, 1);
+			cond_resched();
+		} else {
+			schedule();
+		}
+	}
+	__set_current_state(TASK_RUNNING);
+
+	RETURN(0);
+}
+
+static unsigned long wbc_shrink_count(struct shrinker *shrinker,
+				      struct shrink_control *sc)
+{
+	struct wbc_super *super = container_of(shrinker, struct wbc_super,
+					       wbcs_shrinker);
+	unsigned long count;
+
+	if (!(sc->gfp_mask & __GFP_FS) ||
+	    !smp_load_acquire(&super->wbcs_shrinker_ready) ||
+	    !super->wbcs_conf.wbcc_shrinker)
+		return 0;
+
+	count = wbc_lru_shrink_count(&super->wbcs_rsvd_inode_lru, sc) +
+		wbc_lru_shrink_count(&super->wbcs_data_inode_lru, sc);
+
+	return vfs_pressure_ratio(count);
+}
+
+/*
+ * The objects of the shrinker are the reserved inodes and the files with
+ * cache pages in MemFS. Flushing them out needs RPCs and locks that the
+ * allocating task may hold, thus the reclaim is handed over to the
+ * reclaimer thread and nothing is freed in the context of the shrinker.
+ */
+static unsigned long wbc_shrink_scan(struct shrinker *shrinker,
+				     struct shrink_control *sc)
+{
+	struct wbc_super *super = container_of(shrinker, struct wbc_super,
+					       wbcs_shrinker);
+	struct mem_cgroup *memcg = NULL;
+	unsigned long nr_inodes;
+	unsigned long nr_files;
+	unsigned long total;
+
+	if (!(sc->gfp_mask & __GFP_FS) ||
+	    !smp_load_acquire(&super->wbcs_shrinker_ready) ||
+	    !super->wbcs_conf.wbcc_shrinker)
+		return SHRINK_STOP;
+
+	nr_inodes = wbc_lru_shrink_count(&super->wbcs_rsvd_inode_lru, sc);
+	nr_files = wbc_lru_shrink_count(&super->wbcs_data_inode_lru, sc);
+	total = nr_inodes + nr_files;
+	if (total == 0)
+		return SHRINK_STOP;
+
+	/* Split the scan over both LRU lists in proportion to their sizes. */
+	nr_inodes = mult_frac(sc->nr_to_scan, nr_inodes, total);
+	nr_files = sc->nr_to_scan - nr_inodes;
+
+#ifdef HAVE_LIST_LRU_MEMCG_SHRINKER
+	memcg = sc->memcg;
+#endif
+	spin_lock(&super->wbcs_lock);
+	if (!super->wbcs_shrink_nr_inodes && !super->wbcs_shrink_nr_files) {
+		super->wbcs_shrink_nid = sc->nid;
+		super->wbcs_shrink_memcg = wbc_memcg_get(memcg);
+	} else if (super->wbcs_shrink_nid != sc->nid ||
+		   super->wbcs_shrink_memcg != memcg) {
+		/* Merge with the pending request of another node or memcg. */
+		super->wbcs_shrink_nid = NUMA_NO_NODE;
+		wbc_memcg_put(super->wbcs_shrink_memcg);
+		super->wbcs_shrink_memcg = NULL;
+	}
+	super->wbcs_shrink_nr_inodes += nr_inodes;
+	super->wbcs_shrink_nr_files += nr_files;
+	spin_unlock(&super->wbcs_lock);
+
+	wake_up_process(super->wbcs_reclaim_task);
+	return SHRINK_STOP;
+}
+
+static int wbc_super_shrinker_init(struct wbc_super *super)
+{
+	struct shrinker *shrinker = &super->wbcs_shrinker;
+	int rc;
+
+	shrinker->count_objects = wbc_shrink_count;
+	shrinker->scan_objects = wbc_shrink_scan;
+	shrinker->seeks = DEFAULT_SEEKS;
+	shrinker->flags = SHRINKER_NUMA_AWARE;
+#ifdef HAVE_LIST_LRU_MEMCG_SHRINKER
+	shrinker->flags |= SHRINKER_MEMCG_AWARE;
+#endif
+
+	/*
+	 * A memcg aware LRU list is bound to the ID of the shrinker assigned
+	 * at registration, thus the shrinker is registered first and does
+	 * nothing until the LRU lists are ready.
+	 */
+	rc = register_shrinker(shrinker);
+	if (rc)
+		return rc;
+
+	rc = wbc_list_lru_init(&super->wbcs_rsvd_inode_lru, shrinker);
+	if (rc)
+		GOTO(out_shrinker, rc);
+
+	rc = wbc_list_lru_init(&super->wbcs_data_inode_lru, shrinker);
+	if (rc)
+		GOTO(out_rsvd_lru, rc);
+
+	super->wbcs_shrink_nid = NUMA_NO_NODE;
+	smp_store_release(&super->wbcs_shrinker_ready, true);
+	return 0;
+
+out_rsvd_lru:
+	list_lru_destroy(&super->wbcs_rsvd_inode_lru);
+out_shrinker:
+	unregister_shrinker(shrinker);
+	return rc;
+}
+
+static void wbc_super_shrinker_fini(struct wbc_super *super)
+{
+	WRITE_ONCE(super->wbcs_shrinker_ready, false);
+	unregister_shrinker(&super->wbcs_shrinker);
+	list_lru_destroy(&super->wbcs_data_inode_lru);
+	list_lru_destroy(&super->wbcs_rsvd_inode_lru);
+	wbc_memcg_put(super->wbcs_shrink_memcg);
+	super->wbcs_shrink_memcg = NULL;
+}
+
+static inline __u32 wbc_fc_max_batch_count(struct wbc_conf *conf)
+{
+	return conf->wbcc_max_batch_count ?: WBC_FC_MAX_BATCH_COUNT;
+}
+
+static inline __u32 wbc_fc_max_rpcs(struct wbc_conf *conf)
+{
+	return conf->wbcc_max_rpcs ?: WBC_MAX_RPCS;
+}
+
+/* Called with @wfc_lock held. */
+static void wbc_fc_adjust(struct wbc_flow_ctrl *fc, s64 elapsed)
+{
+	struct wbc_super *super = container_of(fc, struct wbc_super, wbcs_fc);
+	struct wbc_conf *conf = &super->wbcs_conf;
+	__u32 max_count = wbc_fc_max_batch_count(conf);
+	__u32 count;
+
+	fc->wfc_last_rate = fc->wfc_rate;
+	fc->wfc_rate = elapsed > 0 ?
+		       div64_u64(fc->wfc_window_ops * USEC_PER_SEC, elapsed) : 0;
+
+	if (fc->wfc_window_errors ||
+	    fc->wfc_latency > conf->wbcc_batch_latency) {
+		if (fc->wfc_max_rpcs > 1)
+			fc->wfc_max_rpcs /= 2;
+		else
+			fc->wfc_batch_count = max_t(__u32,
+						    WBC_FC_MIN_BATCH_COUNT,
+						    fc->wfc_batch_count / 2);
+		fc->wfc_last_step = -1;
+		fc->wfc_nr_decrease++;
+	} else if (fc->wfc_last_step > 0 &&
+		   fc->wfc_rate * 100 < fc->wfc_last_rate * 105) {
+		/* The last increase did not pay off, hold for a window. */
+		fc->wfc_last_step = 0;
+	} else if (fc->wfc_latency * 4 < (__u64)conf->wbcc_batch_latency * 3) {
+		count = min(max_count,
+			    fc->wfc_batch_count + fc->wfc_batch_count / 4);
+		/* Grow the batch only if the larger reply still fits. */
+		if (count > fc->wfc_batch_count &&
+		    (__u64)fc->wfc_repsize * count <= BUT_MAXREPSIZE)
+			fc->wfc_batch_count = count;
+		else if (fc->wfc_max_rpcs < wbc_fc_max_rpcs(conf))
+			fc->wfc_max_rpcs++;
+		else
+			goto out;
+
+		fc->wfc_last_step = 1;
+		fc->wfc_nr_increase++;
+	} else {
+		fc->wfc_last_step = 0;
+	}
+out:
+	fc->wfc_window_start = ktime_get();
+	fc->wfc_window_ops = 0;
+	fc->wfc_window_errors = 0;
+}
+
+static bool wbc_fc_get_slot(struct wbc_flow_ctrl *fc)
+{
+	bool got = false;
+
+	spin_lock(&fc->wfc_lock);
+	if (fc->wfc_inflight < fc->wfc_max_rpcs) {
+		fc->wfc_inflight++;
+		got = true;
+	}
+	spin_unlock(&fc->wfc_lock);
+
+	return got;
+}
+
+/*
+ * Sample a batch RPC of @count sub requests which was served in @latency.
+ * Called for every batch of the flush: by the flow controller if adaptive
+ * batch is enabled, otherwise by the sampling hooks of wbc_stats.
+ */
+static void wbc_stats_batch_sample(struct wbc_super *super, __u32 count,
+				   ktime_t latency)
+{
+	struct wbc_stats *ws = &super->wbcs_stats;
+	__u64 us = ktime_to_us(latency);
+
+	lprocfs_oh_tally_log2(&ws->ws_batch_fill, count);
+	lprocfs_oh_tally_log2(&ws->ws_batch_latency, us);
+	wbc_stats_add(super, WBC_STATS_BATCH_RPC, us);
+}
+
+static void wbc_fc_send(struct lu_batch_fc *bfc, __u32 count)
+{
+	struct wbc_flow_ctrl *fc = container_of(bfc, struct wbc_flow_ctrl,
+						wfc_fc);
+
+	wait_event_idle(fc->wfc_waitq, wbc_fc_get_slot(fc));
+}
+
+static void wbc_fc_done(struct lu_batch_fc *bfc, __u32 count, __u32 repsize,
+			ktime_t latency, int rc)
+{
+	struct wbc_flow_ctrl *fc = container_of(bfc, struct wbc_flow_ctrl,
+						wfc_fc);
+	__u64 us = ktime_to_us(latency);
+	s64 elapsed;
+
+	spin_lock(&fc->wfc_lock);
+	LASSERT(fc->wfc_inflight > 0);
+	fc->wfc_inflight--;
+	/* Smooth the samples with the weight 1/8 as the RTT of TCP does. */
+	if (fc->wfc_latency == 0)
+		fc->wfc_latency = us;
+	else
+		fc->wfc_latency = (fc->wfc_latency * 7 + us) / 8;
+
+	if (count > 0 && repsize > 0) {
+		if (fc->wfc_repsize == 0)
+			fc->wfc_repsize = repsize / count;
+		else
+			fc->wfc_repsize = (fc->wfc_repsize * 7 +
+					   repsize / count) / 8;
+	}
+
+	fc->wfc_window_ops += count;
+	if (rc)
+		fc->wfc_window_errors++;
+
+	elapsed = ktime_us_delta(ktime_get(), fc->wfc_window_start);
+	if (elapsed >= WBC_FC_WINDOW || rc)
+		wbc_fc_adjust(fc, elapsed);
+	spin_unlock(&fc->wfc_lock);
+
+	wake_up_all(&fc->wfc_waitq);
+	wbc_stats_batch_sample(container_of(fc, struct wbc_super, wbcs_fc),
+			       count, latency);
+}
+
+static __u32 wbc_fc_max_count(struct lu_batch_fc *bfc)
+{
+	struct wbc_flow_ctrl *fc = container_of(bfc, struct wbc_flow_ctrl,
+						wfc_fc);
+
+	return READ_ONCE(fc->wfc_batch_count);
+}
+
+static void wbc_fc_reset(struct wbc_flow_ctrl *fc, struct wbc_conf *conf)
+{
+	spin_lock(&fc->wfc_lock);
+	fc->wfc_batch_count = min_t(__u32, WBC_FC_INIT_BATCH_COUNT,
+				    wbc_fc_max_batch_count(conf));
+	fc->wfc_max_rpcs = min_t(__u32, WBC_FC_INIT_RPCS,
+				 wbc_fc_max_rpcs(conf));
+	fc->wfc_repsize = 0;
+	fc->wfc_latency = 0;
+	fc->wfc_rate = 0;
+	fc->wfc_last_rate = 0;
+	fc->wfc_window_start = ktime_get();
+	fc->wfc_window_ops = 0;
+	fc->wfc_window_errors = 0;
+	fc->wfc_last_step = 0;
+	spin_unlock(&fc->wfc_lock);
+
+	wake_up_all(&fc->wfc_waitq);
+}
+
+static void wbc_fc_init(struct wbc_flow_ctrl *fc, struct wbc_conf *conf)
+{
+	spin_lock_init(&fc->wfc_lock);
+	init_waitqueue_head(&fc->wfc_waitq);
+	fc->wfc_fc.bfc_send = wbc_fc_send;
+	fc->wfc_fc.bfc_done = wbc_fc_done;
+	fc->wfc_fc.bfc_max_count = wbc_fc_max_count;
+	fc->wfc_inflight = 0;
+	fc->wfc_nr_increase = 0;
+	fc->wfc_nr_decrease = 0;
+	wbc_fc_reset(fc, conf);
+}
+
+/*
+ * Create the batch for the batch flush policy. Its batch count and batch RPCs
+ * are under the control of the flow controller if adaptive batch is enabled,
+ * otherwise its RPCs are only sampled for llite.*.wbc_stats. The batch count
+ * adjusted by the flow controller is picked up by the batch (and its per-MDT
+ * sub batches) via ->bfc_max_count() as the sub requests are added, so a long
+ * flush follows it rather than the count at creation.
+ */
+struct lu_batch *wbc_flush_batch_create(struct super_block *sb)
+{
+	struct wbc_super *super = ll_s2wbcs(sb);
+	struct wbc_conf *conf = &super->wbcs_conf;
+	struct wbc_flow_ctrl *fc = &super->wbcs_fc;
+	struct obd_export *exp = ll_s2sbi(sb)->ll_md_exp;
+	struct lu_batch *bh;
+	__u32 count;
+
+	if (!conf->wbcc_adaptive_batch) {
+		bh = md_batch_create(exp, 0, conf->wbcc_max_batch_count);
+		if (!IS_ERR(bh))
+			bh->bh_fc = &super->wbcs_stats.ws_fc;
+		return bh;
+	}
+
+	spin_lock(&fc->wfc_lock);
+	count = fc->wfc_batch_count;
+	spin_unlock(&fc->wfc_lock);
+
+	bh = md_batch_create(exp, 0, count);
+	if (!IS_ERR(bh))
+		bh->bh_fc = &fc->wfc_fc;
+
+	return bh;
+}
+
+/* Called with @wrc_lock held. */
+static void wbc_rc_update_budget(struct wbc_super *super)
+{
+	struct wbc_revoke_ctrl *rc = &super->wbcs_rc;
+	unsigned int latency = READ_ONCE(super->wbcs_conf.wbcc_revoke_latency);
+	unsigned long budget = 0;
+
+	if (latency > 0) {
+		budget = div64_u64((rc->wrc_rate ?: WBC_RC_INIT_RATE) * latency,
+				   2 * MSEC_PER_SEC);
+		budget = max_t(unsigned long, budget, WBC_RC_MIN_BUDGET);
+	}
+
+	rc->wrc_dirty_budget = budget;
+	WRITE_ONCE(super->wbcs_mwb.wb_dirty_budget, budget);
+}
+
+/**
+ * Sample the flush of @ops inodes which took @elapsed usec. @revoke is set if
+ * it was done to answer a blocking AST on a root WBC lock.
+ */
+void wbc_rc_sample(struct wbc_super *super, s64 ops, s64 elapsed, bool revoke)
+{
+	struct wbc_revoke_ctrl *rc = &super->wbcs_rc;
+	__u64 rate;
+
+	if (elapsed <= 0)
+		return;
+
+	spin_lock(&rc->wrc_lock);
+	if (revoke) {
+		rc->wrc_revoke_last = elapsed;
+		if (elapsed > rc->wrc_revoke_max)
+			rc->wrc_revoke_max = elapsed;
+		rc->wrc_revoke_total += elapsed;
+		rc->wrc_revoke_count++;
+	}
+
+	/* A flush of few inodes is dominated by the fixed costs. */
+	if (ops >= WBC_RC_MIN_SAMPLE_OPS) {
+		rate = div64_u64(ops * USEC_PER_SEC, elapsed);
+		/* Smooth the samples with the weight 1/8 as wbc_fc_done(). */
+		if (rc->wrc_rate == 0)
+			rc->wrc_rate = rate;
+		else
+			rc->wrc_rate = (rc->wrc_rate * 7 + rate) / 8;
+		wbc_rc_update_budget(super);
+	}
+	spin_unlock(&rc->wrc_lock);
+}
+
+static void wbc_rc_reset(struct wbc_super *super)
+{
+	struct wbc_revoke_ctrl *rc = &super->wbcs_rc;
+
+	spin_lock(&rc->wrc_lock);
+	wbc_rc_update_budget(super);
+	spin_unlock(&rc->wrc_lock);
+}
+
+static void wbc_rc_init(struct wbc_super *super)
+{
+	struct wbc_revoke_ctrl *rc = &super->wbcs_rc;
+
+	spin_lock_init(&rc->wrc_lock);
+	rc->wrc_rate = 0;
+	rc->wrc_revoke_last = 0;
+	rc->wrc_revoke_max = 0;
+	rc->wrc_revoke_total = 0;
+	rc->wrc_revoke_count = 0;
+	wbc_rc_reset(super);
+}
+
+static void wbc_stats_fc_send(struct lu_batch_fc *bfc, __u32 count)
+{
+}
+
+static void wbc_stats_fc_done(struct lu_batch_fc *bfc, __u32 count,
+			      __u32 repsize, ktime_t latency, int rc)
+{
+	struct wbc_super *super = container_of(bfc, struct wbc_super,
+					       wbcs_stats.ws_fc);
+
+	wbc_stats_batch_sample(super, count, latency);
+}
+
+/* Account @amount metadata updates flushed to MDT with the opcode @opc. */
+void wbc_stats_flush_opc(struct wbc_super *super, long opc, long amount)
+{
+	enum wbc_stats_counter idx;
+
+	switch (opc) {
+	case MD_OP_CREATE_LOCKLESS:
+	case MD_OP_CREATE_EXLOCK:
+		idx = WBC_STATS_CREATE;
+		break;
+	case MD_OP_SETATTR_LOCKLESS:
+	case MD_OP_SETATTR_EXLOCK:
+		idx = WBC_STATS_SETATTR;
+		break;
+	case MD_OP_EXLOCK_ONLY:
+		idx = WBC_STATS_EXLOCK;
+		break;
+	case MD_OP_REMOVE_LOCKLESS:
+		idx = WBC_STATS_REMOVE;
+		break;
+	case MD_OP_LINK_LOCKLESS:
+		idx = WBC_STATS_LINK;
+		break;
+	case MD_OP_UNLINK_LOCKLESS:
+		idx = WBC_STATS_UNLINK;
+		break;
+	case MD_OP_RENAME_LOCKLESS:
+		idx = WBC_STATS_RENAME;
+		break;
+	default:
+		return;
+	}
+
+	wbc_stats_add(super, idx, amount);
+}
 
-		if (list_empty(&super->wbcs_data_inode_lru))
-			break;
+void wbc_stats_clear(struct wbc_super *super)
+{
+	struct wbc_stats *ws = &super->wbcs_stats;
 
-		wbci = list_entry(super->wbcs_data_inode_lru.next,
-				  struct wbc_inode, wbci_data_lru);
+	lprocfs_clear_stats(ws->ws_stats);
+	lprocfs_oh_clear(&ws->ws_batch_fill);
+	lprocfs_oh_clear(&ws->ws_batch_latency);
+	lprocfs_oh_clear(&ws->ws_revoke_latency);
+}
 
-		list_del_init(&wbci->wbci_data_lru);
-		lli = container_of(wbci, struct ll_inode_info, lli_wbc_inode);
-		inode = ll_info2i(lli);
-		dentry = d_find_any_alias(inode);
-		if (!dentry)
-			continue;
+static const char * const wbc_stats_names[WBC_STATS_NR] = {
+	[WBC_STATS_CREATE]	= "create",
+	[WBC_STATS_SETATTR]	= "setattr",
+	[WBC_STATS_EXLOCK]	= "exlock",
+	[WBC_STATS_REMOVE]	= "remove",
+	[WBC_STATS_LINK]	= "link",
+	[WBC_STATS_UNLINK]	= "unlink",
+	[WBC_STATS_RENAME]	= "rename",
+	[WBC_STATS_RMFID]	= "rmfid",
+	[WBC_STATS_BATCH_RPC]	= "batch_rpc",
+	[WBC_STATS_REVOKE]	= "revoke",
+	[WBC_STATS_DECOMPLETE]	= "decomplete",
+	[WBC_STATS_RECLAIM]	= "reclaim",
+	[WBC_STATS_PREFETCH]	= "prefetch",
+};
 
-		spin_unlock(&super->wbcs_data_lru_lock);
+static int wbc_stats_init(struct wbc_super *super)
+{
+	struct wbc_stats *ws = &super->wbcs_stats;
+	int i;
 
-		rc = wbc_make_data_commit(dentry);
-		dput(dentry);
-		if (rc < 0) {
-			CERROR("Reclaim pages failed: rc = %d\n", rc);
-			RETURN(rc);
-		}
+	ws->ws_stats = lprocfs_alloc_stats(WBC_STATS_NR,
+					   LPROCFS_STATS_FLAG_NONE);
+	if (ws->ws_stats == NULL)
+		return -ENOMEM;
 
-		shrank_count += rc;
-		cond_resched();
-		spin_lock(&super->wbcs_data_lru_lock);
+	for (i = 0; i < WBC_STATS_NR; i++) {
+		if (i == WBC_STATS_BATCH_RPC || i == WBC_STATS_REVOKE)
+			lprocfs_counter_init(ws->ws_stats, i,
+					     LPROCFS_TYPE_LATENCY,
+					     wbc_stats_names[i], "usec");
+		else
+			lprocfs_counter_init(ws->ws_stats, i,
+					     LPROCFS_TYPE_REQS,
+					     wbc_stats_names[i], "reqs");
 	}
-	spin_unlock(&super->wbcs_data_lru_lock);
 
-	RETURN(rc);
+	spin_lock_init(&ws->ws_batch_fill.oh_lock);
+	spin_lock_init(&ws->ws_batch_latency.oh_lock);
+	spin_lock_init(&ws->ws_revoke_latency.oh_lock);
+	ws->ws_fc.bfc_send = wbc_stats_fc_send;
+	ws->ws_fc.bfc_done = wbc_stats_fc_done;
+
+	return 0;
 }
 
-static int wbc_reclaim_pages(struct wbc_super *super)
+static void wbc_stats_fini(struct wbc_super *super)
 {
-	__u32 count = super->wbcs_conf.wbcc_max_pages >> 1;
-
-	return wbc_reclaim_pages_count(super, count);
+	lprocfs_free_stats(&super->wbcs_stats.ws_stats);
 }
 
-#ifndef TASK_IDLE
-#define TASK_IDLE TASK_INTERRUPTIBLE
-#endif
-
-static int ll_wbc_reclaim_main(void *arg)
+/* Print the usage of each root WBC directory for llite.*.wbc_stats. */
+void wbc_roots_seq_show(struct seq_file *m, struct wbc_super *super)
 {
-	struct wbc_super *super = arg;
+	struct list_head *lists[] = { &super->wbcs_roots,
+				      &super->wbcs_lazy_roots };
+	struct wbc_inode *wbci;
+	char fid[FID_LEN + 1];
+	int i;
 
-	ENTRY;
+	seq_printf(m, "\n%-32s %10s %10s %10s\n", "root", "dirty", "inodes",
+		   "pages");
+	spin_lock(&super->wbcs_lock);
+	for (i = 0; i < ARRAY_SIZE(lists); i++) {
+		list_for_each_entry(wbci, lists[i], wbci_root_list) {
+			struct wbc_quota *quota = wbci->wbci_quota;
 
-	while (({set_current_state(TASK_IDLE);
-		 !kthread_should_stop(); })) {
-		if (wbc_cache_too_much_inodes(&super->wbcs_conf)) {
-			__set_current_state(TASK_RUNNING);
-			(void) wbc_reclaim_inodes(super);
-			cond_resched();
-		} else if (wbc_cache_too_much_pages(&super->wbcs_conf)) {
-			__set_current_state(TASK_RUNNING);
-			(void) wbc_reclaim_pages(super);
-		} else {
-			schedule();
+			if (quota == NULL)
+				continue;
+
+			snprintf(fid, sizeof(fid), DFID,
+				 PFID(ll_inode2fid(ll_wbci2i(wbci))));
+			seq_printf(m, "%-32s %10lld %10lld %10lld\n", fid,
+				   percpu_counter_sum_positive(&quota->wq_dirty),
+				   percpu_counter_sum(&quota->wq_inodes),
+				   percpu_counter_sum(&quota->wq_pages));
 		}
 	}
-	__set_current_state(TASK_RUNNING);
-
-	RETURN(0);
+	spin_unlock(&super->wbcs_lock);
 }
 
 static void wbc_super_reset_common_conf(struct wbc_conf *conf)
@@ -1290,12 +2812,24 @@ static void wbc_super_reset_common_conf(struct wbc_conf *conf)
 	conf->wbcc_max_rmfid_count = OBD_MAX_FIDS_IN_ARRAY;
 	conf->wbcc_background_async_rpc = 0;
 	conf->wbcc_max_inodes = 0;
-	conf->wbcc_free_inodes = 0;
 	conf->wbcc_max_pages = 0;
 	conf->wbcc_hiwm_ratio = WBC_DEFAULT_HIWM_RATIO;
 	conf->wbcc_hiwm_inodes_count = 0;
 	conf->wbcc_hiwm_pages_count = 0;
 	conf->wbcc_active_data_writeback = true;
+	conf->wbcc_mkdir_qos = false;
+	conf->wbcc_flushers = WBC_DEFAULT_FLUSHERS;
+	conf->wbcc_dop_pol = WBC_DOP_DEFAULT;
+	conf->wbcc_dop_write_thresh = WBC_DEFAULT_DOP_WRITE_THRESH;
+	conf->wbcc_adaptive_batch = false;
+	conf->wbcc_batch_latency = WBC_DEFAULT_BATCH_LATENCY;
+	conf->wbcc_journal_sync = true;
+	conf->wbcc_shrinker = true;
+	conf->wbcc_partial_revoke = false;
+	conf->wbcc_revoke_latency = 0;
+	conf->wbcc_root_max_inodes = 0;
+	conf->wbcc_root_max_pages = 0;
+	conf->wbcc_prefetch_max_entries = 0;
 }
 
 /* called with @wbcs_lock hold. */
@@ -1314,11 +2848,14 @@ repeat:
 	if (conf->wbcc_cache_mode != WBC_MODE_NONE)
 		goto repeat;
 
-	LASSERTF(conf->wbcc_max_inodes == conf->wbcc_free_inodes &&
+	LASSERTF(percpu_counter_sum(&conf->wbcc_used_inodes) == 0 &&
 		 percpu_counter_sum(&conf->wbcc_used_pages) == 0,
-		 "max_inodes: %lu free_inodes:%lu\n",
-		 conf->wbcc_max_inodes, conf->wbcc_free_inodes);
+		 "max_inodes: %lu used_inodes: %lld\n",
+		 conf->wbcc_max_inodes,
+		 percpu_counter_sum(&conf->wbcc_used_inodes));
 	wbc_super_reset_common_conf(conf);
+	super->wbcs_mwb.wb_nr_flushers = conf->wbcc_flushers;
+	wbc_rc_reset(super);
 }
 
 static void wbc_super_conf_default(struct wbc_conf *conf)
@@ -1340,20 +2877,19 @@ static int wbc_super_conf_update(struct wbc_super *super, struct wbc_conf *conf,
 	 * less then used value in the runtime.
 	 */
 	if (cmd->wbcc_flags & WBC_CMD_OP_INODES_LIMIT &&
-	    (conf->wbcc_max_inodes - conf->wbcc_free_inodes) >
-	    cmd->wbcc_conf.wbcc_max_inodes)
+	    wbc_counter_compare(&conf->wbcc_used_inodes,
+				cmd->wbcc_conf.wbcc_max_inodes,
+				conf->wbcc_max_inodes) > 0)
 		return -EINVAL;
 
 	if (cmd->wbcc_flags & WBC_CMD_OP_PAGES_LIMIT &&
-	    percpu_counter_compare(&conf->wbcc_used_pages,
-				   cmd->wbcc_conf.wbcc_max_pages) > 0)
+	    wbc_counter_compare(&conf->wbcc_used_pages,
+				cmd->wbcc_conf.wbcc_max_pages,
+				conf->wbcc_max_pages) > 0)
 		return -EINVAL;
 
-	if (cmd->wbcc_flags & WBC_CMD_OP_INODES_LIMIT) {
-		conf->wbcc_free_inodes += (cmd->wbcc_conf.wbcc_max_inodes -
-					   conf->wbcc_max_inodes);
+	if (cmd->wbcc_flags & WBC_CMD_OP_INODES_LIMIT)
 		conf->wbcc_max_inodes = cmd->wbcc_conf.wbcc_max_inodes;
-	}
 
 	if (cmd->wbcc_flags & WBC_CMD_OP_PAGES_LIMIT)
 		conf->wbcc_max_pages = cmd->wbcc_conf.wbcc_max_pages;
@@ -1404,6 +2940,72 @@ static int wbc_super_conf_update(struct wbc_super *super, struct wbc_conf *conf,
 	if (cmd->wbcc_flags & WBC_CMD_OP_ACTIVE_DATA_WRITEBACK)
 		conf->wbcc_active_data_writeback =
 			cmd->wbcc_conf.wbcc_active_data_writeback;
+	if (cmd->wbcc_flags & WBC_CMD_OP_MKDIR_QOS)
+		conf->wbcc_mkdir_qos = cmd->wbcc_conf.wbcc_mkdir_qos;
+
+	if (cmd->wbcc_flags & WBC_CMD_OP_FLUSHERS) {
+		super->wbcs_mwb.wb_nr_flushers = cmd->wbcc_conf.wbcc_flushers;
+		conf->wbcc_flushers = cmd->wbcc_conf.wbcc_flushers;
+	}
+
+	if (cmd->wbcc_flags & WBC_CMD_OP_DOP_POL)
+		conf->wbcc_dop_pol = cmd->wbcc_conf.wbcc_dop_pol;
+	if (cmd->wbcc_flags & WBC_CMD_OP_DOP_WRITE_THRESH)
+		conf->wbcc_dop_write_thresh =
+			cmd->wbcc_conf.wbcc_dop_write_thresh;
+	if (cmd->wbcc_flags & WBC_CMD_OP_BATCH_LATENCY)
+		conf->wbcc_batch_latency = cmd->wbcc_conf.wbcc_batch_latency;
+	/* The journal itself is opened by wbc_cmd_handle(). */
+	if (cmd->wbcc_flags & WBC_CMD_OP_JOURNAL)
+		strlcpy(conf->wbcc_journal, cmd->wbcc_conf.wbcc_journal,
+			sizeof(conf->wbcc_journal));
+	if (cmd->wbcc_flags & WBC_CMD_OP_JOURNAL_SYNC)
+		conf->wbcc_journal_sync = cmd->wbcc_conf.wbcc_journal_sync;
+	if (cmd->wbcc_flags & WBC_CMD_OP_SHRINKER)
+		conf->wbcc_shrinker = cmd->wbcc_conf.wbcc_shrinker;
+	if (cmd->wbcc_flags & WBC_CMD_OP_PARTIAL_REVOKE)
+		conf->wbcc_partial_revoke = cmd->wbcc_conf.wbcc_partial_revoke;
+
+	/* Restart the controller with the new limits. */
+	if (cmd->wbcc_flags & (WBC_CMD_OP_ADAPTIVE_BATCH |
+			       WBC_CMD_OP_MAX_BATCH_COUNT |
+			       WBC_CMD_OP_MAX_RPCS)) {
+		if (cmd->wbcc_flags & WBC_CMD_OP_ADAPTIVE_BATCH)
+			conf->wbcc_adaptive_batch =
+				cmd->wbcc_conf.wbcc_adaptive_batch;
+		wbc_fc_reset(&super->wbcs_fc, conf);
+	}
+
+	if (cmd->wbcc_flags & WBC_CMD_OP_REVOKE_LATENCY) {
+		conf->wbcc_revoke_latency = cmd->wbcc_conf.wbcc_revoke_latency;
+		wbc_rc_reset(super);
+	}
+
+	if (cmd->wbcc_flags & (WBC_CMD_OP_ROOT_MAX_INODES |
+			       WBC_CMD_OP_ROOT_MAX_PAGES)) {
+		struct wbc_quota *quota;
+
+		if (cmd->wbcc_flags & WBC_CMD_OP_ROOT_MAX_INODES)
+			conf->wbcc_root_max_inodes =
+				cmd->wbcc_conf.wbcc_root_max_inodes;
+		if (cmd->wbcc_flags & WBC_CMD_OP_ROOT_MAX_PAGES)
+			conf->wbcc_root_max_pages =
+				cmd->wbcc_conf.wbcc_root_max_pages;
+
+		/* The existing roots with a quota of their own as well. */
+		list_for_each_entry(quota, &super->wbcs_quotas, wq_linkage) {
+			if (quota->wq_shared)
+				continue;
+			WRITE_ONCE(quota->wq_max_inodes,
+				   conf->wbcc_root_max_inodes);
+			WRITE_ONCE(quota->wq_max_pages,
+				   conf->wbcc_root_max_pages);
+		}
+	}
+
+	if (cmd->wbcc_flags & WBC_CMD_OP_PREFETCH_MAX_ENTRIES)
+		conf->wbcc_prefetch_max_entries =
+			cmd->wbcc_conf.wbcc_prefetch_max_entries;
 
 	return 0;
 }
@@ -1411,41 +3013,57 @@ static int wbc_super_conf_update(struct wbc_super *super, struct wbc_conf *conf,
 /* @wbc_wq serves all asynchronous writeback tasks. */
 struct workqueue_struct *wbc_wq;
 
-void wbc_kill_super(struct wbc_super *super)
+static void wbc_flushers_drain(struct memfs_writeback *mwb)
 {
-	struct memfs_writeback *mwb = &super->wbcs_mwb;
+	int i;
 
 	mod_delayed_work(wbc_wq, &mwb->wb_dwork, 0);
 	flush_delayed_work(&mwb->wb_dwork);
-	WARN_ON(!list_empty(&mwb->wb_work_list));
+	for (i = 0; i < nr_cpu_ids - 1; i++)
+		flush_work(&mwb->wb_flushers[i].wf_work);
+
+	for (i = 0; i < nr_cpu_ids; i++)
+		WARN_ON(!list_empty(&mwb->wb_deques[i].wfd_list));
 	WARN_ON(delayed_work_pending(&mwb->wb_dwork));
 }
 
+void wbc_kill_super(struct wbc_super *super)
+{
+	wbc_flushers_drain(&super->wbcs_mwb);
+}
+
 void wbc_super_fini(struct wbc_super *super)
 {
 	struct memfs_writeback *mwb = &super->wbcs_mwb;
 	int i;
 
-	LASSERT(list_empty(&super->wbcs_rsvd_inode_lru));
-	LASSERT(list_empty(&super->wbcs_data_inode_lru));
+	LASSERT(list_lru_count(&super->wbcs_rsvd_inode_lru) == 0);
+	LASSERT(list_lru_count(&super->wbcs_data_inode_lru) == 0);
 
+	/* The shrinker wakes up the reclaimer, unregister it first. */
+	wbc_super_shrinker_fini(super);
 	if (super->wbcs_reclaim_task) {
 		kthread_stop(super->wbcs_reclaim_task);
 		super->wbcs_reclaim_task = NULL;
 	}
 
-	mod_delayed_work(wbc_wq, &mwb->wb_dwork, 0);
-	flush_delayed_work(&mwb->wb_dwork);
-	WARN_ON(!list_empty(&mwb->wb_work_list));
-	WARN_ON(delayed_work_pending(&mwb->wb_dwork));
+	wbc_flushers_drain(mwb);
+	wbc_journal_close(super);
+	wbc_rules_fini(super);
+	if (mwb->wb_flushers)
+		OBD_FREE_PTR_ARRAY(mwb->wb_flushers, nr_cpu_ids - 1);
+	OBD_FREE_PTR_ARRAY(mwb->wb_deques, nr_cpu_ids);
 
 	for (i = 0; i < NR_WB_STAT; i++)
 		percpu_counter_destroy(&mwb->wb_stat[i]);
 
+	wbc_stats_fini(super);
+	percpu_counter_destroy(&super->wbcs_conf.wbcc_used_inodes);
 	percpu_counter_destroy(&super->wbcs_conf.wbcc_used_pages);
 }
 
 static void wbc_workfn(struct work_struct *work);
+static void wbc_flusher_workfn(struct work_struct *work);
 
 int wbc_super_init(struct wbc_super *super, struct super_block *sb)
 {
@@ -1464,10 +3082,37 @@ int wbc_super_init(struct wbc_super *super, struct super_block *sb)
 	if (rc)
 		RETURN(-ENOMEM);
 
-	spin_lock_init(&mwb->wb_work_lock);
-	INIT_LIST_HEAD(&mwb->wb_work_list);
+#ifdef HAVE_PERCPU_COUNTER_INIT_GFP_FLAG
+	rc = percpu_counter_init(&conf->wbcc_used_inodes, 0, GFP_KERNEL);
+#else
+	rc = percpu_counter_init(&conf->wbcc_used_inodes, 0);
+#endif
+	if (rc)
+		GOTO(out_used_pages, rc = -ENOMEM);
+
+	OBD_ALLOC_PTR_ARRAY(mwb->wb_deques, nr_cpu_ids);
+	if (mwb->wb_deques == NULL)
+		GOTO(out_used_inodes, rc = -ENOMEM);
+
+	for (i = 0; i < nr_cpu_ids; i++) {
+		spin_lock_init(&mwb->wb_deques[i].wfd_lock);
+		INIT_LIST_HEAD(&mwb->wb_deques[i].wfd_list);
+	}
+
+	if (nr_cpu_ids > 1) {
+		OBD_ALLOC_PTR_ARRAY(mwb->wb_flushers, nr_cpu_ids - 1);
+		if (mwb->wb_flushers == NULL)
+			GOTO(out_deques, rc = -ENOMEM);
+	}
+
+	for (i = 0; i < nr_cpu_ids - 1; i++) {
+		INIT_WORK(&mwb->wb_flushers[i].wf_work, wbc_flusher_workfn);
+		mwb->wb_flushers[i].wf_mwb = mwb;
+	}
+
 	INIT_DELAYED_WORK(&mwb->wb_dwork, wbc_workfn);
 	init_waitqueue_head(&mwb->wb_waitq);
+	mwb->wb_nr_flushers = WBC_DEFAULT_FLUSHERS;
 	mwb->wb_sb = sb;
 
 	for (i = 0; i < NR_WB_STAT; i++) {
@@ -1480,18 +3125,25 @@ int wbc_super_init(struct wbc_super *super, struct super_block *sb)
 			GOTO(out_err, rc);
 	}
 
+	rc = wbc_stats_init(super);
+	if (rc)
+		GOTO(out_err, rc);
+
 	conf->wbcc_cache_mode = WBC_MODE_NONE;
 	conf->wbcc_flush_mode = WBC_FLUSH_NONE;
 	wbc_super_reset_common_conf(conf);
 	spin_lock_init(&super->wbcs_lock);
 	INIT_LIST_HEAD(&super->wbcs_roots);
 	INIT_LIST_HEAD(&super->wbcs_lazy_roots);
-	INIT_LIST_HEAD(&super->wbcs_rsvd_inode_lru);
-	INIT_LIST_HEAD(&super->wbcs_data_inode_lru);
-	spin_lock_init(&super->wbcs_data_lru_lock);
 
 	super->wbcs_context.ioc_anchor_used = 1;
 	wbc_sync_io_init(&super->wbcs_context.ioc_anchor, 0);
+	wbc_fc_init(&super->wbcs_fc, conf);
+	wbc_rc_init(super);
+	wbc_rules_init(super);
+	INIT_LIST_HEAD(&super->wbcs_quotas);
+	atomic_set(&super->wbcs_quotas_over, 0);
+	wbc_journal_init(&super->wbcs_journal);
 
 	super->wbcs_reclaim_task = kthread_run(ll_wbc_reclaim_main, super,
 					       "ll_wbc_reclaimer");
@@ -1499,18 +3151,35 @@ int wbc_super_init(struct wbc_super *super, struct super_block *sb)
 		rc = PTR_ERR(super->wbcs_reclaim_task);
 		super->wbcs_reclaim_task = NULL;
 		CERROR("Cannot start WBC reclaim thread: rc = %d\n", rc);
-		GOTO(out_err, rc);
+		GOTO(out_stats, rc);
+	}
+
+	rc = wbc_super_shrinker_init(super);
+	if (rc) {
+		CERROR("Cannot register WBC shrinker: rc = %d\n", rc);
+		kthread_stop(super->wbcs_reclaim_task);
+		super->wbcs_reclaim_task = NULL;
+		GOTO(out_stats, rc);
 	}
 
 	RETURN(0);
+out_stats:
+	wbc_stats_fini(super);
 out_err:
 	while (i--)
 		percpu_counter_destroy(&mwb->wb_stat[i]);
+	if (mwb->wb_flushers)
+		OBD_FREE_PTR_ARRAY(mwb->wb_flushers, nr_cpu_ids - 1);
+out_deques:
+	OBD_FREE_PTR_ARRAY(mwb->wb_deques, nr_cpu_ids);
+out_used_inodes:
+	percpu_counter_destroy(&conf->wbcc_used_inodes);
+out_used_pages:
 	percpu_counter_destroy(&conf->wbcc_used_pages);
 	RETURN(rc);
 }
 
-static int wbc_parse_value_pair(struct wbc_cmd *cmd, char *buffer)
+int wbc_parse_value_pair(struct wbc_cmd *cmd, char *buffer)
 {
 	struct wbc_conf *conf = &cmd->wbcc_conf;
 	char *key, *val, *rest;
@@ -1582,6 +3251,8 @@ static int wbc_parse_value_pair(struct wbc_cmd *cmd, char *buffer)
 			conf->wbcc_rmpol = WBC_RMPOL_DELAY;
 		else if (strcmp(val, "subtree") == 0)
 			conf->wbcc_rmpol = WBC_RMPOL_SUBTREE;
+		else if (strcmp(val, "batch") == 0)
+			conf->wbcc_rmpol = WBC_RMPOL_BATCH;
 		else
 			return -EINVAL;
 
@@ -1591,6 +3262,12 @@ static int wbc_parse_value_pair(struct wbc_cmd *cmd, char *buffer)
 			conf->wbcc_readdir_pol = WBC_READDIR_DCACHE_COMPAT;
 		else if (strcmp(val, "dcache_decomp") == 0)
 			conf->wbcc_readdir_pol = WBC_READDIR_DCACHE_DECOMPLETE;
+		else if (strcmp(val, "htree_runtime") == 0)
+			conf->wbcc_readdir_pol = WBC_READDIR_HTREE_RUNTIME;
+		else if (strcmp(val, "htree_resident") == 0)
+			conf->wbcc_readdir_pol = WBC_READDIR_HTREE_RESIDENT;
+		else if (strcmp(val, "htree_merge") == 0)
+			conf->wbcc_readdir_pol = WBC_READDIR_HTREE_MERGE;
 		else
 			return -EINVAL;
 
@@ -1617,6 +3294,18 @@ static int wbc_parse_value_pair(struct wbc_cmd *cmd, char *buffer)
 			return -EINVAL;
 
 		cmd->wbcc_flags |= WBC_CMD_OP_PAGES_LIMIT;
+	} else if (strcmp(key, "root_max_inodes") == 0) {
+		conf->wbcc_root_max_inodes = memparse(val, &rest);
+		if (*rest)
+			return -EINVAL;
+
+		cmd->wbcc_flags |= WBC_CMD_OP_ROOT_MAX_INODES;
+	} else if (strcmp(key, "root_max_pages") == 0) {
+		conf->wbcc_root_max_pages = memparse(val, &rest);
+		if (*rest)
+			return -EINVAL;
+
+		cmd->wbcc_flags |= WBC_CMD_OP_ROOT_MAX_PAGES;
 	} else if (strcmp(key, "size") == 0) {
 		unsigned long long size;
 
@@ -1665,6 +3354,126 @@ static int wbc_parse_value_pair(struct wbc_cmd *cmd, char *buffer)
 
 		conf->wbcc_active_data_writeback = result;
 		cmd->wbcc_flags |= WBC_CMD_OP_ACTIVE_DATA_WRITEBACK;
+	} else if (strcmp(key, "mkdir_qos") == 0) {
+		bool result;
+
+		rc = kstrtobool(val, &result);
+		if (rc)
+			return rc;
+
+		conf->wbcc_mkdir_qos = result;
+		cmd->wbcc_flags |= WBC_CMD_OP_MKDIR_QOS;
+	} else if (strcmp(key, "flushers") == 0) {
+		rc = kstrtoul(val, 10, &num);
+		if (rc)
+			return rc;
+
+		if (num == 0 || num > nr_cpu_ids)
+			return -ERANGE;
+
+		conf->wbcc_flushers = num;
+		cmd->wbcc_flags |= WBC_CMD_OP_FLUSHERS;
+	} else if (strcmp(key, "dop_pol") == 0) {
+		if (strcmp(val, "at_flush") == 0)
+			conf->wbcc_dop_pol = WBC_DOP_AT_FLUSH;
+		else if (strcmp(val, "at_write") == 0)
+			conf->wbcc_dop_pol = WBC_DOP_AT_WRITE;
+		else if (strcmp(val, "at_commit") == 0)
+			conf->wbcc_dop_pol = WBC_DOP_AT_COMMIT;
+		else
+			return -EINVAL;
+
+		cmd->wbcc_flags |= WBC_CMD_OP_DOP_POL;
+	} else if (strcmp(key, "dop_write_thresh") == 0) {
+		rc = kstrtoul(val, 10, &num);
+		if (rc)
+			return rc;
+
+		if (num == 0)
+			return -ERANGE;
+
+		conf->wbcc_dop_write_thresh = num;
+		cmd->wbcc_flags |= WBC_CMD_OP_DOP_WRITE_THRESH;
+	} else if (strcmp(key, "adaptive_batch") == 0) {
+		bool result;
+
+		rc = kstrtobool(val, &result);
+		if (rc)
+			return rc;
+
+		conf->wbcc_adaptive_batch = result;
+		cmd->wbcc_flags |= WBC_CMD_OP_ADAPTIVE_BATCH;
+	} else if (strcmp(key, "batch_latency") == 0) {
+		rc = kstrtoul(val, 10, &num);
+		if (rc)
+			return rc;
+
+		if (num == 0 || num > UINT_MAX)
+			return -ERANGE;
+
+		conf->wbcc_batch_latency = num;
+		cmd->wbcc_flags |= WBC_CMD_OP_BATCH_LATENCY;
+	} else if (strcmp(key, "journal") == 0) {
+		rest = strchr(val, '\n');
+		if (rest)
+			*rest = '\0';
+
+		if (val[0] != '/' && strcmp(val, "none") != 0)
+			return -EINVAL;
+
+		if (strlcpy(conf->wbcc_journal, val,
+			    sizeof(conf->wbcc_journal)) >=
+		    sizeof(conf->wbcc_journal))
+			return -ENAMETOOLONG;
+
+		cmd->wbcc_flags |= WBC_CMD_OP_JOURNAL;
+	} else if (strcmp(key, "journal_sync") == 0) {
+		bool result;
+
+		rc = kstrtobool(val, &result);
+		if (rc)
+			return rc;
+
+		conf->wbcc_journal_sync = result;
+		cmd->wbcc_flags |= WBC_CMD_OP_JOURNAL_SYNC;
+	} else if (strcmp(key, "shrinker") == 0) {
+		bool result;
+
+		rc = kstrtobool(val, &result);
+		if (rc)
+			return rc;
+
+		conf->wbcc_shrinker = result;
+		cmd->wbcc_flags |= WBC_CMD_OP_SHRINKER;
+	} else if (strcmp(key, "partial_revoke") == 0) {
+		bool result;
+
+		rc = kstrtobool(val, &result);
+		if (rc)
+			return rc;
+
+		conf->wbcc_partial_revoke = result;
+		cmd->wbcc_flags |= WBC_CMD_OP_PARTIAL_REVOKE;
+	} else if (strcmp(key, "revoke_latency") == 0) {
+		rc = kstrtoul(val, 10, &num);
+		if (rc)
+			return rc;
+
+		if (num > UINT_MAX)
+			return -ERANGE;
+
+		conf->wbcc_revoke_latency = num;
+		cmd->wbcc_flags |= WBC_CMD_OP_REVOKE_LATENCY;
+	} else if (strcmp(key, "prefetch_max_entries") == 0) {
+		rc = kstrtoul(val, 10, &num);
+		if (rc)
+			return rc;
+
+		if (num > UINT_MAX)
+			return -ERANGE;
+
+		conf->wbcc_prefetch_max_entries = num;
+		cmd->wbcc_flags |= WBC_CMD_OP_PREFETCH_MAX_ENTRIES;
 	} else {
 		return -EINVAL;
 	}
@@ -1744,10 +3553,22 @@ int wbc_cmd_handle(struct wbc_super *super, struct wbc_cmd *cmd)
 	struct wbc_conf *conf = &super->wbcs_conf;
 	int rc = 0;
 
+	/*
+	 * Open the journal (and replay the records left by a crash) before
+	 * the configuration takes effect, it may sleep.
+	 */
+	if (cmd->wbcc_cmd == WBC_CMD_CONFIG &&
+	    cmd->wbcc_flags & WBC_CMD_OP_JOURNAL) {
+		rc = wbc_journal_open(super, cmd->wbcc_conf.wbcc_journal);
+		if (rc)
+			return rc;
+	}
+
 	spin_lock(&super->wbcs_lock);
 	switch (cmd->wbcc_cmd) {
 	case WBC_CMD_DISABLE:
 		wbc_super_disable_cache(super);
+		conf->wbcc_journal[0] = '\0';
 		super->wbcs_generation++;
 		break;
 	case WBC_CMD_ENABLE:
@@ -1775,6 +3596,9 @@ int wbc_cmd_handle(struct wbc_super *super, struct wbc_cmd *cmd)
 	}
 
 	spin_unlock(&super->wbcs_lock);
+
+	if (cmd->wbcc_cmd == WBC_CMD_DISABLE)
+		wbc_journal_close(super);
 	return rc;
 }
 
@@ -1795,18 +3619,46 @@ int wbc_cmd_parse_and_handle(char *buffer, unsigned long count,
 	return rc;
 }
 
+/*
+ * The dirty inode limit is the lower of the configured threshold and the
+ * dirty budget of the bounded revocation latency mode.
+ */
+static inline unsigned long wbc_dirty_limit(struct memfs_writeback *mwb)
+{
+	unsigned long budget = READ_ONCE(mwb->wb_dirty_budget);
+
+	if (budget > 0 && (mwb->wb_dirty_flush_thresh == 0 ||
+			   budget < mwb->wb_dirty_flush_thresh))
+		return budget;
+
+	return mwb->wb_dirty_flush_thresh;
+}
+
+static inline s64 wbc_dirty_inodes(struct memfs_writeback *mwb,
+				   unsigned long limit)
+{
+	if (limit < 2 * wbc_stat_error())
+		return wbc_stat_sum(mwb, WB_INODE_DIRTY);
+
+	return wbc_stat(mwb, WB_INODE_DIRTY);
+}
+
 static inline bool wbc_over_dirty_threshold(struct memfs_writeback *mwb)
 {
-	bool over;
+	unsigned long limit = wbc_dirty_limit(mwb);
 
-	if (mwb->wb_dirty_flush_thresh < 2 * wbc_stat_error())
-		over = wbc_stat_sum(mwb, WB_INODE_DIRTY) >
-		       mwb->wb_dirty_flush_thresh;
-	else
-		over = wbc_stat(mwb, WB_INODE_DIRTY) >
-		       mwb->wb_dirty_flush_thresh;
+	return wbc_dirty_inodes(mwb, limit) > limit;
+}
+
+/*
+ * The background flush in bounded revocation latency mode trickles out the
+ * dirty inodes down to half of the budget, instead of all of them.
+ */
+static inline bool wbc_dirty_budget_met(struct memfs_writeback *mwb)
+{
+	unsigned long budget = READ_ONCE(mwb->wb_dirty_budget);
 
-	return over;
+	return budget > 0 && wbc_dirty_inodes(mwb, budget) <= budget / 2;
 }
 
 int wbc_workqueue_init(void)
@@ -1876,16 +3728,29 @@ static void finish_writeback_work(struct memfs_writeback *mwb,
 		wake_up_all(&mwb->wb_waitq);
 }
 
+/*
+ * Queue the writeback @work on the deque of the current CPU, and kick the
+ * flushers of the pool. The owner CPU takes the tasks from the head of its
+ * deque, while the others steal from the tail, see get_next_work_item().
+ */
 static void wb_queue_work(struct memfs_writeback *mwb,
 			  struct wb_writeback_work *work)
 {
+	struct wbc_flush_deque *dq;
+	int i;
+
 	if (work->done)
 		atomic_inc(&work->done->cnt);
 
-	spin_lock_bh(&mwb->wb_work_lock);
-	list_add_tail(&work->list, &mwb->wb_work_list);
+	dq = &mwb->wb_deques[raw_smp_processor_id()];
+	spin_lock_bh(&dq->wfd_lock);
+	list_add(&work->list, &dq->wfd_list);
+	spin_unlock_bh(&dq->wfd_lock);
+	inc_wbc_stat(mwb, WB_FLUSH_TASKS);
+
 	mod_delayed_work(wbc_wq, &mwb->wb_dwork, 0);
-	spin_unlock_bh(&mwb->wb_work_lock);
+	for (i = 0; i < mwb->wb_nr_flushers - 1; i++)
+		queue_work(wbc_wq, &mwb->wb_flushers[i].wf_work);
 }
 
 static bool wb_io_lists_populated(struct bdi_writeback *wb)
@@ -2204,17 +4069,43 @@ static int write_inode(struct inode *inode, struct writeback_control *wbc)
 	return 0;
 }
 
+/*
+ * Take the next writeback task for a flusher. The latest task queued on the
+ * current CPU is preferred, which keeps the flush depth-first and cache hot.
+ * Otherwise steal the oldest task of another CPU, which is usually the top of
+ * a larger subtree.
+ */
 static struct wb_writeback_work *get_next_work_item(struct memfs_writeback *mwb)
 {
 	struct wb_writeback_work *work = NULL;
+	struct wbc_flush_deque *dq;
+	int cpu = raw_smp_processor_id();
+	int i;
+
+	for (i = 0; i < nr_cpu_ids; i++) {
+		dq = &mwb->wb_deques[(cpu + i) % nr_cpu_ids];
+		if (list_empty_careful(&dq->wfd_list))
+			continue;
+
+		spin_lock_bh(&dq->wfd_lock);
+		if (!list_empty(&dq->wfd_list)) {
+			if (i == 0)
+				work = list_first_entry(&dq->wfd_list,
+						struct wb_writeback_work, list);
+			else
+				work = list_last_entry(&dq->wfd_list,
+						struct wb_writeback_work, list);
+			list_del_init(&work->list);
+		}
+		spin_unlock_bh(&dq->wfd_lock);
 
-	spin_lock_bh(&mwb->wb_work_lock);
-	if (!list_empty(&mwb->wb_work_list)) {
-		work = list_entry(mwb->wb_work_list.next,
-				  struct wb_writeback_work, list);
-		list_del_init(&work->list);
+		if (work != NULL) {
+			if (i > 0)
+				inc_wbc_stat(mwb, WB_FLUSH_STEALS);
+			break;
+		}
 	}
-	spin_unlock_bh(&mwb->wb_work_lock);
+
 	return work;
 }
 
@@ -2311,6 +4202,9 @@ static long wbc_writeback_sb_inodes(struct super_block *sb,
 	while (!list_empty(&wb->b_io)) {
 		struct inode *inode = wb_inode(wb->b_io.prev);
 
+		if (work->for_background && wbc_dirty_budget_met(ll_s2mwb(sb)))
+			break;
+
 		if (inode->i_sb != sb) {
 			if (work->sb) {
 				/*
@@ -2434,7 +4328,7 @@ static int wb_writeback_parallel(struct memfs_writeback *mwb,
 	struct dentry *parent = work->parent;
 	struct dentry *child;
 	struct dentry *tmp;
-	int rc;
+	int rc = 0;
 
 	ENTRY;
 
@@ -2467,22 +4361,41 @@ static int wb_writeback_parallel(struct memfs_writeback *mwb,
 }
 
 /*
- * Retrieve work items and do the writeback they describe
+ * Retrieve work items and do the writeback they describe, then commit the
+ * sub updates packed in the I/O context of the flusher. Each subtree is
+ * flushed with the sync mode of the work that queued it.
  */
-static int wb_do_writeback(struct memfs_writeback *mwb,
-			   struct writeback_control_ext *wbcx)
+static int wb_do_writeback_work(struct memfs_writeback *mwb,
+				struct writeback_control_ext *wbcx)
 {
+	enum writeback_sync_modes sync_mode = wbcx->sync_mode;
+	unsigned int for_background = wbcx->for_background;
 	struct wb_writeback_work *work;
-	int ret;
+	int ret = 0;
 
 	while ((work = get_next_work_item(mwb)) != NULL) {
+		wbcx->sync_mode = work->sync_mode;
+		wbcx->for_background = work->for_background;
 		ret = wb_writeback_parallel(mwb, work, wbcx);
 		finish_writeback_work(mwb, work);
 		if (ret)
-			return ret;
+			break;
 	}
 
-	ret = wbcfs_context_commit(mwb->wb_sb, &wbcx->context);
+	wbcx->sync_mode = sync_mode;
+	wbcx->for_background = for_background;
+	if (ret)
+		return ret;
+
+	return wbcfs_context_commit(mwb->wb_sb, &wbcx->context);
+}
+
+static int wb_do_writeback(struct memfs_writeback *mwb,
+			   struct writeback_control_ext *wbcx)
+{
+	int ret;
+
+	ret = wb_do_writeback_work(mwb, wbcx);
 	if (ret)
 		return ret;
 
@@ -2507,6 +4420,8 @@ static void wbc_workfn(struct work_struct *work)
 		.has_ioctx		= 1,
 	};
 	struct super_block *sb = mwb->wb_sb;
+	ktime_t start = ktime_get();
+	s64 written;
 	int rc;
 
 	ENTRY;
@@ -2517,13 +4432,51 @@ static void wbc_workfn(struct work_struct *work)
 	if (rc)
 		RETURN_EXIT;
 
+	written = wbc_stat_sum(mwb, WB_INODE_WRITTEN);
 	rc = wb_do_writeback(mwb, &wbcx);
 	if (rc)
 		CDEBUG(D_CACHE, "Writeback failed: rc = %d\n", rc);
 
 	rc = wbcfs_context_fini(sb, &wbcx.context);
 	clear_bit(WB_FLUSHER_RUNNING, &mwb->wb_state);
+	wbc_rc_sample(ll_s2wbcs(sb),
+		      wbc_stat_sum(mwb, WB_INODE_WRITTEN) - written,
+		      ktime_us_delta(ktime_get(), start), false);
+
+	EXIT;
+}
+
+/*
+ * Flusher of the pool other than the main one. It only works on the queued
+ * subtree tasks with its own I/O context, so that the dcache walking and
+ * packing of different subtrees proceed on multiple CPUs.
+ */
+static void wbc_flusher_workfn(struct work_struct *work)
+{
+	struct wbc_flusher *flusher = container_of(work, struct wbc_flusher,
+						   wf_work);
+	struct memfs_writeback *mwb = flusher->wf_mwb;
+	struct writeback_control_ext wbcx = {
+		.nr_to_write		= 0,
+		.sync_mode		= WB_SYNC_NONE,
+		.for_background		= 1,
+		.for_pflush	= 1,
+		.has_ioctx		= 1,
+	};
+	struct super_block *sb = mwb->wb_sb;
+	int rc;
+
+	ENTRY;
+
+	rc = wbcfs_context_init(sb, &wbcx.context, false, false);
+	if (rc)
+		RETURN_EXIT;
+
+	rc = wb_do_writeback_work(mwb, &wbcx);
+	if (rc)
+		CDEBUG(D_CACHE, "Writeback failed: rc = %d\n", rc);
 
+	rc = wbcfs_context_fini(sb, &wbcx.context);
 	EXIT;
 }
 
@@ -2563,7 +4516,7 @@ static void wbc_start_background_writeback(struct memfs_writeback *mwb)
 
 void wbc_check_dirty_flush(struct memfs_writeback *mwb)
 {
-	if (!wbc_cap_flush_parallel(mwb))
+	if (!wbc_cap_account_dirty(mwb))
 		return;
 
 	if (wbc_flush_in_progress(mwb))
@@ -2573,7 +4526,8 @@ void wbc_check_dirty_flush(struct memfs_writeback *mwb)
 		wbc_start_background_writeback(mwb);
 }
 
-int wbc_queue_writeback_work(struct dentry *parent)
+int wbc_queue_writeback_work(struct dentry *parent,
+			     enum writeback_sync_modes sync_mode)
 {
 	struct memfs_writeback *mwb = ll_i2mwb(parent->d_inode);
 	struct wb_writeback_work *work;
@@ -2585,7 +4539,8 @@ int wbc_queue_writeback_work(struct dentry *parent)
 	if (work == NULL)
 		return -ENOMEM;
 
-	work->sync_mode = WB_SYNC_NONE;
+	work->sync_mode = sync_mode;
+	work->for_background = sync_mode == WB_SYNC_NONE;
 	work->for_flush = 1;
 	work->auto_free = 1;
 	work->auto_dput = 1;
@@ -34,6 +34,8 @@
 #include <linux/fs.h>
 #include <linux/seq_file.h>
 #include <linux/mm.h>
+#include <linux/list_lru.h>
+#include <linux/rbtree.h>
 #include <uapi/linux/lustre/lustre_user.h>
 
 #define LPROCFS_WR_WBC_MAX_CMD 4096
@@ -43,13 +45,44 @@
 
 #define WBC_DEFAULT_MAX_QLEN	8192
 
+/* Bounds and defaults of the adaptive batch flow controller. */
+#define WBC_FC_MIN_BATCH_COUNT	8
+#define WBC_FC_MAX_BATCH_COUNT	1024
+#define WBC_FC_INIT_BATCH_COUNT	64
+#define WBC_FC_INIT_RPCS	8
+/* Adjust the controller once per window (in usec). */
+#define WBC_FC_WINDOW		200000
+/* Default target of the batch RPC service time (in usec). */
+#define WBC_DEFAULT_BATCH_LATENCY	20000
+
+/*
+ * Bounds of the dirty budget in bounded revocation latency mode. The flush
+ * rate (in inodes per second) is assumed before any flush is measured, and
+ * flushes of fewer inodes are not sampled.
+ */
+#define WBC_RC_INIT_RATE	1000
+#define WBC_RC_MIN_BUDGET	32
+#define WBC_RC_MIN_SAMPLE_OPS	8
+
 #define WBC_DEFAULT_MAX_NRPAGES_PER_FILE	ULONG_MAX
 
+#define WBC_DEFAULT_FLUSHERS	1
+
+/* Maximum length of the path to the local metadata journal. */
+#define WBC_JOURNAL_PATH_MAX	256
+/* Size of each of the two in-memory buffers of the journal. */
+#define WBC_JOURNAL_BUF_SIZE	(256 * 1024)
+/* Commit interval of the journal in asynchronous mode (in jiffies). */
+#define WBC_JOURNAL_COMMIT_INTERVAL	(HZ)
+/* Size of a journal segment file from which the commits go to the other. */
+#define WBC_JOURNAL_SEG_SIZE	(64 * 1024 * 1024)
+
 enum wbc_remove_policy {
 	WBC_RMPOL_NONE,
 	WBC_RMPOL_SYNC,
 	WBC_RMPOL_DELAY,
 	WBC_RMPOL_SUBTREE,
+	WBC_RMPOL_BATCH,
 	WBC_RMPOL_DEFAULT = WBC_RMPOL_SYNC,
 };
 
@@ -109,6 +142,13 @@ enum wbc_readdir_policy {
 	 * It is resident in memory for th whole life of the directory.
 	 */
 	WBC_READDIR_HTREE_RESIDENT	= 4,
+	/*
+	 * Merge the hash ordered dir pages of a flushed directory on MDT with
+	 * the entries in MemFS not yet flushed. The entries removed or renamed
+	 * locally are suppressed. Large directories can be listed without
+	 * being decompleted (flushed) first.
+	 */
+	WBC_READDIR_HTREE_MERGE		= 5,
 	/* Default readdir policy. */
 	WBC_READDIR_POL_DEFAULT		= WBC_READDIR_DCACHE_COMPAT,
 };
@@ -138,6 +178,9 @@ enum wbc_dop_policy {
 	WBC_DOP_DEFAULT		= WBC_DOP_AT_FLUSH,
 };
 
+/* 1GiB in pages, the default threshold for WBC_DOP_AT_WRITE. */
+#define WBC_DEFAULT_DOP_WRITE_THRESH	(1UL << (30 - PAGE_SHIFT))
+
 #define WBC_DEFAULT_HIWM_RATIO	0	/* Disable reclaimation. */
 
 struct wbc_conf {
@@ -159,8 +202,11 @@ struct wbc_conf {
 	__u32			wbcc_background_async_rpc:1;
 	/* How many inodes are allowed. */
 	unsigned long		wbcc_max_inodes;
-	/* How many inodes are left for allocation. */
-	unsigned long		wbcc_free_inodes;
+	/*
+	 * How many inodes are reserved. Counted even without the limit, per
+	 * CPU so that the creates in parallel do not contend on a global lock.
+	 */
+	struct percpu_counter	wbcc_used_inodes;
 	/* How many pages are allowed. */
 	unsigned long		wbcc_max_pages;
 	/* How many pages are allocated. */
@@ -176,6 +222,57 @@ struct wbc_conf {
 
 	unsigned long		wbcc_dirty_flush_thresh;
 	bool			wbcc_active_data_writeback;
+	/*
+	 * Spread the cached directories over MDTs by QoS, so that a cached
+	 * subtree is flushed to multiple MDTs in parallel.
+	 */
+	bool			wbcc_mkdir_qos;
+	/* Number of flushers to writeback the subtrees in parallel. */
+	__u32			wbcc_flushers;
+	/*
+	 * Adjust the batch count and the in-flight batch RPCs according to
+	 * the service time of batch RPCs for the batch flush policy.
+	 */
+	bool			wbcc_adaptive_batch;
+	/* Target of the batch RPC service time (in usec). */
+	__u32			wbcc_batch_latency;
+	/* When to instantiate the PCC copy for Data on PCC cache mode. */
+	enum wbc_dop_policy	wbcc_dop_pol;
+	/* Cache pages of a file to spill into PCC for WBC_DOP_AT_WRITE. */
+	unsigned long		wbcc_dop_write_thresh;
+	/*
+	 * Local file to log the MemFS metadata updates, so that they survive
+	 * a client crash. Empty if the journal is disabled.
+	 */
+	char			wbcc_journal[WBC_JOURNAL_PATH_MAX];
+	/* Wait for the journal commit before returning to the caller. */
+	bool			wbcc_journal_sync;
+	/* Reclaim the MemFS caches under the memory pressure of the system. */
+	bool			wbcc_shrinker;
+	/*
+	 * Acquire EX locks on the assimilated subdirectories in lock keep
+	 * flush mode, so that a revocation of the root lock flushes only
+	 * the levels on the path of the conflicting access.
+	 */
+	bool			wbcc_partial_revoke;
+	/*
+	 * Target time (in msec) to answer a blocking AST on a WBC root. The
+	 * dirty inodes are kept under a budget derived from the measured
+	 * flush rate. 0 means unbounded.
+	 */
+	unsigned int		wbcc_revoke_latency;
+	/*
+	 * Default inode and page limits of each root WBC directory, for the
+	 * roots not created by a rule carrying limits. 0 means unlimited.
+	 */
+	unsigned long		wbcc_root_max_inodes;
+	unsigned long		wbcc_root_max_pages;
+	/*
+	 * An existing directory with up to this number of entries becomes a
+	 * complete root WBC directory when it is looked up, by prefetching
+	 * its entries and their attributes into MemFS. 0 means disabled.
+	 */
+	__u32			wbcc_prefetch_max_entries;
 };
 
 enum wbc_stat_item {
@@ -183,6 +280,22 @@ enum wbc_stat_item {
 	WB_INODE_DIRTY,
 	WB_INODE_WRITTEN,
 	WB_PAGES_DIRTY,
+	/* Writeback tasks queued to the flusher pool. */
+	WB_FLUSH_TASKS,
+	/* Writeback tasks stolen from the deque of another CPU. */
+	WB_FLUSH_STEALS,
+	/* Cache pages in MemFS of the files with Data on PCC cache mode. */
+	WB_DOP_PAGES_RESIDENT,
+	/*
+	 * Cache pages moved from MemFS into the PCC copy by the event which
+	 * triggered the move, see wbc_dop_pol2stat().
+	 */
+	WB_DOP_PAGES_AT_FLUSH,
+	WB_DOP_PAGES_AT_WRITE,
+	WB_DOP_PAGES_AT_COMMIT,
+	/* Inodes and cache pages reclaimed on behalf of the shrinker. */
+	WB_SHRINK_INODES,
+	WB_SHRINK_PAGES,
 	NR_WB_STAT,
 };
 
@@ -190,19 +303,36 @@ enum wbc_stat_item {
 #define WB_STAT_BATCH (8*(1+ilog2(nr_cpu_ids)))
 #endif
 
+/* Per-CPU deque of the writeback tasks for the flusher pool. */
+struct wbc_flush_deque {
+	spinlock_t		wfd_lock;
+	struct list_head	wfd_list;
+} ____cacheline_aligned_in_smp;
+
+/* Flusher of the pool in addition to the main flusher @wb_dwork. */
+struct wbc_flusher {
+	struct work_struct	 wf_work;
+	struct memfs_writeback	*wf_mwb;
+};
+
 struct memfs_writeback {
 	struct super_block	*wb_sb;
 	unsigned long		 wb_state;
 	unsigned int		 wb_capabilities;
-	spinlock_t		 wb_work_lock;
-	struct list_head	 wb_work_list;
+	/* Writeback tasks queued on each CPU, indexed by CPU id. */
+	struct wbc_flush_deque	*wb_deques;
 	/* Work item used for writeback */
 	struct delayed_work	 wb_dwork;
+	/* Extra flushers, the first @wb_nr_flushers - 1 of them are used. */
+	struct wbc_flusher	*wb_flushers;
+	unsigned int		 wb_nr_flushers;
 	wait_queue_head_t	 wb_waitq;
 	struct percpu_counter	 wb_stat[NR_WB_STAT];
 
 	/* Dirty inode threshold to trigger flush on background. */
 	unsigned long		 wb_dirty_flush_thresh;
+	/* Dirty inode budget in bounded revocation latency mode. */
+	unsigned long		 wb_dirty_budget;
 };
 
 /* Anchor for synchronous transfer. */
@@ -232,6 +362,268 @@ struct wbc_context {
 #define ioc_batch	ioc_engine.ioe_batch
 #define ioc_rqset	ioc_engine.ioe_rqset
 
+/*
+ * Feedback controller of the batch flush. It tracks the service time of batch
+ * RPCs and the reply size per sub request, and adjusts the batch count and the
+ * number of in-flight batch RPCs to maximize the flush throughput without
+ * driving the service time past the target:
+ * - Multiplicative decrease when the smoothed service time exceeds the target
+ *   or any batch RPC fails. Reduce the in-flight RPCs first, then the batch
+ *   count.
+ * - Increase when the service time is well below the target. Prefer larger
+ *   batches while the reply still fits, then more in-flight RPCs. Hold if the
+ *   last increase did not improve the throughput.
+ */
+struct wbc_flow_ctrl {
+	struct lu_batch_fc	 wfc_fc;
+	spinlock_t		 wfc_lock;
+	wait_queue_head_t	 wfc_waitq;
+	__u32			 wfc_batch_count;
+	__u32			 wfc_max_rpcs;
+	__u32			 wfc_inflight;
+	/* Smoothed reply size of a sub request in bytes. */
+	__u32			 wfc_repsize;
+	/* Smoothed service time of a batch RPC in usec. */
+	__u64			 wfc_latency;
+	/* Sub requests finished per second in the last two windows. */
+	__u64			 wfc_rate;
+	__u64			 wfc_last_rate;
+	ktime_t			 wfc_window_start;
+	__u64			 wfc_window_ops;
+	__u32			 wfc_window_errors;
+	/* Direction of the last adjustment. */
+	int			 wfc_last_step;
+	__u64			 wfc_nr_increase;
+	__u64			 wfc_nr_decrease;
+};
+
+/*
+ * Controller of the bounded revocation latency. The flush rate is sampled on
+ * each background flush and revocation of a root WBC lock. The dirty budget is
+ * the number of inodes which can be flushed within half of the target latency
+ * at the smoothed rate; the other half is left for the lock callback itself
+ * and the variance of the rate. The background flusher trickles out the dirty
+ * inodes once they exceed the budget.
+ */
+struct wbc_revoke_ctrl {
+	spinlock_t		 wrc_lock;
+	/* Smoothed inodes flushed per second. */
+	__u64			 wrc_rate;
+	unsigned long		 wrc_dirty_budget;
+	/* Observed time (in usec) to answer the blocking ASTs. */
+	__u64			 wrc_revoke_last;
+	__u64			 wrc_revoke_max;
+	__u64			 wrc_revoke_total;
+	__u64			 wrc_revoke_count;
+};
+
+/* Counters of llite.*.wbc_stats, named in wbc_stats_init(). */
+enum wbc_stats_counter {
+	/* Metadata updates flushed to MDT, by kind. */
+	WBC_STATS_CREATE,
+	WBC_STATS_SETATTR,
+	WBC_STATS_EXLOCK,
+	WBC_STATS_REMOVE,
+	WBC_STATS_LINK,
+	WBC_STATS_UNLINK,
+	WBC_STATS_RENAME,
+	WBC_STATS_RMFID,
+	/* Service time of the batch RPCs of the flush, in usec. */
+	WBC_STATS_BATCH_RPC,
+	/* Time from the blocking AST until the root lock can be canceled. */
+	WBC_STATS_REVOKE,
+	WBC_STATS_DECOMPLETE,
+	/* Runs of the reclaimer for the cache limits, quotas or shrinker. */
+	WBC_STATS_RECLAIM,
+	/* Directories prefetched into MemFS as complete roots. */
+	WBC_STATS_PREFETCH,
+	WBC_STATS_NR,
+};
+
+/*
+ * Statistics of the flush and the lock revocation. The histograms are in
+ * log2 buckets: the sub requests per batch RPC, the service time of a batch
+ * RPC in usec, and the revocation time in msec.
+ */
+struct wbc_stats {
+	struct lprocfs_stats	*ws_stats;
+	/* Sampling hooks of the batches without the flow control. */
+	struct lu_batch_fc	 ws_fc;
+	struct obd_histogram	 ws_batch_fill;
+	struct obd_histogram	 ws_batch_latency;
+	struct obd_histogram	 ws_revoke_latency;
+};
+
+/*
+ * Cache specification of a new root WBC directory. The fields which are zero
+ * are taken from the global configuration.
+ */
+struct wbc_cache_spec {
+	enum lu_wbc_cache_mode	wcs_cache_mode;
+	enum lu_wbc_flush_mode	wcs_flush_mode;
+	enum wbc_remove_policy	wcs_rmpol;
+	/* Referenced quota of the rule, released by wbc_cache_spec_fini(). */
+	struct wbc_quota	*wcs_quota;
+};
+
+#define WBC_QUOTA_NAME_MAX	64
+
+enum wbc_quota_flags {
+	/* Over the high watermark, waiting for the reclaimer. */
+	WBC_QUOTA_FL_OVER	= 0,
+};
+
+/*
+ * Usage and limits of the MemFS caches charged to a root WBC directory.
+ * All the files and directories under a root, including the nested roots,
+ * share the quota of the root. The roots created by a rule carrying limits
+ * share the quota of the rule instead, so that the limits apply to a job or
+ * a project as a whole. Linked into @wbcs_quotas under @wbcs_lock.
+ */
+struct wbc_quota {
+	struct list_head	wq_linkage;
+	atomic_t		wq_refcount;
+	unsigned long		wq_flags;
+	/* Limits of inodes and pages, 0 means unlimited. */
+	unsigned long		wq_max_inodes;
+	unsigned long		wq_max_pages;
+	/* Usage, per CPU as a root is usually populated in parallel. */
+	struct percpu_counter	wq_inodes;
+	struct percpu_counter	wq_pages;
+	/* Inodes created in MemFS and not yet flushed to MDT. */
+	struct percpu_counter	wq_dirty;
+	/* Number of the root WBC directories charged to this quota. */
+	atomic_t		wq_roots;
+	/* Reservations failed due to the limits. */
+	atomic64_t		wq_denied;
+	atomic64_t		wq_reclaimed_inodes;
+	atomic64_t		wq_reclaimed_pages;
+	/* Shared by the roots of a rule. */
+	bool			wq_shared;
+	char			wq_name[WBC_QUOTA_NAME_MAX];
+};
+
+/*
+ * Rule of the automatic WBC root selection. The conditions use the syntax of
+ * the PCC attach rules with the additional fields "jobid" and "path" (of the
+ * parent directory from the root of the file system). The rules are checked
+ * in order on mkdir under a directory not cached by WBC, and the first one
+ * matched decides whether and how the new directory is cached.
+ */
+struct wbc_rule {
+	struct list_head	wr_linkage;
+	struct pcc_match_rule	wr_match;
+	/* Fields referred by the conditions, in bits of enum pcc_field. */
+	__u32			wr_fields;
+	/* Never cache the matched directories. */
+	bool			wr_exclude;
+	struct wbc_cache_spec	wr_spec;
+	/* Limits shared by all the roots created by this rule. */
+	unsigned long		wr_max_inodes;
+	unsigned long		wr_max_pages;
+	struct wbc_quota	*wr_quota;
+	atomic64_t		wr_hits;
+};
+
+enum wbc_jrec_type {
+	WBC_JREC_CREATE		= 1,
+	WBC_JREC_SETATTR	= 2,
+	WBC_JREC_UNLINK		= 3,
+	WBC_JREC_RENAME		= 4,
+	WBC_JREC_LINK		= 5,
+};
+
+#define WBC_JREC_MAGIC		0x57424a52	/* "WBJR" */
+
+/*
+ * On-disk record of the WBC metadata journal. All records have the same
+ * fixed part, followed by the NUL terminated name and the NUL terminated
+ * target name (for rename) or symlink body (for create), and are padded
+ * to 8 bytes. The journal is private to the client which writes it, so the
+ * fields are kept in the CPU byte order.
+ */
+struct wbc_jrec {
+	__u32			wjr_magic;
+	__u16			wjr_type;
+	__u16			wjr_namelen;
+	__u32			wjr_len;
+	/* crc32 of the whole record with @wjr_cksum as zero. */
+	__u32			wjr_cksum;
+	/* Records are numbered without gaps within a journal file. */
+	__u64			wjr_seq;
+	struct lu_fid		wjr_pfid;
+	struct lu_fid		wjr_fid;
+	struct lu_fid		wjr_tgt_pfid;
+	__u32			wjr_mode;
+	__u32			wjr_uid;
+	__u32			wjr_gid;
+	__u32			wjr_rdev;
+	/* ATTR_* flags of the setattr record. */
+	__u32			wjr_valid;
+	__u16			wjr_tgt_namelen;
+	__u16			wjr_padding;
+	__s64			wjr_atime;
+	__s64			wjr_mtime;
+	__s64			wjr_ctime;
+	__u32			wjr_atime_ns;
+	__u32			wjr_mtime_ns;
+	__u32			wjr_ctime_ns;
+	__u32			wjr_padding2;
+	char			wjr_name[0];
+};
+
+static inline size_t wbc_jrec_size(__u16 namelen, __u16 tgt_namelen)
+{
+	return round_up(offsetof(struct wbc_jrec,
+				 wjr_name[namelen + tgt_namelen + 2]), 8);
+}
+
+/*
+ * Crash-durable journal of the metadata updates cached in MemFS.
+ *
+ * The updates are appended as checksummed records into one of two memory
+ * buffers. A committer swaps the buffers under @wj_lock and writes out the
+ * full one followed by a single fsync(), so concurrent updates waiting on
+ * @wj_mutex share the commit (group commit). When the journal is enabled
+ * again after a crash, the valid records are replayed onto MDT and the
+ * journal is truncated.
+ *
+ * The records are written into two segment files, the journal path and the
+ * path with a ".1" suffix, in turn: once the current segment is larger than
+ * WBC_JOURNAL_SEG_SIZE and the other one is empty, the commits go to the
+ * other one. A checkpoint after a root is flushed truncates each segment
+ * whose records were all flushed by the roots, so that the journal does not
+ * grow without bound while the updates keep being logged.
+ */
+struct wbc_journal {
+	struct mutex		 wj_mutex;
+	spinlock_t		 wj_lock;
+	/* Segment file the records are committed into. */
+	struct file		*wj_filp;
+	/* The other segment file. */
+	struct file		*wj_old_filp;
+	/* Sequence of the last record in @wj_old_filp, 0 if it is empty. */
+	__u64			 wj_old_seq;
+	char			*wj_bufs[2];
+	int			 wj_cur;
+	size_t			 wj_len;
+	loff_t			 wj_off;
+	/* Sequence of the last appended record. */
+	__u64			 wj_seq;
+	/* Sequence of the last record on stable storage. */
+	__u64			 wj_commit_seq;
+	/* Sequence of the last record obsoleted by a checkpoint. */
+	__u64			 wj_ckpt_seq;
+	struct delayed_work	 wj_dwork;
+	/* The journal stops logging after a write failure. */
+	int			 wj_error;
+	__u64			 wj_nr_records;
+	__u64			 wj_nr_commits;
+	__u64			 wj_nr_bytes;
+	__u64			 wj_nr_replayed;
+	__u64			 wj_nr_replay_skipped;
+};
+
 struct wbc_super {
 	spinlock_t		 wbcs_lock;
 	__u64			 wbcs_generation;
@@ -240,17 +632,50 @@ struct wbc_super {
 	struct list_head	 wbcs_roots;
 	struct list_head	 wbcs_lazy_roots;
 
-	/* For cache shrinking and reclaimation. */
-	/* LRU list head for reserved inodes. */
-	struct list_head	 wbcs_rsvd_inode_lru;
-	struct list_head	 wbcs_data_inode_lru;
-	spinlock_t		 wbcs_data_lru_lock;
+	/*
+	 * For cache shrinking and reclaimation. The LRU lists are per NUMA
+	 * node and per memcg (the memcg charged for the inode), so that the
+	 * shrinker can reclaim the caches for a given node or memcg.
+	 */
+	/* LRU list for reserved inodes. */
+	struct list_lru		 wbcs_rsvd_inode_lru;
+	/* LRU list for regular files with cache pages in MemFS. */
+	struct list_lru		 wbcs_data_inode_lru;
 	struct task_struct	*wbcs_reclaim_task;
+	struct shrinker		 wbcs_shrinker;
+	bool			 wbcs_shrinker_ready;
+	/*
+	 * Reclaim requested by the shrinker and performed by the reclaimer
+	 * thread, protected by @wbcs_lock. @wbcs_shrink_nid is NUMA_NO_NODE
+	 * and @wbcs_shrink_memcg is NULL when the requests from different
+	 * nodes or memcgs are merged.
+	 */
+	int			 wbcs_shrink_nid;
+	struct mem_cgroup	*wbcs_shrink_memcg;
+	unsigned long		 wbcs_shrink_nr_inodes;
+	unsigned long		 wbcs_shrink_nr_files;
 
 	/* Writeback dirty inodes and cache pages in MemFS. */
 	struct memfs_writeback	 wbcs_mwb;
 	/* I/O context for all asynchronous I/Os. */
 	struct wbc_context	 wbcs_context;
+	/* Flow control of the batch flush. */
+	struct wbc_flow_ctrl	 wbcs_fc;
+	/* Dirty budget of the bounded revocation latency mode. */
+	struct wbc_revoke_ctrl	 wbcs_rc;
+	/* Exported as llite.*.wbc_stats. */
+	struct wbc_stats	 wbcs_stats;
+	/* Local journal of the MemFS metadata updates. */
+	struct wbc_journal	 wbcs_journal;
+	/* Rules of the automatic WBC root selection. */
+	struct rw_semaphore	 wbcs_rules_sem;
+	struct list_head	 wbcs_rules;
+	/* Fields referred by any of the rules, to collect on mkdir. */
+	__u32			 wbcs_rule_fields;
+	/* Quotas of the root WBC directories, protected by @wbcs_lock. */
+	struct list_head	 wbcs_quotas;
+	/* Number of the quotas with WBC_QUOTA_FL_OVER set. */
+	atomic_t		 wbcs_quotas_over;
 };
 
 #ifndef I_SYNC_QUEUED
@@ -320,9 +745,72 @@ struct writeback_control_ext {
 	struct wbc_context context;
 };
 
+/*
+ * Pending namespace update on an entry which was already flushed to MDT.
+ * The items queued on a directory are replayed in order when the directory
+ * is written back: removals with MD_OP_NONE are sent by FID via rmfid(),
+ * the named updates are packed as batched sub requests.
+ */
 struct wbc_removed_item {
 	struct lu_fid		wbvi_fid;
 	struct list_head	wbvi_item;
+	enum md_opcode		wbvi_opc;
+	/* Parent FID of @wbvi_name, and of the target name for rename. */
+	struct lu_fid		wbvi_pfid;
+	struct lu_fid		wbvi_tgt_pfid;
+	__u32			wbvi_mode;
+	__u16			wbvi_namelen;
+	__u16			wbvi_tgt_namelen;
+	/* Result of the batched sub request, -ECANCELED until replied. */
+	int			wbvi_rc;
+	/* Name pinned for MD_OP_LINK_LOCKLESS, pending again if it fails. */
+	struct dentry		*wbvi_dentry;
+	/* NUL terminated name followed by NUL terminated target name. */
+	char			wbvi_name[0];
+};
+
+static inline size_t wbc_removed_item_size(__u16 namelen, __u16 tgt_namelen)
+{
+	return offsetof(struct wbc_removed_item,
+			wbvi_name[namelen + tgt_namelen + 2]);
+}
+
+static inline const char *
+wbc_removed_item_tgt_name(struct wbc_removed_item *item)
+{
+	return item->wbvi_name + item->wbvi_namelen + 1;
+}
+
+static inline void wbc_removed_item_free(struct wbc_removed_item *item)
+{
+	OBD_FREE(item, wbc_removed_item_size(item->wbvi_namelen,
+					     item->wbvi_tgt_namelen));
+}
+
+/* Node of the hashed index for a child dentry under a MemFS directory. */
+struct wbc_hnode {
+	struct rb_node		 whn_node;
+	/* Hash of the name, used as telldir()/seekdir() cookie. */
+	__u64			 whn_hash;
+	struct dentry		*whn_dentry;
+	/* Merge readdir() returns the entry from the dir pages on MDT. */
+	unsigned int		 whn_mdt:1;
+};
+
+/*
+ * Hashed index rbtree sorting the children dentries of a directory according
+ * to the hash of the file name, which is used to return dentries in hash
+ * order for readdir() call.
+ */
+struct wbc_hindex {
+	struct rb_root		 whi_root;
+	/* Serialize index building, updating and iteration. */
+	struct mutex		 whi_lock;
+	__u32			 whi_count;
+	/* The index reflects all children dentries of the directory. */
+	unsigned int		 whi_valid:1,
+	/* Each indexed dentry is pinned by a reference. */
+				 whi_pinned:1;
 };
 
 struct wbc_inode {
@@ -338,6 +826,13 @@ struct wbc_inode {
 	struct list_head	wbci_root_list;
 	struct list_head	wbci_rsvd_lru;
 	struct list_head	wbci_data_lru;
+	/* Quota of the root WBC directory, see struct wbc_quota. */
+	struct wbc_quota	*wbci_quota;
+	/*
+	 * For a root, the first journal sequence which may log an update
+	 * under it not flushed to MDT yet.
+	 */
+	__u64			wbci_jseq;
 	struct lustre_handle	wbci_lock_handle;
 	struct rw_semaphore	wbci_rw_sem;
 
@@ -348,6 +843,13 @@ struct wbc_inode {
 			spinlock_t		wbci_removed_lock;
 			struct list_head	wbci_removed_list;
 			enum wbc_remove_policy	wbci_rmpol;
+			/* Resident hashed index for readdir(). */
+			struct wbc_hindex	*wbci_hindex;
+			/*
+			 * The directory has too many entries to prefetch,
+			 * do not try it again before this time.
+			 */
+			time64_t		wbci_prefetch_retry;
 		};
 		/* for regular file */
 		struct {
@@ -357,18 +859,57 @@ struct wbc_inode {
 	};
 };
 
+enum wbc_dentry_flags {
+	/*
+	 * The name is a hard link of a file which was created on MDT with
+	 * another name, it is not linked on MDT yet.
+	 */
+	WBC_DENTRY_FL_LINK	= 0x1,
+};
+
 struct wbc_dentry {
 	struct list_head	wbcd_flush_item;
 	struct list_head	wbcd_fsync_item;
 	struct list_head	wbcd_open_files;
 	spinlock_t		wbcd_open_lock;
 	__u32			wbcd_dirent_num;
+	/* enum wbc_dentry_flags, protected by the inode i_lock. */
+	__u32			wbcd_flags;
+};
+
+/*
+ * State of a hashed readdir() in MemFS when the directory was reopened on
+ * MDT, see memfs_dir_resume_read().
+ */
+struct wbc_dir_resume {
+	/* Snapshot of the entries, and where they were from for merge. */
+	struct wbc_hindex	*wdr_index;
+	/* Position in MemFS, a local hash unless @wdr_mdt_pos is set. */
+	__u64			 wdr_pos;
+	__u32			 wdr_hash_off;
+	unsigned int		 wdr_merge:1,
+				 wdr_mdt_read:1,
+				 wdr_mdt_pos:1;
 };
 
 struct wbc_file {
 	struct list_head	 wbcf_open_item;
 	enum wbc_readdir_policy	 wbcf_readdir_pol;
+	/* Merge readdir() is reading MDT, @lfd_pos is an MDT hash cookie. */
+	unsigned int		 wbcf_mdt_pos:1;
+	/* The merge readdir() iteration has the MDT phase. */
+	unsigned int		 wbcf_mdt_read:1;
+	/* Entries returned with the hash @lfd_pos, for hash collisions. */
+	__u32			 wbcf_hash_off;
 	void			*wbcf_private_data;
+	struct wbc_dir_resume	 wbcf_resume;
+};
+
+/* Inodes under WBC roots whose local files are reopened in one batch. */
+struct wbc_reopen_set {
+	struct inode		**wrs_inodes;
+	unsigned int		  wrs_count;
+	unsigned int		  wrs_size;
 };
 
 enum wbc_cmd_type {
@@ -395,6 +936,20 @@ enum wbc_cmd_op {
 	WBC_CMD_OP_MAX_RMFID_COUNT	= 0x1000,
 	WBC_CMD_OP_DIRTY_FLUSH_THRESH	= 0x2000,
 	WBC_CMD_OP_ACTIVE_DATA_WRITEBACK	= 0x4000,
+	WBC_CMD_OP_MKDIR_QOS		= 0x8000,
+	WBC_CMD_OP_FLUSHERS		= 0x10000,
+	WBC_CMD_OP_DOP_POL		= 0x20000,
+	WBC_CMD_OP_DOP_WRITE_THRESH	= 0x40000,
+	WBC_CMD_OP_ADAPTIVE_BATCH	= 0x80000,
+	WBC_CMD_OP_BATCH_LATENCY	= 0x100000,
+	WBC_CMD_OP_JOURNAL		= 0x200000,
+	WBC_CMD_OP_JOURNAL_SYNC		= 0x400000,
+	WBC_CMD_OP_SHRINKER		= 0x800000,
+	WBC_CMD_OP_PARTIAL_REVOKE	= 0x1000000,
+	WBC_CMD_OP_REVOKE_LATENCY	= 0x2000000,
+	WBC_CMD_OP_ROOT_MAX_INODES	= 0x4000000,
+	WBC_CMD_OP_ROOT_MAX_PAGES	= 0x8000000,
+	WBC_CMD_OP_PREFETCH_MAX_ENTRIES	= 0x10000000,
 };
 
 struct wbc_cmd {
@@ -472,23 +1027,19 @@ static inline bool wbc_cap_flush_parallel(struct memfs_writeback *mwb)
 
 static inline bool wbc_cap_account_dirty(struct memfs_writeback *mwb)
 {
-	return mwb->wb_dirty_flush_thresh > 0;
+	return mwb->wb_dirty_flush_thresh > 0 ||
+	       READ_ONCE(mwb->wb_dirty_budget) > 0;
 }
 
 void wbc_check_dirty_flush(struct memfs_writeback *mwb);
 
-static inline void wbc_account_inode_dirtied(struct memfs_writeback *mwb)
-{
-	if (wbc_cap_account_dirty(mwb)) {
-		inc_wbc_stat(mwb, WB_INODE_DIRTY);
-		wbc_check_dirty_flush(mwb);
-	}
-}
+void wbc_account_inode_dirtied(struct inode *inode);
+void wbc_unacct_inode_dirtied(struct inode *inode);
 
-static inline void wbc_unacct_inode_dirtied(struct memfs_writeback *mwb)
+static inline void wbc_stats_add(struct wbc_super *super,
+				 enum wbc_stats_counter idx, long amount)
 {
-	if (wbc_cap_account_dirty(mwb))
-		dec_wbc_stat(mwb, WB_INODE_DIRTY);
+	lprocfs_counter_add(super->wbcs_stats.ws_stats, idx, amount);
 }
 
 static inline bool md_opcode_need_exlock(enum md_opcode opc)
@@ -593,6 +1144,20 @@ static inline bool wbc_inode_remove_dirty(struct wbc_inode *wbci)
 	return wbci->wbci_dirty_flags & WBC_DIRTY_FL_REMOVE;
 }
 
+static inline bool wbc_inode_hardlink_dirty(struct wbc_inode *wbci)
+{
+	return wbci->wbci_dirty_flags & WBC_DIRTY_FL_HARDLINK;
+}
+
+/*
+ * The xattrs of a file not yet flushed to MDT only live in the client
+ * cache, they are sent to MDT together with the file creation.
+ */
+static inline bool wbc_inode_xattr_local(struct wbc_inode *wbci)
+{
+	return wbc_inode_has_protected(wbci) && !wbc_inode_was_flushed(wbci);
+}
+
 static inline bool wbc_decomplete_lock_keep(struct wbc_inode *wbci,
 					    struct md_op_item *item)
 {
@@ -624,6 +1189,8 @@ static inline const char *wbc_rmpol2string(enum wbc_remove_policy pol)
 		return "delay";
 	case WBC_RMPOL_SUBTREE:
 		return "subtree";
+	case WBC_RMPOL_BATCH:
+		return "batch";
 	default:
 		return "unknow";
 	}
@@ -636,11 +1203,24 @@ static inline const char *wbc_readdir_pol2string(enum wbc_readdir_policy pol)
 		return "dcache_compat";
 	case WBC_READDIR_DCACHE_DECOMPLETE:
 		return "dcache_decomp";
+	case WBC_READDIR_HTREE_RUNTIME:
+		return "htree_runtime";
+	case WBC_READDIR_HTREE_RESIDENT:
+		return "htree_resident";
+	case WBC_READDIR_HTREE_MERGE:
+		return "htree_merge";
 	default:
 		return "unknow";
 	}
 }
 
+static inline bool wbc_readdir_pol_hashed(enum wbc_readdir_policy pol)
+{
+	return pol == WBC_READDIR_HTREE_RUNTIME ||
+	       pol == WBC_READDIR_HTREE_RESIDENT ||
+	       pol == WBC_READDIR_HTREE_MERGE;
+}
+
 static inline const char *wbc_flushpol2string(enum wbc_flush_policy pol)
 {
 	switch (pol) {
@@ -655,32 +1235,111 @@ static inline const char *wbc_flushpol2string(enum wbc_flush_policy pol)
 	}
 }
 
+static inline const char *wbc_dop_pol2string(enum wbc_dop_policy pol)
+{
+	switch (pol) {
+	case WBC_DOP_AT_FLUSH:
+		return "at_flush";
+	case WBC_DOP_AT_WRITE:
+		return "at_write";
+	case WBC_DOP_AT_COMMIT:
+		return "at_commit";
+	default:
+		return "unknow";
+	}
+}
+
+/* The counter of the cache pages moved into PCC by the event @pol. */
+static inline enum wbc_stat_item wbc_dop_pol2stat(enum wbc_dop_policy pol)
+{
+	switch (pol) {
+	case WBC_DOP_AT_WRITE:
+		return WB_DOP_PAGES_AT_WRITE;
+	case WBC_DOP_AT_COMMIT:
+		return WB_DOP_PAGES_AT_COMMIT;
+	case WBC_DOP_AT_FLUSH:
+	default:
+		return WB_DOP_PAGES_AT_FLUSH;
+	}
+}
+
+/*
+ * The usage counters checked against a limit are updated with a per-CPU
+ * batch scaled to the limit. With the default batch every CPU may hold up
+ * to percpu_counter_batch, so a compare against a small limit, as a per-root
+ * one often is, falls back to the exact sum on each charge. The total drift
+ * is kept within 1/WBC_COUNTER_DRIFT_DIV of the limit instead.
+ */
+#define WBC_COUNTER_DRIFT_DIV	4
+
+static inline s32 wbc_counter_batch(unsigned long limit)
+{
+	unsigned long batch;
+
+	if (limit == 0)
+		return percpu_counter_batch;
+
+	batch = limit / (WBC_COUNTER_DRIFT_DIV * num_online_cpus());
+	return clamp_t(unsigned long, batch, 1, percpu_counter_batch);
+}
+
+static inline void wbc_counter_add(struct percpu_counter *fbc, s64 amount,
+				   unsigned long limit)
+{
+	percpu_counter_add_batch(fbc, amount, wbc_counter_batch(limit));
+}
+
+static inline int wbc_counter_compare(struct percpu_counter *fbc, s64 rhs,
+				      unsigned long limit)
+{
+	return __percpu_counter_compare(fbc, rhs, wbc_counter_batch(limit));
+}
+
 static inline bool wbc_cache_too_much_inodes(struct wbc_conf *conf)
 {
-	if (conf->wbcc_hiwm_ratio)
-		return conf->wbcc_max_inodes - conf->wbcc_free_inodes >
-		       conf->wbcc_hiwm_inodes_count;
+	if (conf->wbcc_hiwm_ratio && conf->wbcc_max_inodes)
+		return wbc_counter_compare(&conf->wbcc_used_inodes,
+					   conf->wbcc_hiwm_inodes_count,
+					   conf->wbcc_max_inodes) > 0;
 	return false;
 }
 
 static inline bool wbc_cache_too_much_pages(struct wbc_conf *conf)
 {
 	if (conf->wbcc_hiwm_ratio)
-		return percpu_counter_compare(&conf->wbcc_used_pages,
-					      conf->wbcc_hiwm_pages_count) > 0;
+		return wbc_counter_compare(&conf->wbcc_used_pages,
+					   conf->wbcc_hiwm_pages_count,
+					   conf->wbcc_max_pages) > 0;
 	return false;
 }
 
+static inline struct wbc_quota *wbc_quota_get(struct wbc_quota *quota)
+{
+	if (quota)
+		atomic_inc(&quota->wq_refcount);
+	return quota;
+}
+
 /* wbc.c */
 void wbc_super_root_add(struct inode *inode);
 void wbc_super_root_del(struct inode *inode);
-int wbc_reserve_inode(struct wbc_super *super);
+int wbc_reserve_inode(struct wbc_super *super, struct wbc_quota *quota);
 void wbc_unreserve_inode(struct inode *inode);
 void wbc_reserved_inode_lru_add(struct inode *inode);
 void wbc_reserved_inode_lru_del(struct inode *inode);
 void wbc_inode_data_lru_add(struct inode *inode, struct file *file);
 void wbc_inode_data_lru_del(struct inode *inode);
 void wbc_free_inode(struct inode *inode);
+struct wbc_quota *wbc_quota_alloc(struct wbc_super *super, const char *name,
+				  unsigned long max_inodes,
+				  unsigned long max_pages, bool shared);
+void wbc_quota_put(struct wbc_super *super, struct wbc_quota *quota);
+bool wbc_quota_charge_pages(struct wbc_super *super, struct wbc_quota *quota,
+			    long nr_pages);
+void wbc_quota_uncharge_pages(struct wbc_quota *quota, long nr_pages);
+void wbc_quota_root_init(struct inode *inode, struct wbc_cache_spec *spec);
+void wbc_cache_spec_fini(struct wbc_super *super, struct wbc_cache_spec *spec);
+void wbc_quotas_seq_show(struct seq_file *m, struct wbc_super *super);
 void wbc_inode_unreserve_dput(struct inode *inode, struct dentry *dentry);
 void wbc_sync_io_init(struct wbc_sync_io *anchor, int nr);
 int wbc_sync_io_wait(struct wbc_sync_io *anchor, long timeout);
@@ -695,31 +1354,84 @@ int wbc_make_inode_deroot(struct inode *inode, struct ldlm_lock *lock,
 int wbc_make_inode_decomplete(struct inode *inode, unsigned int unrsv_children);
 int wbc_make_dir_decomplete(struct inode *dir, struct dentry *parent,
 			    unsigned int unrsv_children);
-int wbc_make_data_commit(struct dentry *dentry);
+int wbc_make_data_commit(struct dentry *dentry, enum wbc_dop_policy reason);
 int wbc_super_init(struct wbc_super *super, struct super_block *sb);
 void wbc_super_fini(struct wbc_super *super);
+int wbc_parse_value_pair(struct wbc_cmd *cmd, char *buffer);
 void wbc_inode_init(struct inode *inode);
 void wbc_dentry_init(struct dentry *dentry);
+struct dentry *wbc_d_find_alias(struct inode *inode);
+void __wbc_inode_mark_links(struct inode *inode, struct dentry *dentry);
+void __wbc_dentry_link_done(struct inode *inode, struct dentry *dentry);
+void __wbc_dentry_link_redo(struct inode *inode, struct dentry *dentry);
+bool wbc_dentry_link_clear(struct inode *inode, struct dentry *dentry);
 int wbc_cmd_handle(struct wbc_super *super, struct wbc_cmd *cmd);
 int wbc_cmd_parse_and_handle(char *buffer, unsigned long count,
 			     struct wbc_super *super);
 int wbc_workqueue_init(void);
 void wbc_workqueue_fini(void);
 void wbc_check_dirty_flush(struct memfs_writeback *mwb);
-int wbc_queue_writeback_work(struct dentry *parent);
+int wbc_queue_writeback_work(struct dentry *parent,
+			     enum writeback_sync_modes sync_mode);
 void __inode_wait_for_writeback(struct inode *inode);
 void __wbc_inode_wait_for_writeback(struct inode *inode);
 void wbc_kill_super(struct wbc_super *super);
+struct lu_batch *wbc_flush_batch_create(struct super_block *sb);
+void wbc_rc_sample(struct wbc_super *super, s64 ops, s64 elapsed,
+		   bool revoke);
+void wbc_stats_flush_opc(struct wbc_super *super, long opc, long amount);
+void wbc_stats_clear(struct wbc_super *super);
+void wbc_roots_seq_show(struct seq_file *m, struct wbc_super *super);
+
+/* wbc_journal.c */
+void wbc_journal_init(struct wbc_journal *wj);
+int wbc_journal_open(struct wbc_super *super, const char *path);
+void wbc_journal_close(struct wbc_super *super);
+__u64 wbc_journal_seq(struct wbc_super *super);
+void wbc_journal_checkpoint(struct wbc_super *super, __u64 seq);
+void wbc_journal_log_create(struct inode *dir, struct dentry *dchild);
+void wbc_journal_log_setattr(struct inode *inode, unsigned int valid);
+void wbc_journal_log_unlink(struct inode *dir, struct dentry *dchild);
+void wbc_journal_log_rename(struct inode *src, struct dentry *src_dchild,
+			    struct inode *tgt, struct dentry *tgt_dchild);
+void wbc_journal_log_link(struct inode *dir, struct dentry *dchild);
+void wbc_journal_seq_show(struct seq_file *m, struct wbc_super *super);
+
+/* wbc_rule.c */
+void wbc_rules_init(struct wbc_super *super);
+void wbc_rules_fini(struct wbc_super *super);
+int wbc_rule_cmd_handle(struct wbc_super *super, char *buffer);
+bool wbc_rule_match(struct wbc_super *super, struct inode *dir,
+		    struct dentry *dchild, struct wbc_cache_spec *spec);
+void wbc_rules_seq_show(struct seq_file *m, struct wbc_super *super);
 
 /* memfs.c */
 void wbc_inode_operations_set(struct inode *inode, umode_t mode, dev_t dev);
 bool wbc_inode_acct_page(struct inode *inode, long nr_pages);
 void wbc_inode_unacct_pages(struct inode *inode, long nr_pages);
+void wbc_hindex_free(struct wbc_hindex *hidx);
+void wbc_dir_hindex_fini(struct inode *dir);
+int memfs_xattr_set(struct inode *inode, const char *name,
+		    const void *value, size_t size, int flags);
+struct wbc_removed_item *
+wbc_removed_item_alloc(enum md_opcode opc, struct inode *inode,
+		       const struct qstr *name, const struct qstr *tgt_name);
+void memfs_prefetch_init(struct inode *dir, struct dentry *dentry);
+int memfs_prefetch_add(struct inode *dir, struct dentry *dchild);
+void memfs_dir_resume_save(struct file *file, struct wbc_dir_resume *resume);
+void memfs_dir_resume_set(struct file *file, struct wbc_dir_resume *resume);
+void memfs_dir_resume_fini(struct wbc_dir_resume *resume);
+void memfs_dir_pos_decode(struct ll_file_data *fd);
+#ifdef HAVE_DIR_CONTEXT
+int memfs_dir_resume_read(struct file *file, struct dir_context *ctx);
+#else
+int memfs_dir_resume_read(struct file *file, void *cookie, filldir_t filldir);
+#endif
 
 /* llite_wbc.c */
 void wbcfs_inode_operations_switch(struct inode *inode);
 int wbcfs_d_init(struct dentry *de);
-int wbcfs_commit_cache_pages(struct inode *inode);
+int wbcfs_commit_cache_pages(struct inode *inode, enum wbc_dop_policy reason);
 int wbcfs_inode_flush_lockless(struct inode *inode,
 			       struct writeback_control_ext *wbcx);
 int wbcfs_context_init(struct super_block *sb, struct wbc_context *ctx,
@@ -727,6 +1439,7 @@ int wbcfs_context_init(struct super_block *sb, struct wbc_context *ctx,
 int wbcfs_context_fini(struct super_block *sb, struct wbc_context *ctx);
 int wbcfs_context_prepare(struct super_block *sb, struct wbc_context *ctx);
 int wbcfs_context_commit(struct super_block *sb, struct wbc_context *ctx);
+int wbcfs_subdir_exlock_async(struct dentry *dchild);
 int wbcfs_flush_dir_child(struct wbc_context *ctx, struct inode *dir,
 			  struct dentry *dchild, struct ldlm_lock *lock,
 			  struct writeback_control_ext *wbcx);
@@ -734,16 +1447,24 @@ int wbcfs_writeback_dir_child(struct inode *dir, struct dentry *child,
 			      struct writeback_control_ext *wbcx);
 int wbcfs_file_open_local(struct inode *inode, struct file *file);
 void wbcfs_file_release_local(struct inode *inode, struct file *file);
+int wbcfs_reopen_prefetch(struct inode **inodes, unsigned int count);
+void wbcfs_reopen_release(struct inode *inode);
+int wbcfs_reopen_collect(struct inode *root, int depth,
+			 struct wbc_reopen_set *set);
+void wbcfs_reopen_set_fini(struct wbc_reopen_set *set);
 int wbcfs_dcache_dir_open(struct inode *inode, struct file *file);
 int wbcfs_dcache_dir_close(struct inode *inode, struct file *file);
 int wbcfs_inode_sync_metadata(long opc, struct inode *inode,
 			      unsigned int valid);
+int wbcfs_sync_removed_items(struct inode *dir, struct list_head *head);
+int wbcfs_flush_hardlinks(struct inode *inode);
 int wbcfs_setattr_data_object(struct inode *inode, struct iattr *attr);
 void wbc_free_inode_pages_final(struct inode *inode,
 				struct address_space *mapping);
 
 bool wbc_may_exclusive_cache(struct inode *dir, struct dentry *dchild,
-			     umode_t mode, __u64 *extra_lock_flags);
+			     umode_t mode, __u64 *extra_lock_flags,
+			     struct wbc_cache_spec *spec);
 void wbc_tunables_init(struct super_block *sb);
 void wbc_tunables_fini(struct super_block *sb);
 long wbc_ioctl(struct file *file, unsigned int cmd, unsigned long arg);
@@ -756,11 +1477,13 @@ void wbc_free_inode(struct inode *inode);
 void wbc_free_inode_pages_final(struct inode *inode,
 				struct address_space *mapping);
 void wbc_intent_inode_init(struct inode *dir, struct inode *inode,
-			   struct lookup_intent *it);
+			   struct lookup_intent *it,
+			   struct wbc_cache_spec *spec);
 
 int ll_new_inode_init(struct inode *dir, struct dentry *dchild,
 		      struct inode *inode);
 void ll_intent_inode_init(struct inode *dir, struct inode *inode,
 			  struct lookup_intent *it);
+void ll_dir_prefetch(struct inode *parent, struct dentry *dentry);
 
 #endif /* LLITE_WBC_H */
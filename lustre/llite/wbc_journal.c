@@ -0,0 +1,1022 @@
+/*
+ * LGPL HEADER START
+ *
+ * DO NOT ALTER OR REMOVE COPYRIGHT NOTICES OR THIS FILE HEADER.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * LGPL version 2.1 or (at your discretion) any later version.
+ * LGPL version 2.1 accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * LGPL HEADER END
+ */
+/*
+ * Copyright (c) 2019-2021, DDN Storage Corporation.
+ */
+/*
+ * lustre/llite/wbc_journal.c
+ *
+ * Crash-durable local journal for the metadata cached by Lustre Metadata
+ * Writeback Caching (WBC).
+ *
+ * The namespace and attribute updates applied in MemFS are lost when the
+ * client crashes before they are flushed to MDT, which limits how long the
+ * updates may age in the cache. With the journal enabled, each update is
+ * logged as a record into a local file before it is acknowledged, and the
+ * records left over by a crash are replayed onto MDT when the journal is
+ * enabled again. The file data cached in MemFS is not logged.
+ */
+
+#define DEBUG_SUBSYSTEM S_LLITE
+
+#include <linux/namei.h>
+#include <linux/file.h>
+#include <linux/crc32.h>
+#include <lustre_compat.h>
+#include "llite_internal.h"
+
+static void wbc_journal_workfn(struct work_struct *work);
+
+void wbc_journal_init(struct wbc_journal *wj)
+{
+	memset(wj, 0, sizeof(*wj));
+	mutex_init(&wj->wj_mutex);
+	spin_lock_init(&wj->wj_lock);
+	INIT_DELAYED_WORK(&wj->wj_dwork, wbc_journal_workfn);
+}
+
+static inline struct wbc_journal *ll_i2wj(struct inode *inode)
+{
+	return &ll_i2wbcs(inode)->wbcs_journal;
+}
+
+static inline __u32 wbc_jrec_cksum(struct wbc_jrec *rec)
+{
+	__u32 cksum = rec->wjr_cksum;
+	__u32 crc;
+
+	rec->wjr_cksum = 0;
+	crc = crc32_le(~0U, (unsigned char *)rec, rec->wjr_len);
+	rec->wjr_cksum = cksum;
+	return crc;
+}
+
+/*
+ * Write out the records appended so far and make them durable.
+ * Called with @wj_mutex held, which serializes the committers; the records
+ * appended while the previous commit was in progress are written together.
+ * The records are written into the other segment once the current one is
+ * full and the other one was emptied by a checkpoint.
+ */
+static void wbc_journal_commit_locked(struct wbc_journal *wj)
+{
+	char *buf;
+	size_t len;
+	__u64 seq;
+	loff_t off;
+	int rc;
+
+	spin_lock(&wj->wj_lock);
+	if (wj->wj_off >= WBC_JOURNAL_SEG_SIZE && wj->wj_old_seq == 0 &&
+	    !wj->wj_error) {
+		swap(wj->wj_filp, wj->wj_old_filp);
+		wj->wj_old_seq = wj->wj_commit_seq;
+		wj->wj_off = 0;
+	}
+	buf = wj->wj_bufs[wj->wj_cur];
+	len = wj->wj_len;
+	seq = wj->wj_seq;
+	wj->wj_cur ^= 1;
+	wj->wj_len = 0;
+	spin_unlock(&wj->wj_lock);
+
+	if (len == 0 || wj->wj_error)
+		GOTO(out, rc = wj->wj_error);
+
+	off = wj->wj_off;
+	rc = cfs_kernel_write(wj->wj_filp, buf, len, &off);
+	if (rc >= 0 && rc != len)
+		rc = -EIO;
+	if (rc < 0)
+		GOTO(out, rc);
+
+	rc = vfs_fsync(wj->wj_filp, 1);
+	if (rc)
+		GOTO(out, rc);
+
+	wj->wj_off = off;
+out:
+	spin_lock(&wj->wj_lock);
+	if (rc < 0 && !wj->wj_error) {
+		CERROR("%pD: WBC journal commit failed, stop logging: rc = %d\n",
+		       wj->wj_filp, rc);
+		wj->wj_error = rc;
+	} else if (rc == 0) {
+		if (len) {
+			wj->wj_nr_commits++;
+			wj->wj_nr_bytes += len;
+		}
+		wj->wj_commit_seq = seq;
+	}
+	spin_unlock(&wj->wj_lock);
+}
+
+static void wbc_journal_commit(struct wbc_journal *wj, __u64 seq)
+{
+	while (READ_ONCE(wj->wj_commit_seq) < seq) {
+		mutex_lock(&wj->wj_mutex);
+		/* Some other thread may have committed @seq meanwhile. */
+		if (wj->wj_commit_seq < seq && wj->wj_filp && !wj->wj_error)
+			wbc_journal_commit_locked(wj);
+		mutex_unlock(&wj->wj_mutex);
+		/* Waiters must not hang on a failed journal. */
+		if (READ_ONCE(wj->wj_filp) == NULL || READ_ONCE(wj->wj_error))
+			break;
+	}
+}
+
+static void wbc_journal_workfn(struct work_struct *work)
+{
+	struct wbc_journal *wj = container_of(work, struct wbc_journal,
+					      wj_dwork.work);
+
+	wbc_journal_commit(wj, READ_ONCE(wj->wj_seq));
+}
+
+/* Arguments of a journal record. */
+struct wbc_jrec_args {
+	enum wbc_jrec_type	 wja_type;
+	struct inode		*wja_dir;
+	struct inode		*wja_inode;
+	struct inode		*wja_tgt_dir;
+	const struct qstr	*wja_name;
+	const char		*wja_tgt_name;
+	__u16			 wja_tgt_namelen;
+	unsigned int		 wja_valid;
+};
+
+static void wbc_jrec_fill(struct wbc_jrec *rec, struct wbc_jrec_args *args)
+{
+	struct inode *inode = args->wja_inode;
+	__u16 namelen = args->wja_name ? args->wja_name->len : 0;
+
+	memset(rec, 0, sizeof(*rec));
+	rec->wjr_magic = WBC_JREC_MAGIC;
+	rec->wjr_type = args->wja_type;
+	rec->wjr_namelen = namelen;
+	rec->wjr_tgt_namelen = args->wja_tgt_namelen;
+	rec->wjr_len = wbc_jrec_size(namelen, args->wja_tgt_namelen);
+	if (args->wja_dir)
+		rec->wjr_pfid = *ll_inode2fid(args->wja_dir);
+	if (args->wja_tgt_dir)
+		rec->wjr_tgt_pfid = *ll_inode2fid(args->wja_tgt_dir);
+	rec->wjr_fid = *ll_inode2fid(inode);
+	rec->wjr_mode = inode->i_mode;
+	rec->wjr_uid = from_kuid(&init_user_ns, inode->i_uid);
+	rec->wjr_gid = from_kgid(&init_user_ns, inode->i_gid);
+	rec->wjr_rdev = old_encode_dev(inode->i_rdev);
+	rec->wjr_valid = args->wja_valid;
+	rec->wjr_atime = inode->i_atime.tv_sec;
+	rec->wjr_atime_ns = inode->i_atime.tv_nsec;
+	rec->wjr_mtime = inode->i_mtime.tv_sec;
+	rec->wjr_mtime_ns = inode->i_mtime.tv_nsec;
+	rec->wjr_ctime = inode->i_ctime.tv_sec;
+	rec->wjr_ctime_ns = inode->i_ctime.tv_nsec;
+	/* NUL terminators and padding are covered by the checksum. */
+	memset(rec->wjr_name, 0,
+	       rec->wjr_len - offsetof(struct wbc_jrec, wjr_name));
+	if (namelen)
+		memcpy(rec->wjr_name, args->wja_name->name, namelen);
+	if (args->wja_tgt_namelen)
+		memcpy(rec->wjr_name + namelen + 1, args->wja_tgt_name,
+		       args->wja_tgt_namelen);
+}
+
+/*
+ * Append a record into the journal, and wait for it to be committed if the
+ * journal is in synchronous mode. A failure of the journal does not fail the
+ * update in MemFS, the journal just stops logging.
+ */
+static void wbc_journal_log(struct wbc_jrec_args *args)
+{
+	struct inode *inode = args->wja_inode;
+	struct wbc_journal *wj = ll_i2wj(inode);
+	struct wbc_jrec *rec;
+	size_t len;
+	bool kick;
+	__u64 seq;
+
+	if (likely(READ_ONCE(wj->wj_filp) == NULL))
+		return;
+
+	len = wbc_jrec_size(args->wja_name ? args->wja_name->len : 0,
+			    args->wja_tgt_namelen);
+	if (len > WBC_JOURNAL_BUF_SIZE)
+		return;
+
+	spin_lock(&wj->wj_lock);
+	while (wj->wj_filp && !wj->wj_error &&
+	       wj->wj_len + len > WBC_JOURNAL_BUF_SIZE) {
+		seq = wj->wj_seq;
+		spin_unlock(&wj->wj_lock);
+		wbc_journal_commit(wj, seq);
+		spin_lock(&wj->wj_lock);
+	}
+
+	if (wj->wj_filp == NULL || wj->wj_error) {
+		spin_unlock(&wj->wj_lock);
+		return;
+	}
+
+	rec = (struct wbc_jrec *)(wj->wj_bufs[wj->wj_cur] + wj->wj_len);
+	wbc_jrec_fill(rec, args);
+	rec->wjr_seq = ++wj->wj_seq;
+	rec->wjr_cksum = wbc_jrec_cksum(rec);
+	kick = wj->wj_len == 0;
+	wj->wj_len += len;
+	wj->wj_nr_records++;
+	seq = wj->wj_seq;
+	spin_unlock(&wj->wj_lock);
+
+	if (ll_i2wbcc(inode)->wbcc_journal_sync)
+		wbc_journal_commit(wj, seq);
+	else if (kick)
+		schedule_delayed_work(&wj->wj_dwork,
+				      WBC_JOURNAL_COMMIT_INTERVAL);
+}
+
+void wbc_journal_log_create(struct inode *dir, struct dentry *dchild)
+{
+	struct inode *inode = dchild->d_inode;
+	struct wbc_jrec_args args = {
+		.wja_type	= WBC_JREC_CREATE,
+		.wja_dir	= dir,
+		.wja_inode	= inode,
+		.wja_name	= &dchild->d_name,
+	};
+
+	if (S_ISLNK(inode->i_mode)) {
+		args.wja_tgt_name = ll_i2info(inode)->lli_symlink_name;
+		args.wja_tgt_namelen = strlen(args.wja_tgt_name);
+	}
+
+	wbc_journal_log(&args);
+}
+
+void wbc_journal_log_setattr(struct inode *inode, unsigned int valid)
+{
+	struct wbc_jrec_args args = {
+		.wja_type	= WBC_JREC_SETATTR,
+		.wja_inode	= inode,
+		.wja_valid	= valid & (ATTR_MODE | ATTR_UID | ATTR_GID |
+					   ATTR_ATIME | ATTR_MTIME |
+					   ATTR_CTIME),
+	};
+
+	if (args.wja_valid)
+		wbc_journal_log(&args);
+}
+
+void wbc_journal_log_unlink(struct inode *dir, struct dentry *dchild)
+{
+	struct wbc_jrec_args args = {
+		.wja_type	= WBC_JREC_UNLINK,
+		.wja_dir	= dir,
+		.wja_inode	= dchild->d_inode,
+		.wja_name	= &dchild->d_name,
+	};
+
+	wbc_journal_log(&args);
+}
+
+/* Called after simple_rename() but before d_move() of @src_dchild. */
+void wbc_journal_log_rename(struct inode *src, struct dentry *src_dchild,
+			    struct inode *tgt, struct dentry *tgt_dchild)
+{
+	struct wbc_jrec_args args = {
+		.wja_type	= WBC_JREC_RENAME,
+		.wja_dir	= src,
+		.wja_tgt_dir	= tgt,
+		.wja_inode	= src_dchild->d_inode,
+		.wja_name	= &src_dchild->d_name,
+		.wja_tgt_name	= tgt_dchild->d_name.name,
+		.wja_tgt_namelen = tgt_dchild->d_name.len,
+	};
+
+	wbc_journal_log(&args);
+}
+
+void wbc_journal_log_link(struct inode *dir, struct dentry *dchild)
+{
+	struct wbc_jrec_args args = {
+		.wja_type	= WBC_JREC_LINK,
+		.wja_dir	= dir,
+		.wja_inode	= dchild->d_inode,
+		.wja_name	= &dchild->d_name,
+	};
+
+	wbc_journal_log(&args);
+}
+
+/*
+ * Whether the entry @name under @dir on MDT still refers to @fid, otherwise
+ * the record was already applied and the name was reused afterwards.
+ */
+static int wbc_jrec_name_match(struct inode *dir, const char *name,
+			       int namelen, const struct lu_fid *fid,
+			       struct lu_fid *cur)
+{
+	struct lu_fid tmp;
+	int rc;
+
+	if (cur == NULL)
+		cur = &tmp;
+
+	rc = ll_get_fid_by_name(dir, name, namelen, cur, NULL);
+	if (rc == -ENOENT)
+		return 0;
+	if (rc)
+		return rc;
+
+	return lu_fid_eq(cur, fid);
+}
+
+static int wbc_jrec_replay_create(struct super_block *sb,
+				  struct wbc_jrec *rec)
+{
+	struct ptlrpc_request *req = NULL;
+	struct md_op_data *op_data;
+	struct inode *inode;
+	struct lu_fid fid;
+	struct inode *dir;
+	const char *tgt = NULL;
+	size_t tgtlen = 0;
+	int opc;
+	int rc;
+
+	ENTRY;
+
+	switch (rec->wjr_mode & S_IFMT) {
+	case S_IFDIR:
+		opc = LUSTRE_OPC_MKDIR;
+		break;
+	case S_IFLNK:
+		opc = LUSTRE_OPC_SYMLINK;
+		tgt = rec->wjr_name + rec->wjr_namelen + 1;
+		tgtlen = rec->wjr_tgt_namelen + 1;
+		break;
+	default:
+		opc = LUSTRE_OPC_CREATE;
+		break;
+	}
+
+	/* The file was created on MDT already, it may be renamed later. */
+	inode = search_inode_for_lustre(sb, &rec->wjr_fid);
+	if (!IS_ERR(inode)) {
+		iput(inode);
+		RETURN(1);
+	}
+	if (PTR_ERR(inode) != -ENOENT)
+		RETURN(PTR_ERR(inode));
+
+	/* The parent was removed after the record was applied. */
+	dir = search_inode_for_lustre(sb, &rec->wjr_pfid);
+	if (IS_ERR(dir))
+		RETURN(PTR_ERR(dir) == -ENOENT ? 1 : PTR_ERR(dir));
+
+	/*
+	 * The lockless create below replaces an existing name, which was
+	 * reused after the record was applied, or created by other clients
+	 * after the crash. Never destroy it.
+	 */
+	rc = ll_get_fid_by_name(dir, rec->wjr_name, rec->wjr_namelen,
+				&fid, NULL);
+	if (rc == 0)
+		GOTO(out_iput, rc = 1);
+	if (rc != -ENOENT)
+		GOTO(out_iput, rc);
+
+	op_data = ll_prep_md_op_data(NULL, dir, NULL, rec->wjr_name,
+				     rec->wjr_namelen, 0, opc, NULL);
+	if (IS_ERR(op_data))
+		GOTO(out_iput, rc = PTR_ERR(op_data));
+
+	/*
+	 * Reuse the FID allocated by the client as the later records do.
+	 * It needs the lockless create as the normal one allocates a new
+	 * FID, the name was checked missing just above.
+	 */
+	op_data->op_fid2 = rec->wjr_fid;
+	op_data->op_fsuid = rec->wjr_uid;
+	op_data->op_fsgid = rec->wjr_gid;
+	op_data->op_attr.ia_atime.tv_sec = rec->wjr_atime;
+	op_data->op_attr.ia_atime.tv_nsec = rec->wjr_atime_ns;
+	op_data->op_attr.ia_mtime.tv_sec = rec->wjr_mtime;
+	op_data->op_attr.ia_mtime.tv_nsec = rec->wjr_mtime_ns;
+	op_data->op_attr.ia_ctime.tv_sec = rec->wjr_ctime;
+	op_data->op_attr.ia_ctime.tv_nsec = rec->wjr_ctime_ns;
+	op_data->op_bias |= MDS_WBC_LOCKLESS;
+	if (exp_connect_wbc(ll_i2mdexp(dir)))
+		op_data->op_bias |= MDS_WBC_CREATE_ATTR;
+	rc = md_create(ll_i2sbi(dir)->ll_md_exp, op_data, tgt, tgtlen,
+		       rec->wjr_mode, rec->wjr_uid, rec->wjr_gid,
+		       cfs_curproc_cap_pack(), rec->wjr_rdev, 0, &req);
+	ptlrpc_req_finished(req);
+	ll_finish_md_op_data(op_data);
+	if (rc == -EEXIST)
+		rc = 1;
+out_iput:
+	iput(dir);
+	RETURN(rc);
+}
+
+static int wbc_jrec_replay_setattr(struct super_block *sb,
+				   struct wbc_jrec *rec)
+{
+	struct ptlrpc_request *req = NULL;
+	struct md_op_data *op_data;
+	struct inode *inode;
+	struct iattr *attr;
+	int rc;
+
+	ENTRY;
+
+	inode = search_inode_for_lustre(sb, &rec->wjr_fid);
+	if (IS_ERR(inode))
+		RETURN(PTR_ERR(inode) == -ENOENT ? 1 : PTR_ERR(inode));
+
+	op_data = ll_prep_md_op_data(NULL, inode, NULL, NULL, 0, 0,
+				     LUSTRE_OPC_ANY, NULL);
+	if (IS_ERR(op_data))
+		GOTO(out_iput, rc = PTR_ERR(op_data));
+
+	attr = &op_data->op_attr;
+	attr->ia_valid = rec->wjr_valid;
+	attr->ia_mode = rec->wjr_mode;
+	attr->ia_uid = make_kuid(&init_user_ns, rec->wjr_uid);
+	attr->ia_gid = make_kgid(&init_user_ns, rec->wjr_gid);
+	attr->ia_atime.tv_sec = rec->wjr_atime;
+	attr->ia_atime.tv_nsec = rec->wjr_atime_ns;
+	attr->ia_mtime.tv_sec = rec->wjr_mtime;
+	attr->ia_mtime.tv_nsec = rec->wjr_mtime_ns;
+	attr->ia_ctime.tv_sec = rec->wjr_ctime;
+	attr->ia_ctime.tv_nsec = rec->wjr_ctime_ns;
+	/* Set the logged times as they are, not the current time. */
+	if (attr->ia_valid & ATTR_ATIME)
+		attr->ia_valid |= ATTR_ATIME_SET;
+	if (attr->ia_valid & ATTR_MTIME)
+		attr->ia_valid |= ATTR_MTIME_SET;
+	if (attr->ia_valid & ATTR_CTIME)
+		op_data->op_xvalid |= OP_XVALID_CTIME_SET;
+
+	rc = md_setattr(ll_i2sbi(inode)->ll_md_exp, op_data, NULL, 0, &req);
+	ptlrpc_req_finished(req);
+	ll_finish_md_op_data(op_data);
+	if (rc == -ENOENT)
+		rc = 1;
+out_iput:
+	iput(inode);
+	RETURN(rc);
+}
+
+static int wbc_jrec_replay_unlink(struct super_block *sb,
+				  struct wbc_jrec *rec)
+{
+	struct ptlrpc_request *req = NULL;
+	struct md_op_data *op_data;
+	struct inode *dir;
+	int rc;
+
+	ENTRY;
+
+	dir = search_inode_for_lustre(sb, &rec->wjr_pfid);
+	if (IS_ERR(dir))
+		RETURN(PTR_ERR(dir) == -ENOENT ? 1 : PTR_ERR(dir));
+
+	rc = wbc_jrec_name_match(dir, rec->wjr_name, rec->wjr_namelen,
+				 &rec->wjr_fid, NULL);
+	if (rc <= 0)
+		GOTO(out_iput, rc = rc ? rc : 1);
+
+	op_data = ll_prep_md_op_data(NULL, dir, NULL, rec->wjr_name,
+				     rec->wjr_namelen,
+				     S_ISDIR(rec->wjr_mode) ? S_IFDIR : 0,
+				     LUSTRE_OPC_ANY, NULL);
+	if (IS_ERR(op_data))
+		GOTO(out_iput, rc = PTR_ERR(op_data));
+
+	op_data->op_fid2 = op_data->op_fid3 = rec->wjr_fid;
+	rc = md_unlink(ll_i2sbi(dir)->ll_md_exp, op_data, &req);
+	ptlrpc_req_finished(req);
+	ll_finish_md_op_data(op_data);
+out_iput:
+	iput(dir);
+	RETURN(rc);
+}
+
+static int wbc_jrec_replay_rename(struct super_block *sb,
+				  struct wbc_jrec *rec)
+{
+	const char *tgt_name = rec->wjr_name + rec->wjr_namelen + 1;
+	struct ptlrpc_request *req = NULL;
+	struct md_op_data *op_data;
+	struct inode *src;
+	struct inode *tgt;
+	struct lu_fid victim = { 0 };
+	int rc;
+
+	ENTRY;
+
+	src = search_inode_for_lustre(sb, &rec->wjr_pfid);
+	if (IS_ERR(src))
+		RETURN(PTR_ERR(src) == -ENOENT ? 1 : PTR_ERR(src));
+
+	tgt = search_inode_for_lustre(sb, &rec->wjr_tgt_pfid);
+	if (IS_ERR(tgt))
+		GOTO(out_src, rc = PTR_ERR(tgt) == -ENOENT ? 1 : PTR_ERR(tgt));
+
+	rc = wbc_jrec_name_match(src, rec->wjr_name, rec->wjr_namelen,
+				 &rec->wjr_fid, NULL);
+	if (rc <= 0)
+		GOTO(out_tgt, rc = rc ? rc : 1);
+
+	op_data = ll_prep_md_op_data(NULL, src, tgt, NULL, 0, rec->wjr_mode,
+				     LUSTRE_OPC_ANY, NULL);
+	if (IS_ERR(op_data))
+		GOTO(out_tgt, rc = PTR_ERR(op_data));
+
+	op_data->op_fid3 = rec->wjr_fid;
+	rc = wbc_jrec_name_match(tgt, tgt_name, rec->wjr_tgt_namelen,
+				 &rec->wjr_fid, &victim);
+	if (rc == 0 && fid_is_sane(&victim))
+		op_data->op_fid4 = victim;
+
+	rc = md_rename(ll_i2sbi(src)->ll_md_exp, op_data,
+		       rec->wjr_name, rec->wjr_namelen,
+		       tgt_name, rec->wjr_tgt_namelen, &req);
+	ptlrpc_req_finished(req);
+	ll_finish_md_op_data(op_data);
+out_tgt:
+	iput(tgt);
+out_src:
+	iput(src);
+	RETURN(rc);
+}
+
+static int wbc_jrec_replay_link(struct super_block *sb, struct wbc_jrec *rec)
+{
+	struct ptlrpc_request *req = NULL;
+	struct md_op_data *op_data;
+	struct inode *inode;
+	struct inode *dir;
+	int rc;
+
+	ENTRY;
+
+	inode = search_inode_for_lustre(sb, &rec->wjr_fid);
+	if (IS_ERR(inode))
+		RETURN(PTR_ERR(inode) == -ENOENT ? 1 : PTR_ERR(inode));
+
+	dir = search_inode_for_lustre(sb, &rec->wjr_pfid);
+	if (IS_ERR(dir))
+		GOTO(out_inode, rc = PTR_ERR(dir) == -ENOENT ? 1 :
+						PTR_ERR(dir));
+
+	op_data = ll_prep_md_op_data(NULL, inode, dir, rec->wjr_name,
+				     rec->wjr_namelen, 0, LUSTRE_OPC_ANY, NULL);
+	if (IS_ERR(op_data))
+		GOTO(out_dir, rc = PTR_ERR(op_data));
+
+	rc = md_link(ll_i2sbi(dir)->ll_md_exp, op_data, &req);
+	ptlrpc_req_finished(req);
+	ll_finish_md_op_data(op_data);
+	if (rc == -EEXIST)
+		rc = 1;
+out_dir:
+	iput(dir);
+out_inode:
+	iput(inode);
+	RETURN(rc);
+}
+
+/*
+ * Apply a record onto MDT by the normal (not lockless) updates, as the WBC
+ * locks of the crashed client are gone.
+ * \retval	0 if the update is applied.
+ * \retval	1 if the update was applied already before the crash.
+ * \retval	negative errno if the update fails.
+ */
+static int wbc_jrec_replay(struct super_block *sb, struct wbc_jrec *rec)
+{
+	switch (rec->wjr_type) {
+	case WBC_JREC_CREATE:
+		return wbc_jrec_replay_create(sb, rec);
+	case WBC_JREC_SETATTR:
+		return wbc_jrec_replay_setattr(sb, rec);
+	case WBC_JREC_UNLINK:
+		return wbc_jrec_replay_unlink(sb, rec);
+	case WBC_JREC_RENAME:
+		return wbc_jrec_replay_rename(sb, rec);
+	case WBC_JREC_LINK:
+		return wbc_jrec_replay_link(sb, rec);
+	default:
+		return -EINVAL;
+	}
+}
+
+/* Whether the record @rec of @rec->wjr_len bytes is intact. */
+static bool wbc_jrec_valid(struct wbc_jrec *rec, __u64 seq)
+{
+	if (rec->wjr_len != wbc_jrec_size(rec->wjr_namelen,
+					  rec->wjr_tgt_namelen))
+		return false;
+
+	if (seq && rec->wjr_seq != seq)
+		return false;
+
+	return wbc_jrec_cksum(rec) == rec->wjr_cksum;
+}
+
+/*
+ * Replay the records in the journal segment @filp in order. The replay stops
+ * at the first invalid record, which is the torn tail of the last commit
+ * before the crash. @seqp is the sequence expected for the first record, 0
+ * for any, and is set to the one expected after the last record replayed.
+ */
+static int wbc_journal_replay(struct wbc_super *super, struct file *filp,
+			      __u64 *seqp)
+{
+	struct wbc_journal *wj = &super->wbcs_journal;
+	struct super_block *sb = super->wbcs_mwb.wb_sb;
+	char *buf = wj->wj_bufs[0];
+	size_t avail = 0;
+	size_t pos = 0;
+	loff_t off = 0;
+	__u64 seq = *seqp;
+	ssize_t size;
+	int rc = 0;
+
+	ENTRY;
+
+	while (1) {
+		struct wbc_jrec *rec = (struct wbc_jrec *)(buf + pos);
+
+		if (avail - pos >= sizeof(*rec)) {
+			if (rec->wjr_magic != WBC_JREC_MAGIC ||
+			    rec->wjr_len < sizeof(*rec) ||
+			    rec->wjr_len > WBC_JOURNAL_BUF_SIZE)
+				break;
+
+			if (rec->wjr_len <= avail - pos) {
+				if (!wbc_jrec_valid(rec, seq))
+					break;
+
+				rc = wbc_jrec_replay(sb, rec);
+				if (rc < 0) {
+					CERROR("%s: failed to replay WBC journal record %llu type %u "DFID"/%.*s: rc = %d\n",
+					       ll_s2sbi(sb)->ll_fsname,
+					       rec->wjr_seq, rec->wjr_type,
+					       PFID(&rec->wjr_pfid),
+					       rec->wjr_namelen, rec->wjr_name,
+					       rc);
+					GOTO(out, rc);
+				}
+
+				if (rc == 1)
+					wj->wj_nr_replay_skipped++;
+				else
+					wj->wj_nr_replayed++;
+				seq = rec->wjr_seq + 1;
+				pos += rec->wjr_len;
+				rc = 0;
+				continue;
+			}
+		}
+
+		/* The next record crosses the end of the buffer. */
+		memmove(buf, buf + pos, avail - pos);
+		avail -= pos;
+		pos = 0;
+		size = cfs_kernel_read(filp, buf + avail,
+				       WBC_JOURNAL_BUF_SIZE - avail, &off);
+		if (size < 0)
+			GOTO(out, rc = size);
+		if (size == 0)
+			break;
+
+		avail += size;
+	}
+
+	if (avail - pos)
+		CDEBUG(D_INODE, "%s: discard torn WBC journal at %llu\n",
+		       ll_s2sbi(sb)->ll_fsname, off - (avail - pos));
+	*seqp = seq;
+out:
+	RETURN(rc);
+}
+
+/* Sequence of the first record in the journal segment @filp, 0 if none. */
+static __u64 wbc_journal_first_seq(struct file *filp)
+{
+	struct wbc_jrec rec;
+	loff_t off = 0;
+	ssize_t size;
+
+	size = cfs_kernel_read(filp, &rec, sizeof(rec), &off);
+	if (size != sizeof(rec) || rec.wjr_magic != WBC_JREC_MAGIC)
+		return 0;
+
+	return rec.wjr_seq;
+}
+
+static int wbc_journal_truncate(struct file *filp)
+{
+	int rc;
+
+	rc = vfs_truncate(&filp->f_path, 0);
+	if (rc == 0)
+		rc = vfs_fsync(filp, 0);
+	return rc;
+}
+
+/* Open the segment @idx of the journal at @path. */
+static struct file *wbc_journal_seg_open(struct wbc_super *super,
+					 const char *path, int idx)
+{
+	struct file *filp;
+	char *name;
+
+	OBD_ALLOC(name, WBC_JOURNAL_PATH_MAX + 3);
+	if (name == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	if (idx)
+		snprintf(name, WBC_JOURNAL_PATH_MAX + 3, "%s.%d", path, idx);
+	else
+		strlcpy(name, path, WBC_JOURNAL_PATH_MAX + 3);
+	filp = filp_open(name, O_RDWR | O_CREAT | O_LARGEFILE, 0600);
+	OBD_FREE(name, WBC_JOURNAL_PATH_MAX + 3);
+	if (IS_ERR(filp))
+		return filp;
+
+	/* The journal must not live on the file system it protects. */
+	if (!S_ISREG(file_inode(filp)->i_mode) ||
+	    file_inode(filp)->i_sb == super->wbcs_mwb.wb_sb) {
+		filp_close(filp, NULL);
+		return ERR_PTR(-EINVAL);
+	}
+
+	return filp;
+}
+
+/*
+ * Enable the journal on the local file @path. The records left in the
+ * segment files by a previous mount are replayed first, the older segment
+ * first, so it must be enabled before any update is cached in MemFS.
+ */
+int wbc_journal_open(struct wbc_super *super, const char *path)
+{
+	struct wbc_journal *wj = &super->wbcs_journal;
+	struct file *filps[2] = { NULL, NULL };
+	__u64 first[2];
+	__u64 seq = 0;
+	int rc;
+	int i;
+
+	ENTRY;
+
+	if (strcmp(path, "none") == 0) {
+		wbc_journal_close(super);
+		RETURN(0);
+	}
+
+	mutex_lock(&wj->wj_mutex);
+	if (wj->wj_filp != NULL)
+		GOTO(out_unlock, rc = -EALREADY);
+
+	spin_lock(&super->wbcs_lock);
+	rc = list_empty(&super->wbcs_roots) &&
+	     list_empty(&super->wbcs_lazy_roots) ? 0 : -EBUSY;
+	spin_unlock(&super->wbcs_lock);
+	if (rc)
+		GOTO(out_unlock, rc);
+
+	for (i = 0; i < 2; i++) {
+		filps[i] = wbc_journal_seg_open(super, path, i);
+		if (IS_ERR(filps[i])) {
+			rc = PTR_ERR(filps[i]);
+			filps[i] = NULL;
+			GOTO(out_close, rc);
+		}
+		first[i] = wbc_journal_first_seq(filps[i]);
+	}
+
+	for (i = 0; i < 2; i++) {
+		OBD_ALLOC_LARGE(wj->wj_bufs[i], WBC_JOURNAL_BUF_SIZE);
+		if (wj->wj_bufs[i] == NULL)
+			GOTO(out_free, rc = -ENOMEM);
+	}
+
+	wj->wj_nr_replayed = 0;
+	wj->wj_nr_replay_skipped = 0;
+	/* The older segment is the one with the lower first sequence. */
+	if (first[0] && first[1] && first[1] < first[0])
+		swap(filps[0], filps[1]);
+	for (i = 0; i < 2; i++) {
+		rc = wbc_journal_replay(super, filps[i], &seq);
+		if (rc)
+			GOTO(out_free, rc);
+	}
+
+	for (i = 0; i < 2; i++) {
+		rc = wbc_journal_truncate(filps[i]);
+		if (rc)
+			GOTO(out_free, rc);
+	}
+
+	spin_lock(&wj->wj_lock);
+	wj->wj_cur = 0;
+	wj->wj_len = 0;
+	wj->wj_off = 0;
+	wj->wj_commit_seq = wj->wj_seq;
+	wj->wj_ckpt_seq = wj->wj_seq;
+	wj->wj_error = 0;
+	wj->wj_old_seq = 0;
+	wj->wj_old_filp = filps[1];
+	wj->wj_filp = filps[0];
+	spin_unlock(&wj->wj_lock);
+	mutex_unlock(&wj->wj_mutex);
+
+	CDEBUG(D_INODE, "%s: WBC journal %s enabled, replayed %llu records\n",
+	       ll_s2sbi(super->wbcs_mwb.wb_sb)->ll_fsname, path,
+	       wj->wj_nr_replayed);
+	RETURN(0);
+out_free:
+	for (i = 0; i < 2; i++) {
+		if (wj->wj_bufs[i]) {
+			OBD_FREE_LARGE(wj->wj_bufs[i], WBC_JOURNAL_BUF_SIZE);
+			wj->wj_bufs[i] = NULL;
+		}
+	}
+out_close:
+	for (i = 0; i < 2; i++) {
+		if (filps[i])
+			filp_close(filps[i], NULL);
+	}
+out_unlock:
+	mutex_unlock(&wj->wj_mutex);
+	RETURN(rc);
+}
+
+/* Commit the pending records and stop logging. */
+void wbc_journal_close(struct wbc_super *super)
+{
+	struct wbc_journal *wj = &super->wbcs_journal;
+	struct file *old_filp;
+	struct file *filp;
+	int i;
+
+	mutex_lock(&wj->wj_mutex);
+	if (wj->wj_filp == NULL) {
+		mutex_unlock(&wj->wj_mutex);
+		return;
+	}
+
+	wbc_journal_commit_locked(wj);
+	spin_lock(&wj->wj_lock);
+	filp = wj->wj_filp;
+	old_filp = wj->wj_old_filp;
+	wj->wj_filp = NULL;
+	wj->wj_old_filp = NULL;
+	spin_unlock(&wj->wj_lock);
+	mutex_unlock(&wj->wj_mutex);
+
+	cancel_delayed_work_sync(&wj->wj_dwork);
+	filp_close(filp, NULL);
+	filp_close(old_filp, NULL);
+	for (i = 0; i < 2; i++) {
+		OBD_FREE_LARGE(wj->wj_bufs[i], WBC_JOURNAL_BUF_SIZE);
+		wj->wj_bufs[i] = NULL;
+	}
+}
+
+/* Sequence of the last record logged, sampled before a flush begins. */
+__u64 wbc_journal_seq(struct wbc_super *super)
+{
+	return READ_ONCE(super->wbcs_journal.wj_seq);
+}
+
+/*
+ * A root flushed the updates under it logged up to @seq to MDT. The records
+ * up to @seq are obsolete, except the ones which another root logged since
+ * its @wbci_jseq and may not have flushed yet. A segment is truncated once
+ * all its records are obsolete. The pending records are committed before
+ * the current segment is truncated, thus a record in flight is never
+ * dropped from the memory buffer.
+ */
+void wbc_journal_checkpoint(struct wbc_super *super, __u64 seq)
+{
+	struct wbc_journal *wj = &super->wbcs_journal;
+	struct list_head *lists[] = { &super->wbcs_roots,
+				      &super->wbcs_lazy_roots };
+	struct wbc_inode *wbci;
+	bool busy;
+	int rc;
+	int i;
+
+	if (READ_ONCE(wj->wj_filp) == NULL)
+		return;
+
+	spin_lock(&super->wbcs_lock);
+	for (i = 0; i < ARRAY_SIZE(lists); i++) {
+		list_for_each_entry(wbci, lists[i], wbci_root_list)
+			seq = min(seq, wbci->wbci_jseq - 1);
+	}
+	spin_unlock(&super->wbcs_lock);
+	if (seq <= READ_ONCE(wj->wj_ckpt_seq))
+		return;
+
+	mutex_lock(&wj->wj_mutex);
+	if (wj->wj_filp == NULL || wj->wj_error)
+		GOTO(out_unlock, rc = 0);
+
+	if (wj->wj_old_seq && wj->wj_old_seq <= seq) {
+		rc = wbc_journal_truncate(wj->wj_old_filp);
+		if (rc)
+			GOTO(out_error, rc);
+
+		spin_lock(&wj->wj_lock);
+		wj->wj_old_seq = 0;
+		spin_unlock(&wj->wj_lock);
+	}
+
+	spin_lock(&wj->wj_lock);
+	busy = wj->wj_seq > seq || wj->wj_old_seq;
+	spin_unlock(&wj->wj_lock);
+	if (!busy) {
+		wbc_journal_commit_locked(wj);
+		spin_lock(&wj->wj_lock);
+		/* The records logged meanwhile are still needed. */
+		busy = wj->wj_seq > seq || wj->wj_len || wj->wj_error;
+		spin_unlock(&wj->wj_lock);
+	}
+
+	/*
+	 * The records logged during the truncation stay in the memory buffer
+	 * until the next commit, which writes them from the offset 0.
+	 */
+	if (!busy) {
+		rc = wbc_journal_truncate(wj->wj_filp);
+		if (rc)
+			GOTO(out_error, rc);
+		wj->wj_off = 0;
+	}
+
+	spin_lock(&wj->wj_lock);
+	if (seq > wj->wj_ckpt_seq)
+		wj->wj_ckpt_seq = seq;
+	spin_unlock(&wj->wj_lock);
+	GOTO(out_unlock, rc = 0);
+out_error:
+	spin_lock(&wj->wj_lock);
+	CERROR("%pD: failed to truncate WBC journal: rc = %d\n",
+	       wj->wj_filp, rc);
+	wj->wj_error = rc;
+	spin_unlock(&wj->wj_lock);
+out_unlock:
+	mutex_unlock(&wj->wj_mutex);
+}
+
+void wbc_journal_seq_show(struct seq_file *m, struct wbc_super *super)
+{
+	struct wbc_journal *wj = &super->wbcs_journal;
+	__u64 records, commits, bytes;
+	bool enabled;
+	int error;
+
+	spin_lock(&wj->wj_lock);
+	enabled = wj->wj_filp != NULL;
+	error = wj->wj_error;
+	records = wj->wj_nr_records;
+	commits = wj->wj_nr_commits;
+	bytes = wj->wj_nr_bytes;
+	spin_unlock(&wj->wj_lock);
+
+	seq_printf(m, "journal: %s\n",
+		   enabled ? super->wbcs_conf.wbcc_journal : "none");
+	seq_printf(m, "journal_sync: %d\n",
+		   super->wbcs_conf.wbcc_journal_sync);
+	seq_printf(m, "journal_error: %d\n", error);
+	seq_printf(m, "journal_records: %llu\n", records);
+	seq_printf(m, "journal_commits: %llu\n", commits);
+	seq_printf(m, "journal_bytes: %llu\n", bytes);
+	seq_printf(m, "journal_replayed: %llu\n", wj->wj_nr_replayed);
+	seq_printf(m, "journal_replay_skipped: %llu\n",
+		   wj->wj_nr_replay_skipped);
+}
@@ -0,0 +1,397 @@
+/*
+ * LGPL HEADER START
+ *
+ * DO NOT ALTER OR REMOVE COPYRIGHT NOTICES OR THIS FILE HEADER.
+ *
+ * All rights reserved. This program and the accompanying materials
+ * are made available under the terms of the GNU Lesser General Public License
+ * LGPL version 2.1 or (at your discretion) any later version.
+ * LGPL version 2.1 accompanies this distribution, and is available at
+ * http://www.gnu.org/licenses/lgpl-2.1.html
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * LGPL HEADER END
+ */
+/*
+ * Copyright (c) 2019-2021, DDN Storage Corporation.
+ */
+/*
+ * lustre/llite/wbc_rule.c
+ *
+ * Rules of the automatic root selection for Lustre Metadata Writeback
+ * Caching (WBC).
+ *
+ * Without any rule, each directory created under a directory not cached by
+ * WBC becomes a root WBC directory with the cache mode and flush mode of the
+ * global configuration. Once rules are defined, only the directories which
+ * match a rule are cached, with the cache specification of the first matched
+ * rule. The rules are managed via:
+ *
+ *   lctl set_param llite.*.wbc.rule="add <conds> [cache_mode=...]
+ *                                     [flush_mode=...] [rmpol=...]"
+ *   lctl set_param llite.*.wbc.rule="del <conds>"
+ *   lctl set_param llite.*.wbc.rule="clear"
+ *
+ * The conditions are parsed once into the same form as the PCC attach rules,
+ * for example "jobid={dd.*}&uid={500 501},path={/scratch/*}". The rule with
+ * "cache_mode=none" excludes the matched directories from caching.
+ *
+ * A rule may also carry the limits "max_inodes=" and "max_pages=" (or
+ * "size="), which are shared by all the root directories it creates, so
+ * that a job or a project is confined to its own part of MemFS.
+ */
+
+#define DEBUG_SUBSYSTEM S_LLITE
+
+#include <linux/dcache.h>
+#include <obd_class.h>
+#include "llite_internal.h"
+
+void wbc_rules_init(struct wbc_super *super)
+{
+	init_rwsem(&super->wbcs_rules_sem);
+	INIT_LIST_HEAD(&super->wbcs_rules);
+	super->wbcs_rule_fields = 0;
+}
+
+static void wbc_rule_free(struct wbc_super *super, struct wbc_rule *rule)
+{
+	wbc_quota_put(super, rule->wr_quota);
+	if (!list_empty(&rule->wr_match.pmr_conds))
+		pcc_rule_conds_free(&rule->wr_match.pmr_conds);
+	if (rule->wr_match.pmr_conds_str)
+		OBD_FREE(rule->wr_match.pmr_conds_str,
+			 strlen(rule->wr_match.pmr_conds_str) + 1);
+	OBD_FREE_PTR(rule);
+}
+
+/* Called with @wbcs_rules_sem held for write. */
+static void wbc_rules_update_fields(struct wbc_super *super)
+{
+	struct wbc_rule *rule;
+	__u32 fields = 0;
+
+	list_for_each_entry(rule, &super->wbcs_rules, wr_linkage)
+		fields |= rule->wr_fields;
+
+	WRITE_ONCE(super->wbcs_rule_fields, fields);
+}
+
+static void wbc_rules_clear(struct wbc_super *super)
+{
+	struct wbc_rule *rule, *tmp;
+
+	down_write(&super->wbcs_rules_sem);
+	list_for_each_entry_safe(rule, tmp, &super->wbcs_rules, wr_linkage) {
+		list_del_init(&rule->wr_linkage);
+		wbc_rule_free(super, rule);
+	}
+	wbc_rules_update_fields(super);
+	up_write(&super->wbcs_rules_sem);
+}
+
+void wbc_rules_fini(struct wbc_super *super)
+{
+	wbc_rules_clear(super);
+}
+
+/* Parse the cache specification "key=value" pairs of a rule. */
+static int wbc_rule_spec_parse(struct wbc_rule *rule, char *buffer)
+{
+	struct wbc_cache_spec *spec = &rule->wr_spec;
+	struct wbc_cmd *cmd;
+	char *token;
+	int rc = 0;
+
+	OBD_ALLOC_PTR(cmd);
+	if (cmd == NULL)
+		return -ENOMEM;
+
+	while (buffer != NULL && strlen(buffer) != 0) {
+		token = strsep(&buffer, " ");
+		if (strcmp(token, "cache_mode=none") == 0) {
+			rule->wr_exclude = true;
+			continue;
+		}
+
+		rc = wbc_parse_value_pair(cmd, token);
+		if (rc)
+			GOTO(out, rc);
+	}
+
+	if (cmd->wbcc_flags & ~(WBC_CMD_OP_CACHE_MODE | WBC_CMD_OP_FLUSH_MODE |
+				WBC_CMD_OP_RMPOL | WBC_CMD_OP_INODES_LIMIT |
+				WBC_CMD_OP_PAGES_LIMIT))
+		GOTO(out, rc = -EINVAL);
+
+	if (rule->wr_exclude && cmd->wbcc_flags)
+		GOTO(out, rc = -EINVAL);
+
+	if (cmd->wbcc_flags & WBC_CMD_OP_CACHE_MODE)
+		spec->wcs_cache_mode = cmd->wbcc_conf.wbcc_cache_mode;
+	if (cmd->wbcc_flags & WBC_CMD_OP_FLUSH_MODE)
+		spec->wcs_flush_mode = cmd->wbcc_conf.wbcc_flush_mode;
+	if (cmd->wbcc_flags & WBC_CMD_OP_RMPOL)
+		spec->wcs_rmpol = cmd->wbcc_conf.wbcc_rmpol;
+	if (cmd->wbcc_flags & WBC_CMD_OP_INODES_LIMIT)
+		rule->wr_max_inodes = cmd->wbcc_conf.wbcc_max_inodes;
+	if (cmd->wbcc_flags & WBC_CMD_OP_PAGES_LIMIT)
+		rule->wr_max_pages = cmd->wbcc_conf.wbcc_max_pages;
+out:
+	OBD_FREE_PTR(cmd);
+	return rc;
+}
+
+static struct wbc_rule *wbc_rule_parse(struct wbc_super *super, char *conds,
+				       char *specs)
+{
+	struct wbc_rule *rule;
+	int rc;
+
+	OBD_ALLOC_PTR(rule);
+	if (rule == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	INIT_LIST_HEAD(&rule->wr_linkage);
+	INIT_LIST_HEAD(&rule->wr_match.pmr_conds);
+	atomic64_set(&rule->wr_hits, 0);
+
+	/* The parsing modifies the string, keep the original one for show. */
+	OBD_ALLOC(rule->wr_match.pmr_conds_str, strlen(conds) + 1);
+	if (rule->wr_match.pmr_conds_str == NULL)
+		GOTO(out_free, rc = -ENOMEM);
+
+	memcpy(rule->wr_match.pmr_conds_str, conds, strlen(conds));
+	rc = pcc_conds_parse(conds, strlen(conds), &rule->wr_match.pmr_conds);
+	if (rc)
+		GOTO(out_free, rc);
+
+	rule->wr_fields = pcc_conds_fields(&rule->wr_match.pmr_conds);
+	rc = wbc_rule_spec_parse(rule, specs);
+	if (rc)
+		GOTO(out_free, rc);
+
+	if (rule->wr_max_inodes || rule->wr_max_pages) {
+		rule->wr_quota = wbc_quota_alloc(super,
+						 rule->wr_match.pmr_conds_str,
+						 rule->wr_max_inodes,
+						 rule->wr_max_pages, true);
+		if (rule->wr_quota == NULL)
+			GOTO(out_free, rc = -ENOMEM);
+	}
+
+	return rule;
+out_free:
+	wbc_rule_free(super, rule);
+	return ERR_PTR(rc);
+}
+
+/* Called with @wbcs_rules_sem held. */
+static struct wbc_rule *wbc_rule_find(struct wbc_super *super,
+				      const char *conds)
+{
+	struct wbc_rule *rule;
+
+	list_for_each_entry(rule, &super->wbcs_rules, wr_linkage) {
+		if (strcmp(rule->wr_match.pmr_conds_str, conds) == 0)
+			return rule;
+	}
+
+	return NULL;
+}
+
+static int wbc_rule_add(struct wbc_super *super, char *conds, char *specs)
+{
+	struct wbc_rule *rule;
+	int rc = 0;
+
+	rule = wbc_rule_parse(super, conds, specs);
+	if (IS_ERR(rule))
+		return PTR_ERR(rule);
+
+	down_write(&super->wbcs_rules_sem);
+	if (wbc_rule_find(super, rule->wr_match.pmr_conds_str)) {
+		rc = -EEXIST;
+	} else {
+		list_add_tail(&rule->wr_linkage, &super->wbcs_rules);
+		wbc_rules_update_fields(super);
+	}
+	up_write(&super->wbcs_rules_sem);
+
+	if (rc)
+		wbc_rule_free(super, rule);
+	return rc;
+}
+
+static int wbc_rule_del(struct wbc_super *super, const char *conds)
+{
+	struct wbc_rule *rule;
+
+	down_write(&super->wbcs_rules_sem);
+	rule = wbc_rule_find(super, conds);
+	if (rule) {
+		list_del_init(&rule->wr_linkage);
+		wbc_rules_update_fields(super);
+	}
+	up_write(&super->wbcs_rules_sem);
+
+	if (rule == NULL)
+		return -ENOENT;
+
+	wbc_rule_free(super, rule);
+	return 0;
+}
+
+int wbc_rule_cmd_handle(struct wbc_super *super, char *buffer)
+{
+	char *token;
+	char *val;
+	bool add;
+
+	ENTRY;
+
+	buffer = strim(buffer);
+	if (strcmp(buffer, "clear") == 0) {
+		wbc_rules_clear(super);
+		RETURN(0);
+	}
+
+	val = buffer;
+	token = strsep(&val, " ");
+	if (val == NULL || strlen(val) == 0)
+		RETURN(-EINVAL);
+
+	if (strcmp(token, "add") == 0)
+		add = true;
+	else if (strcmp(token, "del") == 0)
+		add = false;
+	else
+		RETURN(-EINVAL);
+
+	/* The conditions end with the last '}'. */
+	token = val;
+	val = strrchr(token, '}');
+	if (!val)
+		RETURN(-EINVAL);
+
+	/* Skip '}' */
+	val++;
+	if (*val == '\0') {
+		val = NULL;
+	} else if (*val == ' ') {
+		*val = '\0';
+		val++;
+	} else {
+		RETURN(-EINVAL);
+	}
+
+	if (add)
+		RETURN(wbc_rule_add(super, token, val));
+
+	if (val != NULL && strlen(val) != 0)
+		RETURN(-EINVAL);
+
+	RETURN(wbc_rule_del(super, token));
+}
+
+/**
+ * Check whether the directory @dchild being created under @dir should become
+ * a root WBC directory, and fill the cache specification @spec of the matched
+ * rule. Only the fields used by the rules are collected for the matching.
+ */
+bool wbc_rule_match(struct wbc_super *super, struct inode *dir,
+		    struct dentry *dchild, struct wbc_cache_spec *spec)
+{
+	char jobid[LUSTRE_JOBID_SIZE];
+	struct pcc_matcher matcher;
+	struct wbc_rule *rule;
+	bool matched = false;
+	char *buf = NULL;
+	__u32 fields;
+
+	ENTRY;
+
+	memset(spec, 0, sizeof(*spec));
+	if (list_empty_careful(&super->wbcs_rules))
+		RETURN(true);
+
+	fields = READ_ONCE(super->wbcs_rule_fields);
+	matcher.pm_uid = from_kuid(&init_user_ns, current_uid());
+	matcher.pm_gid = from_kgid(&init_user_ns, current_gid());
+	matcher.pm_projid = ll_i2info(dir)->lli_projid;
+	matcher.pm_name = &dchild->d_name;
+	matcher.pm_jobid = NULL;
+	matcher.pm_path = NULL;
+
+	if (fields & BIT(PCC_FIELD_JOBID) &&
+	    lustre_get_jobid(jobid, sizeof(jobid)) == 0 && jobid[0] != '\0')
+		matcher.pm_jobid = jobid;
+
+	if (fields & BIT(PCC_FIELD_PATH)) {
+		OBD_ALLOC(buf, PATH_MAX);
+		if (buf != NULL) {
+			char *path = dentry_path_raw(dchild->d_parent, buf,
+						     PATH_MAX);
+
+			if (!IS_ERR(path))
+				matcher.pm_path = path;
+		}
+	}
+
+	down_read(&super->wbcs_rules_sem);
+	list_for_each_entry(rule, &super->wbcs_rules, wr_linkage) {
+		if (!pcc_cond_match(&rule->wr_match, &matcher))
+			continue;
+
+		atomic64_inc(&rule->wr_hits);
+		if (!rule->wr_exclude) {
+			*spec = rule->wr_spec;
+			spec->wcs_quota = wbc_quota_get(rule->wr_quota);
+			matched = true;
+		}
+		CDEBUG(D_CACHE, "WBC rule %s %s %pd\n",
+		       rule->wr_match.pmr_conds_str,
+		       matched ? "caches" : "excludes", dchild);
+		break;
+	}
+	up_read(&super->wbcs_rules_sem);
+
+	if (buf != NULL)
+		OBD_FREE(buf, PATH_MAX);
+
+	RETURN(matched);
+}
+
+void wbc_rules_seq_show(struct seq_file *m, struct wbc_super *super)
+{
+	struct wbc_rule *rule;
+
+	down_read(&super->wbcs_rules_sem);
+	list_for_each_entry(rule, &super->wbcs_rules, wr_linkage) {
+		struct wbc_cache_spec *spec = &rule->wr_spec;
+
+		seq_printf(m, "%s", rule->wr_match.pmr_conds_str);
+		if (rule->wr_exclude)
+			seq_puts(m, " cache_mode=none");
+		if (spec->wcs_cache_mode != WBC_MODE_NONE)
+			seq_printf(m, " cache_mode=%s",
+				   wbc_cachemode2string(spec->wcs_cache_mode));
+		if (spec->wcs_flush_mode != WBC_FLUSH_NONE)
+			seq_printf(m, " flush_mode=%s",
+				   wbc_flushmode2string(spec->wcs_flush_mode));
+		if (spec->wcs_rmpol != WBC_RMPOL_NONE)
+			seq_printf(m, " rmpol=%s",
+				   wbc_rmpol2string(spec->wcs_rmpol));
+		if (rule->wr_max_inodes)
+			seq_printf(m, " max_inodes=%lu", rule->wr_max_inodes);
+		if (rule->wr_max_pages)
+			seq_printf(m, " max_pages=%lu", rule->wr_max_pages);
+		seq_printf(m, " hits=%lld\n",
+			   (long long)atomic64_read(&rule->wr_hits));
+	}
+	up_read(&super->wbcs_rules_sem);
+}
@@ -161,6 +161,19 @@ static int ll_xattr_set_common(const struct xattr_handler *handler,
 	if (!fullname)
 		RETURN(-ENOMEM);
 
+	/* Keep the xattr in MemFS if the file is not yet on MDT. */
+	if (wbc_inode_has_protected(ll_i2wbci(inode))) {
+		rc = memfs_xattr_set(inode, fullname,
+				     valid == OBD_MD_FLXATTRRM ? NULL : pv,
+				     size, flags);
+		if (rc != -EAGAIN) {
+			kfree(fullname);
+			if (rc)
+				RETURN(rc);
+			GOTO(out_tally, rc);
+		}
+	}
+
 	rc = md_setxattr(sbi->ll_md_exp, ll_inode2fid(inode), valid, fullname,
 			 pv, size, flags, ll_i2suppgid(inode), &req);
 	kfree(fullname);
@@ -174,6 +187,7 @@ static int ll_xattr_set_common(const struct xattr_handler *handler,
 
 	ptlrpc_req_finished(req);
 
+out_tally:
 	ll_stats_ops_tally(ll_i2sbi(inode), valid == OBD_MD_FLXATTRRM ?
 				LPROC_LL_REMOVEXATTR : LPROC_LL_SETXATTR,
 			   ktime_us_delta(ktime_get(), kstart));
@@ -349,8 +363,15 @@ static int ll_xattr_set(const struct xattr_handler *handler,
 
 	/* lustre/trusted.lov.xxx would be passed through xattr API */
 	if (!strcmp(name, "lov")) {
-		rc = ll_setstripe_ea(dentry, (struct lov_user_md *)value,
-				       size);
+		/*
+		 * No layout is instantiated for a file cached in MemFS, it is
+		 * decided when the file is flushed to MDT.
+		 */
+		if (wbc_inode_xattr_local(ll_i2wbci(inode)))
+			rc = -EOPNOTSUPP;
+		else
+			rc = ll_setstripe_ea(dentry,
+					     (struct lov_user_md *)value, size);
 		ll_stats_ops_tally(ll_i2sbi(inode), op_type,
 				   ktime_us_delta(ktime_get(), kstart));
 		return rc;
@@ -379,8 +400,10 @@ int ll_xattr_list(struct inode *inode, const char *name, int type, void *buffer,
 	int rc;
 	ENTRY;
 
-	if (sbi->ll_xattr_cache_enabled && type != XATTR_ACL_ACCESS_T &&
-	    (type != XATTR_SECURITY_T || strcmp(name, "security.selinux"))) {
+	/* The xattrs of a file cached in MemFS are all in the cache. */
+	if (wbc_inode_xattr_local(ll_i2wbci(inode)) ||
+	    (sbi->ll_xattr_cache_enabled && type != XATTR_ACL_ACCESS_T &&
+	     (type != XATTR_SECURITY_T || strcmp(name, "security.selinux")))) {
 		rc = ll_xattr_cache_get(inode, name, buffer, size, valid);
 		if (rc == -EAGAIN)
 			goto getxattr_nocache;
@@ -498,6 +521,10 @@ static ssize_t ll_getxattr_lov(struct inode *inode, void *buf, size_t buf_size)
 {
 	ssize_t rc;
 
+	/* No layout is instantiated for a file cached in MemFS. */
+	if (wbc_inode_xattr_local(ll_i2wbci(inode)))
+		RETURN(-ENODATA);
+
 	if (S_ISREG(inode->i_mode)) {
 		struct cl_object *obj = ll_i2info(inode)->lli_clob;
 		struct cl_layout cl = {
@@ -85,6 +85,7 @@ static void ll_xattr_cache_init(struct ll_inode_info *lli)
 	LASSERT(lli != NULL);
 
 	INIT_LIST_HEAD(&lli->lli_xattrs);
+	atomic_set(&lli->lli_xattrs_count, 0);
 	set_bit(LLIF_XATTR_CACHE, &lli->lli_flags);
 }
 
@@ -123,17 +124,19 @@ static int ll_xattr_cache_find(struct list_head *cache,
 /**
  * This adds an xattr.
  *
- * Add @xattr_name attr with @xattr_val value and @xattr_val_len length,
+ * Add @xattr_name attr with @xattr_val value and @xattr_val_len length
+ * to the cache of @lli.
  *
  * \retval 0       success
  * \retval -ENOMEM if no memory could be allocated for the cached attr
  * \retval -EPROTO if duplicate xattr is being added
  */
-static int ll_xattr_cache_add(struct list_head *cache,
+static int ll_xattr_cache_add(struct ll_inode_info *lli,
 			      const char *xattr_name,
 			      const char *xattr_val,
 			      unsigned xattr_val_len)
 {
+	struct list_head *cache = &lli->lli_xattrs;
 	struct ll_xattr_entry *xattr;
 
 	ENTRY;
@@ -168,6 +171,7 @@ static int ll_xattr_cache_add(struct list_head *cache,
 	memcpy(xattr->xe_value, xattr_val, xattr_val_len);
 	xattr->xe_vallen = xattr_val_len;
 	list_add(&xattr->xe_list, cache);
+	atomic_inc(&lli->lli_xattrs_count);
 
 	CDEBUG(D_CACHE, "set: [%s]=%.*s\n", xattr_name,
 		xattr_val_len, xattr_val);
@@ -184,14 +188,15 @@ err_name:
 /**
  * This removes an extended attribute from cache.
  *
- * Remove @xattr_name attribute from @cache.
+ * Remove @xattr_name attribute from the cache of @lli.
  *
  * \retval 0        success
  * \retval -ENODATA if @xattr_name is not cached
  */
-static int ll_xattr_cache_del(struct list_head *cache,
+static int ll_xattr_cache_del(struct ll_inode_info *lli,
 			      const char *xattr_name)
 {
+	struct list_head *cache = &lli->lli_xattrs;
 	struct ll_xattr_entry *xattr;
 
 	ENTRY;
@@ -200,6 +205,7 @@ static int ll_xattr_cache_del(struct list_head *cache,
 
 	if (ll_xattr_cache_find(cache, xattr_name, &xattr) == 0) {
 		list_del(&xattr->xe_list);
+		atomic_dec(&lli->lli_xattrs_count);
 		OBD_FREE(xattr->xe_name, xattr->xe_namelen);
 		OBD_FREE(xattr->xe_value, xattr->xe_vallen);
 		OBD_SLAB_FREE_PTR(xattr, xattr_kmem);
@@ -274,7 +280,7 @@ static int ll_xattr_cache_destroy_locked(struct ll_inode_info *lli)
 	if (!ll_xattr_cache_valid(lli))
 		RETURN(0);
 
-	while (ll_xattr_cache_del(&lli->lli_xattrs, NULL) == 0)
+	while (ll_xattr_cache_del(lli, NULL) == 0)
 		/* empty loop */ ;
 
 	clear_bit(LLIF_XATTR_CACHE, &lli->lli_flags);
@@ -450,7 +456,7 @@ static int ll_xattr_cache_refill(struct inode *inode)
 			CDEBUG(D_CACHE, "not caching security.selinux\n");
 			rc = 0;
 		} else {
-			rc = ll_xattr_cache_add(&lli->lli_xattrs, xdata, xval,
+			rc = ll_xattr_cache_add(lli, xdata, xval,
 						*xsizes);
 		}
 		if (rc < 0) {
@@ -485,6 +491,22 @@ err_req:
 	RETURN(rc);
 }
 
+/**
+ * Init the xattr cache of a file cached in MemFS.
+ *
+ * The file does not exist on MDT yet, so there is nothing to fetch and
+ * the cache simply starts empty. The function exits with the list lock
+ * held for write like ll_xattr_cache_refill().
+ */
+static void ll_xattr_cache_local_init(struct inode *inode)
+{
+	struct ll_inode_info *lli = ll_i2info(inode);
+
+	down_write(&lli->lli_xattrs_list_rwsem);
+	if (!ll_xattr_cache_valid(lli))
+		ll_xattr_cache_init(lli);
+}
+
 /**
  * Get an xattr value or list xattrs using the write-through cache.
  *
@@ -515,9 +537,13 @@ int ll_xattr_cache_get(struct inode *inode,
 	down_read(&lli->lli_xattrs_list_rwsem);
 	if (!ll_xattr_cache_valid(lli)) {
 		up_read(&lli->lli_xattrs_list_rwsem);
-		rc = ll_xattr_cache_refill(inode);
-		if (rc)
-			RETURN(rc);
+		if (wbc_inode_xattr_local(ll_i2wbci(inode))) {
+			ll_xattr_cache_local_init(inode);
+		} else {
+			rc = ll_xattr_cache_refill(inode);
+			if (rc)
+				RETURN(rc);
+		}
 		downgrade_write(&lli->lli_xattrs_list_rwsem);
 	} else {
 		ll_stats_ops_tally(ll_i2sbi(inode), LPROC_LL_GETXATTR_HITS, 1);
@@ -573,7 +599,7 @@ int ll_xattr_cache_insert(struct inode *inode,
 	down_read(&lli->lli_xattrs_list_rwsem);
 	if (!ll_xattr_cache_valid(lli))
 		ll_xattr_cache_init(lli);
-	rc = ll_xattr_cache_add(&lli->lli_xattrs, name, buffer,
+	rc = ll_xattr_cache_add(lli, name, buffer,
 				size);
 	up_read(&lli->lli_xattrs_list_rwsem);
 
@@ -585,3 +611,78 @@ int ll_xattr_cache_insert(struct inode *inode,
 		rc = 0;
 	RETURN(rc);
 }
+
+/**
+ * Set or remove an xattr in the cache of a file cached in MemFS.
+ *
+ * Set @name xattr with @value and @size length, or remove it if @value is
+ * NULL, honouring XATTR_CREATE and XATTR_REPLACE in @flags. The cache is
+ * the only copy of the xattrs until the file is flushed to MDT.
+ * The caller must hold lli_xattrs_list_rwsem for write.
+ *
+ * \retval 0        success
+ * \retval -EEXIST  @name exists with XATTR_CREATE
+ * \retval -ENODATA @name does not exist with XATTR_REPLACE or for removal
+ * \retval -ENOMEM  not enough memory for the cache
+ */
+int ll_xattr_cache_update(struct inode *inode, const char *name,
+			  const char *value, size_t size, int flags)
+{
+	struct ll_inode_info *lli = ll_i2info(inode);
+	struct ll_xattr_entry *xattr;
+	bool exist;
+	int rc;
+
+	ENTRY;
+
+	if (!ll_xattr_cache_valid(lli))
+		ll_xattr_cache_init(lli);
+
+	exist = ll_xattr_cache_find(&lli->lli_xattrs, name, &xattr) == 0;
+	if (value == NULL)
+		RETURN(ll_xattr_cache_del(lli, name));
+
+	if (exist && flags & XATTR_CREATE)
+		RETURN(-EEXIST);
+	if (!exist && flags & XATTR_REPLACE)
+		RETURN(-ENODATA);
+
+	if (exist)
+		ll_xattr_cache_del(lli, name);
+
+	rc = ll_xattr_cache_add(lli, name, value, size);
+	RETURN(rc);
+}
+
+/**
+ * Walk over the cached xattrs of @inode.
+ *
+ * Call @cb for each cached xattr with its name, value and value length,
+ * stop at the first error returned by @cb.
+ *
+ * \retval 0 success or the cache is not initialized
+ * \retval < 0 the error returned by @cb
+ */
+int ll_xattr_cache_iterate(struct inode *inode, ll_xattr_iter_cb_t cb,
+			   void *cbdata)
+{
+	struct ll_inode_info *lli = ll_i2info(inode);
+	struct ll_xattr_entry *xattr;
+	int rc = 0;
+
+	ENTRY;
+
+	down_read(&lli->lli_xattrs_list_rwsem);
+	if (!ll_xattr_cache_valid(lli))
+		GOTO(out, rc = 0);
+
+	list_for_each_entry(xattr, &lli->lli_xattrs, xe_list) {
+		rc = cb(cbdata, xattr->xe_name, xattr->xe_value,
+			xattr->xe_vallen);
+		if (rc)
+			break;
+	}
+out:
+	up_read(&lli->lli_xattrs_list_rwsem);
+	RETURN(rc);
+}
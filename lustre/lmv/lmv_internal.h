@@ -212,6 +212,9 @@ static inline bool lmv_dir_retry_check_update(struct md_op_data *op_data)
 struct lmv_tgt_desc *lmv_locate_tgt_create(struct obd_device *obd,
 					   struct lmv_obd *lmv,
 					   struct md_op_data *op_data);
+struct lmv_tgt_desc *lmv_locate_tgt_wbc(struct obd_device *obd,
+					struct lmv_obd *lmv,
+					struct md_op_data *op_data);
 struct lmv_tgt_desc *lmv_locate_tgt(struct lmv_obd *lmv,
 				    struct md_op_data *op_data);
 int lmv_old_layout_lookup(struct lmv_obd *lmv, struct md_op_data *op_data);
@@ -1069,18 +1069,18 @@ int lmv_fid_alloc(const struct lu_env *env, struct obd_export *exp,
 	LASSERT(fid);
 
 	/*
-	 * All files under a root WBC directory are with FIDs located on the
-	 * same target (MDT).
-	 * TODO: Files under a root WBC directory could be distributed across
-	 * MDT targets other than the one which the root WBC directory located
-	 * on.
+	 * Files under a root WBC directory are with FIDs located on the same
+	 * target (MDT) as their parent, while the subdirectories may be
+	 * distributed across MDTs, see lmv_locate_tgt_wbc().
 	 */
 	if (op_data->op_cli_flags & CLI_WBC_TGT) {
 		/* It does not support default LMV on the parent currently. */
 		if (op_data->op_default_mea1)
 			RETURN(-EINVAL);
 
-		tgt = lmv_locate_tgt(lmv, op_data);
+		tgt = lmv_locate_tgt_wbc(obd, lmv, op_data);
+		if (IS_ERR(tgt))
+			RETURN(PTR_ERR(tgt));
 	} else {
 		tgt = lmv_tgt(lmv, op_data->op_mds);
 	}
@@ -1885,6 +1885,40 @@ struct lmv_tgt_desc *lmv_locate_tgt_create(struct obd_device *obd,
 	RETURN(tgt);
 }
 
+/*
+ * Locate the target to allocate the FID for a new object cached under a root
+ * WBC directory. A file stays on the MDT of its parent, while a directory
+ * with CLI_WBC_QOS_MKDIR is placed by QoS, or round-robin if the MDTs are
+ * balanced, so that the cached subtree is spread over the MDTs and flushed
+ * to them in parallel.
+ */
+struct lmv_tgt_desc *lmv_locate_tgt_wbc(struct obd_device *obd,
+					struct lmv_obd *lmv,
+					struct md_op_data *op_data)
+{
+	struct lmv_tgt_desc *tgt;
+
+	ENTRY;
+
+	tgt = lmv_locate_tgt(lmv, op_data);
+	if (IS_ERR(tgt))
+		RETURN(tgt);
+
+	if (!(op_data->op_cli_flags & CLI_WBC_QOS_MKDIR) ||
+	    op_data->op_code != LUSTRE_OPC_MKDIR ||
+	    lmv_dir_striped(op_data->op_mea1))
+		RETURN(tgt);
+
+	tgt = lmv_locate_tgt_qos(lmv, &op_data->op_mds);
+	if (tgt == ERR_PTR(-EAGAIN))
+		tgt = lmv_locate_tgt_rr(lmv, &op_data->op_mds);
+	if (IS_ERR(tgt))
+		RETURN(tgt);
+
+	lmv_statfs_check_update(obd, tgt);
+	RETURN(tgt);
+}
+
 int lmv_create(struct obd_export *exp, struct md_op_data *op_data,
 		const void *data, size_t datalen, umode_t mode, uid_t uid,
 		gid_t gid, cfs_cap_t cap_effective, __u64 rdev, __u64 cr_flags,
@@ -3871,8 +3905,65 @@ lmv_batch_locate_tgt(struct lmv_obd *lmv, struct md_op_item *item)
 	case MD_OP_SETATTR_LOCKLESS:
 	case MD_OP_SETATTR_EXLOCK:
 	case MD_OP_EXLOCK_ONLY:
+	/*
+	 * The xattrs of a newly created file follow its creation in the
+	 * same batch, which is sent to the MDT of the child as well.
+	 */
+	case MD_OP_SETXATTR_LOCKLESS:
+	/* Reopen by FID is served by the MDT of the file. */
+	case MD_OP_OPEN_LOCKLESS:
 		tgt = lmv_fid2tgt(lmv, &op_data->op_fid1);
 		break;
+	case MD_OP_UNLINK_LOCKLESS:
+		/*
+		 * Send the unlink to the MDT of the parent, where the WBC EX
+		 * lock of the parent is verified. As the rename, only support
+		 * the unlink within a single MDT for now.
+		 */
+		tgt = lmv_locate_tgt(lmv, op_data);
+		if (IS_ERR(tgt))
+			break;
+
+		if (fid_is_sane(&op_data->op_fid2) &&
+		    lmv_fid2tgt(lmv, &op_data->op_fid2) != tgt)
+			RETURN(ERR_PTR(-EREMOTE));
+		break;
+	case MD_OP_RENAME_LOCKLESS: {
+		const char *name = op_data->op_name;
+		size_t namelen = op_data->op_namelen;
+		struct lmv_tgt_desc *tp_tgt;
+
+		tgt = lmv_locate_tgt(lmv, op_data);
+		if (IS_ERR(tgt))
+			break;
+
+		op_data->op_name = item->mop_tgt_name.ln_name;
+		op_data->op_namelen = item->mop_tgt_name.ln_namelen;
+		tp_tgt = lmv_locate_tgt2(lmv, op_data);
+		op_data->op_name = name;
+		op_data->op_namelen = namelen;
+		if (IS_ERR(tp_tgt))
+			RETURN(tp_tgt);
+
+		/* Only support the rename within a single MDT for now. */
+		if (tp_tgt != tgt)
+			RETURN(ERR_PTR(-EREMOTE));
+
+		if (fid_is_sane(&op_data->op_fid3) &&
+		    lmv_fid2tgt(lmv, &op_data->op_fid3) != tgt)
+			RETURN(ERR_PTR(-EREMOTE));
+		if (fid_is_sane(&op_data->op_fid4) &&
+		    lmv_fid2tgt(lmv, &op_data->op_fid4) != tgt)
+			RETURN(ERR_PTR(-EREMOTE));
+		break;
+	}
+	case MD_OP_LINK_LOCKLESS:
+		/*
+		 * As lmv_link(), send the link to the MDT of the target
+		 * parent, a remote source is referenced by MDT.
+		 */
+		tgt = lmv_locate_tgt2(lmv, op_data);
+		break;
 	default:
 		tgt = ERR_PTR(-ENOTSUPP);
 	}
@@ -3922,6 +4013,7 @@ struct lu_batch *lmv_batch_get_sub(struct lmv_batch *lbh,
 	}
 
 	child_bh->bh_rqset = bh->bh_rqset;
+	child_bh->bh_fc = bh->bh_fc;
 	sbh->sbh_sub = child_bh;
 	list_add(&sbh->sbh_sub_item, &lbh->lbh_sub_batch_list);
 	RETURN(child_bh);
@@ -60,6 +60,19 @@ struct batch_update_head {
 	__u32			 buh_batchid;
 	struct list_head	 buh_buf_list;
 	struct list_head	 buh_cb_list;
+	/*
+	 * md_open_data of the handles fetched by the sub opens and kept for
+	 * open replay, protected by rq_lock of the batch RPC.
+	 */
+	struct list_head	 buh_open_list;
+	/* Flow control of the batch, and the time the RPC was sent. */
+	struct lu_batch_fc	*buh_fc;
+	ktime_t			 buh_sent;
+	/* Free the update buffers after the batch RPC is committed. */
+	struct work_struct	 buh_free_work;
+	unsigned int		 buh_interpreted:1,
+				 buh_committed:1,
+				 buh_open:1;
 };
 
 struct batch_update_args {
@@ -77,6 +90,8 @@ struct object_update_callback {
 	object_update_interpret_t	 ouc_interpret;
 	struct batch_update_head	*ouc_head;
 	void				*ouc_data;
+	/* Index of the sub request in the batch. */
+	__u32				 ouc_index;
 };
 
 
@@ -293,6 +308,7 @@ batch_insert_update_callback(struct batch_update_head *head, void *data,
 	ouc->ouc_interpret = interpret;
 	ouc->ouc_head = head;
 	ouc->ouc_data = data;
+	ouc->ouc_index = head->buh_update_count - 1;
 	list_add_tail(&ouc->ouc_item, &head->buh_cb_list);
 
 	return 0;
@@ -317,6 +333,8 @@ batch_update_request_create(struct obd_export *exp, struct lu_batch *bh)
 
 	INIT_LIST_HEAD(&head->buh_cb_list);
 	INIT_LIST_HEAD(&head->buh_buf_list);
+	INIT_LIST_HEAD(&head->buh_open_list);
+	INIT_WORK(&head->buh_free_work, batch_update_free_work);
 	head->buh_exp = exp;
 	head->buh_batch = bh;
 
@@ -360,6 +378,12 @@ static int batch_update_request_fini(struct batch_update_head *head,
 	if (reply)
 		count = reply->burp_count;
 
+	if (head->buh_fc != NULL)
+		head->buh_fc->bfc_done(head->buh_fc, head->buh_update_count,
+				       req ? req->rq_repdata_len : 0,
+				       ktime_sub(ktime_get(), head->buh_sent),
+				       rc);
+
 	list_for_each_entry_safe(ouc, next, &head->buh_cb_list, ouc_item) {
 		int rc1 = 0;
 
@@ -398,9 +422,262 @@ static int batch_update_request_fini(struct batch_update_head *head,
 			rc = rc1;
 	}
 
+	RETURN(rc);
+}
+
+static void batch_update_free_work(struct work_struct *work)
+{
+	struct batch_update_head *head;
+
+	head = container_of(work, struct batch_update_head, buh_free_work);
 	batch_update_request_destroy(head);
+}
 
-	RETURN(rc);
+/*
+ * Commit callback of the batch RPC. The update buffers are attached to the
+ * bulk of the request, and a batch retained for replay keeps them until it is
+ * committed. It may be called under imp_lock, so the buffers are freed by a
+ * work. The open handles still kept for replay, if the batch is dropped on
+ * eviction, are detached from it as mdc_commit_open() does.
+ */
+static void batch_update_commit(struct ptlrpc_request *req)
+{
+	struct batch_update_head *head = req->rq_cb_data;
+	struct md_open_data *mod, *tmp;
+	LIST_HEAD(mods);
+	bool interpreted;
+
+	spin_lock(&req->rq_lock);
+	head->buh_committed = 1;
+	interpreted = head->buh_interpreted;
+	if (!list_empty(&head->buh_open_list)) {
+		list_splice_init(&head->buh_open_list, &mods);
+		req->rq_committed = 1;
+	}
+	spin_unlock(&req->rq_lock);
+
+	list_for_each_entry_safe(mod, tmp, &mods, mod_batch_item) {
+		list_del_init(&mod->mod_batch_item);
+		obd_mod_put(mod);
+	}
+
+	if (interpreted)
+		schedule_work(&head->buh_free_work);
+}
+
+/*
+ * Find the sub request at @index of the batch RPC @req, in the request
+ * buffer if packed inline, or in the update buffers sent in bulk.
+ */
+static struct lustre_msg *
+batch_update_reqmsg_find(struct batch_update_head *head,
+			 struct ptlrpc_request *req, __u32 index)
+{
+	struct batch_update_request *bur = NULL;
+	struct batch_update_buffer *buf;
+	struct but_update_header *buh;
+	struct lustre_msg *reqmsg = NULL;
+
+	buh = req_capsule_client_get(&req->rq_pill, &RMF_BUT_HEADER);
+	if (buh == NULL)
+		return NULL;
+
+	if (buh->buh_inline_length > 0) {
+		bur = (struct batch_update_request *)buh->buh_inline_data;
+	} else {
+		list_for_each_entry(buf, &head->buh_buf_list, bub_item) {
+			if (index < buf->bub_req->burq_count) {
+				bur = buf->bub_req;
+				break;
+			}
+			index -= buf->bub_req->burq_count;
+		}
+	}
+
+	if (bur == NULL || index >= bur->burq_count)
+		return NULL;
+
+	do {
+		reqmsg = batch_update_reqmsg_next(bur, reqmsg);
+	} while (index-- > 0);
+
+	return reqmsg;
+}
+
+static struct mdt_rec_create *
+batch_open_rec_find(struct batch_update_head *head,
+		    struct ptlrpc_request *req, __u32 index)
+{
+	struct lustre_msg *reqmsg;
+	struct req_capsule pill;
+
+	reqmsg = batch_update_reqmsg_find(head, req, index);
+	if (reqmsg == NULL)
+		return NULL;
+
+	req_capsule_subreq_init(&pill, &RQF_BUT_OPEN_LOCKLESS, req,
+				reqmsg, NULL, RCL_CLIENT);
+	return req_capsule_client_get(&pill, &RMF_REC_REINT);
+}
+
+/*
+ * Register the handle @och fetched by the sub open at @index of the batch RPC
+ * @req for open replay, as mdc_set_open_replay_data() does for an open RPC.
+ * The batch is kept for replay while any of its handles is open.
+ */
+static void batch_set_open_replay_data(struct batch_update_head *head,
+				       struct ptlrpc_request *req, __u32 index,
+				       struct req_capsule *pill,
+				       struct obd_client_handle *och)
+{
+	struct mdt_rec_create *rec;
+	struct md_open_data *mod;
+	struct mdt_body *body;
+
+	/* The batch is retained for replay only with a transno. */
+	if (!req->rq_replay || req->rq_transno == 0)
+		return;
+
+	body = req_capsule_server_get(pill, &RMF_MDT_BODY);
+	rec = batch_open_rec_find(head, req, index);
+	if (body == NULL || rec == NULL)
+		return;
+
+	mod = obd_mod_alloc();
+	if (mod == NULL) {
+		DEBUG_REQ(D_ERROR, req, "cannot allocate md_open_data");
+		return;
+	}
+
+	/*
+	 * One reference for @och, one for the close and one for the batch.
+	 * @mod holds the batch RPC until it is freed.
+	 */
+	obd_mod_get(mod);
+	obd_mod_get(mod);
+	ptlrpc_request_addref(req);
+
+	spin_lock(&req->rq_lock);
+	och->och_mod = mod;
+	mod->mod_och = och;
+	mod->mod_open_req = req;
+	mod->mod_batch_index = index;
+	list_add_tail(&mod->mod_batch_item, &head->buh_open_list);
+	rec->cr_fid2 = body->mbo_fid1;
+	rec->cr_open_handle_old = body->mbo_open_handle;
+	spin_unlock(&req->rq_lock);
+
+	DEBUG_REQ(D_RPCTRACE, req, "Set up open replay data of sub %u",
+		  index);
+}
+
+/*
+ * Stop keeping the handle of @mod for replay once it is closed. Its sub open
+ * is replayed as a no-op then, see mdt_open_lockless(), and the batch is not
+ * retained any more after the last handle is closed.
+ *
+ * Return true if the batch RPC does not keep any handle for replay.
+ */
+bool mdc_batch_open_release(struct md_open_data *mod)
+{
+	struct ptlrpc_request *req = mod->mod_open_req;
+	bool registered;
+	bool released;
+
+	spin_lock(&req->rq_lock);
+	registered = !list_empty(&mod->mod_batch_item);
+	if (registered) {
+		struct batch_update_head *head = req->rq_cb_data;
+		struct mdt_rec_create *rec;
+
+		list_del_init(&mod->mod_batch_item);
+		rec = batch_open_rec_find(head, req, mod->mod_batch_index);
+		if (rec != NULL)
+			rec->cr_open_handle_old.cookie = 0;
+		if (list_empty(&head->buh_open_list))
+			req->rq_replay = 0;
+	}
+	released = !req->rq_replay;
+	spin_unlock(&req->rq_lock);
+
+	if (registered)
+		obd_mod_put(mod);
+
+	return released;
+}
+
+/*
+ * Replay callback of a batch RPC kept for its open handles. Update the
+ * handles and their pending close requests with the ones got by the
+ * replayed sub opens.
+ */
+static void batch_update_replay(struct ptlrpc_request *req)
+{
+	struct batch_update_head *head = req->rq_cb_data;
+	struct batch_update_reply *reply;
+	struct md_open_data *mod;
+
+	ENTRY;
+
+	reply = req_capsule_server_sized_get(&req->rq_pill, &RMF_BUT_REPLY,
+					     sizeof(*reply));
+	if (reply == NULL || reply->burp_magic != BUT_REPLY_MAGIC) {
+		DEBUG_REQ(D_ERROR, req, "cannot replay the batched opens");
+		RETURN_EXIT;
+	}
+
+	spin_lock(&req->rq_lock);
+	list_for_each_entry(mod, &head->buh_open_list, mod_batch_item) {
+		struct obd_client_handle *och = mod->mod_och;
+		struct lustre_msg *repmsg = NULL;
+		struct req_capsule pill;
+		struct mdt_body *body;
+		__u32 i;
+
+		if (mod->mod_batch_index >= reply->burp_count)
+			continue;
+
+		for (i = 0; i <= mod->mod_batch_index; i++)
+			repmsg = batch_update_repmsg_next(reply, repmsg);
+		if (repmsg->lm_result != 0) {
+			DEBUG_REQ(D_ERROR, req, "replay of sub open %u: rc = %d",
+				  mod->mod_batch_index, repmsg->lm_result);
+			continue;
+		}
+
+		req_capsule_subreq_init(&pill, &RQF_BUT_OPEN_LOCKLESS, req,
+					NULL, repmsg, RCL_CLIENT);
+		body = req_capsule_server_get(&pill, &RMF_MDT_BODY);
+		if (body == NULL)
+			continue;
+
+		if (och != NULL && och->och_open_handle.cookie == 0)
+			och = NULL;
+		mdc_replay_open_handle(mod, och, body);
+	}
+	spin_unlock(&req->rq_lock);
+
+	EXIT;
+}
+
+/*
+ * Release @head once the batch RPC @req is interpreted. The batch is only
+ * retained for replay in after_reply() before, so if it is not on the replay
+ * list and not committed yet, no commit callback will come.
+ */
+static void batch_update_request_release(struct batch_update_head *head,
+					 struct ptlrpc_request *req)
+{
+	bool retained;
+
+	spin_lock(&req->rq_lock);
+	head->buh_interpreted = 1;
+	retained = !head->buh_committed &&
+		   !list_empty(&req->rq_replay_list);
+	spin_unlock(&req->rq_lock);
+
+	if (!retained)
+		batch_update_request_destroy(head);
 }
 
 static int batch_update_interpret(const struct lu_env *env,
@@ -427,6 +704,14 @@ static int batch_update_interpret(const struct lu_env *env,
 
 	rc = batch_update_request_fini(aa->ba_head, req, reply, rc);
 
+	/* No handle is kept for open replay, see mdc_clear_replay_flag(). */
+	spin_lock(&req->rq_lock);
+	if (list_empty(&aa->ba_head->buh_open_list))
+		req->rq_replay = 0;
+	spin_unlock(&req->rq_lock);
+
+	batch_update_request_release(aa->ba_head, req);
+
 	RETURN(rc);
 }
 
@@ -448,12 +733,27 @@ static int batch_send_update_req(const struct lu_env *env,
 	rc = batch_prep_update_req(head, &req);
 	if (rc) {
 		rc = batch_update_request_fini(head, NULL, NULL, rc);
+		batch_update_request_destroy(head);
 		RETURN(rc);
 	}
 
 	aa = ptlrpc_req_async_args(aa, req);
 	aa->ba_head = head;
 	req->rq_interpret_reply = batch_update_interpret;
+	/* The sub requests are replayed from the update buffers. */
+	req->rq_commit_cb = batch_update_commit;
+	req->rq_cb_data = head;
+	/* The handles of the sub opens are kept for open replay. */
+	if (head->buh_open) {
+		req->rq_replay = req->rq_import->imp_replayable;
+		req->rq_replay_cb = batch_update_replay;
+	}
+
+	if (bh->bh_fc != NULL) {
+		bh->bh_fc->bfc_send(bh->bh_fc, head->buh_update_count);
+		head->buh_fc = bh->bh_fc;
+		head->buh_sent = ktime_get();
+	}
 
 	if (bh->bh_flags & BATCH_FL_SYNC) {
 		rc = ptlrpc_queue_wait(req);
@@ -536,8 +836,17 @@ static int batch_update_request_add(struct batch_update_head **headp,
 	if (rc)
 		GOTO(out, rc);
 
-	/* Unplug the batch queue if accumulated enough update requests. */
-	if (bh->bh_max_count && head->buh_update_count >= bh->bh_max_count) {
+	/* The flow controller may resize the batch during its lifetime. */
+	if (bh->bh_fc != NULL && bh->bh_fc->bfc_max_count != NULL)
+		bh->bh_max_count = bh->bh_fc->bfc_max_count(bh->bh_fc);
+
+	/*
+	 * Unplug the batch queue if accumulated enough update requests.
+	 * A chained sub request must be sent in the same batch RPC with the
+	 * sub requests following it as they depend on it.
+	 */
+	if (bh->bh_max_count && head->buh_update_count >= bh->bh_max_count &&
+	    !(item->mop_flags & WBC_FL_BATCH_CHAIN)) {
 		rc = batch_send_update_req(NULL, head);
 		*headp = NULL;
 	}
@@ -1005,6 +1314,248 @@ static int mdc_exlock_only_interpret(struct ptlrpc_request *req,
 	return item->mop_cb(&pill, item, rc);
 }
 
+static int mdc_unlink_lockless_pack(struct batch_update_head *head,
+				    struct lustre_msg *reqmsg,
+				    size_t *max_pack_size,
+				    struct md_op_item *item)
+{
+	struct md_op_data *op_data = &item->mop_data;
+	struct req_capsule pill;
+	__u32 size;
+
+	ENTRY;
+
+	req_capsule_subreq_init(&pill, &RQF_BUT_UNLINK_LOCKLESS, NULL,
+				reqmsg, NULL, RCL_CLIENT);
+	req_capsule_set_size(&pill, &RMF_NAME, RCL_CLIENT,
+			     op_data->op_namelen + 1);
+	size = req_capsule_msg_size(&pill, RCL_CLIENT);
+	if (unlikely(size >= *max_pack_size)) {
+		*max_pack_size = size;
+		RETURN(-E2BIG);
+	}
+
+	req_capsule_client_pack(&pill);
+	mdc_unlink_pack(&pill, op_data);
+	req_capsule_set_replen(&pill);
+	reqmsg->lm_opc = BUT_UNLINK_LOCKLESS;
+	*max_pack_size = size;
+	RETURN(0);
+}
+
+static int mdc_unlink_lockless_interpret(struct ptlrpc_request *req,
+					 struct lustre_msg *repmsg,
+					 struct object_update_callback *ouc,
+					 int rc)
+{
+	struct md_op_item *item = (struct md_op_item *)ouc->ouc_data;
+	struct req_capsule pill;
+
+	req_capsule_subreq_init(&pill, &RQF_BUT_UNLINK_LOCKLESS, req,
+				NULL, repmsg, RCL_CLIENT);
+
+	return item->mop_cb(&pill, item, rc);
+}
+
+static int mdc_rename_lockless_pack(struct batch_update_head *head,
+				    struct lustre_msg *reqmsg,
+				    size_t *max_pack_size,
+				    struct md_op_item *item)
+{
+	struct md_op_data *op_data = &item->mop_data;
+	struct lu_name *tname = &item->mop_tgt_name;
+	struct req_capsule pill;
+	__u32 size;
+
+	ENTRY;
+
+	req_capsule_subreq_init(&pill, &RQF_BUT_RENAME_LOCKLESS, NULL,
+				reqmsg, NULL, RCL_CLIENT);
+	req_capsule_set_size(&pill, &RMF_NAME, RCL_CLIENT,
+			     op_data->op_namelen + 1);
+	req_capsule_set_size(&pill, &RMF_SYMTGT, RCL_CLIENT,
+			     tname->ln_namelen + 1);
+	size = req_capsule_msg_size(&pill, RCL_CLIENT);
+	if (unlikely(size >= *max_pack_size)) {
+		*max_pack_size = size;
+		RETURN(-E2BIG);
+	}
+
+	req_capsule_client_pack(&pill);
+	mdc_rename_pack(&pill, op_data, op_data->op_name, op_data->op_namelen,
+			tname->ln_name, tname->ln_namelen);
+	req_capsule_set_replen(&pill);
+	reqmsg->lm_opc = BUT_RENAME_LOCKLESS;
+	*max_pack_size = size;
+	RETURN(0);
+}
+
+static int mdc_rename_lockless_interpret(struct ptlrpc_request *req,
+					 struct lustre_msg *repmsg,
+					 struct object_update_callback *ouc,
+					 int rc)
+{
+	struct md_op_item *item = (struct md_op_item *)ouc->ouc_data;
+	struct req_capsule pill;
+
+	req_capsule_subreq_init(&pill, &RQF_BUT_RENAME_LOCKLESS, req,
+				NULL, repmsg, RCL_CLIENT);
+
+	return item->mop_cb(&pill, item, rc);
+}
+
+static int mdc_link_lockless_pack(struct batch_update_head *head,
+				  struct lustre_msg *reqmsg,
+				  size_t *max_pack_size,
+				  struct md_op_item *item)
+{
+	struct md_op_data *op_data = &item->mop_data;
+	struct req_capsule pill;
+	__u32 size;
+
+	ENTRY;
+
+	req_capsule_subreq_init(&pill, &RQF_BUT_LINK_LOCKLESS, NULL,
+				reqmsg, NULL, RCL_CLIENT);
+	req_capsule_set_size(&pill, &RMF_NAME, RCL_CLIENT,
+			     op_data->op_namelen + 1);
+	size = req_capsule_msg_size(&pill, RCL_CLIENT);
+	if (unlikely(size >= *max_pack_size)) {
+		*max_pack_size = size;
+		RETURN(-E2BIG);
+	}
+
+	req_capsule_client_pack(&pill);
+	mdc_link_pack(&pill, op_data);
+	req_capsule_set_replen(&pill);
+	reqmsg->lm_opc = BUT_LINK_LOCKLESS;
+	*max_pack_size = size;
+	RETURN(0);
+}
+
+static int mdc_link_lockless_interpret(struct ptlrpc_request *req,
+				       struct lustre_msg *repmsg,
+				       struct object_update_callback *ouc,
+				       int rc)
+{
+	struct md_op_item *item = (struct md_op_item *)ouc->ouc_data;
+	struct req_capsule pill;
+
+	req_capsule_subreq_init(&pill, &RQF_BUT_LINK_LOCKLESS, req,
+				NULL, repmsg, RCL_CLIENT);
+
+	return item->mop_cb(&pill, item, rc);
+}
+
+static int mdc_setxattr_lockless_pack(struct batch_update_head *head,
+				      struct lustre_msg *reqmsg,
+				      size_t *max_pack_size,
+				      struct md_op_item *item)
+{
+	struct md_op_data *op_data = &item->mop_data;
+	struct req_capsule pill;
+	__u32 size;
+
+	ENTRY;
+
+	req_capsule_subreq_init(&pill, &RQF_BUT_SETXATTR_LOCKLESS, NULL,
+				reqmsg, NULL, RCL_CLIENT);
+	req_capsule_set_size(&pill, &RMF_NAME, RCL_CLIENT,
+			     op_data->op_namelen + 1);
+	req_capsule_set_size(&pill, &RMF_EADATA, RCL_CLIENT,
+			     op_data->op_data_size);
+	size = req_capsule_msg_size(&pill, RCL_CLIENT);
+	if (unlikely(size >= *max_pack_size)) {
+		*max_pack_size = size;
+		RETURN(-E2BIG);
+	}
+
+	req_capsule_client_pack(&pill);
+	mdc_setxattr_pack(&pill, op_data);
+	req_capsule_set_replen(&pill);
+	reqmsg->lm_opc = BUT_SETXATTR_LOCKLESS;
+	*max_pack_size = size;
+	RETURN(0);
+}
+
+static int mdc_setxattr_lockless_interpret(struct ptlrpc_request *req,
+					   struct lustre_msg *repmsg,
+					   struct object_update_callback *ouc,
+					   int rc)
+{
+	struct md_op_item *item = (struct md_op_item *)ouc->ouc_data;
+	struct req_capsule pill;
+
+	req_capsule_subreq_init(&pill, &RQF_BUT_SETXATTR_LOCKLESS, req,
+				NULL, repmsg, RCL_CLIENT);
+
+	return item->mop_cb(&pill, item, rc);
+}
+
+static int mdc_open_lockless_pack(struct batch_update_head *head,
+				  struct lustre_msg *reqmsg,
+				  size_t *max_pack_size,
+				  struct md_op_item *item)
+{
+	struct md_op_data *op_data = &item->mop_data;
+	struct lookup_intent *it = &item->mop_it;
+	struct req_capsule pill;
+	__u32 size;
+
+	ENTRY;
+
+	req_capsule_subreq_init(&pill, &RQF_BUT_OPEN_LOCKLESS, NULL,
+				reqmsg, NULL, RCL_CLIENT);
+	req_capsule_set_size(&pill, &RMF_NAME, RCL_CLIENT,
+			     op_data->op_namelen + 1);
+	req_capsule_set_size(&pill, &RMF_EADATA, RCL_CLIENT, 0);
+	req_capsule_set_size(&pill, &RMF_FILE_SECCTX_NAME, RCL_CLIENT, 0);
+	req_capsule_set_size(&pill, &RMF_FILE_SECCTX, RCL_CLIENT, 0);
+	req_capsule_set_size(&pill, &RMF_FILE_ENCCTX, RCL_CLIENT, 0);
+	size = req_capsule_msg_size(&pill, RCL_CLIENT);
+	if (unlikely(size >= *max_pack_size)) {
+		*max_pack_size = size;
+		RETURN(-E2BIG);
+	}
+
+	req_capsule_client_pack(&pill);
+	mdc_open_pack(&pill, op_data, it->it_create_mode, 0, it->it_flags,
+		      NULL, 0);
+
+	/* The ACLs are cached on the client already. */
+	req_capsule_set_size(&pill, &RMF_ACL, RCL_SERVER, 0);
+	if (S_ISREG(it->it_create_mode))
+		req_capsule_set_size(&pill, &RMF_MDT_MD, RCL_SERVER,
+				     MAX_MD_SIZE);
+	else
+		req_capsule_set_size(&pill, &RMF_MDT_MD, RCL_SERVER, 0);
+
+	req_capsule_set_replen(&pill);
+	reqmsg->lm_opc = BUT_OPEN_LOCKLESS;
+	*max_pack_size = size;
+	head->buh_open = 1;
+	RETURN(0);
+}
+
+static int mdc_open_lockless_interpret(struct ptlrpc_request *req,
+				       struct lustre_msg *repmsg,
+				       struct object_update_callback *ouc,
+				       int rc)
+{
+	struct md_op_item *item = (struct md_op_item *)ouc->ouc_data;
+	struct obd_client_handle *och = item->mop_och;
+	struct req_capsule pill;
+
+	req_capsule_subreq_init(&pill, &RQF_BUT_OPEN_LOCKLESS, req,
+				NULL, repmsg, RCL_CLIENT);
+
+	rc = item->mop_cb(&pill, item, rc);
+	if (rc == 0 && och != NULL && och->och_magic == OBD_CLIENT_HANDLE_MAGIC)
+		batch_set_open_replay_data(ouc->ouc_head, req, ouc->ouc_index,
+					   &pill, och);
+	return rc;
+}
+
 static md_update_pack_t mdc_update_packers[MD_OP_MAX] = {
 	[MD_OP_GETATTR]			= mdc_batch_getattr_pack,
 	[MD_OP_CREATE_LOCKLESS]		= mdc_create_lockless_pack,
@@ -1012,6 +1563,11 @@ static md_update_pack_t mdc_update_packers[MD_OP_MAX] = {
 	[MD_OP_SETATTR_LOCKLESS]	= mdc_setattr_lockless_pack,
 	[MD_OP_SETATTR_EXLOCK]		= mdc_setattr_exlock_pack,
 	[MD_OP_EXLOCK_ONLY]		= mdc_exlock_only_pack,
+	[MD_OP_UNLINK_LOCKLESS]		= mdc_unlink_lockless_pack,
+	[MD_OP_RENAME_LOCKLESS]		= mdc_rename_lockless_pack,
+	[MD_OP_LINK_LOCKLESS]		= mdc_link_lockless_pack,
+	[MD_OP_SETXATTR_LOCKLESS]	= mdc_setxattr_lockless_pack,
+	[MD_OP_OPEN_LOCKLESS]		= mdc_open_lockless_pack,
 };
 
 object_update_interpret_t mdc_update_interpreters[MD_OP_MAX] = {
@@ -1021,6 +1577,11 @@ object_update_interpret_t mdc_update_interpreters[MD_OP_MAX] = {
 	[MD_OP_SETATTR_LOCKLESS]	= mdc_setattr_lockless_interpret,
 	[MD_OP_SETATTR_EXLOCK]		= mdc_setattr_exlock_interpret,
 	[MD_OP_EXLOCK_ONLY]		= mdc_exlock_only_interpret,
+	[MD_OP_UNLINK_LOCKLESS]		= mdc_unlink_lockless_interpret,
+	[MD_OP_RENAME_LOCKLESS]		= mdc_rename_lockless_interpret,
+	[MD_OP_LINK_LOCKLESS]		= mdc_link_lockless_interpret,
+	[MD_OP_SETXATTR_LOCKLESS]	= mdc_setxattr_lockless_interpret,
+	[MD_OP_OPEN_LOCKLESS]		= mdc_open_lockless_interpret,
 };
 
 static int mdc_update_request_add(struct batch_update_head **headp,
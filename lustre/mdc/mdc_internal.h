@@ -62,6 +62,7 @@ void mdc_file_sepol_pack(struct req_capsule *pill);
 
 void mdc_unlink_pack(struct req_capsule *pill, struct md_op_data *op_data);
 void mdc_link_pack(struct req_capsule *pill, struct md_op_data *op_data);
+void mdc_setxattr_pack(struct req_capsule *pill, struct md_op_data *op_data);
 void mdc_rename_pack(struct req_capsule *pill, struct md_op_data *op_data,
 		     const char *old, size_t oldlen,
 		     const char *new, size_t newlen);
@@ -115,6 +116,9 @@ int mdc_set_open_replay_data(struct obd_export *exp,
 
 void mdc_commit_open(struct ptlrpc_request *req);
 void mdc_replay_open(struct ptlrpc_request *req);
+void mdc_replay_open_handle(struct md_open_data *mod,
+			    struct obd_client_handle *och,
+			    struct mdt_body *body);
 
 int mdc_create(struct obd_export *exp, struct md_op_data *op_data,
 		const void *data, size_t datalen,
@@ -146,6 +150,13 @@ int mdc_batch_stop(struct obd_export *exp, struct lu_batch *bh);
 int mdc_batch_flush(struct obd_export *exp, struct lu_batch *bh, bool wait);
 int mdc_batch_add(struct obd_export *exp, struct lu_batch *bh,
 		  struct md_op_item *item);
+bool mdc_batch_open_release(struct md_open_data *mod);
+
+/* The open handle of @req was fetched by a sub open of a batch RPC. */
+static inline bool mdc_open_req_is_batch(struct ptlrpc_request *req)
+{
+	return lustre_msg_get_opc(req->rq_reqmsg) == MDS_BATCH;
+}
 
 enum ldlm_mode mdc_lock_match(struct obd_export *exp, __u64 flags,
 			      const struct lu_fid *fid, enum ldlm_type type,
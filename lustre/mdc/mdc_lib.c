@@ -233,6 +233,17 @@ void mdc_create_pack(struct req_capsule *pill, struct md_op_data *op_data,
 	set_mrc_cr_flags(rec, flags);
 	rec->cr_bias     = op_data->op_bias;
 	rec->cr_umask    = current_umask();
+	if (op_data->op_bias & MDS_WBC_CREATE_ATTR) {
+		/*
+		 * The file was created in the client cache, its mode has
+		 * already been masked and its timestamps may have changed
+		 * since then; pack the final attributes as they are.
+		 */
+		rec->cr_time  = op_data->op_attr.ia_mtime.tv_sec;
+		rec->cr_atime = op_data->op_attr.ia_atime.tv_sec;
+		rec->cr_ctime = op_data->op_attr.ia_ctime.tv_sec;
+		rec->cr_umask = 0;
+	}
 
 	mdc_pack_name(pill, &RMF_NAME, op_data->op_name, op_data->op_namelen);
 	if (data) {
@@ -517,6 +528,40 @@ void mdc_link_pack(struct req_capsule *pill, struct md_op_data *op_data)
 	mdc_file_sepol_pack(pill);
 }
 
+/*
+ * Pack the xattr @op_name with the value @op_data of the file @op_fid1.
+ * A removal is told by OBD_MD_FLXATTRRM in @op_valid.
+ */
+void mdc_setxattr_pack(struct req_capsule *pill, struct md_op_data *op_data)
+{
+	struct mdt_rec_setxattr *rec;
+	void *tmp;
+
+	BUILD_BUG_ON(sizeof(struct mdt_rec_reint) !=
+		     sizeof(struct mdt_rec_setxattr));
+	rec = req_capsule_client_get(pill, &RMF_REC_REINT);
+	LASSERT(rec != NULL);
+
+	rec->sx_opcode   = REINT_SETXATTR;
+	rec->sx_fsuid    = op_data->op_fsuid;
+	rec->sx_fsgid    = op_data->op_fsgid;
+	rec->sx_cap      = op_data->op_cap;
+	rec->sx_suppgid1 = op_data->op_suppgids[0];
+	rec->sx_suppgid2 = -1;
+	rec->sx_fid      = op_data->op_fid1;
+	rec->sx_valid    = op_data->op_valid | OBD_MD_FLCTIME;
+	rec->sx_time     = op_data->op_mod_time;
+	rec->sx_size     = 0;
+	rec->sx_flags    = 0;
+
+	mdc_pack_name(pill, &RMF_NAME, op_data->op_name, op_data->op_namelen);
+
+	if (op_data->op_data_size > 0) {
+		tmp = req_capsule_client_get(pill, &RMF_EADATA);
+		memcpy(tmp, op_data->op_data, op_data->op_data_size);
+	}
+}
+
 static void mdc_close_intent_pack(struct req_capsule *pill,
 				  struct md_op_data *op_data)
 {
@@ -630,12 +630,52 @@ static int mdc_free_lustre_md(struct obd_export *exp, struct lustre_md *md)
 	RETURN(0);
 }
 
+/*
+ * Update the open handle @och of @mod, if it is still used, and the pending
+ * close request with the handle in @body got by the replayed open.
+ */
+void mdc_replay_open_handle(struct md_open_data *mod,
+			    struct obd_client_handle *och,
+			    struct mdt_body *body)
+{
+	struct lustre_handle old_open_handle = { };
+	struct ptlrpc_request *close_req;
+
+	if (och != NULL) {
+		struct lustre_handle *file_open_handle;
+
+		LASSERT(och->och_magic == OBD_CLIENT_HANDLE_MAGIC);
+
+		file_open_handle = &och->och_open_handle;
+		CDEBUG(D_HA, "updating handle from %#llx to %#llx\n",
+		       file_open_handle->cookie, body->mbo_open_handle.cookie);
+		old_open_handle = *file_open_handle;
+		*file_open_handle = body->mbo_open_handle;
+	}
+
+	close_req = mod->mod_close_req;
+	if (close_req) {
+		__u32 opc = lustre_msg_get_opc(close_req->rq_reqmsg);
+		struct mdt_ioepoch *epoch;
+
+		LASSERT(opc == MDS_CLOSE);
+		epoch = req_capsule_client_get(&close_req->rq_pill,
+					       &RMF_MDT_EPOCH);
+		LASSERT(epoch);
+
+		if (och != NULL)
+			LASSERT(old_open_handle.cookie ==
+				epoch->mio_open_handle.cookie);
+
+		DEBUG_REQ(D_HA, close_req, "updating close body with new fh");
+		epoch->mio_open_handle = body->mbo_open_handle;
+	}
+}
+
 void mdc_replay_open(struct ptlrpc_request *req)
 {
 	struct md_open_data *mod = req->rq_cb_data;
-	struct ptlrpc_request *close_req;
 	struct obd_client_handle *och;
-	struct lustre_handle old_open_handle = { };
 	struct mdt_body *body;
 	struct ldlm_reply *rep;
 	ENTRY;
@@ -663,35 +703,8 @@ void mdc_replay_open(struct ptlrpc_request *req)
 		req->rq_early_free_repbuf = 0;
 	spin_unlock(&req->rq_lock);
 
-	if (req->rq_early_free_repbuf) {
-		struct lustre_handle *file_open_handle;
-
-		LASSERT(och->och_magic == OBD_CLIENT_HANDLE_MAGIC);
-
-		file_open_handle = &och->och_open_handle;
-		CDEBUG(D_HA, "updating handle from %#llx to %#llx\n",
-		       file_open_handle->cookie, body->mbo_open_handle.cookie);
-		old_open_handle = *file_open_handle;
-		*file_open_handle = body->mbo_open_handle;
-	}
-
-	close_req = mod->mod_close_req;
-	if (close_req) {
-		__u32 opc = lustre_msg_get_opc(close_req->rq_reqmsg);
-		struct mdt_ioepoch *epoch;
-
-		LASSERT(opc == MDS_CLOSE);
-		epoch = req_capsule_client_get(&close_req->rq_pill,
-					       &RMF_MDT_EPOCH);
-		LASSERT(epoch);
-
-		if (req->rq_early_free_repbuf)
-			LASSERT(old_open_handle.cookie ==
-				epoch->mio_open_handle.cookie);
-
-		DEBUG_REQ(D_HA, close_req, "updating close body with new fh");
-		epoch->mio_open_handle = body->mbo_open_handle;
-	}
+	mdc_replay_open_handle(mod, req->rq_early_free_repbuf ? och : NULL,
+			       body);
 	EXIT;
 }
 
@@ -790,10 +803,14 @@ int mdc_set_open_replay_data(struct obd_export *exp,
 
 static void mdc_free_open(struct md_open_data *mod)
 {
+	bool keep_open_req = false;
 	int committed = 0;
 
-	if (mod->mod_is_create == 0 &&
-	    imp_connect_disp_stripe(mod->mod_open_req->rq_import))
+	if (mdc_open_req_is_batch(mod->mod_open_req))
+		/* Other handles of the batch may still need its replay. */
+		keep_open_req = !mdc_batch_open_release(mod);
+	else if (mod->mod_is_create == 0 &&
+		 imp_connect_disp_stripe(mod->mod_open_req->rq_import))
 		committed = 1;
 
 	/**
@@ -807,7 +824,8 @@ static void mdc_free_open(struct md_open_data *mod)
 		  "free open request, rq_replay=%d",
 		  mod->mod_open_req->rq_replay);
 
-	ptlrpc_request_committed(mod->mod_open_req, committed);
+	if (!keep_open_req)
+		ptlrpc_request_committed(mod->mod_open_req, committed);
 	if (mod->mod_close_req)
 		ptlrpc_request_committed(mod->mod_close_req, committed);
 }
@@ -898,9 +916,13 @@ static int mdc_close(struct obd_export *exp, struct md_op_data *op_data,
 		DEBUG_REQ(D_RPCTRACE, mod->mod_open_req, "matched open");
 		/* We no longer want to preserve this open for replay even
 		 * though the open was committed. b=3632, b=3633 */
-		spin_lock(&mod->mod_open_req->rq_lock);
-		mod->mod_open_req->rq_replay = 0;
-		spin_unlock(&mod->mod_open_req->rq_lock);
+		if (mdc_open_req_is_batch(mod->mod_open_req)) {
+			mdc_batch_open_release(mod);
+		} else {
+			spin_lock(&mod->mod_open_req->rq_lock);
+			mod->mod_open_req->rq_replay = 0;
+			spin_unlock(&mod->mod_open_req->rq_lock);
+		}
 	} else {
 		CDEBUG(D_HA, "couldn't find open req; expecting close error\n");
 	}
@@ -3055,6 +3055,246 @@ out_free:
 	return rc;
 }
 
+/*
+ * Create one file of mdd_create_batch() in the started transaction. On failure
+ * the updates made for the file are undone in the transaction as mdd_create()
+ * does, so no name is left pointing to a destroyed object.
+ */
+static int mdd_create_batch_one(const struct lu_env *env,
+				struct mdd_device *mdd,
+				struct mdd_object *pobj,
+				struct md_create_item *item,
+				struct dt_allocation_hint *hint,
+				struct thandle *handle)
+{
+	struct linkea_data *ldata = &mdd_env_info(env)->mti_link_data;
+	struct mdd_object *son = md2mdd_obj(item->mci_child);
+	struct lu_attr *attr = &item->mci_ma->ma_attr;
+	const struct lu_name *lname = item->mci_name;
+	int rc, rc2;
+
+	rc = mdd_create_object(env, pobj, son, attr, item->mci_spec, NULL,
+			       NULL, NULL, hint, handle, true);
+	if (rc != 0)
+		return rc;
+
+	rc = __mdd_index_insert(env, pobj, mdd_object_fid(son), attr->la_mode,
+				lname->ln_name, handle);
+	if (rc != 0)
+		goto err_created;
+
+	memset(ldata, 0, sizeof(*ldata));
+	if (mdd_linkea_prepare(env, son, NULL, NULL, mdd_object_fid(pobj),
+			       lname, 1, 0, ldata) == 0)
+		mdd_links_add(env, son, mdd_object_fid(pobj), lname, handle,
+			      ldata, 1);
+
+	if (fid_is_namespace_visible(mdd_object_fid(son))) {
+		rc = mdd_changelog_ns_store(env, mdd, CL_CREATE, 0, son,
+					    mdd_object_fid(pobj), NULL, NULL,
+					    lname, NULL, handle);
+		if (rc != 0)
+			goto err_insert;
+	}
+
+	return 0;
+
+err_insert:
+	/* The linkEA goes away with the object destroyed below. */
+	rc2 = __mdd_index_delete(env, pobj, lname->ln_name, 0, handle);
+	if (rc2 != 0) {
+		/* Keep the object referenced by the name. */
+		CERROR("%s: cannot undo create "DFID"/"DNAME": rc = %d\n",
+		       mdd2obd_dev(mdd)->obd_name, PFID(mdd_object_fid(pobj)),
+		       PNAME(lname), rc2);
+		return rc;
+	}
+err_created:
+	mdd_write_lock(env, son, DT_TGT_CHILD);
+	if (mdo_ref_del(env, son, handle) == 0)
+		mdo_destroy(env, son, handle);
+	mdd_write_unlock(env, son);
+	return rc;
+}
+
+/**
+ * Create a group of regular files under the same parent in one transaction.
+ *
+ * This is used by the batched creates of the WBC flush, where a client
+ * sends many creates under the same parent in one batch RPC. Running them
+ * in one transaction saves the journal handle start/stop and the last_rcvd
+ * update of each create. Only plain creates are grouped: the parent must be
+ * local without default ACL, and the files have no layout, security or
+ * encryption context given by the client. Otherwise -EOPNOTSUPP is returned
+ * and the caller creates the files with mdd_create() one by one.
+ *
+ * Any failure before the transaction is started is returned as is, and no
+ * file is created. Once started, the files are created in order until one
+ * of them fails. The name, linkEA and object of the failed one are removed
+ * in the same transaction by mdd_create_batch_one(), and the previous ones
+ * are kept.
+ *
+ * \param[in] pobj	parent object
+ * \param[in,out] items	files to create, mci_rc is set for each
+ *			processed item
+ * \param[in] count	number of \a items
+ *
+ * \retval		number of processed items
+ * \retval		negative errno if no item was processed
+ */
+static int mdd_create_batch(const struct lu_env *env, struct md_object *pobj,
+			    struct md_create_item *items, int count)
+{
+	struct mdd_thread_info *info = mdd_env_info(env);
+	struct mdd_object *mdd_pobj = md2mdd_obj(pobj);
+	struct mdd_device *mdd = mdo2mdd(pobj);
+	struct lu_attr *pattr = &info->mti_pattr;
+	struct lu_attr *la = &info->mti_la_for_fix;
+	struct linkea_data *ldata = &info->mti_link_data;
+	struct dt_allocation_hint *hints;
+	struct lu_ucred *uc = lu_ucred(env);
+	struct thandle *handle;
+	s64 ctime = 0;
+	int done = 0;
+	int rc, rc2;
+	int i;
+
+	ENTRY;
+
+	if (mdd_object_remote(mdd_pobj))
+		RETURN(-EOPNOTSUPP);
+
+	for (i = 0; i < count; i++) {
+		struct md_op_spec *spec = items[i].mci_spec;
+
+		if (!S_ISREG(items[i].mci_ma->ma_attr.la_mode) ||
+		    spec->sp_cr_flags & (MDS_OPEN_HAS_EA | MDS_OPEN_VOLATILE |
+					 MDS_OPEN_PCC) ||
+		    spec->sp_cr_file_secctx_name != NULL ||
+		    spec->sp_cr_file_encctx != NULL)
+			RETURN(-EOPNOTSUPP);
+	}
+
+	rc = mdd_la_get(env, mdd_pobj, pattr);
+	if (rc != 0)
+		RETURN(rc);
+
+	/* The default ACL of the parent is inherited by each file. */
+	mdd_read_lock(env, mdd_pobj, DT_TGT_PARENT);
+	rc = mdo_xattr_get(env, mdd_pobj, &LU_BUF_NULL, XATTR_NAME_ACL_DEFAULT);
+	mdd_read_unlock(env, mdd_pobj);
+	if (rc > 0)
+		RETURN(-EOPNOTSUPP);
+	if (rc < 0 && rc != -ENODATA && rc != -EOPNOTSUPP)
+		RETURN(rc);
+
+	OBD_ALLOC_PTR_ARRAY_LARGE(hints, count);
+	if (hints == NULL)
+		RETURN(-ENOMEM);
+
+	handle = mdd_trans_create(env, mdd);
+	if (IS_ERR(handle))
+		GOTO(out_free, rc = PTR_ERR(handle));
+
+	for (i = 0; i < count; i++) {
+		struct mdd_object *son = md2mdd_obj(items[i].mci_child);
+		struct lu_attr *attr = &items[i].mci_ma->ma_attr;
+		struct md_op_spec *spec = items[i].mci_spec;
+
+		rc = mdd_create_sanity_check(env, pobj, pattr,
+					     items[i].mci_name, attr, spec);
+		if (rc)
+			GOTO(out_stop, rc);
+
+		/* No default ACL, fix the mode by the mask. */
+		if (uc != NULL)
+			attr->la_mode &= ~uc->uc_umask;
+
+		mdd_object_make_hint(env, mdd_pobj, son, attr, spec, &hints[i]);
+
+		memset(ldata, 0, sizeof(*ldata));
+		mdd_linkea_prepare(env, son, NULL, NULL,
+				   mdd_object_fid(mdd_pobj), items[i].mci_name,
+				   1, 0, ldata);
+
+		rc = mdd_declare_create(env, mdd, mdd_pobj, son,
+					items[i].mci_name, attr, handle, spec,
+					ldata, NULL, NULL, NULL, &hints[i]);
+		if (rc)
+			GOTO(out_stop, rc);
+	}
+
+	rc = mdd_trans_start(env, mdd, handle);
+	if (rc)
+		GOTO(out_stop, rc);
+
+	for (i = 0; i < count; i++) {
+		struct md_object *child = items[i].mci_child;
+
+		rc = mdd_create_batch_one(env, mdd, mdd_pobj, &items[i],
+					  &hints[i], handle);
+		items[i].mci_rc = rc;
+		done++;
+		if (items[i].mci_ma->ma_attr.la_ctime > ctime)
+			ctime = items[i].mci_ma->ma_attr.la_ctime;
+		if (rc != 0) {
+			/* The child object shouldn't be cached anymore */
+			set_bit(LU_OBJECT_HEARD_BANSHEE,
+				&child->mo_lu.lo_header->loh_flags);
+			break;
+		}
+	}
+
+	/* Update the parent mtime/ctime once for the whole group. */
+	if (ctime != 0) {
+		la->la_ctime = la->la_mtime = ctime;
+		la->la_valid = LA_CTIME | LA_MTIME;
+		rc2 = mdd_update_time(env, mdd_pobj, pattr, la, handle);
+		if (rc2)
+			CERROR("%s: update time of "DFID" failed: rc = %d\n",
+			       mdd2obd_dev(mdd)->obd_name,
+			       PFID(mdd_object_fid(mdd_pobj)), rc2);
+	}
+
+	/*
+	 * The files created before a failed one are kept, so the transaction
+	 * is stopped as successful for them to get a transno.
+	 */
+	rc = 0;
+out_stop:
+	rc2 = mdd_trans_stop(env, mdd, rc, handle);
+	if (rc == 0 && rc2 < 0) {
+		for (i = 0; i < done; i++) {
+			struct md_object *child = items[i].mci_child;
+
+			if (items[i].mci_rc == 0)
+				mdd_index_delete(env, mdd_pobj,
+						 &items[i].mci_ma->ma_attr,
+						 items[i].mci_name);
+			set_bit(LU_OBJECT_HEARD_BANSHEE,
+				&child->mo_lu.lo_header->loh_flags);
+			items[i].mci_rc = rc2;
+		}
+	}
+out_free:
+	if (is_vmalloc_addr(ldata->ld_buf))
+		/* if we vmalloced a large buffer drop it */
+		lu_buf_free(ldata->ld_buf);
+	OBD_FREE_PTR_ARRAY_LARGE(hints, count);
+
+	/* The children may be declared, they are to be created again. */
+	if (rc < 0) {
+		for (i = 0; i < count; i++) {
+			struct md_object *child = items[i].mci_child;
+
+			set_bit(LU_OBJECT_HEARD_BANSHEE,
+				&child->mo_lu.lo_header->loh_flags);
+		}
+	}
+
+	RETURN(rc ? rc : done);
+}
+
 /* has not mdd_write{read}_lock on any obj yet. */
 static int mdd_rename_sanity_check(const struct lu_env *env,
                                    struct mdd_object *src_pobj,
@@ -5206,6 +5446,7 @@ const struct md_dir_operations mdd_dir_ops = {
 	.mdo_is_subdir     = mdd_is_subdir,
 	.mdo_lookup        = mdd_lookup,
 	.mdo_create        = mdd_create,
+	.mdo_create_batch  = mdd_create_batch,
 	.mdo_rename        = mdd_rename,
 	.mdo_link          = mdd_link,
 	.mdo_unlink        = mdd_unlink,
@@ -130,13 +130,38 @@ struct mdd_generic_thread {
 	bool			mgt_init;
 };
 
+struct mdd_dir_remover;
+
+struct mdd_remover_thread {
+	struct mdd_dir_remover	*mrth_remover;
+	struct lu_env		 mrth_env;
+	struct task_struct	*mrth_task;
+	/* regular files removed in one transaction */
+	struct mdd_remove_ent	*mrth_ents;
+};
+
 struct mdd_dir_remover {
-	struct lu_env		 mrm_env;
-	struct task_struct	*mrm_task;
 	spinlock_t		 mrm_lock;
+	/* removed directories whose subtree is to be removed */
 	struct list_head	 mrm_list;
+	/* directories of the subtrees to be emptied, see mdd_remove_task */
+	struct list_head	 mrm_tasks;
+	wait_queue_head_t	 mrm_waitq;
+	struct mdd_remover_thread *mrm_threads;
+	int			 mrm_nthreads;
+	bool			 mrm_stopping;
 	/* Use orphan dir "PENDING" as the root of removed directories. */
 	struct mdd_object	*mrm_root;
+	/* objects removed per second, 0 for no limit */
+	unsigned int		 mrm_speed_limit;
+	unsigned long		 mrm_window;
+	unsigned int		 mrm_window_count;
+	/* statistics, protected by mrm_lock */
+	__u64			 mrm_subtrees_queued;
+	__u64			 mrm_dirs_queued;
+	__u64			 mrm_subtrees_removed;
+	__u64			 mrm_objects_removed;
+	__u64			 mrm_bytes_removed;
 };
 
 struct mdd_device {
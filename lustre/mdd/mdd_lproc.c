@@ -485,6 +485,36 @@ static ssize_t async_tree_remove_store(struct kobject *kobj,
 }
 LUSTRE_RW_ATTR(async_tree_remove);
 
+static ssize_t tree_remove_speed_limit_show(struct kobject *kobj,
+					    struct attribute *attr, char *buf)
+{
+	struct mdd_device *mdd = container_of(kobj, struct mdd_device,
+					      mdd_kobj);
+
+	return sprintf(buf, "%u\n", mdd->mdd_remover.mrm_speed_limit);
+}
+
+static ssize_t tree_remove_speed_limit_store(struct kobject *kobj,
+					     struct attribute *attr,
+					     const char *buffer, size_t count)
+{
+	struct mdd_device *mdd = container_of(kobj, struct mdd_device,
+					      mdd_kobj);
+	unsigned int val;
+	int rc;
+
+	rc = kstrtouint(buffer, 10, &val);
+	if (rc)
+		return rc;
+
+	/* 0 means no limit on the objects removed per second */
+	WRITE_ONCE(mdd->mdd_remover.mrm_speed_limit, val);
+	wake_up_all(&mdd->mdd_remover.mrm_waitq);
+
+	return count;
+}
+LUSTRE_RW_ATTR(tree_remove_speed_limit);
+
 static ssize_t lfsck_speed_limit_show(struct kobject *kobj,
 				      struct attribute *attr, char *buf)
 {
@@ -560,6 +590,30 @@ static int mdd_lfsck_layout_seq_show(struct seq_file *m, void *data)
 }
 LDEBUGFS_SEQ_FOPS_RO(mdd_lfsck_layout);
 
+static int mdd_tree_remove_stats_seq_show(struct seq_file *m, void *data)
+{
+	struct mdd_device *mdd = m->private;
+	struct mdd_dir_remover *remover;
+
+	LASSERT(mdd != NULL);
+
+	remover = &mdd->mdd_remover;
+	spin_lock(&remover->mrm_lock);
+	seq_printf(m, "threads: %d\n"
+		   "subtrees_queued: %llu\n"
+		   "dirs_queued: %llu\n"
+		   "subtrees_removed: %llu\n"
+		   "objects_removed: %llu\n"
+		   "bytes_removed: %llu\n",
+		   remover->mrm_nthreads, remover->mrm_subtrees_queued,
+		   remover->mrm_dirs_queued, remover->mrm_subtrees_removed,
+		   remover->mrm_objects_removed, remover->mrm_bytes_removed);
+	spin_unlock(&remover->mrm_lock);
+
+	return 0;
+}
+LDEBUGFS_SEQ_FOPS_RO(mdd_tree_remove_stats);
+
 /**
  * Show default number of stripes for O_APPEND files.
  *
@@ -680,6 +734,8 @@ static struct ldebugfs_vars ldebugfs_mdd_obd_vars[] = {
 	  .fops =	&mdd_lfsck_namespace_fops	},
 	{ .name	=	"lfsck_layout",
 	  .fops	=	&mdd_lfsck_layout_fops		},
+	{ .name	=	"tree_remove_stats",
+	  .fops	=	&mdd_tree_remove_stats_fops	},
 	{ NULL }
 };
 
@@ -697,6 +753,7 @@ static struct attribute *mdd_attrs[] = {
 	&lustre_attr_lfsck_speed_limit.attr,
 	&lustre_attr_sync_permission.attr,
 	&lustre_attr_async_tree_remove.attr,
+	&lustre_attr_tree_remove_speed_limit.attr,
 	&lustre_attr_append_stripe_count.attr,
 	&lustre_attr_append_pool.attr,
 	NULL,
@@ -364,7 +364,22 @@ static int mdd_orphan_key_test_and_delete(const struct lu_env *env,
 		return PTR_ERR(mdo);
 
 	rc = -EBUSY;
-	if (mdo->mod_count == 0) {
+	if (mdo->mod_count == 0 && mdd->mdd_remover.mrm_nthreads > 0 &&
+	    S_ISDIR(mdd_object_type(mdo)) &&
+	    mdd_dir_is_empty(env, mdo) == -ENOTEMPTY) {
+		/*
+		 * A subtree whose removal was interrupted by the restart,
+		 * the directory is removed by the remover once emptied.
+		 */
+		CDEBUG(D_HA, "Found removed subtree "DFID", requeue it\n",
+		       PFID(lf));
+		mdd_write_lock(env, mdo, DT_TGT_CHILD);
+		if (!(mdo->mod_flags & REMOVED_OBJ)) {
+			mdo->mod_flags |= REMOVED_OBJ | DEAD_OBJ;
+			mdd_remove_item_add(mdo);
+		}
+		mdd_write_unlock(env, mdo);
+	} else if (mdo->mod_count == 0) {
 		CDEBUG(D_HA, "Found orphan "DFID", delete it\n", PFID(lf));
 		rc = mdd_orphan_destroy(env, mdo, key);
 		if (rc) /* below message checked in replay-single.sh test_37 */
@@ -298,6 +298,396 @@ out:
 	RETURN(rc);
 }
 
+/*
+ * The removed subtrees are emptied by several threads. Each directory of a
+ * subtree is a task: a thread scans it, removes its regular files in batches
+ * of MDD_TREE_REMOVE_BATCH per transaction, and queues its subdirectories as
+ * new tasks which any thread may pick up. A directory is removed itself once
+ * its scan and the tasks of all its subdirectories are done, then the task of
+ * its parent is released in turn, up to the removed directory in PENDING.
+ *
+ * The removed directory stays in PENDING until the whole subtree is removed,
+ * so the removal is started again by the orphan cleanup after a restart, see
+ * mdd_orphan_key_test_and_delete().
+ */
+#define MDD_TREE_REMOVE_BATCH	32
+#define MDD_TREE_REMOVE_THREADS_MAX	32
+
+static unsigned int tree_remove_threads = 4;
+module_param(tree_remove_threads, uint, 0444);
+MODULE_PARM_DESC(tree_remove_threads,
+		 "number of threads removing the subtrees in background");
+
+struct mdd_remove_ent {
+	struct lu_fid		 mre_fid;
+	struct mdd_object	*mre_obj;
+	__u64			 mre_bytes;
+	__u32			 mre_nlink;
+	char			 mre_name[NAME_MAX + 1];
+};
+
+struct mdd_remove_task {
+	struct list_head	 mrt_linkage;
+	struct mdd_object	*mrt_obj;
+	/* task of the parent directory, NULL for the removed directory */
+	struct mdd_remove_task	*mrt_parent;
+	/* the scan of the directory and the tasks of its subdirectories */
+	atomic_t		 mrt_pending;
+	char			 mrt_name[NAME_MAX + 1];
+};
+
+static inline struct mdd_device *
+mdd_remover2mdd(struct mdd_dir_remover *remover)
+{
+	return container_of(remover, struct mdd_device, mdd_remover);
+}
+
+static void mdd_remover_account(struct mdd_dir_remover *remover,
+				int objects, __u64 bytes)
+{
+	spin_lock(&remover->mrm_lock);
+	remover->mrm_objects_removed += objects;
+	remover->mrm_bytes_removed += bytes;
+	spin_unlock(&remover->mrm_lock);
+}
+
+/* Sleep if more objects than the speed limit are removed in this second. */
+static void mdd_remover_throttle(struct mdd_dir_remover *remover, int count)
+{
+	unsigned int limit = READ_ONCE(remover->mrm_speed_limit);
+	unsigned long window = cfs_time_seconds(1);
+	long delay = 0;
+
+	if (limit == 0 || count == 0)
+		return;
+
+	spin_lock(&remover->mrm_lock);
+	if (time_after_eq(jiffies, remover->mrm_window + window)) {
+		remover->mrm_window = jiffies;
+		remover->mrm_window_count = 0;
+	}
+	remover->mrm_window_count += count;
+	if (remover->mrm_window_count >= limit)
+		delay = remover->mrm_window + window - jiffies;
+	spin_unlock(&remover->mrm_lock);
+
+	if (delay > 0)
+		wait_event_idle_timeout(remover->mrm_waitq,
+					READ_ONCE(remover->mrm_stopping),
+					delay);
+}
+
+/* Remove the regular files @ents under @pobj in one transaction. */
+static int mdd_tree_remove_batch(const struct lu_env *env,
+				 struct mdd_dir_remover *remover,
+				 struct mdd_object *pobj,
+				 struct mdd_remove_ent *ents, int count)
+{
+	struct mdd_device *mdd = mdd_obj2mdd_dev(pobj);
+	struct lu_attr *la = &mdd_env_info(env)->mti_cattr;
+	struct thandle *th;
+	__u64 bytes = 0;
+	int removed = 0;
+	int rc = 0;
+	int i;
+
+	ENTRY;
+
+	for (i = 0; i < count; i++) {
+		struct mdd_remove_ent *mre = &ents[i];
+
+		mre->mre_obj = mdd_object_find(env, mdd, &mre->mre_fid);
+		if (IS_ERR(mre->mre_obj)) {
+			mre->mre_obj = NULL;
+			continue;
+		}
+
+		mre->mre_bytes = 0;
+		mre->mre_nlink = 0;
+		if (mdd_object_exists(mre->mre_obj) &&
+		    mdd_la_get(env, mre->mre_obj, la) == 0) {
+			mre->mre_bytes = la->la_blocks << 9;
+			mre->mre_nlink = la->la_nlink;
+		}
+	}
+
+	th = mdd_trans_create(env, mdd);
+	if (IS_ERR(th)) {
+		rc = PTR_ERR(th);
+		if (rc != -EINPROGRESS)
+			CERROR("%s: cannot get orphan thandle: rc = %d\n",
+			       mdd2obd_dev(mdd)->obd_name, rc);
+		GOTO(out_put, rc);
+	}
+
+	for (i = 0; i < count; i++) {
+		struct mdd_object *obj = ents[i].mre_obj;
+
+		if (obj == NULL)
+			continue;
+
+		rc = mdo_declare_index_delete(env, pobj, ents[i].mre_name, th);
+		if (rc)
+			GOTO(out_stop, rc);
+
+		if (!mdd_object_exists(obj))
+			continue;
+
+		rc = mdo_declare_ref_del(env, obj, th);
+		if (rc)
+			GOTO(out_stop, rc);
+
+		if (ents[i].mre_nlink > 1) {
+			rc = mdo_declare_xattr_set(env, obj,
+					mdd_buf_get_const(env, NULL,
+							  MAX_LINKEA_SIZE),
+					XATTR_NAME_LINK, 0, th);
+			if (rc)
+				GOTO(out_stop, rc);
+			continue;
+		}
+
+		rc = mdo_declare_destroy(env, obj, th);
+		if (rc)
+			GOTO(out_stop, rc);
+	}
+
+	rc = mdd_trans_start(env, mdd, th);
+	if (rc)
+		GOTO(out_stop, rc);
+
+	for (i = 0; i < count; i++) {
+		struct mdd_object *obj = ents[i].mre_obj;
+		struct lu_name lname;
+		int rc2;
+
+		if (obj == NULL)
+			continue;
+
+		mdd_write_lock(env, obj, DT_TGT_CHILD);
+		rc2 = __mdd_index_delete(env, pobj, ents[i].mre_name, 0, th);
+		if (rc2 == 0 && mdd_object_exists(obj))
+			rc2 = mdo_ref_del(env, obj, th);
+		if (rc2 == 0 && mdd_object_exists(obj)) {
+			if (ents[i].mre_nlink <= 1) {
+				rc2 = mdo_destroy(env, obj, th);
+			} else {
+				/*
+				 * Keep the file still linked from outside
+				 * the tree, without the removed name in its
+				 * linkEA as mdd_unlink() does. Old files may
+				 * not have linkEA, ignore the errors.
+				 */
+				lname.ln_name = ents[i].mre_name;
+				lname.ln_namelen = strlen(ents[i].mre_name);
+				mdd_links_rename(env, obj, mdd_object_fid(pobj),
+						 &lname, NULL, NULL, th, NULL,
+						 0, 0);
+			}
+		}
+		mdd_write_unlock(env, obj);
+		if (rc2) {
+			CERROR("%s: failed to remove '%s': rc = %d\n",
+			       mdd2obd_dev(mdd)->obd_name, ents[i].mre_name,
+			       rc2);
+			continue;
+		}
+
+		removed++;
+		if (ents[i].mre_nlink <= 1)
+			bytes += ents[i].mre_bytes;
+	}
+
+out_stop:
+	mdd_trans_stop(env, mdd, 0, th);
+out_put:
+	for (i = 0; i < count; i++) {
+		if (ents[i].mre_obj != NULL)
+			mdd_object_put(env, ents[i].mre_obj);
+	}
+
+	mdd_remover_account(remover, removed, bytes);
+	mdd_remover_throttle(remover, removed);
+	RETURN(rc);
+}
+
+static void mdd_remove_task_add(struct mdd_dir_remover *remover,
+				struct mdd_remove_task *task,
+				struct mdd_remove_task *parent,
+				struct mdd_object *obj, const char *name)
+{
+	task->mrt_obj = obj;
+	task->mrt_parent = parent;
+	atomic_set(&task->mrt_pending, 1);
+	strlcpy(task->mrt_name, name, sizeof(task->mrt_name));
+	if (parent != NULL)
+		atomic_inc(&parent->mrt_pending);
+
+	/* Depth first, to keep the number of the queued tasks small. */
+	spin_lock(&remover->mrm_lock);
+	list_add(&task->mrt_linkage, &remover->mrm_tasks);
+	remover->mrm_dirs_queued++;
+	spin_unlock(&remover->mrm_lock);
+
+	wake_up(&remover->mrm_waitq);
+}
+
+/*
+ * Release @task once its scan or the task of one of its subdirectories is
+ * done. The last release removes the directory and releases the task of its
+ * parent.
+ */
+static void mdd_remove_task_put(const struct lu_env *env,
+				struct mdd_dir_remover *remover,
+				struct mdd_remove_task *task)
+{
+	struct mdd_device *mdd = mdd_remover2mdd(remover);
+	struct lu_attr *la = &mdd_env_info(env)->mti_cattr;
+	struct mdd_remove_task *parent;
+	struct mdd_object *pobj;
+	__u64 bytes;
+	int rc;
+
+	while (task != NULL && atomic_dec_and_test(&task->mrt_pending)) {
+		parent = task->mrt_parent;
+		/* Left to the orphan cleanup on the next start. */
+		if (READ_ONCE(remover->mrm_stopping))
+			goto free;
+
+		bytes = 0;
+		if (mdd_la_get(env, task->mrt_obj, la) == 0)
+			bytes = la->la_blocks << 9;
+
+		pobj = parent != NULL ? parent->mrt_obj : remover->mrm_root;
+		rc = mdd_tree_remove_one(env, mdd, pobj,
+					 mdd_object_fid(task->mrt_obj),
+					 task->mrt_name, true);
+		if (rc) {
+			CERROR("%s: failed to remove directory '%s' "DFID": rc = %d\n",
+			       mdd2obd_dev(mdd)->obd_name, task->mrt_name,
+			       PFID(mdd_object_fid(task->mrt_obj)), rc);
+		} else {
+			mdd_remover_account(remover, 1, bytes);
+			mdd_remover_throttle(remover, 1);
+		}
+
+		if (parent == NULL) {
+			spin_lock(&remover->mrm_lock);
+			remover->mrm_subtrees_removed++;
+			spin_unlock(&remover->mrm_lock);
+		}
+free:
+		mdd_object_put(env, task->mrt_obj);
+		OBD_FREE_PTR(task);
+		task = parent;
+	}
+}
+
+/*
+ * Scan the directory of @task, remove its regular files and queue its
+ * subdirectories as new tasks.
+ */
+static int mdd_remove_task_scan(const struct lu_env *env,
+				struct mdd_dir_remover *remover,
+				struct mdd_remove_task *task,
+				struct mdd_remove_ent *ents)
+{
+	struct mdd_device *mdd = mdd_remover2mdd(remover);
+	struct lu_dirent *ent = &mdd_env_info(env)->mti_ent;
+	struct dt_object *obj = mdd_object_child(task->mrt_obj);
+	const struct dt_it_ops *iops;
+	struct dt_it *it;
+	int count = 0;
+	__u16 type;
+	int rc;
+
+	ENTRY;
+
+	CDEBUG(D_INODE, "Scan directory '%s' "DFID" to remove\n",
+	       task->mrt_name, PFID(mdd_object_fid(task->mrt_obj)));
+
+	if (!dt_try_as_dir(env, obj))
+		RETURN(-ENOTDIR);
+
+	iops = &obj->do_index_ops->dio_it;
+	it = iops->init(env, obj, LUDA_64BITHASH | LUDA_TYPE);
+	if (IS_ERR(it))
+		RETURN(PTR_ERR(it));
+
+	rc = iops->load(env, it, 0);
+	if (rc == 0)
+		rc = iops->next(env, it);
+	else if (rc > 0)
+		rc = 0;
+
+	while (rc == 0) {
+		struct mdd_remove_task *sub;
+		struct mdd_object *child;
+
+		if (READ_ONCE(remover->mrm_stopping))
+			GOTO(out_put, rc = -ESHUTDOWN);
+
+		rc = iops->rec(env, it, (struct dt_rec *)ent,
+			       LUDA_64BITHASH | LUDA_TYPE);
+		if (rc == 0)
+			rc = mdd_unpack_ent(ent, &type);
+		if (rc) {
+			CERROR("%s: failed to iterate backend: rc = %d\n",
+			       mdd2obd_dev(mdd)->obd_name, rc);
+			goto next;
+		}
+
+		/* skip dot and dotdot entries */
+		if (name_is_dot_or_dotdot(ent->lde_name, ent->lde_namelen))
+			goto next;
+
+		if (!fid_seq_in_fldb(fid_seq(&ent->lde_fid)))
+			goto next;
+
+		if (S_ISDIR(type)) {
+			OBD_ALLOC_PTR(sub);
+			if (sub == NULL)
+				GOTO(out_put, rc = -ENOMEM);
+
+			child = mdd_object_find(env, mdd, &ent->lde_fid);
+			if (IS_ERR(child)) {
+				OBD_FREE_PTR(sub);
+				CERROR("%s: cannot find directory '%s' "DFID": rc = %ld\n",
+				       mdd2obd_dev(mdd)->obd_name,
+				       ent->lde_name, PFID(&ent->lde_fid),
+				       PTR_ERR(child));
+				goto next;
+			}
+
+			mdd_remove_task_add(remover, sub, task, child,
+					    ent->lde_name);
+			goto next;
+		}
+
+		ents[count].mre_fid = ent->lde_fid;
+		strlcpy(ents[count].mre_name, ent->lde_name,
+			sizeof(ents[count].mre_name));
+		if (++count == MDD_TREE_REMOVE_BATCH) {
+			mdd_tree_remove_batch(env, remover, task->mrt_obj,
+					      ents, count);
+			count = 0;
+		}
+next:
+		rc = iops->next(env, it);
+	}
+
+	if (rc > 0)
+		rc = 0;
+out_put:
+	iops->put(env, it);
+	iops->fini(env, it);
+
+	if (count > 0 && rc != -ESHUTDOWN)
+		mdd_tree_remove_batch(env, remover, task->mrt_obj, ents, count);
+
+	RETURN(rc);
+}
+
 void mdd_remove_item_add(struct mdd_object *obj)
 {
 	struct mdd_device *mdd = mdd_obj2mdd_dev(obj);
@@ -311,66 +701,105 @@ void mdd_remove_item_add(struct mdd_object *obj)
 	mdd_object_get(obj);
 	LASSERT(list_empty(&obj->mod_remove_item));
 	list_add_tail(&obj->mod_remove_item, &remover->mrm_list);
+	remover->mrm_subtrees_queued++;
 	CDEBUG(D_INFO, "add "DFID" into asynchonous removal list.\n",
 	       PFID(mdd_object_fid(obj)));
 	spin_unlock(&remover->mrm_lock);
 
-	wake_up_process(remover->mrm_task);
+	wake_up(&remover->mrm_waitq);
 }
 
-static int mdd_tree_remove_background(struct lu_env *env,
-				      struct mdd_device *mdd,
-				      struct mdd_dir_remover *remover)
+static inline bool mdd_remover_has_work(struct mdd_dir_remover *remover)
 {
-	struct mdd_object *obj = NULL;
-	struct mdd_thread_info *info = mdd_env_info(env);
-	char *name = info->mti_fidname;
-	int rc;
+	return !list_empty(&remover->mrm_tasks) ||
+	       !list_empty(&remover->mrm_list);
+}
 
-	ENTRY;
+/*
+ * Take the next directory to scan. The subdirectories of the subtrees being
+ * removed are taken first, then a new subtree is started.
+ */
+static struct mdd_remove_task *
+mdd_remove_task_get(struct mdd_dir_remover *remover)
+{
+	struct mdd_remove_task *task = NULL;
+	struct mdd_object *obj = NULL;
+	char name[FID_LEN + 2];
 
 	spin_lock(&remover->mrm_lock);
-	if (!list_empty(&remover->mrm_list)) {
-		obj = list_entry(remover->mrm_list.next, typeof(*obj),
-				 mod_remove_item);
+	if (!list_empty(&remover->mrm_tasks)) {
+		task = list_first_entry(&remover->mrm_tasks,
+					struct mdd_remove_task, mrt_linkage);
+		list_del_init(&task->mrt_linkage);
+		remover->mrm_dirs_queued--;
+	} else if (!list_empty(&remover->mrm_list)) {
+		obj = list_first_entry(&remover->mrm_list, struct mdd_object,
+				       mod_remove_item);
 		list_del_init(&obj->mod_remove_item);
+		remover->mrm_subtrees_queued--;
 	}
 	spin_unlock(&remover->mrm_lock);
 
-	if (!obj)
-		RETURN(0);
+	if (obj == NULL)
+		return task;
 
 	LASSERT(obj->mod_flags & REMOVED_OBJ);
-	snprintf(name, sizeof(info->mti_fidname), DFID_NOBRACE,
-		 PFID(mdd_object_fid(obj)));
-	rc = mdd_tree_remove(env, remover->mrm_root, obj, name);
-	if (rc)
-		CERROR("%s: failed to remove subtree FID %s: rc = %d\n",
-		       mdd2obd_dev(mdd)->obd_name, name, rc);
+	OBD_ALLOC_PTR(task);
+	if (task == NULL) {
+		spin_lock(&remover->mrm_lock);
+		list_add_tail(&obj->mod_remove_item, &remover->mrm_list);
+		remover->mrm_subtrees_queued++;
+		spin_unlock(&remover->mrm_lock);
+		return ERR_PTR(-ENOMEM);
+	}
 
-	mdd_object_put(env, obj);
-	RETURN(rc);
+	/* The removed directory is named by its FID in PENDING. */
+	snprintf(name, sizeof(name), DFID_NOBRACE, PFID(mdd_object_fid(obj)));
+	CDEBUG(D_INODE, "Subtree removal for directory '%s'\n", name);
+	task->mrt_obj = obj;
+	atomic_set(&task->mrt_pending, 1);
+	strlcpy(task->mrt_name, name, sizeof(task->mrt_name));
+	INIT_LIST_HEAD(&task->mrt_linkage);
+
+	return task;
 }
 
 static int mdd_remover_main(void *args)
 {
-	struct mdd_device *mdd = (struct mdd_device *)args;
-	struct mdd_dir_remover *remover = &mdd->mdd_remover;
-	struct lu_env *env = &remover->mrm_env;
+	struct mdd_remover_thread *thread = args;
+	struct mdd_dir_remover *remover = thread->mrth_remover;
+	struct lu_env *env = &thread->mrth_env;
+	struct mdd_remove_task *task;
+	int rc;
 
 	ENTRY;
 
-	while (({set_current_state(TASK_IDLE);
-		 !kthread_should_stop(); })) {
-		if (!list_empty(&remover->mrm_list)) {
-			__set_current_state(TASK_RUNNING);
-			mdd_tree_remove_background(env, mdd, remover);
-			cond_resched();
-		} else {
-			schedule();
+	while (!kthread_should_stop()) {
+		wait_event_idle(remover->mrm_waitq,
+				mdd_remover_has_work(remover) ||
+				kthread_should_stop());
+
+		task = mdd_remove_task_get(remover);
+		if (IS_ERR(task)) {
+			wait_event_idle_timeout(remover->mrm_waitq,
+						kthread_should_stop(),
+						cfs_time_seconds(1));
+			continue;
 		}
+		if (task == NULL)
+			continue;
+
+		rc = mdd_remove_task_scan(env, remover, task,
+					  thread->mrth_ents);
+		if (rc < 0 && rc != -ESHUTDOWN)
+			CERROR("%s: failed to scan directory '%s' "DFID": rc = %d\n",
+			       mdd2obd_dev(mdd_remover2mdd(remover))->obd_name,
+			       task->mrt_name,
+			       PFID(mdd_object_fid(task->mrt_obj)), rc);
+
+		mdd_remove_task_put(env, remover, task);
+		cond_resched();
 	}
-	__set_current_state(TASK_RUNNING);
 
 	RETURN(0);
 }
@@ -380,24 +809,17 @@ int mdd_remover_init(const struct lu_env *env, struct mdd_device *mdd)
 	struct mdd_dir_remover *remover = &mdd->mdd_remover;
 	struct task_struct *task;
 	struct md_object *mdo;
-	char *name = NULL;
-	int rc;
+	int nthreads;
+	int rc = 0;
+	int i;
 
 	ENTRY;
 
 	spin_lock_init(&remover->mrm_lock);
 	INIT_LIST_HEAD(&remover->mrm_list);
-
-	rc = lu_env_init(&remover->mrm_env, LCT_MD_THREAD);
-	if (rc)
-		RETURN(rc);
-
-	OBD_ALLOC(name, MTI_NAME_MAXLEN);
-	if (name == NULL)
-		GOTO(err, rc = -ENOMEM);
-
-	snprintf(name, MTI_NAME_MAXLEN, "mdd_remover_%s",
-		 mdd2obd_dev(mdd)->obd_name);
+	INIT_LIST_HEAD(&remover->mrm_tasks);
+	init_waitqueue_head(&remover->mrm_waitq);
+	remover->mrm_window = jiffies;
 
 	mdo = mdo_locate(env, &mdd->mdd_md_dev,
 			 lu_object_fid(&mdd->mdd_orphans->do_lu));
@@ -405,44 +827,87 @@ int mdd_remover_init(const struct lu_env *env, struct mdd_device *mdd)
 		rc = PTR_ERR(mdo);
 		CERROR("%s: cannot locate Orphan object: rc = %d.\n",
 		       mdd2obd_dev(mdd)->obd_name, rc);
-		GOTO(err, rc);
+		RETURN(rc);
 	}
 
 	LASSERT(lu_object_exists(&mdo->mo_lu));
 	remover->mrm_root = md2mdd_obj(mdo);
-	task = kthread_create(mdd_remover_main, mdd, name);
-	if (IS_ERR(task)) {
-		rc = PTR_ERR(task);
-		CERROR("%s: cannot start dir subtree remove thread: rc = %d\n",
-		       mdd2obd_dev(mdd)->obd_name, rc);
-		GOTO(err_put, rc);
+
+	nthreads = clamp_t(unsigned int, tree_remove_threads, 1,
+			   MDD_TREE_REMOVE_THREADS_MAX);
+	OBD_ALLOC_PTR_ARRAY(remover->mrm_threads, nthreads);
+	if (remover->mrm_threads == NULL)
+		GOTO(err, rc = -ENOMEM);
+
+	for (i = 0; i < nthreads; i++) {
+		struct mdd_remover_thread *thread = &remover->mrm_threads[i];
+
+		thread->mrth_remover = remover;
+		OBD_ALLOC_PTR_ARRAY_LARGE(thread->mrth_ents,
+					  MDD_TREE_REMOVE_BATCH);
+		if (thread->mrth_ents == NULL)
+			GOTO(err, rc = -ENOMEM);
+
+		rc = lu_env_init(&thread->mrth_env, LCT_MD_THREAD);
+		if (rc) {
+			OBD_FREE_PTR_ARRAY_LARGE(thread->mrth_ents,
+						 MDD_TREE_REMOVE_BATCH);
+			GOTO(err, rc);
+		}
+
+		task = kthread_run(mdd_remover_main, thread,
+				   "mdd_remover_%s_%02d",
+				   mdd2obd_dev(mdd)->obd_name, i);
+		if (IS_ERR(task)) {
+			rc = PTR_ERR(task);
+			lu_env_fini(&thread->mrth_env);
+			OBD_FREE_PTR_ARRAY_LARGE(thread->mrth_ents,
+						 MDD_TREE_REMOVE_BATCH);
+			CERROR("%s: cannot start dir subtree remove thread: rc = %d\n",
+			       mdd2obd_dev(mdd)->obd_name, rc);
+			GOTO(err, rc);
+		}
+
+		thread->mrth_task = task;
+		remover->mrm_nthreads++;
 	}
-	remover->mrm_task = task;
-	wake_up_process(task);
 
-	OBD_FREE(name, MTI_NAME_MAXLEN);
 	RETURN(0);
 
-err_put:
-	mdd_object_put(env, remover->mrm_root);
-	remover->mrm_root = NULL;
 err:
-	if (name)
-		OBD_FREE(name, MTI_NAME_MAXLEN);
-	lu_env_fini(&remover->mrm_env);
+	mdd_remover_fini(env, mdd);
 	RETURN(rc);
 }
 
 void mdd_remover_fini(const struct lu_env *env, struct mdd_device *mdd)
 {
 	struct mdd_dir_remover *remover = &mdd->mdd_remover;
+	struct mdd_remove_task *task;
 	struct mdd_object *obj, *next;
+	int i;
 
-	if (!remover->mrm_task)
-		return;
+	WRITE_ONCE(remover->mrm_stopping, true);
+	wake_up_all(&remover->mrm_waitq);
+
+	for (i = 0; i < remover->mrm_nthreads; i++) {
+		struct mdd_remover_thread *thread = &remover->mrm_threads[i];
 
-	kthread_stop(remover->mrm_task);
-	remover->mrm_task = NULL;
+		kthread_stop(thread->mrth_task);
+		lu_env_fini(&thread->mrth_env);
+		OBD_FREE_PTR_ARRAY_LARGE(thread->mrth_ents,
+					 MDD_TREE_REMOVE_BATCH);
+	}
+
+	/*
+	 * The subtrees not removed completely are still in PENDING, they are
+	 * removed after the next start.
+	 */
+	while (!list_empty(&remover->mrm_tasks)) {
+		task = list_first_entry(&remover->mrm_tasks,
+					struct mdd_remove_task, mrt_linkage);
+		list_del_init(&task->mrt_linkage);
+		mdd_remove_task_put(env, remover, task);
+	}
 
 	list_for_each_entry_safe(obj, next, &remover->mrm_list,
 				 mod_remove_item) {
@@ -450,10 +915,15 @@ void mdd_remover_fini(const struct lu_env *env, struct mdd_device *mdd)
 		mdd_object_put(env, obj);
 	}
 
-	lu_env_fini(&remover->mrm_env);
+	if (remover->mrm_threads != NULL) {
+		OBD_FREE_PTR_ARRAY(remover->mrm_threads,
+				   clamp_t(unsigned int, tree_remove_threads, 1,
+					   MDD_TREE_REMOVE_THREADS_MAX));
+		remover->mrm_threads = NULL;
+	}
+	remover->mrm_nthreads = 0;
 
 	if (remover->mrm_root) {
-		printk("PUT root\n");
 		mdd_object_put(env, remover->mrm_root);
 		remover->mrm_root = NULL;
 	}
@@ -36,6 +36,7 @@
 #define DEBUG_SUBSYSTEM S_MDS
 
 #include <linux/module.h>
+#include <linux/kthread.h>
 
 #include <lustre_mds.h>
 #include "mdt_internal.h"
@@ -54,6 +55,9 @@ static int mdt_batch_pack_repmsg(struct mdt_thread_info *info, __u32 opc)
 	if (opc == BUT_GETATTR)
 		return 0;
 
+	if (req_capsule_has_field(pill, &RMF_ACL, RCL_SERVER))
+		req_capsule_set_size(pill, &RMF_ACL, RCL_SERVER, 0);
+
 	if (req_capsule_has_field(pill, &RMF_MDT_MD, RCL_SERVER)) {
 		if (S_ISREG(info->mti_attr.ma_attr.la_mode))
 			req_capsule_set_size(pill, &RMF_MDT_MD, RCL_SERVER,
@@ -96,6 +100,52 @@ static void mdt_ldlm_lock_cancel(struct mdt_thread_info *info)
 	LDLM_LOCK_PUT(lock);
 }
 
+/* Pack the reply of a create sub request for the created @child. */
+static int mdt_create_reply(struct mdt_thread_info *info,
+			    struct mdt_object *child)
+{
+	struct md_attr *ma = &info->mti_attr;
+	struct mdt_body *repbody;
+	int rc;
+
+	repbody = req_capsule_server_get(info->mti_pill, &RMF_MDT_BODY);
+	LASSERT(repbody != NULL);
+
+	if (md_should_create(info->mti_spec.sp_cr_flags))
+		mdt_prep_ma_buf_from_rep(info, child, ma);
+
+	rc = mdt_attr_get_complex(info, child, ma);
+	if (rc)
+		return rc;
+
+	if (ma->ma_valid & MA_LOV) {
+		LASSERT(ma->ma_lmm_size != 0);
+		repbody->mbo_eadatasize = ma->ma_lmm_size;
+		if (S_ISREG(ma->ma_attr.la_mode))
+			repbody->mbo_valid |= OBD_MD_FLEASIZE;
+		else if (S_ISDIR(ma->ma_attr.la_mode))
+			repbody->mbo_valid |= OBD_MD_FLDIREA;
+	}
+
+	if (ma->ma_valid & MA_LMV) {
+		LASSERT(ma->ma_lmv_size != 0);
+		repbody->mbo_eadatasize = ma->ma_lmv_size;
+		LASSERT(S_ISDIR(ma->ma_attr.la_mode));
+		repbody->mbo_valid |= OBD_MD_FLDIREA | OBD_MD_MEA;
+	}
+
+	if (ma->ma_valid & MA_LMV_DEF) {
+		LASSERT(S_ISDIR(ma->ma_attr.la_mode));
+		repbody->mbo_valid |= OBD_MD_FLDIREA | OBD_MD_DEFAULT_MEA;
+	}
+
+	/* Return fid & attr to client. */
+	if (ma->ma_valid & MA_INODE)
+		mdt_pack_attr2body(info, repbody, &ma->ma_attr,
+				   mdt_object_fid(child));
+	return 0;
+}
+
 static int mdt_create_lockless(struct tgt_session_info *tsi)
 {
 	struct mdt_thread_info *info = mdt_th_info(tsi->tsi_env);
@@ -104,7 +154,6 @@ static int mdt_create_lockless(struct tgt_session_info *tsi)
 	struct mdt_reint_record *rr = &info->mti_rr;
 	struct mdt_object *parent;
 	struct mdt_object *child;
-	struct mdt_body *repbody;
 	int rc, rc2;
 
 	ENTRY;
@@ -112,263 +161,1554 @@ static int mdt_create_lockless(struct tgt_session_info *tsi)
 	if (!fid_is_md_operative(rr->rr_fid1))
 		RETURN(-EPERM);
 
-	repbody = req_capsule_server_get(info->mti_pill, &RMF_MDT_BODY);
-	LASSERT(repbody != NULL);
-
 	parent = mdt_object_find(info->mti_env, info->mti_mdt, rr->rr_fid1);
 	if (IS_ERR(parent))
 		RETURN(PTR_ERR(parent));
 
-	if (!mdt_object_exists(parent))
-		GOTO(put_parent, rc = -ENOENT);
+	if (!mdt_object_exists(parent))
+		GOTO(put_parent, rc = -ENOENT);
+
+	child = mdt_object_new(info->mti_env, mdt, rr->rr_fid2);
+	if (unlikely(IS_ERR(child)))
+		GOTO(put_parent, rc = PTR_ERR(child));
+
+	ma->ma_need = MA_INODE;
+	ma->ma_valid = 0;
+
+	/*
+	 * Do not perform lookup sanity check. We know that name does
+	 * not exist.
+	 */
+	info->mti_spec.sp_cr_lookup = 0;
+	info->mti_spec.sp_feat = &dt_directory_features;
+
+	rc = mdo_create(info->mti_env, mdt_object_child(parent), &rr->rr_name,
+			mdt_object_child(child), &info->mti_spec, ma);
+	if (rc < 0)
+		GOTO(put_child, rc);
+
+	rc = mdt_create_reply(info, child);
+
+put_child:
+	mdt_object_put(info->mti_env, child);
+put_parent:
+	mdt_object_put(info->mti_env, parent);
+	mdt_client_compatibility(info);
+
+	rc2 = mdt_fix_reply(info);
+	if (rc == 0)
+		rc = rc2;
+	RETURN(rc);
+}
+
+static int mdt_create_exlock(struct tgt_session_info *tsi)
+{
+	struct mdt_thread_info *info = mdt_th_info(tsi->tsi_env);
+	struct req_capsule *pill = &info->mti_sub_pill;
+	int rc;
+
+	ENTRY;
+
+	rc = ldlm_handle_enqueue(info->mti_exp->exp_obd->obd_namespace,
+				 pill, info->mti_dlm_req, &mdt_dlm_cbs);
+	if (rc)
+		RETURN(rc);
+
+	rc = mdt_create_lockless(tsi);
+	if (rc)
+		mdt_ldlm_lock_cancel(info);
+
+	RETURN(rc);
+}
+
+static int mdt_setattr_lockless(struct tgt_session_info *tsi)
+{
+	struct mdt_thread_info *info = mdt_th_info(tsi->tsi_env);
+	struct mdt_device *mdt = info->mti_mdt;
+	struct md_attr *ma = &info->mti_attr;
+	struct mdt_reint_record *rr = &info->mti_rr;
+	struct mdt_object *mo;
+	int rc, rc2;
+
+	ENTRY;
+	CDEBUG(D_INODE, "setattr "DFID" %x", PFID(rr->rr_fid1),
+	       (unsigned int)ma->ma_attr.la_valid);
+
+	mo = mdt_object_find(info->mti_env, mdt, rr->rr_fid1);
+	if (IS_ERR(mo))
+		RETURN(PTR_ERR(mo));
+
+	if (!mdt_object_exists(mo))
+		GOTO(out_put, rc = -ENOENT);
+
+	if (mdt_object_remote(mo))
+		GOTO(out_put, rc = -EREMOTE);
+
+	ma->ma_enable_chprojid_gid = mdt->mdt_enable_chprojid_gid;
+	if (ma->ma_attr.la_valid & LA_SIZE || rr->rr_flags & MRF_OPEN_TRUNC) {
+		/* Check write access for the O_TRUNC case */
+		if (mdt_write_read(mo) < 0)
+			GOTO(out_put, rc = -ETXTBSY);
+
+		/* LU-10286: compatibility check for FLR.
+		 * Please check the comment in mdt_finish_open() for details
+		 */
+		if (!exp_connect_flr(info->mti_exp) ||
+		    !exp_connect_overstriping(info->mti_exp)) {
+			rc = mdt_big_xattr_get(info, mo, XATTR_NAME_LOV);
+			if (rc < 0 && rc != -ENODATA)
+				GOTO(out_put, rc);
+
+			if (!exp_connect_flr(info->mti_exp)) {
+				if (rc > 0 &&
+				    mdt_lmm_is_flr(info->mti_big_lmm))
+					GOTO(out_put, rc = -EOPNOTSUPP);
+			}
+
+			if (!exp_connect_overstriping(info->mti_exp)) {
+				if (rc > 0 &&
+				    mdt_lmm_is_overstriping(info->mti_big_lmm))
+					GOTO(out_put, rc = -EOPNOTSUPP);
+			}
+		}
+
+		/* For truncate, the file size sent from client
+		 * is believable, but the blocks are incorrect,
+		 * which makes the block size in LSOM attribute
+		 * inconsisent with the real block size.
+		 */
+		rc = mdt_lsom_update(info, mo, true);
+		if (rc)
+			GOTO(out_put, rc);
+	}
+
+	if ((ma->ma_valid & MA_INODE) && ma->ma_attr.la_valid) {
+		if (ma->ma_valid & MA_LOV)
+			GOTO(out_put, rc = -EPROTO);
+
+		/*
+		 * FIXME: MDT supports FMD for regular files due to
+		 * Data-on-MDT
+		 */
+
+		/* all attrs are packed into mti_attr in unpack_setattr */
+		rc = mo_attr_set(info->mti_env, mdt_object_child(mo), ma);
+		if (rc)
+			GOTO(out_put, rc);
+	}
+
+	/* If file data is modified, add the dirty flag */
+	if (ma->ma_attr_flags & MDS_DATA_MODIFIED)
+		rc = mdt_add_dirty_flag(info, mo, ma);
+
+out_put:
+	mdt_object_put(info->mti_env, mo);
+	mdt_client_compatibility(info);
+	rc2 = mdt_fix_reply(info);
+	if (rc == 0)
+		rc = rc2;
+	RETURN(rc);
+}
+
+static int mdt_setattr_exlock(struct tgt_session_info *tsi)
+{
+	struct mdt_thread_info *info = mdt_th_info(tsi->tsi_env);
+	struct req_capsule *pill = &info->mti_sub_pill;
+	int rc;
+
+	ENTRY;
+
+	rc = ldlm_handle_enqueue(info->mti_exp->exp_obd->obd_namespace,
+				 pill, info->mti_dlm_req, &mdt_dlm_cbs);
+	if (rc)
+		RETURN(rc);
+
+	rc = mdt_setattr_lockless(tsi);
+	if (rc)
+		mdt_ldlm_lock_cancel(info);
+
+	RETURN(rc);
+}
+
+static int mdt_exlock_only(struct tgt_session_info *tsi)
+{
+	struct mdt_thread_info *info = mdt_th_info(tsi->tsi_env);
+	struct req_capsule *pill = &info->mti_sub_pill;
+	int rc;
+
+	ENTRY;
+
+	rc = ldlm_handle_enqueue(info->mti_exp->exp_obd->obd_namespace,
+				 pill, info->mti_dlm_req, &mdt_dlm_cbs);
+
+	RETURN(rc);
+}
+
+static bool mdt_wbc_exlock_granted(struct mdt_thread_info *info,
+				   struct mdt_object *obj)
+{
+	struct ldlm_res_id res_id;
+	struct ldlm_resource *res;
+	struct ldlm_lock *lock;
+	bool granted = false;
+
+	fid_build_reg_res_name(mdt_object_fid(obj), &res_id);
+	res = ldlm_resource_get(info->mti_mdt->mdt_namespace, NULL, &res_id,
+				LDLM_IBITS, 0);
+	if (IS_ERR(res))
+		return false;
+
+	lock_res(res);
+	list_for_each_entry(lock, &res->lr_granted, l_res_link) {
+		if (lock->l_export == info->mti_exp &&
+		    lock->l_granted_mode == LCK_EX &&
+		    lock->l_policy_data.l_inodebits.bits &
+		    MDS_INODELOCK_UPDATE) {
+			granted = true;
+			break;
+		}
+	}
+	unlock_res(res);
+	ldlm_resource_putref(res);
+
+	return granted;
+}
+
+/*
+ * The namespace sub requests below are only sent by the client holding the
+ * WBC EX lock on the directories involved, so no DLM locks are taken here.
+ * The lock is verified to be granted to the client on each parent, otherwise
+ * the update may race with the operations of the other clients. The lock of
+ * a remote parent is held on its own MDT and can not be verified here, thus
+ * the update is rejected.
+ */
+static int mdt_wbc_exlock_check(struct mdt_thread_info *info,
+				struct mdt_object *dir)
+{
+	ENTRY;
+
+	/* The locks are replayed after the requests during recovery. */
+	if (req_is_replay(mdt_info_req(info)))
+		RETURN(0);
+
+	if (mdt_object_remote(dir)) {
+		CDEBUG(D_DLMTRACE, "%s: WBC EX lock on remote "DFID" for %s\n",
+		       mdt_obd_name(info->mti_mdt),
+		       PFID(mdt_object_fid(dir)),
+		       obd_export_nid2str(info->mti_exp));
+		RETURN(-EREMOTE);
+	}
+
+	if (!mdt_wbc_exlock_granted(info, dir)) {
+		CDEBUG(D_DLMTRACE, "%s: no WBC EX lock on "DFID" for %s\n",
+		       mdt_obd_name(info->mti_mdt),
+		       PFID(mdt_object_fid(dir)),
+		       obd_export_nid2str(info->mti_exp));
+		RETURN(-ENOLCK);
+	}
+
+	RETURN(0);
+}
+
+/*
+ * The sub requests updating an object by FID carry no parent. The object is
+ * covered by the WBC EX lock either on itself, as a directory flushed in
+ * lock_keep mode is, or on one of its parents found in the linkEA.
+ */
+static int mdt_wbc_exlock_check_obj(struct mdt_thread_info *info,
+				    struct mdt_object *obj)
+{
+	struct lu_buf *buf = &info->mti_big_buf;
+	struct linkea_data ldata = { NULL };
+	struct lu_name *lname = &info->mti_name;
+	struct mdt_object *parent;
+	struct lu_fid pfid;
+	int rc;
+
+	ENTRY;
+
+	if (req_is_replay(mdt_info_req(info)) ||
+	    mdt_wbc_exlock_granted(info, obj))
+		RETURN(0);
+
+	buf = lu_buf_check_and_alloc(buf, MAX_LINKEA_SIZE);
+	if (buf->lb_buf == NULL)
+		RETURN(-ENOMEM);
+
+	ldata.ld_buf = buf;
+	rc = mdt_links_read(info, obj, &ldata);
+	if (rc)
+		GOTO(out, rc = (rc == -ENOENT || rc == -ENODATA) ?
+			  -ENOLCK : rc);
+
+	rc = -ENOLCK;
+	for (linkea_first_entry(&ldata); ldata.ld_lee && rc == -ENOLCK;
+	     linkea_next_entry(&ldata)) {
+		linkea_entry_unpack(ldata.ld_lee, &ldata.ld_reclen, lname,
+				    &pfid);
+
+		parent = mdt_object_find(info->mti_env, info->mti_mdt, &pfid);
+		if (IS_ERR(parent))
+			continue;
+
+		if (mdt_object_exists(parent) && !mdt_object_remote(parent) &&
+		    mdt_wbc_exlock_granted(info, parent))
+			rc = 0;
+		mdt_object_put(info->mti_env, parent);
+	}
+
+out:
+	if (rc == -ENOLCK)
+		CDEBUG(D_DLMTRACE, "%s: no WBC EX lock over "DFID" for %s\n",
+		       mdt_obd_name(info->mti_mdt),
+		       PFID(mdt_object_fid(obj)),
+		       obd_export_nid2str(info->mti_exp));
+	RETURN(rc);
+}
+
+static int mdt_unlink_lockless(struct tgt_session_info *tsi)
+{
+	struct mdt_thread_info *info = mdt_th_info(tsi->tsi_env);
+	struct mdt_device *mdt = info->mti_mdt;
+	struct md_attr *ma = &info->mti_attr;
+	struct mdt_reint_record *rr = &info->mti_rr;
+	struct lu_fid *child_fid = &info->mti_tmp_fid1;
+	struct mdt_object *parent;
+	struct mdt_object *child;
+	int rc, rc2;
+
+	ENTRY;
+	CDEBUG(D_INODE, "unlink "DFID"/"DNAME"\n", PFID(rr->rr_fid1),
+	       PNAME(&rr->rr_name));
+
+	if (!fid_is_md_operative(rr->rr_fid1))
+		RETURN(-EPERM);
+
+	parent = mdt_object_find(info->mti_env, mdt, rr->rr_fid1);
+	if (IS_ERR(parent))
+		RETURN(PTR_ERR(parent));
+
+	if (!mdt_object_exists(parent))
+		GOTO(put_parent, rc = -ENOENT);
+
+	rc = mdt_wbc_exlock_check(info, parent);
+	if (rc)
+		GOTO(put_parent, rc);
+
+	fid_zero(child_fid);
+	rc = mdo_lookup(info->mti_env, mdt_object_child(parent),
+			&rr->rr_name, child_fid, &info->mti_spec);
+	if (rc)
+		GOTO(put_parent, rc);
+
+	/* The name may be reused by another object in the meantime. */
+	if (fid_is_sane(rr->rr_fid2) && !lu_fid_eq(child_fid, rr->rr_fid2))
+		GOTO(put_parent, rc = -ESTALE);
+
+	if (!fid_is_md_operative(child_fid))
+		GOTO(put_parent, rc = -EPERM);
+
+	child = mdt_object_find(info->mti_env, mdt, child_fid);
+	if (IS_ERR(child))
+		GOTO(put_parent, rc = PTR_ERR(child));
+
+	if (mdt_object_remote(child))
+		GOTO(put_child, rc = -EREMOTE);
+
+	ma->ma_need = MA_INODE;
+	ma->ma_valid = 0;
+
+	mutex_lock(&child->mot_lov_mutex);
+	rc = mdo_unlink(info->mti_env, mdt_object_child(parent),
+			mdt_object_child(child), &rr->rr_name, ma, 0);
+	mutex_unlock(&child->mot_lov_mutex);
+	if (rc)
+		GOTO(put_child, rc);
+
+	if (!lu_object_is_dying(&child->mot_header)) {
+		rc = mdt_attr_get_complex(info, child, ma);
+		if (rc)
+			GOTO(put_child, rc);
+	} else if (mdt_dom_check_for_discard(info, child)) {
+		mdt_dom_discard_data(info, child);
+	}
+	mdt_handle_last_unlink(info, child, ma);
+
+put_child:
+	mdt_object_put(info->mti_env, child);
+put_parent:
+	mdt_object_put(info->mti_env, parent);
+	mdt_client_compatibility(info);
+	rc2 = mdt_fix_reply(info);
+	if (rc == 0)
+		rc = rc2;
+	RETURN(rc);
+}
+
+static int mdt_rename_lockless(struct tgt_session_info *tsi)
+{
+	struct mdt_thread_info *info = mdt_th_info(tsi->tsi_env);
+	struct mdt_device *mdt = info->mti_mdt;
+	struct md_attr *ma = &info->mti_attr;
+	struct mdt_reint_record *rr = &info->mti_rr;
+	struct lu_fid *old_fid = &info->mti_tmp_fid1;
+	struct lu_fid *new_fid = &info->mti_tmp_fid2;
+	struct lustre_handle rename_lh = { 0 };
+	struct mdt_object *msrcdir;
+	struct mdt_object *mtgtdir;
+	struct mdt_object *mold;
+	struct mdt_object *mnew = NULL;
+	int rc, rc2;
+
+	ENTRY;
+	CDEBUG(D_INODE, "rename "DFID"/"DNAME" to "DFID"/"DNAME"\n",
+	       PFID(rr->rr_fid1), PNAME(&rr->rr_name),
+	       PFID(rr->rr_fid2), PNAME(&rr->rr_tgt_name));
+
+	if (!fid_is_md_operative(rr->rr_fid1) ||
+	    !fid_is_md_operative(rr->rr_fid2))
+		RETURN(-EPERM);
+
+	msrcdir = mdt_object_find(info->mti_env, mdt, rr->rr_fid1);
+	if (IS_ERR(msrcdir))
+		RETURN(PTR_ERR(msrcdir));
+
+	if (!mdt_object_exists(msrcdir))
+		GOTO(put_srcdir, rc = -ENOENT);
+
+	if (mdt_object_remote(msrcdir))
+		GOTO(put_srcdir, rc = -EREMOTE);
+
+	mtgtdir = mdt_object_find(info->mti_env, mdt, rr->rr_fid2);
+	if (IS_ERR(mtgtdir))
+		GOTO(put_srcdir, rc = PTR_ERR(mtgtdir));
+
+	if (!mdt_object_exists(mtgtdir))
+		GOTO(put_tgtdir, rc = -ENOENT);
+
+	if (mdt_object_remote(mtgtdir))
+		GOTO(put_tgtdir, rc = -EREMOTE);
+
+	rc = mdt_wbc_exlock_check(info, msrcdir);
+	if (rc == 0 && mtgtdir != msrcdir)
+		rc = mdt_wbc_exlock_check(info, mtgtdir);
+	if (rc)
+		GOTO(put_tgtdir, rc);
+
+	fid_zero(old_fid);
+	rc = mdo_lookup(info->mti_env, mdt_object_child(msrcdir),
+			&rr->rr_name, old_fid, &info->mti_spec);
+	if (rc)
+		GOTO(put_tgtdir, rc);
+
+	if (lu_fid_eq(old_fid, rr->rr_fid1) || lu_fid_eq(old_fid, rr->rr_fid2))
+		GOTO(put_tgtdir, rc = -EINVAL);
+
+	if (!fid_is_md_operative(old_fid))
+		GOTO(put_tgtdir, rc = -EPERM);
+
+	mold = mdt_object_find(info->mti_env, mdt, old_fid);
+	if (IS_ERR(mold))
+		GOTO(put_tgtdir, rc = PTR_ERR(mold));
+
+	if (!mdt_object_exists(mold))
+		GOTO(put_old, rc = -ENOENT);
+
+	if (mdt_object_remote(mold))
+		GOTO(put_old, rc = -EREMOTE);
+
+	if (mtgtdir != msrcdir && S_ISDIR(lu_object_attr(&mold->mot_obj))) {
+		/*
+		 * The EX locks of the client do not cover the ancestors of
+		 * the two directories. Serialize the subdir check below with
+		 * the other directory renames across directories as
+		 * mdt_reint_rename() does, which skips it for replay too.
+		 * A regular file can not make a loop. As @mti_tmp_fid1 is
+		 * reused by the lock, the FID of @mold is used from here on.
+		 */
+		if (!req_is_replay(mdt_info_req(info))) {
+			rc = mdt_rename_lock(info, &rename_lh);
+			if (rc) {
+				CERROR("%s: cannot lock for rename: rc = %d\n",
+				       mdt_obd_name(mdt), rc);
+				GOTO(put_old, rc);
+			}
+		}
+
+		rc = mdo_is_subdir(info->mti_env, mdt_object_child(mtgtdir),
+				   mdt_object_fid(mold));
+		if (rc) {
+			if (rc == 1)
+				rc = -EINVAL;
+			GOTO(unlock_rename, rc);
+		}
+	}
+
+	fid_zero(new_fid);
+	rc = mdo_lookup(info->mti_env, mdt_object_child(mtgtdir),
+			&rr->rr_tgt_name, new_fid, &info->mti_spec);
+	if (rc == 0) {
+		/* Rename onto itself, nothing to do. */
+		if (lu_fid_eq(mdt_object_fid(mold), new_fid))
+			GOTO(unlock_rename, rc);
+
+		if (lu_fid_eq(new_fid, rr->rr_fid1) ||
+		    lu_fid_eq(new_fid, rr->rr_fid2))
+			GOTO(unlock_rename, rc = -EINVAL);
+
+		if (!fid_is_md_operative(new_fid))
+			GOTO(unlock_rename, rc = -EPERM);
+
+		mnew = mdt_object_find(info->mti_env, mdt, new_fid);
+		if (IS_ERR(mnew))
+			GOTO(unlock_rename, rc = PTR_ERR(mnew));
+
+		if (!mdt_object_exists(mnew))
+			GOTO(put_new, rc = -ENOENT);
+
+		if (mdt_object_remote(mnew))
+			GOTO(put_new, rc = -EREMOTE);
+
+		if (S_ISDIR(lu_object_attr(&mnew->mot_obj)) &&
+		    !S_ISDIR(lu_object_attr(&mold->mot_obj)))
+			GOTO(put_new, rc = -EISDIR);
+	} else if (rc != -ENOENT) {
+		GOTO(unlock_rename, rc);
+	}
+
+	ma->ma_need = MA_INODE;
+	ma->ma_valid = 0;
+
+	if (mnew != NULL)
+		mutex_lock(&mnew->mot_lov_mutex);
+
+	rc = mdo_rename(info->mti_env, mdt_object_child(msrcdir),
+			mdt_object_child(mtgtdir), mdt_object_fid(mold),
+			&rr->rr_name,
+			mnew != NULL ? mdt_object_child(mnew) : NULL,
+			&rr->rr_tgt_name, ma);
+
+	if (mnew != NULL)
+		mutex_unlock(&mnew->mot_lov_mutex);
+
+	if (rc == 0 && mnew != NULL) {
+		mdt_handle_last_unlink(info, mnew, ma);
+		if (mdt_dom_check_for_discard(info, mnew))
+			mdt_dom_discard_data(info, mnew);
+	}
+
+put_new:
+	if (mnew != NULL)
+		mdt_object_put(info->mti_env, mnew);
+unlock_rename:
+	if (lustre_handle_is_used(&rename_lh))
+		mdt_rename_unlock(&rename_lh);
+put_old:
+	mdt_object_put(info->mti_env, mold);
+put_tgtdir:
+	mdt_object_put(info->mti_env, mtgtdir);
+put_srcdir:
+	mdt_object_put(info->mti_env, msrcdir);
+	mdt_client_compatibility(info);
+	rc2 = mdt_fix_reply(info);
+	if (rc == 0)
+		rc = rc2;
+	RETURN(rc);
+}
+
+static int mdt_link_lockless(struct tgt_session_info *tsi)
+{
+	struct mdt_thread_info *info = mdt_th_info(tsi->tsi_env);
+	struct mdt_device *mdt = info->mti_mdt;
+	struct md_attr *ma = &info->mti_attr;
+	struct mdt_reint_record *rr = &info->mti_rr;
+	struct mdt_object *parent;
+	struct mdt_object *source;
+	int rc, rc2;
+
+	ENTRY;
+	CDEBUG(D_INODE, "link "DFID" to "DFID"/"DNAME"\n",
+	       PFID(rr->rr_fid1), PFID(rr->rr_fid2), PNAME(&rr->rr_name));
+
+	if (!fid_is_md_operative(rr->rr_fid1) ||
+	    !fid_is_md_operative(rr->rr_fid2))
+		RETURN(-EPERM);
+
+	/* Target parent. */
+	parent = mdt_object_find(info->mti_env, mdt, rr->rr_fid2);
+	if (IS_ERR(parent))
+		RETURN(PTR_ERR(parent));
+
+	if (!mdt_object_exists(parent))
+		GOTO(put_parent, rc = -ENOENT);
+
+	if (mdt_object_remote(parent))
+		GOTO(put_parent, rc = -EREMOTE);
+
+	rc = mdt_wbc_exlock_check(info, parent);
+	if (rc)
+		GOTO(put_parent, rc);
+
+	source = mdt_object_find(info->mti_env, mdt, rr->rr_fid1);
+	if (IS_ERR(source))
+		GOTO(put_parent, rc = PTR_ERR(source));
+
+	if (!mdt_object_exists(source))
+		GOTO(put_source, rc = -ENOENT);
+
+	if (S_ISDIR(lu_object_attr(&source->mot_obj)))
+		GOTO(put_source, rc = -EPERM);
+
+	rc = mdo_link(info->mti_env, mdt_object_child(parent),
+		      mdt_object_child(source), &rr->rr_name, ma);
+
+put_source:
+	mdt_object_put(info->mti_env, source);
+put_parent:
+	mdt_object_put(info->mti_env, parent);
+	mdt_client_compatibility(info);
+	rc2 = mdt_fix_reply(info);
+	if (rc == 0)
+		rc = rc2;
+	RETURN(rc);
+}
+
+/*
+ * Set or remove an xattr of a file created under the WBC EX lock, usually
+ * in the same batch right after its creation.
+ */
+static int mdt_setxattr_lockless(struct tgt_session_info *tsi)
+{
+	struct mdt_thread_info *info = mdt_th_info(tsi->tsi_env);
+	struct mdt_device *mdt = info->mti_mdt;
+	struct md_attr *ma = &info->mti_attr;
+	struct lu_attr *attr = &ma->ma_attr;
+	struct mdt_reint_record *rr = &info->mti_rr;
+	struct lu_buf *buf = &info->mti_buf;
+	const char *name = rr->rr_name.ln_name;
+	__u64 valid = attr->la_valid;
+	struct md_object *child;
+	struct mdt_object *mo;
+	int rc;
+
+	ENTRY;
+	CDEBUG(D_INODE, "setxattr "DFID": %s %s\n", PFID(rr->rr_fid1),
+	       valid & OBD_MD_FLXATTR ? "set" : "remove", name);
+
+	if (!fid_is_md_operative(rr->rr_fid1))
+		RETURN(-EPERM);
+
+	mo = mdt_object_find(info->mti_env, mdt, rr->rr_fid1);
+	if (IS_ERR(mo))
+		RETURN(PTR_ERR(mo));
+
+	if (!mdt_object_exists(mo))
+		GOTO(out_put, rc = -ENOENT);
+
+	if (mdt_object_remote(mo))
+		GOTO(out_put, rc = -EREMOTE);
+
+	rc = mdt_wbc_exlock_check_obj(info, mo);
+	if (rc)
+		GOTO(out_put, rc);
+
+	if ((valid & OBD_MD_FLXATTR) &&
+	    (strcmp(name, XATTR_NAME_ACL_ACCESS) == 0 ||
+	     strcmp(name, XATTR_NAME_ACL_DEFAULT) == 0)) {
+		rc = mdt_nodemap_map_acl(info, rr->rr_eadata,
+					 rr->rr_eadatalen, name,
+					 NODEMAP_CLIENT_TO_FS);
+		if (rc < 0)
+			GOTO(out_put, rc);
+		/* ACLs were mapped out, return an error so the user knows */
+		if (rc != rr->rr_eadatalen)
+			GOTO(out_put, rc = -EPERM);
+	}
+
+	/* Keep the ctime of the file as it was in the client cache. */
+	attr->la_valid = LA_CTIME;
+	child = mdt_object_child(mo);
+	if (valid & OBD_MD_FLXATTR) {
+		buf->lb_buf = rr->rr_eadata;
+		buf->lb_len = rr->rr_eadatalen;
+		rc = mo_xattr_set(info->mti_env, child, buf, name, 0);
+	} else if (valid & OBD_MD_FLXATTRRM) {
+		rc = mo_xattr_del(info->mti_env, child, name);
+	} else {
+		rc = -EINVAL;
+	}
+
+	if (rc == 0) {
+		ma->ma_attr_flags |= MDS_PERM_BYPASS;
+		rc = mo_attr_set(info->mti_env, child, ma);
+	}
+
+out_put:
+	mdt_object_put(info->mti_env, mo);
+	RETURN(rc);
+}
+
+/*
+ * Reopen a file by FID on behalf of the files opened locally under the WBC
+ * EX lock which is being revoked. The file exists on MDT already, thus it is
+ * never created or truncated here, and no DLM lock is returned. The batch RPC
+ * is kept by the client for open replay while any of its handles is open.
+ */
+static int mdt_open_lockless(struct tgt_session_info *tsi)
+{
+	struct mdt_thread_info *info = mdt_th_info(tsi->tsi_env);
+	struct md_attr *ma = &info->mti_attr;
+	struct mdt_reint_record *rr = &info->mti_rr;
+	u64 open_flags = info->mti_spec.sp_cr_flags;
+	int rc, rc2;
+
+	ENTRY;
+	CDEBUG(D_INODE, "open "DFID" flags %#llo\n", PFID(rr->rr_fid2),
+	       open_flags);
+
+	if (!fid_is_md_operative(rr->rr_fid2))
+		RETURN(-EPERM);
+
+	if (open_flags & (MDS_OPEN_CREAT | MDS_OPEN_TRUNC))
+		RETURN(-EPROTO);
+
+	ma->ma_need = MA_INODE;
+	ma->ma_valid = 0;
+	/*
+	 * A sub open kept for replay carries the handle it got, the client
+	 * clears it once the handle is closed, thus it is not opened again.
+	 * The mfd of a resent sub open is found by mdt_finish_open().
+	 */
+	if (req_is_replay(mdt_info_req(info)) &&
+	    rr->rr_open_handle->cookie == 0) {
+		CDEBUG(D_HA, "skip replay of closed open "DFID"\n",
+		       PFID(rr->rr_fid2));
+		rc = 0;
+	} else {
+		rc = mdt_open_by_fid(info, NULL);
+	}
+
+	mdt_client_compatibility(info);
+	rc2 = mdt_fix_reply(info);
+	if (rc == 0)
+		rc = rc2;
+	RETURN(rc);
+}
+
+/* Batch UpdaTe Request with a format known in advance */
+#define TGT_BUT_HDL(flags, opc, fn)			\
+[opc - BUT_FIRST_OPC] = {				\
+	.th_name	= #opc,				\
+	.th_fail_id	= 0,				\
+	.th_opc		= opc,				\
+	.th_flags	= flags,			\
+	.th_act		= fn,				\
+	.th_fmt		= &RQF_ ## opc,			\
+	.th_version	= LUSTRE_MDS_VERSION,		\
+	.th_hp		= NULL,				\
+}
+
+static struct tgt_handler mdt_batch_handlers[] = {
+TGT_BUT_HDL(HAS_KEY | HAS_REPLY,	BUT_GETATTR,	mdt_batch_getattr),
+TGT_BUT_HDL(HAS_KEY | HAS_REPLY | IS_MUTABLE,
+	    BUT_CREATE_EXLOCK,		mdt_create_exlock),
+TGT_BUT_HDL(HAS_REPLY | IS_MUTABLE,
+	    BUT_CREATE_LOCKLESS,	mdt_create_lockless),
+TGT_BUT_HDL(HAS_KEY | IS_MUTABLE,
+	    BUT_SETATTR_EXLOCK,		mdt_setattr_exlock),
+TGT_BUT_HDL(IS_MUTABLE,
+	    BUT_SETATTR_LOCKLESS,	mdt_setattr_lockless),
+TGT_BUT_HDL(HAS_REPLY | HAS_KEY,
+	    BUT_EXLOCK_ONLY,		mdt_exlock_only),
+TGT_BUT_HDL(HAS_REPLY | IS_MUTABLE,
+	    BUT_UNLINK_LOCKLESS,	mdt_unlink_lockless),
+TGT_BUT_HDL(HAS_REPLY | IS_MUTABLE,
+	    BUT_RENAME_LOCKLESS,	mdt_rename_lockless),
+TGT_BUT_HDL(IS_MUTABLE,
+	    BUT_LINK_LOCKLESS,		mdt_link_lockless),
+TGT_BUT_HDL(IS_MUTABLE,
+	    BUT_SETXATTR_LOCKLESS,	mdt_setxattr_lockless),
+TGT_BUT_HDL(HAS_REPLY | IS_MUTABLE,
+	    BUT_OPEN_LOCKLESS,		mdt_open_lockless),
+};
+
+static struct tgt_handler *mdt_batch_handler_find(__u32 opc)
+{
+	struct tgt_handler *h;
+
+	h = NULL;
+	if (opc >= BUT_FIRST_OPC && opc < BUT_LAST_OPC) {
+		h = &mdt_batch_handlers[opc - BUT_FIRST_OPC];
+		LASSERTF(h->th_opc == opc, "opcode mismatch %d != %d\n",
+			 h->th_opc, opc);
+	} else {
+		h = NULL; /* unsupported opc */
+	}
+	return h;
+}
+
+/*
+ * Reconstruct the reply of the sub request at @index of a resent or replayed
+ * batch RPC if its reply data in @subs, as found by tgt_lookup_sub_replies()
+ * for the @nr sub requests, tells that it was executed already. Only
+ * the lockless modifying sub requests are reconstructed, the others take
+ * their locks and are executed again. A create whose child does not exist is
+ * executed again, as the reply data of the grouped creates covers the whole
+ * run of them, see mdt_batch_create_group().
+ *
+ * Return true if the reply is reconstructed, with its result in @rcp.
+ */
+static bool mdt_batch_reconstruct(struct mdt_thread_info *info, __u32 opc,
+				  __u32 index, struct tg_reply_data *subs,
+				  __u32 nr, int *rcp)
+{
+	struct ptlrpc_request *req = mdt_info_req(info);
+	struct mdt_reint_record *rr = &info->mti_rr;
+	struct tg_reply_data *trd;
+	struct mdt_object *child;
+	int rc = 0;
+	int rc2;
+
+	switch (opc) {
+	case BUT_CREATE_LOCKLESS:
+	case BUT_SETATTR_LOCKLESS:
+	case BUT_UNLINK_LOCKLESS:
+	case BUT_RENAME_LOCKLESS:
+	case BUT_LINK_LOCKLESS:
+	case BUT_SETXATTR_LOCKLESS:
+		break;
+	default:
+		return false;
+	}
+
+	if (index >= nr || subs[index].trd_reply.lrd_transno == 0)
+		return false;
+
+	trd = &subs[index];
+
+	if (opc == BUT_CREATE_LOCKLESS) {
+		child = mdt_object_find(info->mti_env, info->mti_mdt,
+					rr->rr_fid2);
+		if (IS_ERR(child))
+			return false;
+
+		if (!mdt_object_exists(child)) {
+			mdt_object_put(info->mti_env, child);
+			return false;
+		}
+
+		info->mti_attr.ma_need = MA_INODE;
+		info->mti_attr.ma_valid = 0;
+		rc = mdt_create_reply(info, child);
+		mdt_object_put(info->mti_env, child);
+	} else {
+		rc = trd->trd_reply.lrd_result;
+	}
+
+	DEBUG_REQ(D_HA, req, "reconstruct sub request %u opc %u: rc = %d",
+		  index, opc, rc);
+
+	mdt_client_compatibility(info);
+	rc2 = mdt_fix_reply(info);
+	if (rc == 0)
+		rc = rc2;
+	*rcp = rc;
+	return true;
+}
+
+/*
+ * Maximum number of creates executed in one transaction. It keeps the
+ * credits of the transaction well below the limit of the journal.
+ */
+#define MDT_BATCH_CREATE_GROUP_MAX	64
+/* Maximum number of parents of the creates handled together. */
+#define MDT_BATCH_CREATE_GROUPS		16
+
+static unsigned int mds_batch_num_threads = 4;
+module_param(mds_batch_num_threads, uint, 0444);
+MODULE_PARM_DESC(mds_batch_num_threads,
+		 "number of helper threads executing batched creates");
+
+static inline int mdt_batch_helpers_nr(void)
+{
+	return min_t(unsigned int, mds_batch_num_threads,
+		     MDT_BATCH_CREATE_GROUPS);
+}
+
+struct mdt_batch_create {
+	struct lustre_msg	*mbc_reqmsg;
+	struct mdt_object	*mbc_child;
+	struct md_create_item	*mbc_item;
+	int			 mbc_group;
+	struct lu_fid		 mbc_fid;
+	struct lu_name		 mbc_name;
+	struct md_attr		 mbc_ma;
+	struct md_op_spec	 mbc_spec;
+};
+
+struct mdt_batch_create_run;
+
+/* Creates under the same parent executed in one transaction. */
+struct mdt_batch_create_group {
+	/* linkage to mdt_batch_helpers::mbhs_queue */
+	struct list_head		 mbg_linkage;
+	struct mdt_batch_create_run	*mbg_run;
+	struct mdt_object		*mbg_parent;
+	struct lu_fid			 mbg_pfid;
+	/*
+	 * Credential of the creates, with its own references on the group
+	 * info and the identity as it is used by a helper thread.
+	 */
+	struct mdt_rec_create		*mbg_rec;
+	struct lu_ucred			 mbg_uc;
+	struct md_create_item		*mbg_items;
+	int				 mbg_count;
+	/*
+	 * Number of the processed creates, or negative errno if the group
+	 * is not executed at all and the creates are to be executed one by
+	 * one.
+	 */
+	int				 mbg_rc;
+};
+
+/* Run of creates of a batch RPC executed together. */
+struct mdt_batch_create_run {
+	struct mdt_batch_create		*mbr_creates;
+	struct md_create_item		*mbr_items;
+	int				 mbr_nr;
+	int				 mbr_ngroups;
+	struct mdt_batch_create_group	 mbr_groups[MDT_BATCH_CREATE_GROUPS];
+	/* session of the batch RPC and reply data of the transactions */
+	struct tgt_session_info		*mbr_tsi;
+	__u64				 mbr_opdata;
+	/* groups queued to the helper threads and not done yet */
+	atomic_t			 mbr_pending;
+	struct completion		 mbr_done;
+	/*
+	 * Credential of the service thread, as unpacking a create sets it
+	 * to the one of the create, including the one ending the run.
+	 */
+	struct lu_ucred			 mbr_uc;
+};
+
+static inline bool mdt_batch_create_same_cred(const struct mdt_rec_create *a,
+					      const struct mdt_rec_create *b)
+{
+	return a->cr_fsuid == b->cr_fsuid && a->cr_fsgid == b->cr_fsgid &&
+	       a->cr_cap == b->cr_cap && a->cr_suppgid1 == b->cr_suppgid1 &&
+	       a->cr_umask == b->cr_umask;
+}
+
+static int mdt_batch_cred_get(struct mdt_thread_info *info,
+			      struct lu_ucred *uc)
+{
+	struct md_identity *identity;
+
+	if (uc->uc_identity != NULL) {
+		identity = mdt_identity_get(info->mti_mdt->mdt_identity_cache,
+					    uc->uc_identity->mi_uid);
+		if (IS_ERR(identity)) {
+			uc->uc_identity = NULL;
+			uc->uc_ginfo = NULL;
+			return PTR_ERR(identity);
+		}
+		uc->uc_identity = identity;
+	}
+	if (uc->uc_ginfo != NULL)
+		get_group_info(uc->uc_ginfo);
+
+	return 0;
+}
+
+static void mdt_batch_cred_put(struct mdt_thread_info *info,
+			       struct lu_ucred *uc)
+{
+	if (uc->uc_ginfo != NULL) {
+		put_group_info(uc->uc_ginfo);
+		uc->uc_ginfo = NULL;
+	}
+	if (uc->uc_identity != NULL) {
+		mdt_identity_put(info->mti_mdt->mdt_identity_cache,
+				 uc->uc_identity);
+		uc->uc_identity = NULL;
+	}
+}
+
+/*
+ * Unpack the run of lockless creates of regular files starting at @reqmsg
+ * into @run, and sort them into groups by the parent. The creates under the
+ * same parent must have the same credential. Return the length of the run.
+ */
+static int mdt_batch_create_scan(struct mdt_thread_info *info,
+				 struct batch_update_request *bur,
+				 struct lustre_msg *reqmsg,
+				 struct mdt_batch_create_run *run, int max)
+{
+	struct req_capsule *pill = &info->mti_sub_pill;
+	struct ptlrpc_request *req = mdt_info_req(info);
+	struct mdt_reint_record *rr = &info->mti_rr;
+	struct mdt_batch_create_group *mbg;
+	struct mdt_rec_create *rec;
+	int nr;
+	int g;
+
+	for (nr = 0; nr < max; nr++) {
+		struct mdt_batch_create *mbc = &run->mbr_creates[nr];
+
+		if (nr > 0)
+			reqmsg = batch_update_reqmsg_next(bur, reqmsg);
+		if (reqmsg->lm_opc != BUT_CREATE_LOCKLESS)
+			break;
+
+		req_capsule_subreq_init(pill, &RQF_BUT_CREATE_LOCKLESS, req,
+					reqmsg, NULL, RCL_SERVER);
+		mdt_thread_info_reset(info);
+		if (mdt_batch_unpack(info, BUT_CREATE_LOCKLESS))
+			break;
+
+		rec = req_capsule_client_get(pill, &RMF_REC_REINT);
+		if (!S_ISREG(info->mti_attr.ma_attr.la_mode) ||
+		    info->mti_spec.sp_cr_flags & MDS_OPEN_HAS_EA ||
+		    info->mti_spec.sp_cr_file_secctx_name != NULL ||
+		    info->mti_spec.sp_cr_file_encctx != NULL ||
+		    !fid_is_md_operative(rr->rr_fid1))
+			break;
+
+		for (g = 0; g < run->mbr_ngroups; g++) {
+			if (lu_fid_eq(&run->mbr_groups[g].mbg_pfid,
+				      rr->rr_fid1))
+				break;
+		}
+
+		mbg = &run->mbr_groups[g];
+		if (g == run->mbr_ngroups) {
+			if (g == MDT_BATCH_CREATE_GROUPS)
+				break;
+
+			mbg->mbg_uc = *mdt_ucred(info);
+			if (mdt_batch_cred_get(info, &mbg->mbg_uc))
+				break;
+
+			run->mbr_ngroups++;
+			mbg->mbg_run = run;
+			mbg->mbg_pfid = *rr->rr_fid1;
+			mbg->mbg_rec = rec;
+		} else if (mbg->mbg_count == MDT_BATCH_CREATE_GROUP_MAX ||
+			   !mdt_batch_create_same_cred(mbg->mbg_rec, rec)) {
+			break;
+		}
+
+		mbg->mbg_count++;
+		mbc->mbc_group = g;
+		mbc->mbc_reqmsg = reqmsg;
+		mbc->mbc_fid = *rr->rr_fid2;
+		mbc->mbc_name = rr->rr_name;
+		mbc->mbc_ma = info->mti_attr;
+		mbc->mbc_ma.ma_need = MA_INODE;
+		mbc->mbc_ma.ma_valid = 0;
+		mbc->mbc_spec = info->mti_spec;
+		mbc->mbc_spec.sp_cr_lookup = 0;
+		mbc->mbc_spec.sp_feat = &dt_directory_features;
+	}
+
+	return nr;
+}
+
+/*
+ * Find the parents and allocate the children of the creates. A group whose
+ * objects cannot be prepared is left to the one by one execution.
+ */
+static void mdt_batch_create_prep(struct mdt_thread_info *info,
+				  struct mdt_batch_create_run *run)
+{
+	const struct lu_env *env = info->mti_env;
+	struct mdt_batch_create_group *mbg;
+	struct md_create_item *item;
+	int off = 0;
+	int i;
+
+	for (i = 0; i < run->mbr_ngroups; i++) {
+		struct mdt_object *parent;
+
+		mbg = &run->mbr_groups[i];
+		mbg->mbg_items = &run->mbr_items[off];
+		off += mbg->mbg_count;
+		mbg->mbg_count = 0;
+
+		parent = mdt_object_find(env, info->mti_mdt, &mbg->mbg_pfid);
+		if (IS_ERR(parent)) {
+			mbg->mbg_rc = PTR_ERR(parent);
+			continue;
+		}
+
+		if (!mdt_object_exists(parent)) {
+			mdt_object_put(env, parent);
+			mbg->mbg_rc = -ENOENT;
+			continue;
+		}
+		mbg->mbg_parent = parent;
+	}
+
+	for (i = 0; i < run->mbr_nr; i++) {
+		struct mdt_batch_create *mbc = &run->mbr_creates[i];
+		struct mdt_object *child;
+
+		mbg = &run->mbr_groups[mbc->mbc_group];
+		item = &mbg->mbg_items[mbg->mbg_count++];
+		mbc->mbc_item = item;
+		item->mci_name = &mbc->mbc_name;
+		item->mci_spec = &mbc->mbc_spec;
+		item->mci_ma = &mbc->mbc_ma;
+		if (mbg->mbg_rc < 0)
+			continue;
+
+		child = mdt_object_new(env, info->mti_mdt, &mbc->mbc_fid);
+		if (IS_ERR(child)) {
+			mbg->mbg_rc = PTR_ERR(child);
+			continue;
+		}
+
+		mbc->mbc_child = child;
+		item->mci_child = mdt_object_child(child);
+	}
+}
+
+static void mdt_batch_create_exec(const struct lu_env *env,
+				  struct mdt_batch_create_group *mbg)
+{
+	struct lu_ucred *uc = lu_ucred(env);
+
+	*uc = mbg->mbg_uc;
+	tgt_ses_info(env)->tsi_opdata = mbg->mbg_run->mbr_opdata;
+	mbg->mbg_rc = mdo_create_batch(env, mdt_object_child(mbg->mbg_parent),
+				       mbg->mbg_items, mbg->mbg_count);
+}
+
+static void mdt_batch_create_done(struct mdt_batch_create_group *mbg)
+{
+	struct mdt_batch_create_run *run = mbg->mbg_run;
+
+	if (atomic_dec_and_test(&run->mbr_pending))
+		complete(&run->mbr_done);
+}
+
+static int mdt_batch_helper_main(void *arg)
+{
+	struct mdt_batch_helper *mbh = arg;
+	struct mdt_batch_helpers *mbhs = &mbh->mbh_mdt->mdt_batch_helpers;
+	struct tgt_session_info *tsi = tgt_ses_info(&mbh->mbh_env);
+	struct mdt_batch_create_group *mbg;
+	struct lu_ucred *uc = lu_ucred(&mbh->mbh_env);
 
-	child = mdt_object_new(info->mti_env, mdt, rr->rr_fid2);
-	if (unlikely(IS_ERR(child)))
-		GOTO(put_parent, rc = PTR_ERR(child));
+	ENTRY;
 
-	ma->ma_need = MA_INODE;
-	ma->ma_valid = 0;
+	while (!kthread_should_stop()) {
+		wait_event_idle(mbhs->mbhs_waitq,
+				!list_empty(&mbhs->mbhs_queue) ||
+				kthread_should_stop());
+
+		spin_lock(&mbhs->mbhs_lock);
+		mbg = list_first_entry_or_null(&mbhs->mbhs_queue,
+					       struct mdt_batch_create_group,
+					       mbg_linkage);
+		if (mbg != NULL)
+			list_del_init(&mbg->mbg_linkage);
+		spin_unlock(&mbhs->mbhs_lock);
+		if (mbg == NULL)
+			continue;
 
-	/*
-	 * Do not perform lookup sanity check. We know that name does
-	 * not exist.
-	 */
-	info->mti_spec.sp_cr_lookup = 0;
-	info->mti_spec.sp_feat = &dt_directory_features;
+		/*
+		 * The transactions here get their transnos and reply data on
+		 * behalf of the batch RPC, see tgt_txn_stop_cb(). Only the
+		 * request is shared with the service thread, its reply transno
+		 * is updated under rq_lock.
+		 */
+		req_capsule_init(&mbh->mbh_pill,
+				 tgt_ses_req(mbg->mbg_run->mbr_tsi), RCL_SERVER);
+		tsi->tsi_exp = mbg->mbg_run->mbr_tsi->tsi_exp;
+		tsi->tsi_pill = &mbh->mbh_pill;
+		tsi->tsi_jobid = mbg->mbg_run->mbr_tsi->tsi_jobid;
+		tgt_mult_trans_set(&mbh->mbh_env, true);
+		mdt_batch_create_exec(&mbh->mbh_env, mbg);
+		tsi->tsi_exp = NULL;
+		tsi->tsi_pill = NULL;
+		tsi->tsi_jobid = NULL;
+		tsi->tsi_opdata = 0;
+		req_capsule_fini(&mbh->mbh_pill);
+		/* The group info and identity are held by the group. */
+		uc->uc_valid = UCRED_INVALID;
+		uc->uc_ginfo = NULL;
+		uc->uc_identity = NULL;
+		mdt_batch_create_done(mbg);
+	}
 
-	rc = mdo_create(info->mti_env, mdt_object_child(parent), &rr->rr_name,
-			mdt_object_child(child), &info->mti_spec, ma);
-	if (rc < 0)
-		GOTO(put_child, rc);
+	RETURN(0);
+}
 
-	if (md_should_create(info->mti_spec.sp_cr_flags))
-		mdt_prep_ma_buf_from_rep(info, child, ma);
+/*
+ * Execute the groups of @run. The groups under different parents are
+ * independent, all but the first one are queued to the helper threads, while
+ * the service thread executes the first one, takes back the queued ones no
+ * helper has picked up yet and then waits for the others.
+ */
+static void mdt_batch_create_dispatch(struct mdt_thread_info *info,
+				      struct mdt_batch_create_run *run)
+{
+	struct mdt_batch_helpers *mbhs = &info->mti_mdt->mdt_batch_helpers;
+	struct mdt_batch_create_group *first = NULL;
+	struct mdt_batch_create_group *mbg;
+	LIST_HEAD(groups);
+	int queued = 0;
+	int i;
 
-	rc = mdt_attr_get_complex(info, child, ma);
-	if (rc)
-		GOTO(put_child, rc);
+	for (i = 0; i < run->mbr_ngroups; i++) {
+		mbg = &run->mbr_groups[i];
+		if (mbg->mbg_rc < 0)
+			continue;
 
-	if (ma->ma_valid & MA_LOV) {
-		LASSERT(ma->ma_lmm_size != 0);
-		repbody->mbo_eadatasize = ma->ma_lmm_size;
-		if (S_ISREG(ma->ma_attr.la_mode))
-			repbody->mbo_valid |= OBD_MD_FLEASIZE;
-		else if (S_ISDIR(ma->ma_attr.la_mode))
-			repbody->mbo_valid |= OBD_MD_FLDIREA;
+		if (first == NULL) {
+			first = mbg;
+		} else {
+			list_add_tail(&mbg->mbg_linkage, &groups);
+			queued++;
+		}
 	}
 
-	if (ma->ma_valid & MA_LMV) {
-		LASSERT(ma->ma_lmv_size != 0);
-		repbody->mbo_eadatasize = ma->ma_lmv_size;
-		LASSERT(S_ISDIR(ma->ma_attr.la_mode));
-		repbody->mbo_valid |= OBD_MD_FLDIREA | OBD_MD_MEA;
-	}
+	if (first == NULL)
+		return;
 
-	if (ma->ma_valid & MA_LMV_DEF) {
-		LASSERT(S_ISDIR(ma->ma_attr.la_mode));
-		repbody->mbo_valid |= OBD_MD_FLDIREA | OBD_MD_DEFAULT_MEA;
+	if (queued == 0 || mbhs->mbhs_count == 0) {
+		mdt_batch_create_exec(info->mti_env, first);
+		list_for_each_entry(mbg, &groups, mbg_linkage)
+			mdt_batch_create_exec(info->mti_env, mbg);
+		return;
 	}
 
-	/* Return fid & attr to client. */
-	if (ma->ma_valid & MA_INODE)
-		mdt_pack_attr2body(info, repbody, &ma->ma_attr,
-				   mdt_object_fid(child));
+	atomic_set(&run->mbr_pending, queued);
+	init_completion(&run->mbr_done);
+	spin_lock(&mbhs->mbhs_lock);
+	list_splice_tail(&groups, &mbhs->mbhs_queue);
+	spin_unlock(&mbhs->mbhs_lock);
+	wake_up_all(&mbhs->mbhs_waitq);
+
+	mdt_batch_create_exec(info->mti_env, first);
+
+	while (1) {
+		struct mdt_batch_create_group *tmp;
+
+		mbg = NULL;
+		spin_lock(&mbhs->mbhs_lock);
+		list_for_each_entry(tmp, &mbhs->mbhs_queue, mbg_linkage) {
+			if (tmp->mbg_run == run) {
+				list_del_init(&tmp->mbg_linkage);
+				mbg = tmp;
+				break;
+			}
+		}
+		spin_unlock(&mbhs->mbhs_lock);
+		if (mbg == NULL)
+			break;
 
-put_child:
-	mdt_object_put(info->mti_env, child);
-put_parent:
-	mdt_object_put(info->mti_env, parent);
-	mdt_client_compatibility(info);
+		mdt_batch_create_exec(info->mti_env, mbg);
+		mdt_batch_create_done(mbg);
+	}
 
-	rc2 = mdt_fix_reply(info);
-	if (rc == 0)
-		rc = rc2;
-	RETURN(rc);
+	wait_for_completion(&run->mbr_done);
 }
 
-static int mdt_create_exlock(struct tgt_session_info *tsi)
+/*
+ * Undo the create @mbc executed by its group after a create failed before it
+ * in the batch, as the sub requests after the failed one are not handled.
+ */
+static void mdt_batch_create_undo(struct mdt_thread_info *info,
+				  struct mdt_batch_create_run *run,
+				  struct mdt_batch_create *mbc)
 {
-	struct mdt_thread_info *info = mdt_th_info(tsi->tsi_env);
-	struct req_capsule *pill = &info->mti_sub_pill;
+	struct mdt_batch_create_group *mbg = &run->mbr_groups[mbc->mbc_group];
+	struct md_attr *ma = &info->mti_attr;
+	int idx = mbc->mbc_item - mbg->mbg_items;
 	int rc;
 
-	ENTRY;
-
-	rc = ldlm_handle_enqueue(info->mti_exp->exp_obd->obd_namespace,
-				 pill, info->mti_dlm_req, &mdt_dlm_cbs);
-	if (rc)
-		RETURN(rc);
+	if (mbg->mbg_rc <= idx || mbc->mbc_item->mci_rc != 0)
+		return;
 
-	rc = mdt_create_lockless(tsi);
+	*mdt_ucred(info) = mbg->mbg_uc;
+	run->mbr_tsi->tsi_opdata = run->mbr_opdata;
+	ma->ma_need = MA_INODE;
+	ma->ma_valid = 0;
+	mutex_lock(&mbc->mbc_child->mot_lov_mutex);
+	rc = mdo_unlink(info->mti_env, mdt_object_child(mbg->mbg_parent),
+			mdt_object_child(mbc->mbc_child), &mbc->mbc_name, ma, 0);
+	mutex_unlock(&mbc->mbc_child->mot_lov_mutex);
 	if (rc)
-		mdt_ldlm_lock_cancel(info);
-
-	RETURN(rc);
+		CERROR("%s: cannot undo create "DFID"/%s: rc = %d\n",
+		       mdt_obd_name(info->mti_mdt), PFID(&mbg->mbg_pfid),
+		       mbc->mbc_name.ln_name, rc);
+	mdt_thread_info_reset(info);
 }
 
-static int mdt_setattr_lockless(struct tgt_session_info *tsi)
+/*
+ * Execute the run of lockless creates starting at *@reqmsgp. The creates
+ * under the same parent are executed in one transaction, see
+ * mdd_create_batch(), and the ones under different parents are executed in
+ * parallel by the helper threads. The replies are packed in order as if the
+ * sub requests were executed one by one, and *@reqmsgp and *@repmsgp are
+ * moved to the last handled sub request.
+ *
+ * A failed create stops the batch as if the sub requests were executed one by
+ * one: the replies are packed up to the failed one, and the creates after it
+ * which were executed by the other groups are undone, see
+ * mdt_batch_create_undo(). The creates of a group which could not be executed
+ * together are executed one by one in order while packing the replies.
+ *
+ * Return the number of the handled sub requests, 0 if the sub request at
+ * *@reqmsgp is to be executed alone, or a negative errno of the failed sub
+ * request.
+ */
+static int mdt_batch_create_group(struct tgt_session_info *tsi,
+				  struct tgt_handler *h,
+				  struct batch_update_request *bur,
+				  struct batch_update_reply *reply,
+				  struct lustre_msg **reqmsgp,
+				  struct lustre_msg **repmsgp, int max,
+				  __u32 *handled, __u32 *replen, bool *grown)
 {
 	struct mdt_thread_info *info = mdt_th_info(tsi->tsi_env);
-	struct mdt_device *mdt = info->mti_mdt;
-	struct md_attr *ma = &info->mti_attr;
-	struct mdt_reint_record *rr = &info->mti_rr;
-	struct mdt_object *mo;
-	int rc, rc2;
+	struct req_capsule *pill = &info->mti_sub_pill;
+	struct ptlrpc_request *req = tgt_ses_req(tsi);
+	const struct lu_env *env = info->mti_env;
+	struct lustre_msg *repmsg = *repmsgp;
+	struct mdt_batch_create_group *mbg;
+	struct mdt_batch_create_run *run;
+	bool executed = false;
+	int done = 0;
+	int rc = 0;
+	int i;
 
 	ENTRY;
-	CDEBUG(D_INODE, "setattr "DFID" %x", PFID(rr->rr_fid1),
-	       (unsigned int)ma->ma_attr.la_valid);
 
-	mo = mdt_object_find(info->mti_env, mdt, rr->rr_fid1);
-	if (IS_ERR(mo))
-		RETURN(PTR_ERR(mo));
+	OBD_ALLOC_PTR(run);
+	if (run == NULL)
+		RETURN(0);
 
-	if (!mdt_object_exists(mo))
-		GOTO(out_put, rc = -ENOENT);
+	run->mbr_uc = *mdt_ucred(info);
+	max = min(max, MDT_BATCH_CREATE_GROUP_MAX * MDT_BATCH_CREATE_GROUPS);
+	OBD_ALLOC_PTR_ARRAY_LARGE(run->mbr_creates, max);
+	if (run->mbr_creates == NULL)
+		GOTO(out_free, rc = 0);
 
-	if (mdt_object_remote(mo))
-		GOTO(out_put, rc = -EREMOTE);
+	run->mbr_nr = mdt_batch_create_scan(info, bur, *reqmsgp, run, max);
+	mdt_thread_info_reset(info);
+	if (run->mbr_nr < 2)
+		GOTO(out_free, rc = 0);
 
-	ma->ma_enable_chprojid_gid = mdt->mdt_enable_chprojid_gid;
-	if (ma->ma_attr.la_valid & LA_SIZE || rr->rr_flags & MRF_OPEN_TRUNC) {
-		/* Check write access for the O_TRUNC case */
-		if (mdt_write_read(mo) < 0)
-			GOTO(out_put, rc = -ETXTBSY);
+	/*
+	 * The creates of a group are not contiguous in the batch, the reply
+	 * data of each group transaction covers the whole run, see
+	 * mdt_batch_reconstruct().
+	 */
+	run->mbr_tsi = tsi;
+	run->mbr_opdata = tgt_sub_opdata(*handled, run->mbr_nr);
 
-		/* LU-10286: compatibility check for FLR.
-		 * Please check the comment in mdt_finish_open() for details
-		 */
-		if (!exp_connect_flr(info->mti_exp) ||
-		    !exp_connect_overstriping(info->mti_exp)) {
-			rc = mdt_big_xattr_get(info, mo, XATTR_NAME_LOV);
-			if (rc < 0 && rc != -ENODATA)
-				GOTO(out_put, rc);
+	OBD_ALLOC_PTR_ARRAY_LARGE(run->mbr_items, run->mbr_nr);
+	if (run->mbr_items == NULL)
+		GOTO(out_free, rc = 0);
 
-			if (!exp_connect_flr(info->mti_exp)) {
-				if (rc > 0 &&
-				    mdt_lmm_is_flr(info->mti_big_lmm))
-					GOTO(out_put, rc = -EOPNOTSUPP);
-			}
+	mdt_batch_create_prep(info, run);
+	mdt_batch_create_dispatch(info, run);
 
-			if (!exp_connect_overstriping(info->mti_exp)) {
-				if (rc > 0 &&
-				    mdt_lmm_is_overstriping(info->mti_big_lmm))
-					GOTO(out_put, rc = -EOPNOTSUPP);
-			}
-		}
+	/*
+	 * The groups not executed are to be created again one by one, their
+	 * children may be declared and marked dying already.
+	 */
+	for (i = 0; i < run->mbr_ngroups; i++) {
+		if (run->mbr_groups[i].mbg_rc > 0)
+			executed = true;
+	}
+	for (i = 0; i < run->mbr_nr; i++) {
+		struct mdt_batch_create *mbc = &run->mbr_creates[i];
 
-		/* For truncate, the file size sent from client
-		 * is believable, but the blocks are incorrect,
-		 * which makes the block size in LSOM attribute
-		 * inconsisent with the real block size.
-		 */
-		rc = mdt_lsom_update(info, mo, true);
-		if (rc)
-			GOTO(out_put, rc);
+		mbg = &run->mbr_groups[mbc->mbc_group];
+		if ((mbg->mbg_rc < 0 || !executed) && mbc->mbc_child) {
+			mdt_object_put(env, mbc->mbc_child);
+			mbc->mbc_child = NULL;
+		}
 	}
+	/* Nothing is executed, let the caller execute them in order. */
+	if (!executed)
+		GOTO(put_objects, rc = 0);
+
+	/* Pack the replies of the creates in order up to the failed one. */
+	for (i = 0; i < run->mbr_nr; i++) {
+		struct mdt_batch_create *mbc = &run->mbr_creates[i];
+		__u32 opc = BUT_CREATE_LOCKLESS;
+		int idx;
+		int rc2;
+
+		mbg = &run->mbr_groups[mbc->mbc_group];
+		idx = mbc->mbc_item - mbg->mbg_items;
+		if (i > 0)
+			repmsg = batch_update_repmsg_next(reply, repmsg);
 
-	if ((ma->ma_valid & MA_INODE) && ma->ma_attr.la_valid) {
-		if (ma->ma_valid & MA_LOV)
-			GOTO(out_put, rc = -EPROTO);
+		req_capsule_subreq_init(pill, h->th_fmt, req, mbc->mbc_reqmsg,
+					repmsg, RCL_SERVER);
+		rc = mdt_batch_unpack(info, opc);
+		if (rc == 0)
+			rc = mdt_batch_pack_repmsg(info, opc);
+		if (rc) {
+			CERROR("%s: cannot pack reply of "DFID"/%s: rc = %d\n",
+			       mdt_obd_name(info->mti_mdt),
+			       PFID(&mbg->mbg_pfid), mbc->mbc_name.ln_name, rc);
+			GOTO(put_objects, rc);
+		}
 
-		/*
-		 * FIXME: MDT supports FMD for regular files due to
-		 * Data-on-MDT
-		 */
+		if (mbg->mbg_rc < 0) {
+			tsi->tsi_opdata = tgt_sub_opdata(*handled, 1);
+			rc = h->th_act(tsi);
+		} else {
+			/* A group stops at its failed create, handled first. */
+			LASSERT(idx < mbg->mbg_rc);
+			rc = mbc->mbc_item->mci_rc;
+			if (rc == 0) {
+				info->mti_attr.ma_need = MA_INODE;
+				info->mti_attr.ma_valid = 0;
+				rc = mdt_create_reply(info, mbc->mbc_child);
+			}
+			mdt_client_compatibility(info);
+			rc2 = mdt_fix_reply(info);
+			if (rc == 0)
+				rc = rc2;
+		}
 
-		/* all attrs are packed into mti_attr in unpack_setattr */
-		rc = mo_attr_set(info->mti_env, mdt_object_child(mo), ma);
-		if (rc)
-			GOTO(out_put, rc);
-	}
+		if (repmsg != pill->rc_repmsg) {
+			repmsg = pill->rc_repmsg;
+			*grown = true;
+		}
 
-	/* If file data is modified, add the dirty flag */
-	if (ma->ma_attr_flags & MDS_DATA_MODIFIED)
-		rc = mdt_add_dirty_flag(info, mo, ma);
+		repmsg->lm_result = rc;
+		mdt_thread_info_reset(info);
+		*reqmsgp = mbc->mbc_reqmsg;
+		*repmsgp = repmsg;
+		*replen += lustre_packed_msg_size(repmsg);
+		(*handled)++;
+		done++;
+		if (rc < 0)
+			break;
+	}
 
-out_put:
-	mdt_object_put(info->mti_env, mo);
-	mdt_client_compatibility(info);
-	rc2 = mdt_fix_reply(info);
-	if (rc == 0)
-		rc = rc2;
+	if (rc < 0) {
+		for (i++; i < run->mbr_nr; i++)
+			mdt_batch_create_undo(info, run, &run->mbr_creates[i]);
+	} else {
+		rc = done;
+	}
+	CDEBUG(D_INODE, "%s: created %d files under %d parents: rc = %d\n",
+	       mdt_obd_name(info->mti_mdt), done, run->mbr_ngroups, rc);
+put_objects:
+	for (i = 0; i < run->mbr_nr; i++) {
+		if (run->mbr_creates[i].mbc_child != NULL)
+			mdt_object_put(env, run->mbr_creates[i].mbc_child);
+	}
+	for (i = 0; i < run->mbr_ngroups; i++) {
+		if (run->mbr_groups[i].mbg_parent != NULL)
+			mdt_object_put(env, run->mbr_groups[i].mbg_parent);
+	}
+	OBD_FREE_PTR_ARRAY_LARGE(run->mbr_items, run->mbr_nr);
+out_free:
+	for (i = 0; i < run->mbr_ngroups; i++)
+		mdt_batch_cred_put(info, &run->mbr_groups[i].mbg_uc);
+	*mdt_ucred(info) = run->mbr_uc;
+	if (run->mbr_creates != NULL)
+		OBD_FREE_PTR_ARRAY_LARGE(run->mbr_creates, max);
+	OBD_FREE_PTR(run);
 	RETURN(rc);
 }
 
-static int mdt_setattr_exlock(struct tgt_session_info *tsi)
+int mdt_batch_helpers_start(struct mdt_device *mdt)
 {
-	struct mdt_thread_info *info = mdt_th_info(tsi->tsi_env);
-	struct req_capsule *pill = &info->mti_sub_pill;
-	int rc;
+	struct mdt_batch_helpers *mbhs = &mdt->mdt_batch_helpers;
+	struct task_struct *task;
+	int count;
+	int rc = 0;
+	int i;
 
 	ENTRY;
 
-	rc = ldlm_handle_enqueue(info->mti_exp->exp_obd->obd_namespace,
-				 pill, info->mti_dlm_req, &mdt_dlm_cbs);
-	if (rc)
-		RETURN(rc);
+	spin_lock_init(&mbhs->mbhs_lock);
+	INIT_LIST_HEAD(&mbhs->mbhs_queue);
+	init_waitqueue_head(&mbhs->mbhs_waitq);
+	mbhs->mbhs_count = 0;
 
-	rc = mdt_setattr_lockless(tsi);
-	if (rc)
-		mdt_ldlm_lock_cancel(info);
+	count = mdt_batch_helpers_nr();
+	if (count == 0)
+		RETURN(0);
 
-	RETURN(rc);
-}
+	OBD_ALLOC_PTR_ARRAY(mbhs->mbhs_threads, count);
+	if (mbhs->mbhs_threads == NULL)
+		RETURN(-ENOMEM);
 
-static int mdt_exlock_only(struct tgt_session_info *tsi)
-{
-	struct mdt_thread_info *info = mdt_th_info(tsi->tsi_env);
-	struct req_capsule *pill = &info->mti_sub_pill;
-	int rc;
+	for (i = 0; i < count; i++) {
+		struct mdt_batch_helper *mbh = &mbhs->mbhs_threads[i];
 
-	ENTRY;
+		mbh->mbh_mdt = mdt;
+		rc = lu_env_init(&mbh->mbh_env, LCT_MD_THREAD);
+		if (rc)
+			break;
 
-	rc = ldlm_handle_enqueue(info->mti_exp->exp_obd->obd_namespace,
-				 pill, info->mti_dlm_req, &mdt_dlm_cbs);
+		rc = lu_context_init(&mbh->mbh_session, LCT_SERVER_SESSION);
+		if (rc) {
+			lu_env_fini(&mbh->mbh_env);
+			break;
+		}
+
+		lu_context_enter(&mbh->mbh_session);
+		mbh->mbh_env.le_ses = &mbh->mbh_session;
+
+		task = kthread_run(mdt_batch_helper_main, mbh,
+				   "mdt_batch%03d_%02d",
+				   mdt_seq_site(mdt)->ss_node_id, i);
+		if (IS_ERR(task)) {
+			rc = PTR_ERR(task);
+			lu_context_exit(&mbh->mbh_session);
+			lu_context_fini(&mbh->mbh_session);
+			lu_env_fini(&mbh->mbh_env);
+			break;
+		}
+
+		mbh->mbh_task = task;
+		mbhs->mbhs_count++;
+	}
+
+	if (rc) {
+		CERROR("%s: cannot start batch helper threads: rc = %d\n",
+		       mdt_obd_name(mdt), rc);
+		mdt_batch_helpers_stop(mdt);
+	}
 
 	RETURN(rc);
 }
 
-/* Batch UpdaTe Request with a format known in advance */
-#define TGT_BUT_HDL(flags, opc, fn)			\
-[opc - BUT_FIRST_OPC] = {				\
-	.th_name	= #opc,				\
-	.th_fail_id	= 0,				\
-	.th_opc		= opc,				\
-	.th_flags	= flags,			\
-	.th_act		= fn,				\
-	.th_fmt		= &RQF_ ## opc,			\
-	.th_version	= LUSTRE_MDS_VERSION,		\
-	.th_hp		= NULL,				\
-}
+void mdt_batch_helpers_stop(struct mdt_device *mdt)
+{
+	struct mdt_batch_helpers *mbhs = &mdt->mdt_batch_helpers;
+	int i;
 
-static struct tgt_handler mdt_batch_handlers[] = {
-TGT_BUT_HDL(HAS_KEY | HAS_REPLY,	BUT_GETATTR,	mdt_batch_getattr),
-TGT_BUT_HDL(HAS_KEY | HAS_REPLY | IS_MUTABLE,
-	    BUT_CREATE_EXLOCK,		mdt_create_exlock),
-TGT_BUT_HDL(HAS_REPLY | IS_MUTABLE,
-	    BUT_CREATE_LOCKLESS,	mdt_create_lockless),
-TGT_BUT_HDL(HAS_KEY | IS_MUTABLE,
-	    BUT_SETATTR_EXLOCK,		mdt_setattr_exlock),
-TGT_BUT_HDL(IS_MUTABLE,
-	    BUT_SETATTR_LOCKLESS,	mdt_setattr_lockless),
-TGT_BUT_HDL(HAS_REPLY | HAS_KEY,
-	    BUT_EXLOCK_ONLY,		mdt_exlock_only),
-};
+	if (mbhs->mbhs_threads == NULL)
+		return;
 
-static struct tgt_handler *mdt_batch_handler_find(__u32 opc)
-{
-	struct tgt_handler *h;
+	for (i = 0; i < mbhs->mbhs_count; i++) {
+		struct mdt_batch_helper *mbh = &mbhs->mbhs_threads[i];
 
-	h = NULL;
-	if (opc >= BUT_FIRST_OPC && opc < BUT_LAST_OPC) {
-		h = &mdt_batch_handlers[opc - BUT_FIRST_OPC];
-		LASSERTF(h->th_opc == opc, "opcode mismatch %d != %d\n",
-			 h->th_opc, opc);
-	} else {
-		h = NULL; /* unsupported opc */
+		kthread_stop(mbh->mbh_task);
+		lu_context_exit(&mbh->mbh_session);
+		lu_context_fini(&mbh->mbh_session);
+		lu_env_fini(&mbh->mbh_env);
 	}
-	return h;
+
+	LASSERT(list_empty(&mbhs->mbhs_queue));
+	OBD_FREE_PTR_ARRAY(mbhs->mbhs_threads, mdt_batch_helpers_nr());
+	mbhs->mbhs_threads = NULL;
+	mbhs->mbhs_count = 0;
 }
 
 int mdt_batch(struct tgt_session_info *tsi)
@@ -385,6 +1725,8 @@ int mdt_batch(struct tgt_session_info *tsi)
 	__u32 update_buf_count;
 	__u32 packed_replen;
 	void **update_bufs;
+	struct tg_reply_data *subs = NULL;
+	bool redo = false;
 	bool grown = false;
 	int buh_size;
 	int rc;
@@ -481,6 +1823,23 @@ int mdt_batch(struct tgt_session_info *tsi)
 	info->mti_batch_env = 1;
 	info->mti_pill = pill;
 
+	/*
+	 * Each transaction of the sub requests gets its own transno and reply
+	 * data, so that a resent or replayed batch does not execute again the
+	 * sub requests done already. A replayed batch is executed under its
+	 * single transno as the OUT updates are, see out_handle().
+	 */
+	tgt_mult_trans_set(tsi->tsi_env, !req_is_replay(req));
+	if (lustre_msg_get_flags(req->rq_reqmsg) & (MSG_RESENT | MSG_REPLAY)) {
+		redo = true;
+		subs = tgt_lookup_sub_replies(req, buh->buh_update_count);
+		if (IS_ERR(subs)) {
+			rc = PTR_ERR(subs);
+			subs = NULL;
+			GOTO(out, rc);
+		}
+	}
+
 	/* Walk through sub requests in the batch request to execute them. */
 	for (i = 0; i < update_buf_count; i++) {
 		struct batch_update_request *bur;
@@ -512,7 +1871,25 @@ int mdt_batch(struct tgt_session_info *tsi)
 				GOTO(out, rc = -ENOTSUPP);
 			}
 
-			/* TODO: Check resend case only for modifying RPC */
+			/*
+			 * Execute the following creates together, grouped by
+			 * the parent. A resent or replayed batch executes them
+			 * one by one to find the ones done already.
+			 */
+			if (reqmsg->lm_opc == BUT_CREATE_LOCKLESS &&
+			    update_count - j > 1 && !redo) {
+				rc = mdt_batch_create_group(tsi, h, bur, reply,
+						&reqmsg, &repmsg,
+						update_count - j,
+						&handled_update_count,
+						&packed_replen, &grown);
+				if (rc < 0)
+					GOTO(out, rc);
+				if (rc > 0) {
+					j += rc - 1;
+					continue;
+				}
+			}
 
 			LASSERT(h->th_fmt != NULL);
 			req_capsule_subreq_init(pill, h->th_fmt, req,
@@ -529,7 +1906,13 @@ int mdt_batch(struct tgt_session_info *tsi)
 			if (rc)
 				GOTO(out, rc);
 
-			rc = h->th_act(tsi);
+			tsi->tsi_opdata = tgt_sub_opdata(handled_update_count,
+							 1);
+			if (subs == NULL ||
+			    !mdt_batch_reconstruct(info, reqmsg->lm_opc,
+						   handled_update_count, subs,
+						   buh->buh_update_count, &rc))
+				rc = h->th_act(tsi);
 			if (rc)
 				GOTO(out, rc);
 
@@ -583,6 +1966,10 @@ out_free:
 	if (desc != NULL)
 		ptlrpc_free_bulk(desc);
 
+	if (subs != NULL)
+		OBD_FREE_LARGE(subs, sizeof(*subs) * buh->buh_update_count);
+
+	tsi->tsi_opdata = 0;
 	mdt_thread_info_fini(info);
 	RETURN(rc);
 }
@@ -5697,6 +5697,7 @@ static void mdt_fini(const struct lu_env *env, struct mdt_device *m)
 
 	mdt_stack_pre_fini(env, m, md2lu_dev(m->mdt_child));
 
+	mdt_batch_helpers_stop(m);
 	mdt_restriper_stop(m);
 	ping_evictor_stop();
 
@@ -6019,8 +6020,14 @@ static int mdt_init0(const struct lu_env *env, struct mdt_device *m,
 	if (rc)
 		GOTO(err_ping_evictor, rc);
 
+	rc = mdt_batch_helpers_start(m);
+	if (rc)
+		GOTO(err_restriper, rc);
+
 	RETURN(0);
 
+err_restriper:
+	mdt_restriper_stop(m);
 err_ping_evictor:
 	ping_evictor_stop();
 err_procfs:
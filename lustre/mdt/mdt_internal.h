@@ -58,6 +58,7 @@
 #include <lustre_quota.h>
 #include <lustre_linkea.h>
 #include <lustre_lmv.h>
+#include <lustre_nodemap.h>
 
 struct mdt_object;
 
@@ -235,6 +236,27 @@ struct mdt_dir_restriper {
 	struct page	       *mdr_page;
 };
 
+/* helper thread executing independent sub requests of batch RPCs */
+struct mdt_batch_helper {
+	struct mdt_device	*mbh_mdt;
+	struct lu_env		 mbh_env;
+	struct lu_context	 mbh_session;
+	/* capsule of the batch RPC for the last_rcvd updates */
+	struct req_capsule	 mbh_pill;
+	struct task_struct	*mbh_task;
+};
+
+struct mdt_batch_helpers {
+	/* lock for mbhs_queue */
+	spinlock_t		 mbhs_lock;
+	/* groups of sub requests waiting for a helper thread */
+	struct list_head	 mbhs_queue;
+	wait_queue_head_t	 mbhs_waitq;
+	/* number of the running helper threads */
+	int			 mbhs_count;
+	struct mdt_batch_helper	*mbhs_threads;
+};
+
 struct mdt_device {
 	/* super-class */
 	struct lu_device	   mdt_lu_dev;
@@ -330,6 +352,8 @@ struct mdt_device {
 	struct mdt_object	  *mdt_md_root;
 
 	struct mdt_dir_restriper   mdt_restriper;
+
+	struct mdt_batch_helpers   mdt_batch_helpers;
 };
 
 #define MDT_SERVICE_WATCHDOG_FACTOR	(2)
@@ -847,6 +871,8 @@ void mdt_reint_striped_unlock(struct mdt_thread_info *info,
 			      struct mdt_object *o,
 			      struct mdt_lock_handle *lh,
 			      struct ldlm_enqueue_info *einfo, int decref);
+int mdt_rename_lock(struct mdt_thread_info *info, struct lustre_handle *lh);
+void mdt_rename_unlock(struct lustre_handle *lh);
 
 enum mdt_name_flags {
 	MNF_FIX_ANON = 1,
@@ -872,6 +898,9 @@ int mdt_pack_size2body(struct mdt_thread_info *info,
 int mdt_getxattr(struct mdt_thread_info *info);
 int mdt_reint_setxattr(struct mdt_thread_info *info,
                        struct mdt_lock_handle *lh);
+int mdt_nodemap_map_acl(struct mdt_thread_info *info, void *buf,
+			size_t size, const char *name,
+			enum nodemap_tree_type tree_type);
 
 void mdt_lock_handle_init(struct mdt_lock_handle *lh);
 void mdt_lock_handle_fini(struct mdt_lock_handle *lh);
@@ -896,6 +925,7 @@ int mdt_lock_new_child(struct mdt_thread_info *info,
 		       struct mdt_lock_handle *child_lockh);
 void mdt_mfd_set_mode(struct mdt_file_data *mfd, u64 open_flags);
 int mdt_reint_open(struct mdt_thread_info *info, struct mdt_lock_handle *lhc);
+int mdt_open_by_fid(struct mdt_thread_info *info, struct ldlm_reply *rep);
 void mdt_prep_ma_buf_from_rep(struct mdt_thread_info *info,
 			      struct mdt_object *obj, struct md_attr *ma);
 struct mdt_file_data *mdt_open_handle2mfd(struct mdt_export_data *med,
@@ -1030,6 +1060,8 @@ __u64 mdt_req_from_lrd(struct ptlrpc_request *req, struct tg_reply_data *trd);
 
 /* mdt/mdt_batch.c */
 int mdt_batch(struct tgt_session_info *tsi);
+int mdt_batch_helpers_start(struct mdt_device *mdt);
+void mdt_batch_helpers_stop(struct mdt_device *mdt);
 
 /* mdt/mdt_hsm.c */
 int mdt_hsm_state_get(struct tgt_session_info *tsi);
@@ -1311,6 +1311,16 @@ static int mdt_create_unpack(struct mdt_thread_info *info)
         memset(&sp->u, 0, sizeof(sp->u));
         sp->sp_cr_flags = get_mrc_cr_flags(rec);
 	info->mti_attr.ma_attr_flags |= rec->cr_bias & MDS_WBC_LOCKLESS;
+	if (rec->cr_bias & MDS_WBC_CREATE_ATTR &&
+	    exp_connect_wbc(info->mti_exp)) {
+		/*
+		 * WBC flush of a file created and then modified in the client
+		 * cache: create it with its final timestamps in one go, so no
+		 * separate setattr is needed.
+		 */
+		attr->la_atime = rec->cr_atime;
+		attr->la_ctime = rec->cr_ctime;
+	}
 
 	rc = mdt_name_unpack(pill, &RMF_NAME, &rr->rr_name, 0);
 	if (rc < 0)
@@ -1862,6 +1872,34 @@ int mdt_batch_unpack(struct mdt_thread_info *info, __u32 op)
 		info->mti_rr.rr_opcode = REINT_SETATTR;
 		rc = mdt_reint_unpackers[REINT_SETATTR](info);
 		break;
+	/*
+	 * Namespace sub requests are executed under the WBC EX lock held by
+	 * the client, thus they never carry a DLM request.
+	 */
+	case BUT_UNLINK_LOCKLESS:
+		info->mti_attr.ma_attr_flags |= MDS_WBC_LOCKLESS;
+		info->mti_rr.rr_opcode = REINT_UNLINK;
+		rc = mdt_reint_unpackers[REINT_UNLINK](info);
+		break;
+	case BUT_RENAME_LOCKLESS:
+		info->mti_attr.ma_attr_flags |= MDS_WBC_LOCKLESS;
+		info->mti_rr.rr_opcode = REINT_RENAME;
+		rc = mdt_reint_unpackers[REINT_RENAME](info);
+		break;
+	case BUT_LINK_LOCKLESS:
+		info->mti_attr.ma_attr_flags |= MDS_WBC_LOCKLESS;
+		info->mti_rr.rr_opcode = REINT_LINK;
+		rc = mdt_reint_unpackers[REINT_LINK](info);
+		break;
+	case BUT_SETXATTR_LOCKLESS:
+		info->mti_attr.ma_attr_flags |= MDS_WBC_LOCKLESS;
+		info->mti_rr.rr_opcode = REINT_SETXATTR;
+		rc = mdt_reint_unpackers[REINT_SETXATTR](info);
+		break;
+	case BUT_OPEN_LOCKLESS:
+		info->mti_rr.rr_opcode = REINT_OPEN;
+		rc = mdt_reint_unpackers[REINT_OPEN](info);
+		break;
 	default:
 		CERROR("Unexpected opcode %d\n", op);
 		rc = -EOPNOTSUPP;
@@ -627,10 +627,18 @@ static int mdt_finish_open(struct mdt_thread_info *info,
 
 	mfd = NULL;
 	if (lustre_msg_get_flags(req->rq_reqmsg) & MSG_RESENT) {
+		/*
+		 * The sub opens of a batch RPC share its xid, so the mfd is
+		 * matched by the object and the open mode as well.
+		 */
 		spin_lock(&med->med_open_lock);
 		list_for_each(t, &med->med_open_head) {
 			mfd = list_entry(t, struct mdt_file_data, mfd_list);
-			if (mfd->mfd_xid == req->rq_xid)
+			if (mfd->mfd_xid == req->rq_xid &&
+			    mfd->mfd_object == o &&
+			    !((mfd->mfd_open_flags ^ open_flags) &
+			      (MDS_FMODE_READ | MDS_FMODE_WRITE |
+			       MDS_FMODE_EXEC)))
 				break;
 			mfd = NULL;
 		}
@@ -764,7 +772,7 @@ out:
 	LASSERT(ergo(rc < 0, lustre_msg_get_transno(req->rq_repmsg) == 0));
 }
 
-static int mdt_open_by_fid(struct mdt_thread_info *info, struct ldlm_reply *rep)
+int mdt_open_by_fid(struct mdt_thread_info *info, struct ldlm_reply *rep)
 {
 	u64 open_flags = info->mti_spec.sp_cr_flags;
 	struct mdt_reint_record *rr = &info->mti_rr;
@@ -1678,8 +1678,7 @@ static int mdt_pdir_hash_lock(struct mdt_thread_info *info,
 /**
  * Get BFL lock for rename or migrate process.
  **/
-static int mdt_rename_lock(struct mdt_thread_info *info,
-			   struct lustre_handle *lh)
+int mdt_rename_lock(struct mdt_thread_info *info, struct lustre_handle *lh)
 {
 	int	rc;
 
@@ -1724,7 +1723,7 @@ static int mdt_rename_lock(struct mdt_thread_info *info,
 	RETURN(rc);
 }
 
-static void mdt_rename_unlock(struct lustre_handle *lh)
+void mdt_rename_unlock(struct lustre_handle *lh)
 {
 	ENTRY;
 	LASSERT(lustre_handle_is_used(lh));
@@ -138,9 +138,9 @@ static int mdt_getxattr_pack_reply(struct mdt_thread_info *info)
 	RETURN(rc < 0 ? rc : size);
 }
 
-static int mdt_nodemap_map_acl(struct mdt_thread_info *info, void *buf,
-			       size_t size, const char *name,
-			       enum nodemap_tree_type tree_type)
+int mdt_nodemap_map_acl(struct mdt_thread_info *info, void *buf,
+			size_t size, const char *name,
+			enum nodemap_tree_type tree_type)
 {
 	struct lu_nodemap      *nodemap;
 	struct obd_export      *exp = info->mti_exp;
@@ -863,6 +863,51 @@ static const struct req_msg_field *exlock_only_server[] = {
 	&RMF_DLM_REP,
 };
 
+static const struct req_msg_field *unlink_lockless_client[] = {
+	&RMF_REC_REINT,
+	&RMF_NAME,
+};
+
+static const struct req_msg_field *unlink_lockless_server[] = {
+	&RMF_MDT_BODY,
+};
+
+static const struct req_msg_field *rename_lockless_client[] = {
+	&RMF_REC_REINT,
+	&RMF_NAME,
+	&RMF_SYMTGT,
+};
+
+static const struct req_msg_field *rename_lockless_server[] = {
+	&RMF_MDT_BODY,
+};
+
+static const struct req_msg_field *link_lockless_client[] = {
+	&RMF_REC_REINT,
+	&RMF_NAME,
+};
+
+static const struct req_msg_field *setxattr_lockless_client[] = {
+	&RMF_REC_REINT,
+	&RMF_NAME,
+	&RMF_EADATA,
+};
+
+static const struct req_msg_field *open_lockless_client[] = {
+	&RMF_REC_REINT,
+	&RMF_NAME,
+	&RMF_EADATA,
+	&RMF_FILE_SECCTX_NAME,
+	&RMF_FILE_SECCTX,
+	&RMF_FILE_ENCCTX,
+};
+
+static const struct req_msg_field *open_lockless_server[] = {
+	&RMF_MDT_BODY,
+	&RMF_MDT_MD,
+	&RMF_ACL,
+};
+
 static struct req_format *req_formats[] = {
 	&RQF_OBD_PING,
 	&RQF_OBD_SET_INFO,
@@ -970,6 +1015,11 @@ static struct req_format *req_formats[] = {
 	&RQF_BUT_SETATTR_EXLOCK,
 	&RQF_BUT_SETATTR_LOCKLESS,
 	&RQF_BUT_EXLOCK_ONLY,
+	&RQF_BUT_UNLINK_LOCKLESS,
+	&RQF_BUT_RENAME_LOCKLESS,
+	&RQF_BUT_LINK_LOCKLESS,
+	&RQF_BUT_SETXATTR_LOCKLESS,
+	&RQF_BUT_OPEN_LOCKLESS,
 	&RQF_MDS_BATCH,
 };
 
@@ -1949,6 +1999,29 @@ struct req_format RQF_BUT_EXLOCK_ONLY =
 	DEFINE_REQ_FMT0("EXLOCK_ONLY", exlock_only_client, exlock_only_server);
 EXPORT_SYMBOL(RQF_BUT_EXLOCK_ONLY);
 
+struct req_format RQF_BUT_UNLINK_LOCKLESS =
+	DEFINE_REQ_FMT0("UNLINK_LOCKLESS", unlink_lockless_client,
+					   unlink_lockless_server);
+EXPORT_SYMBOL(RQF_BUT_UNLINK_LOCKLESS);
+
+struct req_format RQF_BUT_RENAME_LOCKLESS =
+	DEFINE_REQ_FMT0("RENAME_LOCKLESS", rename_lockless_client,
+					   rename_lockless_server);
+EXPORT_SYMBOL(RQF_BUT_RENAME_LOCKLESS);
+
+struct req_format RQF_BUT_LINK_LOCKLESS =
+	DEFINE_REQ_FMT0("LINK_LOCKLESS", link_lockless_client, empty);
+EXPORT_SYMBOL(RQF_BUT_LINK_LOCKLESS);
+
+struct req_format RQF_BUT_SETXATTR_LOCKLESS =
+	DEFINE_REQ_FMT0("SETXATTR_LOCKLESS", setxattr_lockless_client, empty);
+EXPORT_SYMBOL(RQF_BUT_SETXATTR_LOCKLESS);
+
+struct req_format RQF_BUT_OPEN_LOCKLESS =
+	DEFINE_REQ_FMT0("OPEN_LOCKLESS", open_lockless_client,
+					 open_lockless_server);
+EXPORT_SYMBOL(RQF_BUT_OPEN_LOCKLESS);
+
 /* Convenience macro */
 #define FMT_FIELD(fmt, i, j) (fmt)->rf_fields[(i)].d[(j)]
 
@@ -2800,10 +2800,18 @@ void lustre_assert_wire_constants(void)
 		 (long long)(int)offsetof(struct mdt_rec_create, cr_ioepoch));
 	LASSERTF((int)sizeof(((struct mdt_rec_create *)0)->cr_ioepoch) == 8, "found %lld\n",
 		 (long long)(int)sizeof(((struct mdt_rec_create *)0)->cr_ioepoch));
+	LASSERTF((int)offsetof(struct mdt_rec_create, cr_atime) == 96, "found %lld\n",
+		 (long long)(int)offsetof(struct mdt_rec_create, cr_atime));
+	LASSERTF((int)sizeof(((struct mdt_rec_create *)0)->cr_atime) == 8, "found %lld\n",
+		 (long long)(int)sizeof(((struct mdt_rec_create *)0)->cr_atime));
 	LASSERTF((int)offsetof(struct mdt_rec_create, cr_padding_1) == 104, "found %lld\n",
 		 (long long)(int)offsetof(struct mdt_rec_create, cr_padding_1));
 	LASSERTF((int)sizeof(((struct mdt_rec_create *)0)->cr_padding_1) == 8, "found %lld\n",
 		 (long long)(int)sizeof(((struct mdt_rec_create *)0)->cr_padding_1));
+	LASSERTF((int)offsetof(struct mdt_rec_create, cr_ctime) == 104, "found %lld\n",
+		 (long long)(int)offsetof(struct mdt_rec_create, cr_ctime));
+	LASSERTF((int)sizeof(((struct mdt_rec_create *)0)->cr_ctime) == 8, "found %lld\n",
+		 (long long)(int)sizeof(((struct mdt_rec_create *)0)->cr_ctime));
 	LASSERTF((int)offsetof(struct mdt_rec_create, cr_mode) == 112, "found %lld\n",
 		 (long long)(int)offsetof(struct mdt_rec_create, cr_mode));
 	LASSERTF((int)sizeof(((struct mdt_rec_create *)0)->cr_mode) == 4, "found %lld\n",
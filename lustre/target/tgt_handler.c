@@ -514,6 +514,7 @@ static int tgt_filter_recovery_request(struct ptlrpc_request *req,
 	case OBD_PING:
 	case MDS_REINT:
 	case OUT_UPDATE:
+	case MDS_BATCH:
 	case SEQ_QUERY:
 	case FLD_QUERY:
 	case FLD_READ:
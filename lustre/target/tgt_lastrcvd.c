@@ -403,6 +403,7 @@ int tgt_client_alloc(struct obd_export *exp)
 	/* Mark that slot is not yet valid, 0 doesn't work here */
 	exp->exp_target_data.ted_lr_idx = -1;
 	INIT_LIST_HEAD(&exp->exp_target_data.ted_reply_list);
+	INIT_LIST_HEAD(&exp->exp_target_data.ted_sub_reply_list);
 	mutex_init(&exp->exp_target_data.ted_lcd_lock);
 	RETURN(0);
 }
@@ -426,6 +427,10 @@ void tgt_client_free(struct obd_export *exp)
 	list_for_each_entry_safe(trd, tmp, &ted->ted_reply_list, trd_list) {
 		tgt_release_reply_data(lut, ted, trd);
 	}
+	list_for_each_entry_safe(trd, tmp, &ted->ted_sub_reply_list,
+				 trd_list) {
+		tgt_release_reply_data(lut, ted, trd);
+	}
 	if (ted->ted_reply_last != NULL) {
 		tgt_free_reply_data(lut, ted, ted->ted_reply_last);
 		ted->ted_reply_last = NULL;
@@ -1192,6 +1197,29 @@ static void tgt_clean_by_tag(struct obd_export *exp, __u64 xid, __u16 tag)
 	}
 }
 
+/* Link @trd to the reply list of @ted, called with ted_lcd_lock held. The
+ * reply data of the sub requests of batched RPCs are kept on their own list
+ * sorted by xid, so that the other requests do not walk them, and the ones
+ * of a batch are found together.
+ */
+static void tgt_reply_list_add(struct tg_export_data *ted,
+			       struct tg_reply_data *trd)
+{
+	struct tg_reply_data *prev;
+
+	if (!tgt_is_sub_reply(trd)) {
+		list_add(&trd->trd_list, &ted->ted_reply_list);
+		return;
+	}
+
+	/* The xids are mostly increasing, look for the place from the tail */
+	list_for_each_entry_reverse(prev, &ted->ted_sub_reply_list, trd_list) {
+		if (prev->trd_reply.lrd_xid <= trd->trd_reply.lrd_xid)
+			break;
+	}
+	list_add(&trd->trd_list, &prev->trd_list);
+}
+
 static int tgt_add_reply_data(const struct lu_env *env, struct lu_target *tgt,
 		       struct tg_export_data *ted, struct tg_reply_data *trd,
 		       struct ptlrpc_request *req,
@@ -1253,7 +1281,7 @@ static int tgt_add_reply_data(const struct lu_env *env, struct lu_target *tgt,
 			tgt_clean_by_tag(req->rq_export, req->rq_xid,
 					 trd->trd_tag);
 	}
-	list_add(&trd->trd_list, &ted->ted_reply_list);
+	tgt_reply_list_add(ted, trd);
 	ted->ted_reply_cnt++;
 	if (ted->ted_reply_cnt > ted->ted_reply_max)
 		ted->ted_reply_max = ted->ted_reply_cnt;
@@ -1396,8 +1424,17 @@ static int tgt_last_rcvd_update(const struct lu_env *env, struct lu_target *tgt,
 	       tti->tti_transno, tgt->lut_obd->obd_last_committed);
 
 	if (req != NULL) {
-		req->rq_transno = tti->tti_transno;
-		lustre_msg_set_transno(req->rq_repmsg, tti->tti_transno);
+		/*
+		 * The transactions of a request with several ones, e.g. a
+		 * batched RPC, may be stopped in different threads, its reply
+		 * carries the highest transno of them.
+		 */
+		spin_lock(&req->rq_lock);
+		if (!tti->tti_mult_trans || tti->tti_transno > req->rq_transno) {
+			req->rq_transno = tti->tti_transno;
+			lustre_msg_set_transno(req->rq_repmsg, tti->tti_transno);
+		}
+		spin_unlock(&req->rq_lock);
 	}
 
 	/* if can't add callback, do sync write */
@@ -1992,6 +2029,18 @@ int tgt_txn_stop_cb(const struct lu_env *env, struct thandle *th,
 	return rc;
 }
 
+/*
+ * Let each transaction of the request of @env get its own transno and reply
+ * data, see tgt_txn_stop_cb().
+ */
+void tgt_mult_trans_set(const struct lu_env *env, bool mult_trans)
+{
+	struct tgt_thread_info *tti = tgt_th_info(env);
+
+	tti->tti_mult_trans = mult_trans;
+}
+EXPORT_SYMBOL(tgt_mult_trans_set);
+
 int tgt_reply_data_init(const struct lu_env *env, struct lu_target *tgt)
 {
 	struct tgt_thread_info	*tti = tgt_th_info(env);
@@ -2084,7 +2133,7 @@ int tgt_reply_data_init(const struct lu_env *env, struct lu_target *tgt)
 			trd->trd_pre_versions[3] = 0;
 			trd->trd_index = idx;
 			trd->trd_tag = 0;
-			list_add(&trd->trd_list, &ted->ted_reply_list);
+			tgt_reply_list_add(ted, trd);
 			ted->ted_reply_cnt++;
 			if (ted->ted_reply_cnt > ted->ted_reply_max)
 				ted->ted_reply_max = ted->ted_reply_cnt;
@@ -2212,12 +2261,70 @@ int tgt_lookup_reply(struct ptlrpc_request *req, struct tg_reply_data *trd)
 }
 EXPORT_SYMBOL(tgt_lookup_reply);
 
+/* Look for the reply data of the sub requests of the batched RPC @req, which
+ * has @count sub requests. Return an array indexed by the sub requests with a
+ * copy of the reply data covering each of them, or a zeroed entry for the sub
+ * requests not executed. Return NULL if none of them was executed.
+ */
+struct tg_reply_data *tgt_lookup_sub_replies(struct ptlrpc_request *req,
+					     __u32 count)
+{
+	struct tg_export_data *ted = &req->rq_export->exp_target_data;
+	struct tg_reply_data *reply;
+	struct tg_reply_data *subs;
+	int found = 0;
+	__u32 first;
+	__u32 last;
+	__u32 i;
+
+	if (!tgt_is_multimodrpcs_client(req->rq_export) || count == 0)
+		return NULL;
+
+	OBD_ALLOC_LARGE(subs, sizeof(*subs) * count);
+	if (subs == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	mutex_lock(&ted->ted_lcd_lock);
+	list_for_each_entry_reverse(reply, &ted->ted_sub_reply_list,
+				    trd_list) {
+		if (reply->trd_reply.lrd_xid > req->rq_xid)
+			continue;
+		if (reply->trd_reply.lrd_xid < req->rq_xid)
+			break;
+
+		/* The reply data of a single sub request takes precedence
+		 * over the one of the run of grouped creates covering it.
+		 */
+		first = tgt_sub_reply_index(reply);
+		last = min(first + tgt_sub_reply_count(reply), count);
+		for (i = first; i < last; i++) {
+			if (subs[i].trd_reply.lrd_transno == 0 ||
+			    tgt_sub_reply_count(reply) == 1)
+				subs[i] = *reply;
+		}
+		found++;
+	}
+	mutex_unlock(&ted->ted_lcd_lock);
+
+	CDEBUG(D_TRACE, "%s: lookup sub replies xid %llu, found %d\n",
+	       tgt_name(class_exp2tgt(req->rq_export)), req->rq_xid, found);
+
+	if (found == 0) {
+		OBD_FREE_LARGE(subs, sizeof(*subs) * count);
+		return NULL;
+	}
+
+	return subs;
+}
+EXPORT_SYMBOL(tgt_lookup_sub_replies);
+
 int tgt_handle_received_xid(struct obd_export *exp, __u64 rcvd_xid)
 {
 	struct tg_export_data	*ted = &exp->exp_target_data;
 	struct lu_target	*lut = class_exp2tgt(exp);
 	struct tg_reply_data	*trd, *tmp;
-
+	__u64			 last_committed;
+	__u64			 keep_xid = rcvd_xid + 1;
 
 	list_for_each_entry_safe(trd, tmp, &ted->ted_reply_list, trd_list) {
 		if (trd->trd_reply.lrd_xid > rcvd_xid)
@@ -2226,6 +2333,29 @@ int tgt_handle_received_xid(struct obd_export *exp, __u64 rcvd_xid)
 		tgt_release_reply_data(lut, ted, trd);
 	}
 
+	/*
+	 * The reply data of the sub requests of a batched RPC are needed to
+	 * replay the batch without executing again the sub requests already
+	 * committed. Keep them from the first batch not committed completely.
+	 */
+	last_committed = lut->lut_obd->obd_last_committed;
+	list_for_each_entry(trd, &ted->ted_sub_reply_list, trd_list) {
+		if (trd->trd_reply.lrd_xid > rcvd_xid)
+			break;
+		if (trd->trd_reply.lrd_transno > last_committed) {
+			keep_xid = trd->trd_reply.lrd_xid;
+			break;
+		}
+	}
+
+	list_for_each_entry_safe(trd, tmp, &ted->ted_sub_reply_list,
+				 trd_list) {
+		if (trd->trd_reply.lrd_xid >= keep_xid)
+			break;
+		ted->ted_release_xid++;
+		tgt_release_reply_data(lut, ted, trd);
+	}
+
 	return 0;
 }
 
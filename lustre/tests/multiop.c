@@ -45,6 +45,7 @@
 #include <sys/ioctl.h>
 #include <sys/xattr.h>
 #include <sys/file.h>
+#include <sys/syscall.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -81,6 +82,7 @@ char usage[] =
 "	 G gid get grouplock\n"
 "	 g gid put grouplock\n"
 "	 H[num] create HSM released file with num stripes\n"
+"	 i[num] getdents64 and print the names [optional buffer size]\n"
 "	 K  link path to filename\n"
 "	 L  link\n"
 "	 l  symlink filename to path\n"
@@ -471,6 +473,34 @@ int main(int argc, char **argv)
 			}
 			rc = fd;
 			break;
+		case 'i': {
+			char *dents;
+			int off;
+
+			len = atoi(commands + 1);
+			if (len <= 0)
+				len = 4096;
+			dents = malloc(len);
+			if (!dents)
+				errx(-1, "malloc(%d)", len);
+
+			rc = syscall(SYS_getdents64, fd, dents, len);
+			if (rc == -1) {
+				save_errno = errno;
+				perror("getdents64");
+				exit(save_errno);
+			}
+
+			for (off = 0; off < rc; ) {
+				struct dirent64 *de;
+
+				de = (struct dirent64 *)(dents + off);
+				printf("%s\n", de->d_name);
+				off += de->d_reclen;
+			}
+			free(dents);
+			break;
+		}
 		case 'j':
 			if (flock(fd, LOCK_EX) == -1)
 				errx(-1, "flock()");
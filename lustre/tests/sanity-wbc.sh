@@ -85,6 +85,19 @@ wbc_conf_show()
 	$LCTL get_param llite.$($LFS getname $mnt | awk '{print $1}').wbc.conf
 }
 
+wbc_stats_show()
+{
+	local mnt=${1:-$MOUNT}
+	local fsuuid=$($LFS getname $mnt | awk '{print $1}')
+
+	$LCTL get_param -n llite.$fsuuid.wbc_stats
+}
+
+wbc_stats_stat()
+{
+	wbc_stats_show | awk -v name=$1 '$1 == name { print $2 }'
+}
+
 setup_wbc()
 {
 	local conf="$1"
@@ -1474,6 +1487,21 @@ test_21() {
 	test_21_base "lazy_keep" "dcache_decomp" 1500 0
 	test_21_base "aging_drop" "dcache_decomp" 1500 0
 	test_21_base "aging_keep" "dcache_decomp" 1500 0
+
+	# Read dir entries in hash order via the hashed index without
+	# decompleting the directory.
+	test_21_base "lazy_drop" "htree_runtime" 1500 1
+	test_21_base "lazy_keep" "htree_runtime" 1500 1
+	test_21_base "aging_drop" "htree_runtime" 1500 1
+	test_21_base "aging_keep" "htree_runtime" 1500 1
+
+	test_21_base "lazy_drop" "htree_resident" 1500 1
+	test_21_base "lazy_keep" "htree_resident" 1500 1
+	test_21_base "aging_drop" "htree_resident" 1500 1
+	test_21_base "aging_keep" "htree_resident" 1500 1
+
+	test_21_base "lazy_keep" "htree_merge" 1500 1
+	test_21_base "aging_keep" "htree_merge" 1500 1
 }
 run_test 21 "Verfiy readdir() works correctly for various readdir policies"
 
@@ -2094,6 +2122,1367 @@ test_33() {
 }
 run_test 33 "Delay asynchronous removal with multiple levels"
 
+test_34() {
+	local dir=$DIR/$tdir
+	local nr=100
+	local rmset
+	local mvset
+	local newset
+	local i
+
+	setup_wbc "flush_mode=aging_keep rmpol=batch"
+
+	mkdir $dir || error "mkdir $dir failed"
+	for i in $(seq 1 $nr); do
+		touch $dir/$tfile.$i || error "touch $dir/$tfile.$i failed"
+	done
+	sync
+	check_mdt_fileset_exist "$tdir/$tfile.1 $tdir/$tfile.$nr" 0 ||
+		error "'$tfile.*' should exist on MDT"
+
+	for i in $(seq 1 2 $nr); do
+		rm $dir/$tfile.$i || error "rm $dir/$tfile.$i failed"
+		rmset+="$tdir/$tfile.$i "
+	done
+	for i in $(seq 2 2 $nr); do
+		mv $dir/$tfile.$i $dir/$tfile.new.$i ||
+			error "mv $dir/$tfile.$i failed"
+		mvset+="$tdir/$tfile.$i "
+		newset+="$tdir/$tfile.new.$i "
+	done
+	ln $dir/$tfile.new.2 $dir/$tfile.link ||
+		error "ln $dir/$tfile.new.2 failed"
+	check_mdt_fileset_exist "$tdir/$tfile.1 $tdir/$tfile.2" 0 ||
+		error "'$tfile.*' should still exist on MDT"
+
+	$LCTL set_param mdc.*.batch_stats=clear
+	sync
+	wait_wbc_uptodate $dir
+	$LCTL get_param mdc.*.batch_stats
+	check_mdt_fileset_exist "$rmset $mvset" 1 ||
+		error "removed or renamed files should not exist on MDT"
+	check_mdt_fileset_exist "$newset $tdir/$tfile.link" 0 ||
+		error "renamed or linked files should exist on MDT"
+	stat $DIR2/$tdir/$tfile.link || error "stat $tfile.link failed"
+}
+run_test 34 "Batched unlink, rename and link for rmpol=batch"
+
+test_35() {
+	local file=$DIR/$tdir/$tfile
+	local expected="600"
+	local mtime=1000000000
+	local accf
+	local mtf
+
+	setup_wbc "flush_mode=aging_keep"
+
+	mkdir $DIR/$tdir || error "mkdir $DIR/$tdir failed"
+	touch $file || error "touch $file failed"
+	chmod $expected $file || error "chmod $file failed"
+	touch -m -d @$mtime $file || error "touch -m $file failed"
+
+	sync
+	wait_wbc_uptodate $DIR/$tdir
+	stat $DIR2/$tdir/$tfile || error "stat $DIR2/$tdir/$tfile failed"
+	accf=$(stat -c %a $DIR2/$tdir/$tfile)
+	[ $accf == $expected ] ||
+		error "$file access rights: $accf, expect $expected"
+	mtf=$(stat -c %Y $DIR2/$tdir/$tfile)
+	[ $mtf == $mtime ] || error "$file mtime: $mtf, expect $mtime"
+}
+run_test 35 "Create with the final attributes of the cached file"
+
+test_36() {
+	local dir=$DIR/$tdir
+	local nr=$((MDSCOUNT * 4))
+	local idxset
+	local idx
+	local i
+
+	[ $MDSCOUNT -lt 2 ] && skip_env "needs >= 2 MDTs"
+
+	setup_wbc "flush_mode=aging_keep mkdir_qos=1"
+
+	mkdir $dir || error "mkdir $dir failed"
+	for i in $(seq 1 $nr); do
+		mkdir $dir/dir.$i || error "mkdir $dir/dir.$i failed"
+		touch $dir/dir.$i/$tfile || error "touch $dir/dir.$i failed"
+	done
+
+	sync
+	wait_wbc_uptodate $dir
+	for i in $(seq 1 $nr); do
+		idx=$($LFS getstripe -m $DIR2/$tdir/dir.$i)
+		echo "$dir/dir.$i mdt_index: $idx"
+		[ $idx == $($LFS getstripe -m $DIR2/$tdir/dir.$i/$tfile) ] ||
+			error "$tfile is not on MDT $idx with its parent"
+		idxset+="$idx\n"
+	done
+	[ $(echo -e $idxset | sort -u | grep -c .) -gt 1 ] ||
+		error "subdirs should be spread over MDTs"
+
+	rm -rf $dir || error "rm -rf $dir failed"
+}
+run_test 36 "DNE: Spread cached directories over MDTs with mkdir_qos"
+
+test_37() {
+	local dir=$DIR/$tdir
+	local fsuuid=$($LFS getname $MOUNT | awk '{print $1}')
+	local nr_dir=8
+	local nr_file=16
+	local flushers=4
+	local conf="flushers=$flushers"
+	local tasks
+	local cnt
+	local i
+
+	setup_wbc "flush_mode=aging_keep dirty_flush_thresh=20 $conf"
+	$LCTL set_param llite.$fsuuid.wbc.conf="conf flushers=0" &&
+		error "flushers=0 should be rejected"
+	wbc_conf_show | grep "flushers: $flushers" ||
+		error "flushers should be $flushers"
+
+	mkdir $dir || error "mkdir $dir failed"
+	for i in $(seq 1 $nr_dir); do
+		mkdir $dir/dir.$i || error "mkdir $dir/dir.$i failed"
+		createmany -o $dir/dir.$i/$tfile. $nr_file ||
+			error "createmany under $dir/dir.$i failed"
+	done
+
+	sync
+	wait_wbc_uptodate $dir
+	wbc_stats_show
+	tasks=$(wbc_stats_stat flush_tasks)
+	(( tasks > 0 )) || error "no subtree task was queued to the flushers"
+	for i in $(seq 1 $nr_dir); do
+		cnt=$(ls $DIR2/$tdir/dir.$i | wc -l)
+		(( cnt == nr_file )) ||
+			error "dir.$i has $cnt files, expect $nr_file"
+	done
+}
+run_test 37 "Flush subtrees with a pool of flushers"
+
+wbc_dop_stat() {
+	wbc_stats_stat dop_pages_$1
+}
+
+test_38_base() {
+	local loopfile="$TMP/$tfile"
+	local mntpt="/mnt/pcc.$tdir"
+	local hsm_root="$mntpt/$tdir"
+	local dir=$DIR/$tdir
+	local file=$dir/$tfile
+	local pol=$1
+
+	setup_loopdev client $loopfile $mntpt 60
+	mkdir $hsm_root || error "mkdir $hsm_root failed"
+	copytool setup -m "$MOUNT" -a "$HSM_ARCHIVE_NUMBER" --facet client
+
+	setup_pcc_mapping client \
+		"projid={100}\ rwid=$HSM_ARCHIVE_NUMBER"
+	$LCTL pcc list $MOUNT
+
+	setup_wbc "cache_mode=dop flush_mode=aging_keep dop_pol=$pol $2"
+	wbc_conf_show | grep "dop_pol: $pol" || error "dop_pol should be $pol"
+}
+
+test_38a() {
+	local dir=$DIR/$tdir
+	local file=$dir/$tfile
+	local oldmd5
+	local newmd5
+	local cnt
+
+	test_38_base "at_write" "dop_write_thresh=16"
+
+	mkdir $dir || error "mkdir $dir failed"
+	dd if=/dev/urandom of=$file bs=4k count=8 || error "write $file failed"
+	cnt=$(wbc_dop_stat at_write)
+	(( cnt == 0 )) || error "$cnt pages spilled under the threshold"
+
+	dd if=/dev/urandom of=$file bs=4k count=64 ||
+		error "write $file failed"
+	$LFS wbc state $file
+	$LFS pcc state $file
+	cnt=$(wbc_dop_stat at_write)
+	(( cnt > 0 )) || error "no page spilled into PCC over the threshold"
+	wbc_stats_show
+
+	oldmd5=$(md5sum $file | awk '{print $1}')
+	sync
+	wait_wbc_sync_state $file
+	newmd5=$(md5sum $file | awk '{print $1}')
+	[ "$oldmd5" == "$newmd5" ] || error "md5sum diff: $oldmd5 != $newmd5"
+	$LFS pcc detach $file || error "$LFS pcc detach $file failed"
+	rm -rf $dir || error "rm -rf $dir failed"
+}
+run_test 38a "DOP spills the cache pages into PCC at write"
+
+test_38b() {
+	local dir=$DIR/$tdir
+	local file=$dir/$tfile
+	local oldmd5
+	local newmd5
+	local cnt
+
+	test_38_base "at_commit"
+
+	mkdir $dir || error "mkdir $dir failed"
+	dd if=/dev/urandom of=$file bs=4k count=8 || error "write $file failed"
+	oldmd5=$(md5sum $file | awk '{print $1}')
+	sync
+	wait_wbc_sync_state $file
+	$LFS wbc state $file
+	$LFS pcc state $file
+	cnt=$(wbc_dop_stat resident)
+	(( cnt == 8 )) || error "$cnt pages resident in MemFS, expect 8"
+	cnt=$(wbc_dop_stat at_commit)
+	(( cnt == 0 )) || error "PCC copy was instantiated before commit"
+
+	$MULTIOP $file oyc || error "failed to fsync $file"
+	$LFS pcc state $file
+	cnt=$(wbc_dop_stat at_commit)
+	(( cnt == 8 )) || error "$cnt pages committed into PCC, expect 8"
+	cnt=$(wbc_dop_stat resident)
+	(( cnt == 0 )) || error "$cnt pages still resident in MemFS"
+
+	newmd5=$(md5sum $file | awk '{print $1}')
+	[ "$oldmd5" == "$newmd5" ] || error "md5sum diff: $oldmd5 != $newmd5"
+	$LFS pcc detach $file || error "$LFS pcc detach $file failed"
+	rm -rf $dir || error "rm -rf $dir failed"
+}
+run_test 38b "DOP delays to instantiate the PCC copy until commit"
+
+test_39() {
+	local dir=$DIR/$tdir
+	local file=$dir/$tfile
+	local val
+
+	which setfacl || skip_env "could not find setfacl"
+
+	setup_wbc "flush_mode=lazy_keep"
+
+	mkdir $dir || error "mkdir $dir failed"
+	mkdir $dir/dir.1 || error "mkdir $dir/dir.1 failed"
+	touch $file || error "touch $file failed"
+	$LFS wbc state $dir $file
+
+	setfattr -n user.tval -v wbc_file $file || error "setfattr $file failed"
+	setfattr -n user.tval -v wbc_dir $dir/dir.1 ||
+		error "setfattr $dir/dir.1 failed"
+	setfattr -n user.tdel -v gone $file || error "setfattr $file failed"
+	setfattr -x user.tdel $file || error "setfattr -x $file failed"
+	setfattr -n user.tval -v wbc_new --create $file &&
+		error "setfattr --create should fail with existed xattr"
+	setfacl -m u:$RUNAS_ID:rw $file || error "setfacl $file failed"
+
+	# The xattrs are cached in MemFS before the file is flushed.
+	$LFS wbc state $file
+	val=$(getfattr --only-values -n user.tval $file)
+	[ "$val" == "wbc_file" ] || error "xattr of $file: '$val' != 'wbc_file'"
+	getfattr -d $file | grep -q "user.tdel" && error "user.tdel not removed"
+	getfacl $file | grep -q "user:$RUNAS_ID:rw-" ||
+		error "ACL of $file was not set"
+
+	sync
+	wait_wbc_uptodate $dir
+	$LFS wbc state $dir $file
+	val=$(getfattr --only-values -n user.tval $DIR2/$tdir/$tfile)
+	[ "$val" == "wbc_file" ] ||
+		error "flushed xattr of $file: '$val' != 'wbc_file'"
+	val=$(getfattr --only-values -n user.tval $DIR2/$tdir/dir.1)
+	[ "$val" == "wbc_dir" ] ||
+		error "flushed xattr of $dir/dir.1: '$val' != 'wbc_dir'"
+	getfattr -d $DIR2/$tdir/$tfile | grep -q "user.tdel" &&
+		error "removed user.tdel was flushed"
+	getfacl $DIR2/$tdir/$tfile | grep -q "user:$RUNAS_ID:rw-" ||
+		error "ACL of $file was not flushed"
+
+	rm -rf $dir || error "rm -rf $dir failed"
+}
+run_test 39 "Cache xattrs and ACLs in MemFS and flush them in batch"
+
+test_40() {
+	local dir=$DIR/$tdir
+	local nr_flushed=1500
+	local nr_local=200
+	local nr_rm=100
+	local expected=$((nr_flushed + nr_local - nr_rm))
+	local cnt
+	local i
+
+	setup_wbc "flush_mode=lazy_keep readdir_pol=htree_merge"
+
+	mkdir $dir || error "mkdir $dir failed"
+	createmany -o $dir/$tfile.f $nr_flushed ||
+		error "createmany $dir/$tfile.f failed"
+	sync
+	wait_wbc_uptodate $dir
+
+	# Dirty the flushed directory with local creations, removals and
+	# a rename, none of them is on MDT yet.
+	createmany -o $dir/$tfile.l $nr_local ||
+		error "createmany $dir/$tfile.l failed"
+	unlinkmany $dir/$tfile.f $nr_rm || error "unlinkmany $dir failed"
+	mv $dir/$tfile.f$((nr_flushed - 1)) $dir/$tfile.renamed ||
+		error "rename $tfile.f$((nr_flushed - 1)) failed"
+
+	cnt=$(ls $dir | wc -l)
+	(( cnt == expected )) || error "ls got $cnt entries, expect $expected"
+	cnt=$(ls $dir | sort -u | wc -l)
+	(( cnt == expected )) || error "ls got $cnt unique entries"
+	ls $dir | grep -q "$tfile.f0$" && error "removed $tfile.f0 listed"
+	ls $dir | grep -q "$tfile.f$((nr_flushed - 1))$" &&
+		error "old name of the renamed file listed"
+	ls $dir | grep -q "$tfile.renamed" || error "renamed file not listed"
+	check_wbc_inode_complete $dir 1
+
+	sync
+	wait_wbc_uptodate $dir
+	cnt=$(ls $DIR2/$tdir | wc -l)
+	(( cnt == expected )) || error "MDT has $cnt entries, expect $expected"
+	rm -rf $dir || error "rm -rf $dir failed"
+}
+run_test 40 "Merge readdir of a flushed directory with local updates"
+
+wbc_fc_stat() {
+	wbc_stats_stat fc_$1
+}
+
+test_41() {
+	local dir=$DIR/$tdir
+	local nr_dir=4
+	local nr_file=2000
+	local max_count=256
+	local conf="adaptive_batch=1 max_batch_count=$max_count"
+	local count
+	local cnt
+	local i
+
+	setup_wbc "flush_mode=lazy_keep flush_pol=batch $conf"
+
+	mkdir $dir || error "mkdir $dir failed"
+	for i in $(seq 1 $nr_dir); do
+		mkdir $dir/dir.$i || error "mkdir $dir/dir.$i failed"
+		createmany -o $dir/dir.$i/$tfile. $nr_file ||
+			error "createmany under $dir/dir.$i failed"
+	done
+
+	sync
+	wait_wbc_uptodate $dir
+	wbc_conf_show | grep adaptive_batch
+	wbc_stats_show | grep fc_
+	count=$(wbc_fc_stat batch_count)
+	(( count >= 8 && count <= max_count )) ||
+		error "batch count $count is out of [8, $max_count]"
+	(( $(wbc_fc_stat inflight) == 0 )) || error "batch RPCs still in flight"
+	(( $(wbc_fc_stat latency_us) > 0 )) ||
+		error "no service time was sampled"
+	for i in $(seq 1 $nr_dir); do
+		cnt=$(ls $DIR2/$tdir/dir.$i | wc -l)
+		(( cnt == nr_file )) ||
+			error "dir.$i has $cnt files, expect $nr_file"
+	done
+}
+run_test 41 "Adaptive batch count and RPC concurrency for batch flush"
+
+wbc_journal_stat() {
+	wbc_conf_show | awk "/journal_$1:/ { print \$2 }"
+}
+
+test_42() {
+	local dir=$DIR/$tdir
+	local journal=$TMP/$tfile.journal
+	local saved=$TMP/$tfile.saved
+	local nr=20
+	local records
+	local fid
+	local i
+
+	stack_trap "rm -f $journal* $saved*" EXIT
+	setup_wbc "flush_mode=lazy_drop journal=$journal"
+
+	mkdir $dir || error "mkdir $dir failed"
+	mkdir $dir/sub || error "mkdir $dir/sub failed"
+	createmany -o $dir/sub/$tfile. $nr || error "createmany failed"
+	chmod 0700 $dir/sub/$tfile.0 || error "chmod failed"
+	ln -s $tfile.1 $dir/sub/link || error "symlink failed"
+	mv $dir/sub/$tfile.2 $dir/sub/$tfile.new || error "rename failed"
+	rm $dir/sub/$tfile.3 || error "unlink failed"
+	fid=$($LFS path2fid $dir/sub/$tfile.new)
+
+	wbc_conf_show | grep journal
+	records=$(wbc_journal_stat records)
+	(( records >= nr + 6 )) ||
+		error "logged $records records, expect at least $((nr + 6))"
+	(( $(wbc_journal_stat commits) > 0 )) || error "no journal commit"
+	# Save the journal as a client crash would leave it.
+	cp $journal $saved || error "failed to save $journal"
+
+	cleanup_wbc
+	(( $(stat -c %s $journal) == 0 )) ||
+		error "journal is not truncated after all roots are flushed"
+	rm -rf $dir || error "rm -rf $dir failed"
+
+	setup_wbc "journal=$saved"
+	(( $(wbc_journal_stat replayed) == records )) ||
+		error "replayed $(wbc_journal_stat replayed) of $records"
+	(( $(stat -c %s $saved) == 0 )) || error "journal is not truncated"
+
+	(( $(ls $DIR2/$tdir/sub | wc -l) == nr )) ||
+		error "expect $nr entries after replay"
+	[[ $($LFS path2fid $DIR2/$tdir/sub/$tfile.new) == $fid ]] ||
+		error "FID of $tfile.new is not kept by replay"
+	[[ $(stat -c %a $DIR2/$tdir/sub/$tfile.0) == 700 ]] ||
+		error "mode of $tfile.0 is not replayed"
+	[[ $(readlink $DIR2/$tdir/sub/link) == $tfile.1 ]] ||
+		error "symlink is not replayed"
+	[[ ! -e $DIR2/$tdir/sub/$tfile.2 && ! -e $DIR2/$tdir/sub/$tfile.3 ]] ||
+		error "removed names are replayed"
+}
+run_test 42 "Crash-durable local journal of WBC metadata"
+
+wbc_conf_stat() {
+	wbc_conf_show | awk "/$1:/ { print \$2 }"
+}
+
+test_43() {
+	local dir=$DIR/$tdir
+	local nr=500
+	local inodes
+	local pages
+	local i
+
+	# The reserved inodes are in LRU with the shrinker or an inode limit.
+	setup_wbc "flush_mode=lazy_keep shrinker=0 max_inodes=$((nr * 100))"
+
+	mkdir $dir || error "mkdir $dir failed"
+	mkdir $dir/sub || error "mkdir $dir/sub failed"
+	createmany -o $dir/sub/$tfile. $nr || error "createmany failed"
+	for i in $(seq 0 9); do
+		dd if=/dev/zero of=$dir/sub/$tfile.$i bs=4k count=16 ||
+			error "failed to write $dir/sub/$tfile.$i"
+	done
+
+	wbc_stats_show | grep -E "shrink_|lru_"
+	(( $(wbc_stats_stat lru_inodes) > nr )) ||
+		error "reserved inodes are not in LRU"
+	(( $(wbc_stats_stat lru_files) >= 10 )) ||
+		error "files with cache pages are not in LRU"
+
+	echo 2 > /proc/sys/vm/drop_caches
+	sleep 2
+	(( $(wbc_stats_stat shrink_inodes) == 0 )) ||
+		error "inodes are reclaimed with the shrinker disabled"
+
+	$LCTL set_param llite.*.wbc.conf="conf shrinker=1" ||
+		error "failed to enable the WBC shrinker"
+	for i in $(seq 1 30); do
+		echo 2 > /proc/sys/vm/drop_caches
+		sleep 1
+		inodes=$(wbc_stats_stat shrink_inodes)
+		pages=$(wbc_stats_stat shrink_pages)
+		(( inodes > 0 && pages > 0 )) && break
+	done
+	wbc_stats_show | grep -E "shrink_|lru_"
+	(( inodes > 0 )) || error "no inode is reclaimed by the shrinker"
+	(( pages > 0 )) || error "no cache page is reclaimed by the shrinker"
+	(( $(ls $DIR2/$tdir/sub | wc -l) > 0 )) ||
+		error "reclaimed inodes are not flushed to MDT"
+
+	rm -rf $dir || error "rm -rf $dir failed"
+}
+run_test 43 "Reclaim MemFS caches via the shrinker under memory pressure"
+
+wait_wbc_root_state() {
+	local file=$1
+	local cmd="$LFS wbc state $file | grep -E -c 'state: .*root'"
+
+	wait_update --verbose $HOSTNAME "$cmd" "1" 50 ||
+		error "$file does not become a WBC root"
+}
+
+test_44() {
+	local interval=$(sysctl -n vm.dirty_writeback_centisecs)
+	local expire=$(sysctl -n vm.dirty_expire_centisecs)
+	local dir=$DIR/$tdir
+	local fileset="p1 p1/p2 p1/p2/$tfile s1 s1/s2 s1/s2/$tfile"
+	local file
+
+	interval=$((interval + 100))
+	stack_trap "sysctl -w vm.dirty_expire_centisecs=$expire" EXIT
+	sysctl -w vm.dirty_expire_centisecs=$interval
+
+	setup_wbc "flush_mode=aging_keep partial_revoke=1"
+
+	mkdir $dir || error "mkdir $dir failed"
+	mkdir -p $dir/p1/p2 $dir/s1/s2 || error "mkdir -p failed"
+	touch $dir/p1/p2/$tfile $dir/s1/s2/$tfile || error "touch failed"
+	sleep $((interval / 100))
+	for file in $fileset; do
+		wait_wbc_sync_state $dir/$file
+	done
+
+	# The assimilated subdirectories become nested roots.
+	for file in p1 p1/p2 s1 s1/s2; do
+		wait_wbc_root_state $dir/$file
+	done
+
+	# Only the levels on the path of the conflicting access are revoked.
+	stat $DIR2/$tdir/p1/p2/$tfile ||
+		error "stat $DIR2/$tdir/p1/p2/$tfile failed"
+	for file in "" p1 p1/p2; do
+		check_wbc_flags $dir/$file "0x00000000"
+	done
+	for file in s1 s1/s2; do
+		$LFS wbc state $dir/$file
+		(( ($(get_wbc_flags $dir/$file) & 0x9) == 0x9 )) ||
+			error "$dir/$file should be kept cached as a root"
+	done
+	$LFS wbc state $dir/s1/s2/$tfile | grep -q "protected" ||
+		error "$dir/s1/s2/$tfile should be kept cached"
+
+	stat $DIR2/$tdir/s1/s2/$tfile ||
+		error "stat $DIR2/$tdir/s1/s2/$tfile failed"
+	check_wbc_flags $dir/s1 "0x00000000"
+	rm -rf $dir || error "rm -rf $dir failed"
+}
+run_test 44 "Partial revocation of the nested roots in lock keep mode"
+
+test_45() {
+	local dir=$DIR/$tdir
+	local nr=2000
+	local budget
+	local dirty
+	local i
+
+	setup_wbc "flush_mode=aging_keep revoke_latency=1000"
+
+	budget=$(wbc_stats_stat dirty_budget)
+	(( budget > 0 )) || error "no dirty budget with revoke_latency set"
+
+	mkdir $dir || error "mkdir $dir failed"
+	createmany -o $dir/$tfile. $nr || error "createmany failed"
+	# The background flusher trickles the dirty inodes under the budget.
+	for i in $(seq 1 30); do
+		budget=$(wbc_stats_stat dirty_budget)
+		dirty=$(wbc_conf_stat inodes_dirty)
+		(( dirty <= budget )) && break
+		sleep 1
+	done
+	wbc_stats_show | grep -E "dirty|revoke|flush_inodes"
+	(( dirty <= budget )) ||
+		error "$dirty dirty inodes exceed the budget $budget"
+
+	stat $DIR2/$tdir || error "stat $DIR2/$tdir failed"
+	wbc_stats_show | grep -E "dirty|revoke|flush_inodes"
+	(( $(wbc_stats_stat revoke_count) > 0 )) ||
+		error "the revocation is not accounted"
+	(( $(ls $DIR2/$tdir | wc -l) == nr )) ||
+		error "not all files are flushed to MDT"
+
+	$LCTL set_param llite.*.wbc.conf="conf revoke_latency=0" ||
+		error "failed to disable the bounded revocation latency"
+	(( $(wbc_stats_stat dirty_budget) == 0 )) ||
+		error "dirty budget remains with revoke_latency=0"
+
+	rm -rf $dir || error "rm -rf $dir failed"
+}
+run_test 45 "Bound the revocation latency by the dirty budget"
+
+test_46() {
+	local dir=$DIR/$tdir
+	local fsuuid=$($LFS getname $MOUNT | awk '{print $1}')
+	local param="llite.$fsuuid.wbc.rule"
+
+	setup_wbc "flush_mode=aging_drop"
+	stack_trap "$LCTL set_param $param=clear" EXIT
+
+	$LCTL set_param $param="add fname={nocache*} cache_mode=none" ||
+		error "failed to add the exclude rule"
+	$LCTL set_param $param="add path={/$tdir} flush_mode=lazy_keep" ||
+		error "failed to add the path rule"
+	$LCTL set_param $param="add path={/$tdir} flush_mode=lazy_drop" &&
+		error "a duplicate rule should be rejected"
+	$LCTL set_param $param="add uid={0} bad_key=1" &&
+		error "a rule with a bad cache specification should be rejected"
+	$LCTL get_param $param
+
+	# The parent of $dir does not meet any rule.
+	mkdir $dir || error "mkdir $dir failed"
+	check_wbc_flags $dir "0x00000000"
+
+	mkdir $dir/d1 $dir/nocache1 || error "mkdir failed"
+	check_wbc_flags $dir/d1 "0x0000000f"
+	$LFS wbc state $dir/d1 | grep -q "flush_mode: lazy_keep" ||
+		error "$dir/d1 should use the cache spec of the rule"
+	check_wbc_flags $dir/nocache1 "0x00000000"
+
+	$LCTL get_param -n $param | grep "path={/$tdir}" | grep -q "hits=1" ||
+		error "the path rule should be hit once"
+	$LCTL set_param $param="del path={/$tdir}" ||
+		error "failed to delete the path rule"
+	$LCTL set_param $param="del path={/$tdir}" &&
+		error "deleting a missing rule should fail"
+
+	mkdir $dir/d2 || error "mkdir $dir/d2 failed"
+	check_wbc_flags $dir/d2 "0x00000000"
+
+	$LCTL set_param $param=clear || error "failed to clear the rules"
+	mkdir $dir/d3 || error "mkdir $dir/d3 failed"
+	check_wbc_flags $dir/d3 "0x0000000f"
+	$LFS wbc state $dir/d3 | grep -q "flush_mode: aging_drop" ||
+		error "$dir/d3 should use the global flush mode"
+	rm -rf $dir || error "rm -rf $dir failed"
+}
+run_test 46 "Rule based automatic selection of the root WBC directories"
+
+wbc_quota_inodes() {
+	$LFS wbc state $1 | sed -n 's/.*quota: inodes \([0-9]*\)\/.*/\1/p'
+}
+
+test_47() {
+	local fsuuid=$($LFS getname $MOUNT | awk '{print $1}')
+	local rule="llite.$fsuuid.wbc.rule"
+	local quota="llite.$fsuuid.wbc.quota"
+	local dir1=$DIR/$tdir.1
+	local dir2=$DIR/$tdir.2
+	local used
+
+	setup_wbc "flush_mode=lazy_drop root_max_inodes=16"
+
+	mkdir $dir1 $dir2 || error "mkdir failed"
+	createmany -o $dir1/$tfile. 32 || error "createmany in $dir1 failed"
+	$LFS wbc state $dir1
+	$LCTL get_param $quota
+	used=$(wbc_quota_inodes $dir1)
+	(( used <= 16 )) || error "$dir1 uses $used inodes over the limit 16"
+	$LCTL get_param -n $quota | grep -F -A2 "$($LFS path2fid $dir1)" |
+		grep -q "denied=[1-9]" || error "no denied reservation on $dir1"
+
+	# The other root is not affected by the runaway one.
+	createmany -o $dir2/$tfile. 8 || error "createmany in $dir2 failed"
+	used=$(wbc_quota_inodes $dir2)
+	(( used == 8 )) || error "$dir2 should cache 8 inodes, got $used"
+
+	sync
+	(( $(ls $DIR2/$tdir.1 | wc -l) == 32 )) ||
+		error "not all files are created in $dir1"
+
+	# The roots created by a rule with limits share its quota.
+	stack_trap "$LCTL set_param $rule=clear" EXIT
+	$LCTL set_param $rule="add fname={$tdir.q*} max_inodes=8" ||
+		error "failed to add the rule with limits"
+	mkdir $DIR/$tdir.q1 $DIR/$tdir.q2 || error "mkdir failed"
+	createmany -o $DIR/$tdir.q1/$tfile. 6 || error "createmany failed"
+	createmany -o $DIR/$tdir.q2/$tfile. 6 || error "createmany failed"
+	$LCTL get_param $quota
+	$LCTL get_param -n $quota | grep -A1 "fname={$tdir.q\*}" |
+		grep -q "roots=2" || error "the roots should share the quota"
+	used=$(wbc_quota_inodes $DIR/$tdir.q1)
+	(( used <= 8 )) || error "the shared quota uses $used inodes over 8"
+	rm -rf $dir1 $dir2 $DIR/$tdir.q* || error "rm -rf failed"
+}
+run_test 47 "Per-root inode quotas of WBC"
+
+test_48() {
+	local dir=$DIR/$tdir
+	local max=1000
+	local nr=500
+	local pids=""
+	local free
+	local pid
+	local i
+
+	setup_wbc "flush_mode=lazy_drop max_inodes=$max"
+
+	mkdir $dir || error "mkdir $dir failed"
+	for i in $(seq 1 4); do
+		createmany -o $dir/$tfile.$i. $nr &
+		pids+=" $!"
+	done
+	for pid in $pids; do
+		wait $pid || error "createmany failed"
+	done
+
+	wbc_conf_show | grep inodes
+	free=$(wbc_conf_stat inodes_free)
+	(( free <= max )) || error "$free free inodes over the limit $max"
+
+	clear_wbc
+	free=$(wbc_conf_stat inodes_free)
+	(( free == max )) || error "$((max - free)) inodes still reserved"
+	(( $(ls $DIR2/$tdir | wc -l) == 4 * nr )) ||
+		error "not all files are created"
+	rm -rf $dir || error "rm -rf $dir failed"
+}
+run_test 48 "Per-CPU inode reservation under parallel creates"
+
+test_49a() {
+	local dir=$DIR/$tdir
+	local nr=16
+	local pids=""
+	local pid
+	local i
+
+	setup_wbc "flush_mode=lazy_drop"
+
+	mkdir $dir || error "mkdir $dir failed"
+	for i in $(seq 1 $nr); do
+		echo -n reopen_data_$i > $dir/$tfile.$i ||
+			error "write $dir/$tfile.$i failed"
+		$MULTIOP $dir/$tfile.$i O_c &
+		pids+=" $!"
+		$MULTIOP $dir/$tfile.$i o_c &
+		pids+=" $!"
+	done
+	sleep 2
+	$LFS wbc state $dir $dir/$tfile.1
+
+	# Revoke the root EX lock, all open files are reopened in batch.
+	ls $DIR2/$tdir || error "ls $DIR2/$tdir failed"
+	$LFS wbc state $dir $dir/$tfile.1
+	for pid in $pids; do
+		kill -USR1 $pid && wait $pid || error "multiop failure"
+	done
+
+	for i in $(seq 1 $nr); do
+		[ "$(cat $DIR2/$tdir/$tfile.$i)" == "reopen_data_$i" ] ||
+			error "wrong data in $DIR2/$tdir/$tfile.$i"
+	done
+	rm -rf $dir || error "rm -rf $dir failed"
+}
+run_test 49a "Batched reopen of the open files on root lock revocation"
+
+test_49b() {
+	local dir=$DIR/$tdir
+	local pids=""
+	local file
+	local pid
+
+	setup_wbc "flush_mode=lazy_drop"
+
+	mkdir -p $dir/d1/d2 $dir/d3 || error "mkdir $dir failed"
+	for file in $dir/$tfile $dir/d1/$tfile $dir/d1/d2/$tfile \
+		    $dir/d3/$tfile; do
+		echo -n ${file#$dir} > $file || error "write $file failed"
+		# Flush the file to MDT, thus it can be reopened by FID.
+		$MULTIOP $file oyc || error "fsync $file failed"
+		check_wbc_flushed $file
+		$MULTIOP $file O_c &
+		pids+=" $!"
+		$MULTIOP $file o_c &
+		pids+=" $!"
+	done
+	sleep 2
+
+	# Flush all roots, the open files of the subtrees are reopened in
+	# one batch.
+	clear_wbc
+	for pid in $pids; do
+		kill -USR1 $pid && wait $pid || error "multiop failure"
+	done
+
+	for file in $tfile d1/$tfile d1/d2/$tfile d3/$tfile; do
+		[ "$(cat $DIR2/$tdir/$file)" == "/$file" ] ||
+			error "wrong data in $DIR2/$tdir/$file"
+	done
+	rm -rf $dir || error "rm -rf $dir failed"
+}
+run_test 49b "Batched reopen across the subtrees when flushing all roots"
+
+test_49c() {
+	local dir=$DIR/$tdir
+	local nr=8
+	local pids=""
+	local pid
+	local i
+
+	setup_wbc "flush_mode=lazy_drop"
+
+	mkdir $dir || error "mkdir $dir failed"
+	for i in $(seq 1 $nr); do
+		echo -n replay_data_$i > $dir/$tfile.$i ||
+			error "write $dir/$tfile.$i failed"
+		$MULTIOP $dir/$tfile.$i oyc ||
+			error "fsync $dir/$tfile.$i failed"
+		$MULTIOP $dir/$tfile.$i o_c &
+		pids+=" $!"
+	done
+	sleep 2
+
+	# Reopen in batch, the batch RPC is kept for open replay.
+	ls $DIR2/$tdir > /dev/null || error "ls $DIR2/$tdir failed"
+	replay_barrier $SINGLEMDS
+	fail $SINGLEMDS
+
+	# The replayed handles are closed without error.
+	for pid in $pids; do
+		kill -USR1 $pid && wait $pid || error "multiop failure"
+	done
+
+	for i in $(seq 1 $nr); do
+		[ "$(cat $DIR2/$tdir/$tfile.$i)" == "replay_data_$i" ] ||
+			error "wrong data in $DIR2/$tdir/$tfile.$i"
+	done
+	rm -rf $dir || error "rm -rf $dir failed"
+}
+run_test 49c "Open replay of the handles reopened in batch"
+
+test_50() {
+	local dir=$DIR/$tdir
+	local nr=8
+	local sum
+	local fid
+
+	setup_wbc "flush_mode=lazy_keep max_inodes=$nr"
+
+	mkdir $dir || error "mkdir $dir failed"
+	mkdir $dir/src $dir/tgt || error "mkdir $dir/src $dir/tgt failed"
+	dd if=/dev/urandom of=$dir/src/$tfile bs=1M count=4 ||
+		error "write $dir/src/$tfile failed"
+	sum=$(md5sum < $dir/src/$tfile)
+	fid=$($LFS path2fid $dir/src/$tfile)
+
+	# Exhaust the inode reservation to decomplete the target directory.
+	createmany -o $dir/tgt/$tfile. $nr || error "createmany failed"
+	$LFS wbc state $dir/src $dir/tgt
+	check_wbc_inode_complete $dir/tgt 0
+
+	mv $dir/src/$tfile $dir/tgt/$tfile.mv || error "mv to $dir/tgt failed"
+	[[ $($LFS path2fid $dir/tgt/$tfile.mv) == $fid ]] ||
+		error "$tfile is copied rather than renamed"
+	[[ $(md5sum < $DIR2/$tdir/tgt/$tfile.mv) == $sum ]] ||
+		error "data of $tfile.mv mismatch on $DIR2"
+	[ ! -e $DIR2/$tdir/src/$tfile ] || error "$tfile is still in src"
+
+	# Rename into a directory not cached by WBC.
+	mkdir $DIR2/$tdir.out || error "mkdir $DIR2/$tdir.out failed"
+	stack_trap "rm -rf $DIR2/$tdir.out" EXIT
+	mv $dir/tgt/$tfile.mv $DIR/$tdir.out/$tfile ||
+		error "mv to $DIR/$tdir.out failed"
+	[[ $($LFS path2fid $DIR/$tdir.out/$tfile) == $fid ]] ||
+		error "$tfile is copied rather than renamed"
+	[[ $(md5sum < $DIR2/$tdir.out/$tfile) == $sum ]] ||
+		error "data of $tfile mismatch on $DIR2"
+	rm -rf $dir || error "rm -rf $dir failed"
+}
+run_test 50 "Rename across incomplete and uncached directories"
+
+test_51_base() {
+	local flush_mode=$1
+	local dir=$DIR/$tdir
+	local fid
+	local name
+
+	echo "Hard links flush with flush mode $flush_mode"
+	setup_wbc "flush_mode=$flush_mode"
+
+	mkdir $dir || error "mkdir $dir failed"
+	mkdir $dir/a $dir/b || error "mkdir $dir/a $dir/b failed"
+	echo "hardlink" > $dir/a/$tfile || error "write $dir/a/$tfile failed"
+	ln $dir/a/$tfile $dir/a/$tfile.ln || error "ln in $dir/a failed"
+	ln $dir/a/$tfile $dir/b/$tfile.ln || error "ln into $dir/b failed"
+	$LFS wbc state $dir/a/$tfile $dir/b/$tfile.ln
+
+	# Remove the only name on MDT of a file with a pending hard link.
+	mkdir $dir/c $dir/d || error "mkdir $dir/c $dir/d failed"
+	echo "pending" > $dir/c/$tfile || error "write $dir/c/$tfile failed"
+	$MULTIOP $dir/c/$tfile oyc || error "fsync $dir/c/$tfile failed"
+	ln $dir/c/$tfile $dir/d/$tfile.ln || error "ln into $dir/d failed"
+	rm $dir/c/$tfile || error "rm $dir/c/$tfile failed"
+
+	# The access from the second mount flushes the cached tree.
+	fid=$($LFS path2fid $DIR2/$tdir/a/$tfile) ||
+		error "path2fid $DIR2/$tdir/a/$tfile failed"
+	for name in a/$tfile.ln b/$tfile.ln; do
+		[[ $($LFS path2fid $DIR2/$tdir/$name) == $fid ]] ||
+			error "$name is not a hard link of $fid"
+	done
+	[[ $(stat -c %h $DIR2/$tdir/a/$tfile) == 3 ]] ||
+		error "nlink of $tfile is not 3"
+	[[ $($LFS fid2path $MOUNT2 $fid | wc -l) == 3 ]] ||
+		error "linkEA of $fid does not have 3 names"
+	[[ $(cat $DIR2/$tdir/b/$tfile.ln) == "hardlink" ]] ||
+		error "data of $tfile.ln mismatch on $DIR2"
+	[ -e $DIR2/$tdir/c/$tfile ] && error "c/$tfile is not removed"
+	[[ $(cat $DIR2/$tdir/d/$tfile.ln) == "pending" ]] ||
+		error "file of the pending hard link d/$tfile.ln is destroyed"
+
+	rm -rf $dir || error "rm -rf $dir failed"
+}
+
+test_51() {
+	test_51_base "lazy_drop"
+	test_51_base "lazy_keep"
+	test_51_base "aging_keep"
+}
+run_test 51 "Batched flush of hard links added in MemFS"
+
+test_52() {
+	local fsuuid=$($LFS getname $MOUNT | awk '{print $1}')
+	local param="llite.$fsuuid.wbc_stats"
+	local dir=$DIR/$tdir
+	local nr=10
+	local count
+	local i
+
+	setup_wbc "flush_mode=lazy_drop"
+	$LCTL set_param $param=clear || error "clear $param failed"
+
+	mkdir $dir || error "mkdir $dir failed"
+	for i in $(seq $nr); do
+		echo "stats" > $dir/$tfile.$i || error "write $tfile.$i failed"
+	done
+	ln $dir/$tfile.1 $dir/$tfile.ln || error "ln $tfile.1 failed"
+	mv $dir/$tfile.2 $dir/$tfile.mv || error "mv $tfile.2 failed"
+
+	# The access from the second mount revokes the root WBC lock.
+	ls $DIR2/$tdir > /dev/null || error "ls $DIR2/$tdir failed"
+	$LCTL get_param $param
+
+	count=$($LCTL get_param -n $param | awk '/^create / { print $2 }')
+	(( count >= nr )) || error "flushed $count creates, expect >= $nr"
+	$LCTL get_param -n $param | grep -q "^revoke .*\[usec\]" ||
+		error "no revocation accounted in $param"
+	for i in "sub reqs per rpc" "rpc latency" "revoke latency"; do
+		$LCTL get_param -n $param | grep -q "^$i" ||
+			error "no histogram '$i' in $param"
+	done
+
+	$LCTL set_param $param=clear || error "clear $param failed"
+	! $LCTL get_param -n $param | grep -q "^create " ||
+		error "$param is not cleared"
+	rm -rf $dir || error "rm -rf $dir failed"
+}
+run_test 52 "Flush and revocation statistics in wbc_stats"
+
+test_53a() {
+	local dir=$DIR/$tdir
+	local nr_dir=8
+	local nr=50
+	local count
+	local i j
+
+	setup_wbc "flush_mode=lazy_drop"
+
+	mkdir $dir || error "mkdir $dir failed"
+	for i in $(seq $nr_dir); do
+		mkdir $dir/d$i || error "mkdir $dir/d$i failed"
+	done
+	# Interleave the creates so a batch RPC covers several parents.
+	for i in $(seq $nr); do
+		for j in $(seq $nr_dir); do
+			touch $dir/d$j/$tfile.$i ||
+				error "touch $dir/d$j/$tfile.$i failed"
+		done
+	done
+
+	# The access from the second mount flushes the whole tree.
+	for i in $(seq $nr_dir); do
+		count=$(ls $DIR2/$tdir/d$i | wc -l)
+		(( count == nr )) ||
+			error "$DIR2/$tdir/d$i has $count files, expect $nr"
+	done
+	rm -rf $dir || error "rm -rf $dir failed"
+}
+run_test 53a "Batched creates under different parents"
+
+test_53b() {
+	local dir=$DIR/$tdir
+	local nr=20
+	local owner
+	local mode
+	local i
+
+	setup_wbc "flush_mode=lazy_drop"
+
+	mkdir $dir || error "mkdir $dir failed"
+	chmod 0777 $dir || error "chmod $dir failed"
+	# Interleave the owners and umasks of the creates in a batch RPC.
+	for i in $(seq $nr); do
+		(umask 022; touch $dir/$tfile.$i) ||
+			error "touch $dir/$tfile.$i failed"
+		$RUNAS bash -c "umask 077; touch $dir/$tfile.u$i" ||
+			error "touch $dir/$tfile.u$i failed"
+	done
+
+	# The access from the second mount flushes the whole tree.
+	for i in $(seq $nr); do
+		owner=$(stat -c %u $DIR2/$tdir/$tfile.$i)
+		(( owner == 0 )) || error "$tfile.$i is owned by $owner"
+		mode=$(stat -c %a $DIR2/$tdir/$tfile.$i)
+		[[ $mode == 644 ]] || error "$tfile.$i has mode $mode"
+		owner=$(stat -c %u $DIR2/$tdir/$tfile.u$i)
+		(( owner == $RUNAS_ID )) ||
+			error "$tfile.u$i is owned by $owner"
+		mode=$(stat -c %a $DIR2/$tdir/$tfile.u$i)
+		[[ $mode == 600 ]] || error "$tfile.u$i has mode $mode"
+	done
+	rm -rf $dir || error "rm -rf $dir failed"
+}
+run_test 53b "Batched creates of different owners and umasks"
+
+test_54() {
+	local dir=$DIR/$tdir
+	local nr=20
+	local count
+	local i
+
+	setup_wbc "flush_mode=lazy_drop"
+
+	mkdir $dir || error "mkdir $dir failed"
+	for i in $(seq $nr); do
+		touch $dir/$tfile.$i || error "touch $dir/$tfile.$i failed"
+	done
+
+	replay_barrier $SINGLEMDS
+	# The batch RPC of the flush is not committed when the MDS fails, it
+	# has to be replayed.
+	ls $DIR2/$tdir > /dev/null || error "ls $DIR2/$tdir failed"
+	fail $SINGLEMDS
+
+	count=$(ls $DIR2/$tdir | wc -l)
+	(( count == nr )) ||
+		error "$DIR2/$tdir has $count files after replay, expect $nr"
+	rm -rf $dir || error "rm -rf $dir failed"
+}
+run_test 54 "Replay of the batched flush not committed"
+
+test_55() {
+	local dir=$DIR/$tdir
+	local nr=10
+	local before
+	local after
+	local parents
+	local i
+
+	setup_wbc "flush_mode=aging_keep rmpol=subtree"
+	do_facet $SINGLEMDS $LCTL set_param mdd.*.async_tree_remove=1
+	stack_trap "do_facet $SINGLEMDS $LCTL set_param \
+		mdd.*.async_tree_remove=0" EXIT
+
+	mkdir -p $dir/sub || error "mkdir $dir/sub failed"
+	for i in $(seq $nr); do
+		mkdir -p $dir/sub/d$i/d$i ||
+			error "mkdir $dir/sub/d$i/d$i failed"
+		touch $dir/sub/d$i/f$i $dir/sub/d$i/d$i/f$i ||
+			error "touch under $dir/sub/d$i failed"
+	done
+	ln $dir/sub/d1/f1 $dir/$tfile.link || error "ln $dir/sub/d1/f1 failed"
+	sync
+
+	before=$(do_facet $SINGLEMDS $LCTL get_param -n \
+		 mdd.*.tree_remove_stats | awk '/subtrees_removed/ { print $2 }')
+	rm -rf $dir/sub || error "rm -rf $dir/sub failed"
+	# Revoke the root WBC lock to flush the subtree removal.
+	stat $DIR2/$tdir > /dev/null || error "stat $DIR2/$tdir failed"
+
+	for i in $(seq 60); do
+		after=$(do_facet $SINGLEMDS $LCTL get_param -n \
+			mdd.*.tree_remove_stats |
+			awk '/subtrees_removed/ { print $2 }')
+		(( after > before )) && break
+		sleep 1
+	done
+	(( after > before )) ||
+		error "subtree $dir/sub is not removed in background"
+	do_facet $SINGLEMDS $LCTL get_param mdd.*.tree_remove_stats
+	[ -e $DIR2/$tdir/sub ] && error "$DIR2/$tdir/sub still exists"
+
+	# The removed name is dropped from the linkEA of the kept file.
+	parents=$($LFS path2fid --parents $DIR2/$tdir/$tfile.link) ||
+		error "path2fid --parents $tfile.link failed"
+	echo "parents: $parents"
+	[[ "$parents" == *"/$tfile.link"* && "$parents" != *"/f1"* ]] ||
+		error "linkEA of $tfile.link has the removed name: $parents"
+	rm -rf $dir || error "rm -rf $dir failed"
+}
+run_test 55 "Parallel background removal of a subtree"
+
+test_56() {
+	local fsuuid=$($LFS getname $MOUNT | awk '{print $1}')
+	local param="llite.$fsuuid.wbc_stats"
+	local dir=$DIR/$tdir
+	local nr=20
+	local count
+
+	# Populate the directory on MDT from the mount without WBC.
+	mkdir $DIR2/$tdir || error "mkdir $DIR2/$tdir failed"
+	createmany -o $DIR2/$tdir/$tfile. $nr || error "createmany failed"
+	mkdir $DIR2/$tdir/sub || error "mkdir $DIR2/$tdir/sub failed"
+
+	setup_wbc "flush_mode=lazy_drop prefetch_max_entries=64"
+	$LCTL set_param $param=clear || error "clear $param failed"
+	cancel_lru_locks mdc
+
+	stat $dir > /dev/null || error "stat $dir failed"
+	$LFS wbc state $dir $dir/$tfile.0 $dir/sub
+	check_wbc_flags $dir "0x0000000f"
+	check_fileset_wbc_flags "$tfile.0 sub" "0x00000013" $dir
+	$LCTL get_param -n $param | grep -q "^prefetch " ||
+		error "no prefetch accounted in $param"
+	count=$(ls $dir | wc -l)
+	(( count == nr + 1 )) ||
+		error "ls got $count entries, expect $((nr + 1))"
+
+	touch $dir/$tfile.new || error "touch $dir/$tfile.new failed"
+	rm $dir/$tfile.0 || error "rm $dir/$tfile.0 failed"
+	# The access from the second mount revokes the root WBC lock.
+	count=$(ls $DIR2/$tdir | wc -l)
+	(( count == nr + 1 )) ||
+		error "$DIR2/$tdir has $count entries, expect $((nr + 1))"
+	[ -e $DIR2/$tdir/$tfile.new ] || error "$tfile.new is not flushed"
+	[ -e $DIR2/$tdir/$tfile.0 ] && error "$tfile.0 is not removed on MDT"
+	rm -rf $dir || error "rm -rf $dir failed"
+}
+run_test 56 "Prefetch of an existing directory into MemFS"
+
+test_57() {
+	local dir=$DIR/$tdir
+	local journal=$TMP/$tfile.journal
+	local saved=$TMP/$tfile.saved
+	local nr=10
+	local records
+	local fid
+
+	stack_trap "rm -f $journal* $saved*" EXIT
+	setup_wbc "flush_mode=lazy_drop journal=$journal"
+
+	mkdir $dir || error "mkdir $dir failed"
+	createmany -o $dir/$tfile. $nr || error "createmany failed"
+	records=$(wbc_journal_stat records)
+	# Save the journal as a client crash would leave it.
+	cp $journal $saved || error "failed to save $journal"
+	# Revoke the root to flush it, which checkpoints the journal.
+	ls $DIR2/$tdir > /dev/null || error "ls $DIR2/$tdir failed"
+	(( $(stat -c %s $journal) == 0 )) ||
+		error "journal is not truncated after the root is flushed"
+	cleanup_wbc
+
+	# Update the flushed files on MDT before the journal is replayed.
+	echo "data" > $DIR2/$tdir/$tfile.0 || error "write $tfile.0 failed"
+	fid=$($LFS path2fid $DIR2/$tdir/$tfile.1)
+	mv $DIR2/$tdir/$tfile.1 $DIR2/$tdir/$tfile.new ||
+		error "rename $tfile.1 failed"
+	rm $DIR2/$tdir/$tfile.2 || error "unlink $tfile.2 failed"
+	echo "reused" > $DIR2/$tdir/$tfile.2 || error "reuse $tfile.2 failed"
+
+	setup_wbc "journal=$saved"
+	wbc_conf_show | grep journal
+	(( $(wbc_journal_stat replay_skipped) == records )) ||
+		error "skipped $(wbc_journal_stat replay_skipped) of $records"
+
+	[[ $(cat $DIR2/$tdir/$tfile.0) == "data" ]] ||
+		error "data of $tfile.0 is lost by replay"
+	[[ $($LFS path2fid $DIR2/$tdir/$tfile.new) == $fid ]] ||
+		error "renamed $tfile.new is lost by replay"
+	[ -e $DIR2/$tdir/$tfile.1 ] && error "$tfile.1 is created again"
+	[[ $(cat $DIR2/$tdir/$tfile.2) == "reused" ]] ||
+		error "reused $tfile.2 is replaced by replay"
+	(( $(ls $DIR2/$tdir | wc -l) == nr )) ||
+		error "expect $nr entries after replay"
+}
+run_test 57 "Journal replay over the updated MDT state"
+
+test_58_base() {
+	local readdir_pol=$1
+	local dir=$DIR/$tdir
+	local out=$TMP/$tfile.out
+	local nr=1000
+	local pid
+	local cnt
+
+	echo "=== readdir_pol=$readdir_pol ==="
+	setup_wbc "flush_mode=lazy_drop readdir_pol=$readdir_pol"
+
+	mkdir $dir || error "mkdir $dir failed"
+	createmany -o $dir/$tfile. $nr || error "createmany failed"
+
+	# Read part of the entries in MemFS, then revoke the root EX lock to
+	# reopen the directory on MDT and read the rest from MDT.
+	$MULTIOP $dir Di4096_i1048576i1048576c > $out &
+	pid=$!
+	sleep 1
+	check_wbc_inode_complete $dir 1
+	ls $DIR2/$tdir > /dev/null || error "ls $DIR2/$tdir failed"
+	kill -USR1 $pid && wait $pid || error "multiop failure"
+
+	cnt=$(wc -l < $out)
+	(( cnt == nr + 2 )) || error "got $cnt entries, expect $((nr + 2))"
+	cnt=$(sort -u $out | wc -l)
+	(( cnt == nr + 2 )) || error "got $cnt unique entries"
+	rm -f $out
+	rm -rf $dir || error "rm -rf $dir failed"
+}
+
+test_58() {
+	test_58_base "htree_runtime"
+	test_58_base "htree_resident"
+}
+run_test 58 "Resume hashed readdir() on MDT after the directory is reopened"
+
+test_59_base() {
+	local bufsize=$1
+	local dir=$DIR/$tdir
+	local out=$TMP/$tfile.out
+	local nr=500
+	local pid
+	local cnt
+
+	echo "=== merge readdir() with a $bufsize bytes buffer ==="
+	setup_wbc "flush_mode=lazy_keep readdir_pol=htree_merge"
+
+	mkdir $dir || error "mkdir $dir failed"
+	createmany -o $dir/$tfile.f $nr || error "createmany $tfile.f failed"
+	sync
+	wait_wbc_uptodate $dir
+	createmany -o $dir/$tfile.l $nr || error "createmany $tfile.l failed"
+
+	$MULTIOP $dir Di${bufsize}_i1048576i1048576c > $out &
+	pid=$!
+	sleep 1
+	check_wbc_inode_complete $dir 1
+	ls $DIR2/$tdir > /dev/null || error "ls $DIR2/$tdir failed"
+	kill -USR1 $pid && wait $pid || error "multiop failure"
+
+	cnt=$(wc -l < $out)
+	(( cnt == 2 * nr + 2 )) ||
+		error "got $cnt entries, expect $((2 * nr + 2))"
+	cnt=$(sort -u $out | wc -l)
+	(( cnt == 2 * nr + 2 )) || error "got $cnt unique entries"
+	rm -f $out
+	rm -rf $dir || error "rm -rf $dir failed"
+}
+
+test_59() {
+	# Reopen in the middle of the entries read from MDT.
+	test_59_base 4096
+	# Reopen in the middle of the local only entries.
+	test_59_base 32768
+}
+run_test 59 "Resume merge readdir() on MDT after the directory is reopened"
+
+test_60() {
+	local dir=$DIR/$tdir
+	local sum
+	local fid
+
+	setup_wbc "flush_mode=lazy_keep"
+
+	mkdir $DIR2/$tdir.out || error "mkdir $DIR2/$tdir.out failed"
+	stack_trap "rm -rf $DIR2/$tdir.out" EXIT
+
+	mkdir -p $dir/d1/d2 || error "mkdir -p $dir/d1/d2 failed"
+	dd if=/dev/urandom of=$dir/d1/d2/$tfile bs=1M count=4 ||
+		error "write $dir/d1/d2/$tfile failed"
+	sum=$(md5sum < $dir/d1/d2/$tfile)
+	fid=$($LFS path2fid $dir/d1/d2/$tfile)
+	check_mdt_fileset_exist "$tdir/d1/d2/$tfile" 1 ||
+		error "$tfile should not exist on MDT yet"
+
+	# Only the WBC root holds the EX lock, nothing below is revoked.
+	mv $dir/d1/d2/$tfile $DIR/$tdir.out/$tfile ||
+		error "mv to $DIR/$tdir.out failed"
+	[[ $($LFS path2fid $DIR/$tdir.out/$tfile) == $fid ]] ||
+		error "$tfile is copied rather than renamed"
+	[ ! -e $dir/d1/d2/$tfile ] || error "$tfile is still in $dir/d1/d2"
+	(( $(ls $dir/d1/d2 | wc -l) == 0 )) || error "$dir/d1/d2 is not empty"
+	[[ $(md5sum < $DIR2/$tdir.out/$tfile) == $sum ]] ||
+		error "data of $tfile mismatch on $DIR2"
+	[ ! -e $DIR2/$tdir/d1/d2/$tfile ] || error "$tfile is still on MDT"
+	rm -rf $dir || error "rm -rf $dir failed"
+}
+run_test 60 "Rename an unflushed file out of a nested directory on MDT"
+
+test_61() {
+	local dir=$DIR/$tdir
+	local nr=$((MDSCOUNT * 4))
+	local idx
+	local i
+
+	[ $MDSCOUNT -lt 2 ] && skip_env "needs >= 2 MDTs"
+
+	setup_wbc "flush_mode=aging_keep rmpol=batch mkdir_qos=1"
+
+	mkdir $dir || error "mkdir $dir failed"
+	idx=$($LFS getstripe -m $dir)
+	for i in $(seq 1 $nr); do
+		mkdir $dir/dir.$i || error "mkdir $dir/dir.$i failed"
+		touch $dir/$tfile.$i || error "touch $dir/$tfile.$i failed"
+	done
+	sync
+	wait_wbc_uptodate $dir
+	(( $($LFS getstripe -m $DIR2/$tdir/dir.* | grep -vc "^$idx$") > 0 )) ||
+		error "subdirs should be spread over MDTs"
+
+	# Batched unlinks are for the names on the MDT of $dir only.
+	for i in $(seq 1 $nr); do
+		rmdir $dir/dir.$i || error "rmdir $dir/dir.$i failed"
+		rm $dir/$tfile.$i || error "rm $dir/$tfile.$i failed"
+	done
+	sync
+	wait_wbc_uptodate $dir
+	(( $(ls $DIR2/$tdir | wc -l) == 0 )) ||
+		error "$DIR2/$tdir should be empty"
+	rmdir $dir || error "rmdir $dir failed"
+}
+run_test 61 "DNE: Remove the entries on other MDTs with rmpol=batch"
+
+test_62() {
+	local dir=$DIR/$tdir
+	local file=$dir/dir.1/$tfile
+
+	which setfacl || skip_env "could not find setfacl"
+
+	setup_wbc "flush_mode=lazy_keep"
+
+	mkdir $dir || error "mkdir $dir failed"
+	setfacl -d -m u:$RUNAS_ID:rwx $dir || error "setfacl -d $dir failed"
+	mkdir $dir/dir.1 || error "mkdir $dir/dir.1 failed"
+	touch $file || error "touch $file failed"
+	$LFS wbc state $dir/dir.1 $file
+
+	# The default ACL is inherited in MemFS as it is on MDT.
+	getfacl -d $dir/dir.1 | grep -q "user:$RUNAS_ID:rwx" ||
+		error "default ACL of $dir/dir.1 was not inherited"
+	getfacl $file | grep -q "user:$RUNAS_ID:rw" ||
+		error "access ACL of $file was not inherited"
+
+	sync
+	wait_wbc_uptodate $dir
+	getfacl -d $DIR2/$tdir/dir.1 | grep -q "user:$RUNAS_ID:rwx" ||
+		error "default ACL of $dir/dir.1 was not flushed"
+	[[ "$(getfacl --omit-header $DIR2/$tdir/dir.1/$tfile)" == \
+	      "$(getfacl --omit-header $file)" ]] ||
+		error "ACL of $file mismatch on $DIR2"
+	rm -rf $dir || error "rm -rf $dir failed"
+}
+run_test 62 "Inherit the default ACL on create in MemFS"
+
+test_63() {
+	local dir=$DIR/$tdir
+	local nr=200
+	local conf="flush_mode=lazy_keep shrinker=0"
+
+	setup_wbc "$conf max_inodes=0 root_max_inodes=0"
+
+	mkdir $dir || error "mkdir $dir failed"
+	createmany -o $dir/$tfile. $nr || error "createmany failed"
+	wbc_conf_show | grep inodes
+	wbc_stats_show | grep lru_
+	(( $(wbc_stats_stat lru_inodes) == 0 )) ||
+		error "reserved inodes are in LRU without any limit"
+
+	$LCTL set_param llite.*.wbc.conf="conf shrinker=1" ||
+		error "failed to enable the WBC shrinker"
+	createmany -o $dir/$tfile.new. $nr || error "createmany failed"
+	(( $(wbc_stats_stat lru_inodes) == nr )) ||
+		error "reserved inodes are not in LRU with the shrinker"
+	rm -rf $dir || error "rm -rf $dir failed"
+}
+run_test 63 "Keep no LRU of the reserved inodes without limits"
+
 test_99a() {
 	local dir=$DIR/$tdir
 	local flush_mode="aging_keep"
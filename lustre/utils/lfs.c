@@ -12316,6 +12316,12 @@ static int lfs_wbc_state(int argc, char **argv)
 
 		printf(", flush_mode: %s",
 		       wbc_flushmode2string(state.wbcs_flush_mode));
+		if (state.wbcs_flags & WBC_STATE_FL_ROOT)
+			printf(", quota: inodes %llu/%llu pages %llu/%llu",
+			       (unsigned long long)state.wbcs_quota_inodes,
+			       (unsigned long long)state.wbcs_quota_max_inodes,
+			       (unsigned long long)state.wbcs_quota_pages,
+			       (unsigned long long)state.wbcs_quota_max_pages);
 		printf("\n");
 	}
 	return rc;
@@ -1260,7 +1260,9 @@ check_mdt_rec_create(void)
 	CHECK_MEMBER(mdt_rec_create, cr_time);
 	CHECK_MEMBER(mdt_rec_create, cr_rdev);
 	CHECK_MEMBER(mdt_rec_create, cr_ioepoch);
+	CHECK_MEMBER(mdt_rec_create, cr_atime);
 	CHECK_MEMBER(mdt_rec_create, cr_padding_1);
+	CHECK_MEMBER(mdt_rec_create, cr_ctime);
 	CHECK_MEMBER(mdt_rec_create, cr_mode);
 	CHECK_MEMBER(mdt_rec_create, cr_bias);
 	CHECK_MEMBER(mdt_rec_create, cr_flags_l);